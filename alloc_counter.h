@@ -0,0 +1,100 @@
+// ===== alloc_counter.h =====
+// Opt-in heap allocation counting, to check that streaming does not
+// allocate once a session has warmed up.
+//
+// Build with RD_COUNT_ALLOCATIONS defined (e.g. cl /DRD_COUNT_ALLOCATIONS
+// server.cpp ...) to replace the global operator new/delete with counting
+// versions. SteadyStateCheck then aborts with a message when a loop
+// iteration allocates after its warm-up. Without the define everything
+// here compiles to nothing. tests/steady_state_test runs the codecs this
+// way on every build.
+//
+// Counts are per thread, so a check only sees the thread that runs it.
+//
+// The replacement operators are defined in this header, so include it
+// from exactly one translation unit per program.
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstdint>
+
+#ifdef RD_COUNT_ALLOCATIONS
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Allocations made by the calling thread
+inline uint64_t& ThreadAllocationCount() {
+    static thread_local uint64_t count = 0;
+    return count;
+}
+
+inline void* CountedAllocate(size_t size) {
+    ThreadAllocationCount()++;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size) { return CountedAllocate(size); }
+void* operator new[](size_t size) { return CountedAllocate(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    ThreadAllocationCount()++;
+    return std::malloc(size ? size : 1);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    ThreadAllocationCount()++;
+    return std::malloc(size ? size : 1);
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+// Per-loop check: call Checkpoint() once per iteration. Allocations are
+// allowed during the first `warmupIterations` and again after Rearm()
+// (a resize or format switch legitimately grows buffers).
+class SteadyStateCheck {
+public:
+    SteadyStateCheck(const char* name, int warmupIterations)
+        : m_name(name), m_warmup(warmupIterations), m_remaining(warmupIterations),
+          m_last(ThreadAllocationCount()) {}
+
+    void Rearm() { m_remaining = m_warmup; }
+
+    void Checkpoint() {
+        uint64_t allocations = ThreadAllocationCount() - m_last;
+        m_last = ThreadAllocationCount();
+        if (m_remaining > 0) {
+            m_remaining--;
+            return;
+        }
+        if (allocations) {
+            std::fprintf(stderr, "%s: %llu heap allocations in steady state\n", m_name,
+                         static_cast<unsigned long long>(allocations));
+            std::abort();
+        }
+    }
+
+private:
+    const char* m_name;
+    int m_warmup;
+    int m_remaining;
+    uint64_t m_last;
+};
+
+#else
+
+class SteadyStateCheck {
+public:
+    SteadyStateCheck(const char*, int) {}
+    void Rearm() {}
+    void Checkpoint() {}
+};
+
+#endif // RD_COUNT_ALLOCATIONS
+
+#endif // ALLOC_COUNTER_H
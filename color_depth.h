@@ -0,0 +1,315 @@
+// ===== color_depth.h =====
+// Reduced color-depth encoders for constrained links: RGB565, grayscale
+// and an adaptive 256-color palette with ordered dithering. All of them
+// read the top-down BGRA rows the capture produces.
+//
+// The per-pixel work runs four (RGB565, palette) or sixteen (grayscale)
+// pixels at a time with SSE2 when the compiler targets it, with the
+// PixelTraits scalar code as the fallback and for row tails.
+//
+// The palette is rebuilt for every frame by median cut over a 15-bit
+// color histogram. Pixels are dithered with a 4x4 Bayer matrix, reduced
+// to 15 bits and mapped through a lookup table filled lazily with the
+// nearest palette entry.
+#ifndef COLOR_DEPTH_H
+#define COLOR_DEPTH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "pixel_format.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RD_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// 4x4 Bayer thresholds scaled to one 5-bit quantization step (0..7)
+static const unsigned char kBayer4x4[4][4] = {
+    {0, 4, 1, 5},
+    {6, 2, 7, 3},
+    {1, 5, 0, 4},
+    {7, 3, 6, 2},
+};
+
+inline void QuantizeRowRGB565(const unsigned char* src, unsigned char* dst, int width) {
+    int x = 0;
+#ifdef RD_HAVE_SSE2
+    const __m128i maskB = _mm_set1_epi32(0x001F);
+    const __m128i maskG = _mm_set1_epi32(0x07E0);
+    const __m128i maskR = _mm_set1_epi32(0xF800);
+    for (; x + 4 <= width; x += 4) {
+        __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+        __m128i v = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(px, 3), maskB),
+                                              _mm_and_si128(_mm_srli_epi32(px, 5), maskG)),
+                                 _mm_and_si128(_mm_srli_epi32(px, 8), maskR));
+        // Sign-extend the low 16 bits so the signed pack keeps them intact
+        v = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x * 2), _mm_packs_epi32(v, v));
+    }
+#endif
+    for (; x < width; ++x) {
+        PixelTraits<PIXEL_FORMAT_RGB565>::Store(dst + x * 2, PixelTraits<PIXEL_FORMAT_BGRA32>::Load(src + x * 4));
+    }
+}
+
+inline void QuantizeRowGray8(const unsigned char* src, unsigned char* dst, int width) {
+    int x = 0;
+#ifdef RD_HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights = _mm_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0);
+    for (; x + 16 <= width; x += 16) {
+        __m128i luma[4];
+        for (int i = 0; i < 4; ++i) {
+            __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (x + i * 4) * 4));
+            // B*29 + G*150 and R*77 per pixel, then the two halves summed
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), weights);
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), weights);
+            __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1));
+            luma[i] = _mm_srli_epi32(_mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd)), 8);
+        }
+        __m128i words = _mm_packus_epi16(_mm_packs_epi32(luma[0], luma[1]), _mm_packs_epi32(luma[2], luma[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), words);
+    }
+#endif
+    for (; x < width; ++x) {
+        PixelTraits<PIXEL_FORMAT_GRAY8>::Store(dst + x, PixelTraits<PIXEL_FORMAT_BGRA32>::Load(src + x * 4));
+    }
+}
+
+// Dither a row and reduce it to 15-bit color indices (r << 10 | g << 5 | b)
+inline void DitherRow555(const unsigned char* src, uint32_t* dst, int width, int y) {
+    const unsigned char* bayer = kBayer4x4[y & 3];
+    int x = 0;
+#ifdef RD_HAVE_SSE2
+    const __m128i dither = _mm_setr_epi8(bayer[0], bayer[0], bayer[0], 0, bayer[1], bayer[1], bayer[1], 0,
+                                         bayer[2], bayer[2], bayer[2], 0, bayer[3], bayer[3], bayer[3], 0);
+    const __m128i maskB = _mm_set1_epi32(0x001F);
+    const __m128i maskG = _mm_set1_epi32(0x03E0);
+    const __m128i maskR = _mm_set1_epi32(0x7C00);
+    for (; x + 4 <= width; x += 4) {
+        __m128i px = _mm_adds_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4)), dither);
+        __m128i v = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(px, 3), maskB),
+                                              _mm_and_si128(_mm_srli_epi32(px, 6), maskG)),
+                                 _mm_and_si128(_mm_srli_epi32(px, 9), maskR));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), v);
+    }
+#endif
+    for (; x < width; ++x) {
+        const unsigned char* p = src + x * 4;
+        int d = bayer[x & 3];
+        uint32_t b = std::min(p[0] + d, 255) >> 3;
+        uint32_t g = std::min(p[1] + d, 255) >> 3;
+        uint32_t r = std::min(p[2] + d, 255) >> 3;
+        dst[x] = (r << 10) | (g << 5) | b;
+    }
+}
+
+class PaletteQuantizer {
+public:
+    static const int COLOR_BINS = 1 << 15;
+
+    PaletteQuantizer() : m_histogram(COLOR_BINS, 0), m_lookup(COLOR_BINS, kUnmapped), m_paletteSize(0) {
+        // Worst case up front, so encoding never allocates after the first frame
+        m_colors.reserve(COLOR_BINS);
+        m_boxes.reserve(PALETTE_SIZE);
+    }
+
+    // Writes PALETTE_SIZE BGRA entries followed by `height` rows of
+    // `width` indices to `out`
+    void Encode(const unsigned char* bgra, size_t stride, int width, int height, unsigned char* out) {
+        BuildPalette(bgra, stride, width, height);
+        memcpy(out, m_palette, sizeof(m_palette));
+
+        unsigned char* indices = out + sizeof(m_palette);
+        m_row.resize(width);
+        for (int y = 0; y < height; ++y) {
+            DitherRow555(bgra + static_cast<size_t>(y) * stride, m_row.data(), width, y);
+            unsigned char* dst = indices + static_cast<size_t>(y) * width;
+            for (int x = 0; x < width; ++x) {
+                uint16_t index = m_lookup[m_row[x]];
+                if (index == kUnmapped) index = m_lookup[m_row[x]] = Nearest(m_row[x]);
+                dst[x] = static_cast<unsigned char>(index);
+            }
+        }
+    }
+
+private:
+    static const uint16_t kUnmapped = 0xFFFF;
+
+    struct ColorCount {
+        uint16_t color;
+        uint32_t count;
+    };
+
+    static int Channel(uint16_t color, int axis) { return (color >> (axis * 5)) & 0x1F; }
+
+    void BuildPalette(const unsigned char* bgra, size_t stride, int width, int height) {
+        // Every other row and every other pixel is plenty for a histogram
+        std::fill(m_histogram.begin(), m_histogram.end(), 0);
+        for (int y = 0; y < height; y += 2) {
+            const unsigned char* row = bgra + static_cast<size_t>(y) * stride;
+            for (int x = 0; x < width; x += 2) {
+                const unsigned char* p = row + x * 4;
+                m_histogram[((p[2] >> 3) << 10) | ((p[1] >> 3) << 5) | (p[0] >> 3)]++;
+            }
+        }
+
+        m_colors.clear();
+        for (int i = 0; i < COLOR_BINS; ++i) {
+            if (m_histogram[i]) {
+                ColorCount entry = {static_cast<uint16_t>(i), m_histogram[i]};
+                m_colors.push_back(entry);
+            }
+        }
+
+        // Median cut: split the most populous box along its widest channel
+        m_boxes.clear();
+        m_boxes.push_back(Box{0, m_colors.size()});
+        while (m_boxes.size() < PALETTE_SIZE) {
+            int best = -1;
+            uint64_t bestCount = 0;
+            for (size_t i = 0; i < m_boxes.size(); ++i) {
+                if (m_boxes[i].end - m_boxes[i].begin < 2) continue;
+                uint64_t count = BoxCount(m_boxes[i]);
+                if (count > bestCount) {
+                    bestCount = count;
+                    best = static_cast<int>(i);
+                }
+            }
+            if (best < 0) break;
+
+            Box box = m_boxes[best];
+            int axis = WidestAxis(box);
+            std::sort(m_colors.begin() + box.begin, m_colors.begin() + box.end,
+                      [axis](const ColorCount& a, const ColorCount& b) { return Channel(a.color, axis) < Channel(b.color, axis); });
+
+            size_t split = box.begin + 1;
+            uint64_t running = 0;
+            for (size_t i = box.begin; i < box.end - 1; ++i) {
+                running += m_colors[i].count;
+                split = i + 1;
+                if (running * 2 >= bestCount) break;
+            }
+            m_boxes[best].end = split;
+            m_boxes.push_back(Box{split, box.end});
+        }
+
+        // Entries are the weighted mean of each box; histogram colors map
+        // to their own box, everything else is resolved on first use
+        std::fill(m_lookup.begin(), m_lookup.end(), kUnmapped);
+        memset(m_palette, 0, sizeof(m_palette));
+        m_paletteSize = static_cast<int>(m_boxes.size());
+        for (int b = 0; b < m_paletteSize; ++b) {
+            uint64_t sum[3] = {0, 0, 0}, count = 0;
+            for (size_t i = m_boxes[b].begin; i < m_boxes[b].end; ++i) {
+                const ColorCount& c = m_colors[i];
+                for (int axis = 0; axis < 3; ++axis) sum[axis] += static_cast<uint64_t>(Channel(c.color, axis)) * c.count;
+                count += c.count;
+                m_lookup[c.color] = static_cast<uint16_t>(b);
+            }
+            for (int axis = 0; axis < 3; ++axis) {
+                uint32_t level = count ? static_cast<uint32_t>((sum[axis] * 2 + count) / (count * 2)) : 0;
+                m_palette[b * 4 + axis] = static_cast<unsigned char>((level << 3) | (level >> 2));
+            }
+            m_palette[b * 4 + 3] = 0xFF;
+        }
+        if (m_paletteSize == 0) m_paletteSize = 1; // empty frame: entry 0 is black
+    }
+
+    struct Box {
+        size_t begin;
+        size_t end;
+    };
+
+    uint64_t BoxCount(const Box& box) const {
+        uint64_t count = 0;
+        for (size_t i = box.begin; i < box.end; ++i) count += m_colors[i].count;
+        return count;
+    }
+
+    int WidestAxis(const Box& box) const {
+        int lo[3] = {31, 31, 31}, hi[3] = {0, 0, 0};
+        for (size_t i = box.begin; i < box.end; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                int v = Channel(m_colors[i].color, axis);
+                lo[axis] = std::min(lo[axis], v);
+                hi[axis] = std::max(hi[axis], v);
+            }
+        }
+        int axis = 0;
+        for (int a = 1; a < 3; ++a) {
+            if (hi[a] - lo[a] > hi[axis] - lo[axis]) axis = a;
+        }
+        return axis;
+    }
+
+    uint16_t Nearest(uint32_t color) const {
+        int b = (color & 0x1F) << 3, g = ((color >> 5) & 0x1F) << 3, r = ((color >> 10) & 0x1F) << 3;
+        int best = 0, bestDistance = 1 << 30;
+        for (int i = 0; i < m_paletteSize; ++i) {
+            const unsigned char* p = m_palette + i * 4;
+            int db = p[0] - b, dg = p[1] - g, dr = p[2] - r;
+            int distance = dr * dr * 3 + dg * dg * 4 + db * db * 2;
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                best = i;
+            }
+        }
+        return static_cast<uint16_t>(best);
+    }
+
+    std::vector<uint32_t> m_histogram;
+    std::vector<uint16_t> m_lookup;
+    std::vector<ColorCount> m_colors;
+    std::vector<Box> m_boxes;
+    std::vector<uint32_t> m_row;
+    unsigned char m_palette[PALETTE_SIZE * 4];
+    int m_paletteSize;
+};
+
+// Encoded size of a frame: rows are packed, PALETTE8 carries its palette
+inline size_t EncodedFrameSize(int format, int width, int height) {
+    size_t size = RowStride(format, width) * height;
+    return format == PIXEL_FORMAT_PALETTE8 ? size + PALETTE_SIZE * 4 : size;
+}
+
+// Encode top-down BGRA rows in any raw format. `out` must hold
+// EncodedFrameSize bytes; rows are written with RowStride(format, width).
+inline bool EncodeFrame(int format, const unsigned char* bgra, size_t stride, int width, int height,
+                        unsigned char* out, PaletteQuantizer& quantizer) {
+    size_t outStride = RowStride(format, width);
+    switch (format) {
+        case PIXEL_FORMAT_RGB565:
+            for (int y = 0; y < height; ++y) {
+                QuantizeRowRGB565(bgra + static_cast<size_t>(y) * stride, out + y * outStride, width);
+            }
+            return true;
+        case PIXEL_FORMAT_GRAY8:
+            for (int y = 0; y < height; ++y) {
+                QuantizeRowGray8(bgra + static_cast<size_t>(y) * stride, out + y * outStride, width);
+            }
+            return true;
+        case PIXEL_FORMAT_PALETTE8:
+            quantizer.Encode(bgra, stride, width, height, out);
+            return true;
+    }
+    return ConvertFrame(PIXEL_FORMAT_BGRA32, bgra, stride, format, out, outStride, width, height, false);
+}
+
+// Viewer side: palette indices back to BGRA
+inline void ExpandPalette8(const unsigned char* palette, const unsigned char* src, size_t srcStride,
+                           unsigned char* dst, size_t dstStride, int width, int height, bool flip) {
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* in = src + static_cast<size_t>(y) * srcStride;
+        unsigned char* out = dst + static_cast<size_t>(flip ? height - 1 - y : y) * dstStride;
+        for (int x = 0; x < width; ++x) {
+            memcpy(out + x * 4, palette + in[x] * 4, 4);
+        }
+    }
+}
+
+#endif // COLOR_DEPTH_H
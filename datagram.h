@@ -0,0 +1,472 @@
+// ===== datagram.h =====
+// Frame data over UDP for lossy links.
+//
+// Over TCP one lost segment holds back every later byte until it is
+// retransmitted. Here each MSG_RAW_FRAME message is cut into datagrams
+// with XOR parity (see DatagramHeader in protocol.h), so a single loss
+// per parity group costs nothing. Messages that still cannot be rebuilt
+// are not retransmitted: the viewer reports them and the host sends the
+// current pixels of that screen area again, which is never older than a
+// retransmission would be. Cursor, monitor and control messages stay on
+// TCP, where ordering and delivery are guaranteed.
+//
+// The viewer applies messages in id order so an old tile update never
+// overwrites a newer one; a missing message is given up on once later
+// ones have been waiting for DATAGRAM_REORDER_WAIT.
+//
+// The core is platform neutral; the UDP sockets live in server.cpp and
+// viewer.cpp. DatagramImpairment drops, reorders and delays datagrams
+// deterministically so all of this can be exercised without a network.
+#ifndef DATAGRAM_H
+#define DATAGRAM_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "io_slice.h"
+#include "protocol.h"
+
+#define DATAGRAM_WINDOW 64          // messages being rebuilt at once on the viewer
+#define DATAGRAM_REORDER_WAIT 30    // ms a gap may hold back later messages
+#define DATAGRAM_MAX_MESSAGE (64 * 1024 * 1024)
+
+// Parity group size for a measured loss rate: one parity datagram per
+// 16 data datagrams on clean links, one per 4 on bad ones
+inline int FecGroupSize(double lossRate) {
+    if (lossRate < 0.01) return 16;
+    if (lossRate < 0.04) return 8;
+    return 4;
+}
+
+inline int ParityCount(int dataCount, int groupSize) {
+    return (dataCount + groupSize - 1) / groupSize;
+}
+
+// Host side: cuts messages into data and parity datagrams
+class DatagramPacketizer {
+public:
+    explicit DatagramPacketizer(uint32_t token) : m_token(token), m_nextId(0), m_groupSize(16) {
+        m_packet.resize(sizeof(DatagramHeader) + DATAGRAM_PAYLOAD);
+        m_parity.resize(sizeof(DatagramHeader) + DATAGRAM_PAYLOAD);
+    }
+
+    void SetGroupSize(int groupSize) { m_groupSize = std::max(1, std::min(groupSize, 255)); }
+    int GroupSize() const { return m_groupSize; }
+    uint32_t NextId() const { return m_nextId; }
+
+    // Emit every datagram of one message through emit(data, size).
+    // Returns the message id.
+    template <typename Emit>
+    uint32_t Send(const IoSlice* slices, int count, Emit emit) {
+        size_t total = 0;
+        for (int i = 0; i < count; ++i) total += slices[i].size;
+
+        DatagramHeader header = {};
+        header.token = m_token;
+        header.messageId = m_nextId++;
+        header.messageSize = (uint32_t)total;
+        header.dataCount = (uint16_t)((total + DATAGRAM_PAYLOAD - 1) / DATAGRAM_PAYLOAD);
+        header.groupSize = (uint8_t)m_groupSize;
+
+        SliceCursor cursor(slices, count);
+        unsigned char* payload = m_packet.data() + sizeof(DatagramHeader);
+        unsigned char* parity = m_parity.data() + sizeof(DatagramHeader);
+        size_t parityLength = 0;
+        for (int fragment = 0; fragment < header.dataCount; ++fragment) {
+            size_t length = std::min<size_t>(DATAGRAM_PAYLOAD, total - (size_t)fragment * DATAGRAM_PAYLOAD);
+            IoSlice pieces[MAX_IO_SLICES];
+            int used = cursor.Take(length, pieces, MAX_IO_SLICES);
+            unsigned char* out = payload;
+            for (int i = 0; i < used; ++i) {
+                memcpy(out, pieces[i].data, pieces[i].size);
+                out += pieces[i].size;
+            }
+
+            header.fragment = (uint16_t)fragment;
+            header.length = (uint16_t)length;
+            memcpy(m_packet.data(), &header, sizeof(header));
+            emit(m_packet.data(), sizeof(header) + length);
+
+            // Running XOR of the group; sent after its last data fragment
+            int inGroup = fragment % m_groupSize;
+            if (inGroup == 0) {
+                memset(parity, 0, DATAGRAM_PAYLOAD);
+                parityLength = 0;
+            }
+            for (size_t i = 0; i < length; ++i) parity[i] ^= payload[i];
+            parityLength = std::max(parityLength, length);
+            if (inGroup == m_groupSize - 1 || fragment == header.dataCount - 1) {
+                DatagramHeader parityHeader = header;
+                parityHeader.fragment = (uint16_t)(header.dataCount + fragment / m_groupSize);
+                parityHeader.length = (uint16_t)parityLength;
+                memcpy(m_parity.data(), &parityHeader, sizeof(parityHeader));
+                emit(m_parity.data(), sizeof(parityHeader) + parityLength);
+            }
+        }
+        return header.messageId;
+    }
+
+    // Message-less datagram announcing the next id (sent when idle)
+    template <typename Emit>
+    void SendMark(Emit emit) {
+        DatagramHeader header = {};
+        header.token = m_token;
+        header.messageId = m_nextId;
+        emit(reinterpret_cast<const unsigned char*>(&header), sizeof(header));
+    }
+
+private:
+    uint32_t m_token;
+    uint32_t m_nextId;
+    int m_groupSize;
+    std::vector<unsigned char> m_packet;
+    std::vector<unsigned char> m_parity;
+};
+
+// Viewer side: rebuilds messages and releases them in id order
+class DatagramReassembler {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit DatagramReassembler(uint32_t token)
+        : m_token(token), m_nextId(0), m_knownEnd(0), m_stalled(false), m_received(0), m_recovered(0),
+          m_accounted(0) {
+        for (Slot& slot : m_slots) slot.active = false;
+    }
+
+    // Take one datagram; false if it is not a valid datagram of this session
+    bool Accept(const unsigned char* datagram, size_t size) {
+        DatagramHeader header;
+        if (size < sizeof(header)) return false;
+        memcpy(&header, datagram, sizeof(header));
+        if (header.token != m_token || header.length != size - sizeof(header) ||
+            header.length > DATAGRAM_PAYLOAD) {
+            return false;
+        }
+        m_received++;
+
+        if (header.dataCount == 0) { // mark: messages before this id have been sent
+            if (After(header.messageId, m_knownEnd)) m_knownEnd = header.messageId;
+            return true;
+        }
+        if (header.messageSize > DATAGRAM_MAX_MESSAGE || header.groupSize == 0 ||
+            header.dataCount != (header.messageSize + DATAGRAM_PAYLOAD - 1) / DATAGRAM_PAYLOAD ||
+            header.fragment >= header.dataCount + ParityCount(header.dataCount, header.groupSize)) {
+            return false;
+        }
+        if (After(m_nextId, header.messageId)) return true; // delivered or given up already
+        // Messages go out one after another, so every earlier one is complete on the wire
+        if (After(header.messageId, m_knownEnd)) m_knownEnd = header.messageId;
+
+        // Too far ahead: everything that no longer fits the window is lost
+        while (header.messageId - m_nextId >= DATAGRAM_WINDOW) GiveUp();
+
+        Slot& slot = m_slots[header.messageId % DATAGRAM_WINDOW];
+        if (!slot.active || slot.id != header.messageId) Begin(slot, header);
+        if (slot.complete || slot.have[header.fragment]) return true;
+
+        slot.have[header.fragment] = 1;
+        slot.arrived++;
+        if (header.fragment < slot.dataCount) {
+            memcpy(slot.data.data() + (size_t)header.fragment * DATAGRAM_PAYLOAD,
+                   datagram + sizeof(header), header.length);
+            slot.missing--;
+        } else {
+            unsigned char* parity = slot.parity.data() + (size_t)(header.fragment - slot.dataCount) * DATAGRAM_PAYLOAD;
+            memcpy(parity, datagram + sizeof(header), header.length);
+        }
+        Repair(slot, header.fragment < slot.dataCount ? header.fragment / slot.groupSize
+                                                      : header.fragment - slot.dataCount);
+        slot.complete = slot.missing == 0;
+        return true;
+    }
+
+    // Deliver complete messages that are next in order via
+    // deliver(data, size), and report given-up ids via lost(id)
+    template <typename Deliver, typename Lost>
+    void Poll(Clock::time_point now, Deliver deliver, Lost lost) {
+        PollMessages(now, deliver);
+        for (uint32_t id : m_lost) lost(id);
+        m_lost.clear();
+    }
+
+    uint32_t Received() const { return m_received; }
+    uint32_t Recovered() const { return m_recovered; }
+
+    // Messages before NextId() are delivered or lost; Accounted() counts
+    // the datagrams that arrived for them (for loss rate reports)
+    uint32_t NextId() const { return m_nextId; }
+    uint32_t Accounted() const { return m_accounted; }
+
+private:
+    struct Slot {
+        bool active;
+        bool complete;
+        uint32_t id;
+        uint32_t size;
+        uint16_t dataCount;
+        uint8_t groupSize;
+        uint32_t missing;
+        uint32_t arrived;
+        std::vector<unsigned char> data;
+        std::vector<unsigned char> parity;
+        std::vector<uint8_t> have;
+    };
+
+    template <typename Deliver>
+    void PollMessages(Clock::time_point now, Deliver deliver) {
+        for (;;) {
+            Slot& slot = m_slots[m_nextId % DATAGRAM_WINDOW];
+            if (slot.active && slot.id == m_nextId && slot.complete) {
+                m_accounted += slot.arrived;
+                deliver(slot.data.data(), (size_t)slot.size);
+                slot.active = false;
+                m_nextId++;
+                m_stalled = false;
+                continue;
+            }
+            // Still being sent, as far as we know: not a gap yet
+            if (!After(m_knownEnd, m_nextId)) return;
+            if (!m_stalled) {
+                m_stalled = true;
+                m_stallStart = now;
+            }
+            if (now - m_stallStart < std::chrono::milliseconds(DATAGRAM_REORDER_WAIT)) return;
+            GiveUp();
+        }
+    }
+
+    // a comes after b, allowing for id wrap-around
+    static bool After(uint32_t a, uint32_t b) { return (int32_t)(a - b) > 0; }
+
+    void Begin(Slot& slot, const DatagramHeader& header) {
+        int parityCount = ParityCount(header.dataCount, header.groupSize);
+        slot.active = true;
+        slot.complete = false;
+        slot.id = header.messageId;
+        slot.size = header.messageSize;
+        slot.dataCount = header.dataCount;
+        slot.groupSize = header.groupSize;
+        slot.missing = header.dataCount;
+        slot.arrived = 0;
+        slot.data.assign((size_t)header.dataCount * DATAGRAM_PAYLOAD, 0);
+        slot.parity.assign((size_t)parityCount * DATAGRAM_PAYLOAD, 0);
+        slot.have.assign((size_t)header.dataCount + parityCount, 0);
+    }
+
+    // Rebuild the one missing data fragment of a group from its parity
+    void Repair(Slot& slot, int group) {
+        int first = group * slot.groupSize;
+        int last = std::min<int>(first + slot.groupSize, slot.dataCount);
+        if (!slot.have[slot.dataCount + group]) return;
+        int missing = -1;
+        for (int f = first; f < last; ++f) {
+            if (slot.have[f]) continue;
+            if (missing >= 0) return;
+            missing = f;
+        }
+        if (missing < 0) return;
+
+        unsigned char* out = slot.data.data() + (size_t)missing * DATAGRAM_PAYLOAD;
+        memcpy(out, slot.parity.data() + (size_t)group * DATAGRAM_PAYLOAD, DATAGRAM_PAYLOAD);
+        for (int f = first; f < last; ++f) {
+            if (f == missing) continue;
+            const unsigned char* in = slot.data.data() + (size_t)f * DATAGRAM_PAYLOAD;
+            for (size_t i = 0; i < DATAGRAM_PAYLOAD; ++i) out[i] ^= in[i];
+        }
+        // The short last fragment must not pick up parity bytes past its end
+        size_t length = std::min<size_t>(DATAGRAM_PAYLOAD, slot.size - (size_t)missing * DATAGRAM_PAYLOAD);
+        memset(out + length, 0, DATAGRAM_PAYLOAD - length);
+
+        slot.have[missing] = 1;
+        slot.missing--;
+        m_recovered++;
+    }
+
+    void GiveUp() {
+        Slot& slot = m_slots[m_nextId % DATAGRAM_WINDOW];
+        if (slot.active && slot.id == m_nextId) {
+            m_accounted += slot.arrived;
+            slot.active = false;
+        }
+        m_lost.push_back(m_nextId);
+        m_nextId++;
+        m_stalled = false;
+    }
+
+    uint32_t m_token;
+    uint32_t m_nextId;      // next id to deliver
+    uint32_t m_knownEnd;    // every id before this one has been sent in full
+    bool m_stalled;
+    Clock::time_point m_stallStart;
+    uint32_t m_received;
+    uint32_t m_recovered;
+    uint32_t m_accounted;
+    Slot m_slots[DATAGRAM_WINDOW];
+    std::vector<uint32_t> m_lost; // given up, not yet reported
+};
+
+// Viewer side: holds each MSG_UPDATE_END that arrived ahead of its
+// frames until the reassembler has got past them, so the next update
+// request does not go out while the current update is still landing
+class UpdateEndGate {
+public:
+    UpdateEndGate() : m_waiting(0) {
+        for (uint32_t& id : m_throughId) id = 0;
+    }
+
+    // True if the update is complete with the reassembler at `nextId`;
+    // otherwise it is held until Release() sees it complete
+    bool Arrived(uint8_t streamId, uint32_t throughId, uint32_t nextId) {
+        if ((int32_t)(throughId - nextId) <= 0 || streamId >= MAX_STREAMS) return true;
+        m_throughId[streamId] = throughId;
+        m_waiting |= 1u << streamId;
+        return false;
+    }
+
+    // Streams whose held update is complete with the reassembler at
+    // `nextId`, one bit per stream
+    uint32_t Release(uint32_t nextId) {
+        uint32_t complete = 0;
+        for (int stream = 0; stream < MAX_STREAMS; ++stream) {
+            if ((m_waiting >> stream & 1) && (int32_t)(m_throughId[stream] - nextId) <= 0) {
+                complete |= 1u << stream;
+            }
+        }
+        m_waiting &= ~complete;
+        return complete;
+    }
+
+private:
+    uint32_t m_waiting; // streams with an end held, one bit each
+    uint32_t m_throughId[MAX_STREAMS];
+};
+
+// Send rate limit for frame datagrams: additive increase while the viewer
+// reports little loss, multiplicative decrease when it reports a lot
+class DatagramPacer {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit DatagramPacer(double bytesPerSecond)
+        : m_rate(bytesPerSecond), m_tokens(0), m_last(Clock::now()) {}
+
+    // How long to wait before `bytes` may go out
+    Clock::duration Reserve(size_t bytes) {
+        Clock::time_point now = Clock::now();
+        double elapsed = std::chrono::duration<double>(now - m_last).count();
+        m_last = now;
+        // At most 20 ms of burst saved up
+        m_tokens = std::min(m_tokens + elapsed * m_rate, m_rate * 0.02);
+        m_tokens -= (double)bytes;
+        if (m_tokens >= 0) return Clock::duration::zero();
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(-m_tokens / m_rate));
+    }
+
+    void Feedback(double lossRate) {
+        if (lossRate > 0.05) m_rate = std::max(m_rate * 0.7, 256.0 * 1024);
+        else if (lossRate < 0.01) m_rate = std::min(m_rate + 512.0 * 1024, 1024.0 * 1024 * 1024);
+    }
+
+    double BytesPerSecond() const { return m_rate; }
+
+private:
+    double m_rate;
+    double m_tokens;
+    Clock::time_point m_last;
+};
+
+// Deterministic datagram loss, duplication, reordering and delay for
+// testing, e.g. "loss=5,reorder=3,jitter=8,seed=1": percent of
+// datagrams dropped, percent held back behind the next one, and up to
+// `jitter` later datagrams by which any datagram may be delayed.
+class DatagramImpairment {
+public:
+    DatagramImpairment() : m_loss(0), m_duplicate(0), m_reorder(0), m_jitter(0), m_state(1), m_sequence(0) {}
+
+    // Returns false if the spec names nothing to simulate
+    bool Parse(const std::string& spec) {
+        size_t start = 0;
+        while (start < spec.size()) {
+            size_t end = spec.find(',', start);
+            if (end == std::string::npos) end = spec.size();
+            std::string item = spec.substr(start, end - start);
+            size_t eq = item.find('=');
+            if (eq != std::string::npos) {
+                std::string key = item.substr(0, eq);
+                unsigned value = (unsigned)strtoul(item.c_str() + eq + 1, nullptr, 10);
+                if (key == "loss") m_loss = value;
+                else if (key == "duplicate") m_duplicate = value;
+                else if (key == "reorder") m_reorder = value;
+                else if (key == "jitter") m_jitter = value;
+                else if (key == "seed") m_state = value ? value : 1;
+            }
+            start = end + 1;
+        }
+        return m_loss || m_duplicate || m_reorder || m_jitter;
+    }
+
+    template <typename Emit>
+    void Send(const unsigned char* data, size_t size, Emit emit) {
+        m_sequence++;
+        if (Percent() >= m_loss) {
+            uint64_t release = m_sequence + (m_jitter ? Next() % (m_jitter + 1) : 0);
+            if (Percent() < m_reorder) release++;
+            Hold(data, size, release);
+            if (Percent() < m_duplicate) Hold(data, size, release + 1);
+        }
+        Release(m_sequence, emit);
+    }
+
+    // Let everything still held go out
+    template <typename Emit>
+    void Flush(Emit emit) { Release(UINT64_MAX, emit); }
+
+private:
+    struct Held {
+        uint64_t release;
+        std::vector<unsigned char> data;
+    };
+
+    uint32_t Next() { // xorshift32
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+    unsigned Percent() { return Next() % 100; }
+
+    void Hold(const unsigned char* data, size_t size, uint64_t release) {
+        Held held;
+        held.release = release;
+        held.data.assign(data, data + size);
+        m_held.push_back(std::move(held));
+    }
+
+    template <typename Emit>
+    void Release(uint64_t upTo, Emit emit) {
+        // Stable, so equal release points keep their send order
+        std::stable_sort(m_held.begin(), m_held.end(),
+                         [](const Held& a, const Held& b) { return a.release < b.release; });
+        size_t count = 0;
+        while (count < m_held.size() && m_held[count].release <= upTo) {
+            emit(m_held[count].data.data(), m_held[count].data.size());
+            count++;
+        }
+        m_held.erase(m_held.begin(), m_held.begin() + count);
+    }
+
+    unsigned m_loss;
+    unsigned m_duplicate;
+    unsigned m_reorder;
+    unsigned m_jitter;
+    uint32_t m_state;
+    uint64_t m_sequence;
+    std::vector<Held> m_held;
+};
+
+#endif // DATAGRAM_H
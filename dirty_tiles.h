@@ -0,0 +1,124 @@
+// ===== dirty_tiles.h =====
+// Change detection for captured frames. The screen is split into fixed
+// size tiles and each tile keeps a 64-bit hash of its pixels from the
+// previous capture; a tile is dirty when its hash changes.
+#ifndef DIRTY_TILES_H
+#define DIRTY_TILES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define TILE_SIZE 64
+
+struct TileRect {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// Hash of one tile, row by row, eight bytes at a time
+inline uint64_t HashTile(const unsigned char* const* rows, int rowCount, size_t rowOffset, size_t rowBytes) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int r = 0; r < rowCount; ++r) {
+        const unsigned char* p = rows[r] + rowOffset;
+        size_t i = 0;
+        for (; i + 8 <= rowBytes; i += 8) {
+            uint64_t word;
+            memcpy(&word, p + i, sizeof(word));
+            hash = (hash ^ word) * 0x100000001b3ULL;
+            hash ^= hash >> 29;
+        }
+        for (; i < rowBytes; ++i) {
+            hash = (hash ^ p[i]) * 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+class DirtyTileTracker {
+public:
+    DirtyTileTracker() : m_width(0), m_height(0), m_columns(0), m_rows(0), m_valid(false) {}
+
+    // Forget the previous frame so every tile of the next one is dirty
+    void Invalidate() { m_valid = false; }
+
+    // Make the tiles overlapping `area` dirty in the next Update, e.g.
+    // because the viewer never received them
+    void InvalidateArea(const TileRect& area) {
+        if (!m_valid || area.width <= 0 || area.height <= 0) return;
+        int firstColumn = std::max(0, area.x / TILE_SIZE);
+        int firstRow = std::max(0, area.y / TILE_SIZE);
+        int lastColumn = std::min(m_columns - 1, (area.x + area.width - 1) / TILE_SIZE);
+        int lastRow = std::min(m_rows - 1, (area.y + area.height - 1) / TILE_SIZE);
+        for (int ty = firstRow; ty <= lastRow; ++ty) {
+            for (int tx = firstColumn; tx <= lastColumn; ++tx) {
+                uint64_t& hash = m_hashes[static_cast<size_t>(ty) * m_columns + tx];
+                hash = ~hash; // cannot match the unchanged tile
+            }
+        }
+    }
+
+    // Compare a frame with the previous one. Rows may be stored bottom-up
+    // (as in BMP data); tile coordinates are always top-down.
+    // Returns the number of dirty tiles.
+    size_t Update(const unsigned char* pixels, int width, int height, int stride,
+                  int bytesPerPixel, bool bottomUp) {
+        if (width != m_width || height != m_height) {
+            m_width = width;
+            m_height = height;
+            m_columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+            m_rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+            m_hashes.assign(static_cast<size_t>(m_columns) * m_rows, 0);
+            m_valid = false;
+        }
+
+        m_dirty.clear();
+        const unsigned char* rowPointers[TILE_SIZE];
+
+        for (int ty = 0; ty < m_rows; ++ty) {
+            int y0 = ty * TILE_SIZE;
+            int tileHeight = std::min(TILE_SIZE, height - y0);
+            for (int r = 0; r < tileHeight; ++r) {
+                int y = y0 + r;
+                int storedRow = bottomUp ? height - 1 - y : y;
+                rowPointers[r] = pixels + static_cast<size_t>(storedRow) * stride;
+            }
+
+            for (int tx = 0; tx < m_columns; ++tx) {
+                int x0 = tx * TILE_SIZE;
+                int tileWidth = std::min(TILE_SIZE, width - x0);
+                uint64_t hash = HashTile(rowPointers, tileHeight,
+                                         static_cast<size_t>(x0) * bytesPerPixel,
+                                         static_cast<size_t>(tileWidth) * bytesPerPixel);
+
+                uint64_t& previous = m_hashes[static_cast<size_t>(ty) * m_columns + tx];
+                if (!m_valid || previous != hash) {
+                    previous = hash;
+                    TileRect rect = {x0, y0, tileWidth, tileHeight};
+                    m_dirty.push_back(rect);
+                }
+            }
+        }
+
+        m_valid = true;
+        return m_dirty.size();
+    }
+
+    const std::vector<TileRect>& DirtyTiles() const { return m_dirty; }
+    int Columns() const { return m_columns; }
+    int Rows() const { return m_rows; }
+
+private:
+    int m_width;
+    int m_height;
+    int m_columns;
+    int m_rows;
+    bool m_valid;
+    std::vector<uint64_t> m_hashes;
+    std::vector<TileRect> m_dirty;
+};
+
+#endif // DIRTY_TILES_H
@@ -0,0 +1,271 @@
+// ===== frame_scheduler.h =====
+// Decides when the streaming thread captures the next frame.
+//
+// Frames normally go out on the idle interval. Each injected click or key
+// press schedules an expedited capture a few milliseconds later (long
+// enough for the target app to repaint). Any input, mouse motion included,
+// boosts the rate while it keeps arriving, decaying back to the idle rate
+// once the user stops; motion alone never captures faster than the boost
+// interval.
+//
+// When the screen stops changing, the interval doubles after every
+// unchanged frame past a threshold, down to a heartbeat rate, so a static
+// desktop costs almost nothing. Any change or input snaps back to full rate.
+//
+// In pull mode nothing is captured until the viewer asks for an update;
+// the intervals above then only limit how fast requests are answered.
+//
+// Input-to-capture and input-to-frame-sent latency is recorded for
+// discrete input (clicks and key presses) so click-to-photon time can be
+// tracked per session.
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "latency_histogram.h"
+
+class FrameScheduler {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Pending discrete input carried by one capture, returned by BeginFrame
+    struct FrameTicket {
+        Clock::time_point captureStart;
+        bool hasInput;
+        Clock::time_point inputTime;
+    };
+
+    FrameScheduler(int idleIntervalMs, int boostIntervalMs, int heartbeatIntervalMs,
+                   int unchangedThreshold = 5, int expediteDelayMs = 5,
+                   int boostHoldMs = 300, int decayMs = 1000)
+        : m_idleIntervalMs(idleIntervalMs), m_boostIntervalMs(std::min(boostIntervalMs, idleIntervalMs)),
+          m_heartbeatIntervalMs(std::max(heartbeatIntervalMs, idleIntervalMs)),
+          m_unchangedThreshold(unchangedThreshold), m_expediteDelayMs(expediteDelayMs),
+          m_boostHoldMs(boostHoldMs), m_decayMs(decayMs), m_unchangedFrames(0),
+          m_hasLastInput(false), m_hasPendingInput(false), m_captureRequested(false), m_stopped(false),
+          m_pull(false), m_updateRequested(false), m_video(false) {
+        m_lastFrameStart = Clock::now() - std::chrono::milliseconds(idleIntervalMs);
+    }
+
+    // Called by the input injection thread after events reach the OS.
+    // `inputTime` is when the oldest of the discrete events was received.
+    void NotifyInput(Clock::time_point inputTime, bool discrete) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_lastInput = Clock::now();
+        m_hasLastInput = true;
+        m_unchangedFrames = 0;
+        if (discrete && !m_hasPendingInput) {
+            m_pendingInputTime = inputTime;
+            m_pendingInjectTime = m_lastInput;
+            m_hasPendingInput = true;
+        }
+        m_wakeup.notify_one();
+    }
+
+    // Capture soon (at most at the boost rate) for a reason other than
+    // input, e.g. to resend a lost area: no boost, no reset of the
+    // back-off, nothing recorded as input latency
+    void RequestCapture() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_captureRequested = true;
+        m_wakeup.notify_one();
+    }
+
+    // Frames only when asked for (viewer-paced) or on the clock. The
+    // first update in pull mode is sent unasked.
+    void SetPullMode(bool pull) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pull = pull;
+        m_updateRequested = pull;
+        m_wakeup.notify_one();
+    }
+
+    // Called by the input thread when a pull-mode viewer asks for an update
+    void RequestUpdate() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_updateRequested = true;
+        m_wakeup.notify_one();
+    }
+
+    // True if a frame may be sent now (always, unless in pull mode)
+    bool UpdateRequested() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return !m_pull || m_updateRequested;
+    }
+
+    // The requested update went out; wait for the next request
+    void UpdateDelivered() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_updateRequested = false;
+    }
+
+    // Sleep until the next frame is due or Stop() is called
+    void WaitForNextFrame() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stopped) {
+            if (m_pull && !m_updateRequested) {
+                m_wakeup.wait(lock);
+                continue;
+            }
+            Clock::time_point due = NextFrameTimeLocked();
+            if (Clock::now() >= due) break;
+            m_wakeup.wait_until(lock, due);
+        }
+    }
+
+    // As above, but give up at `deadline` so the caller can use the idle
+    // time. Returns false if the deadline came first.
+    bool WaitForNextFrame(Clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stopped) {
+            Clock::time_point now = Clock::now();
+            if (m_pull && !m_updateRequested) {
+                if (now >= deadline) return false;
+                m_wakeup.wait_until(lock, deadline);
+                continue;
+            }
+            Clock::time_point due = NextFrameTimeLocked();
+            if (now >= due) break;
+            if (now >= deadline) return false;
+            m_wakeup.wait_until(lock, std::min(due, deadline));
+        }
+        return true;
+    }
+
+    FrameTicket BeginFrame() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        FrameTicket ticket;
+        ticket.captureStart = Clock::now();
+        ticket.hasInput = m_hasPendingInput;
+        ticket.inputTime = m_pendingInputTime;
+
+        m_lastFrameStart = ticket.captureStart;
+        m_hasPendingInput = false;
+        m_captureRequested = false;
+        return ticket;
+    }
+
+    // Report whether change detection found anything in the last capture
+    void FrameResult(bool changed) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_unchangedFrames = changed ? 0 : m_unchangedFrames + 1;
+    }
+
+    // Call once the frame for this ticket has been written to the socket
+    void FrameSent(const FrameTicket& ticket) {
+        if (!ticket.hasInput) return;
+        m_inputToCapture.Record(ticket.captureStart - ticket.inputTime);
+        m_inputToFrame.Record(Clock::now() - ticket.inputTime);
+    }
+
+    void Stop() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopped = true;
+        m_wakeup.notify_all();
+    }
+
+    void Reset() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopped = false;
+        m_hasPendingInput = false;
+        m_captureRequested = false;
+        m_unchangedFrames = 0;
+        m_inputToCapture.Reset();
+        m_inputToFrame.Reset();
+    }
+
+    // While a video plays somewhere on the monitor, capture at the boosted rate
+    void SetVideoActive(bool active) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_video = active;
+        m_wakeup.notify_one();
+    }
+
+    // 1 right after input, falling to 0 as the boost decays
+    double InputActivity() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_hasLastInput) return 0.0;
+        long long sinceInput = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - m_lastInput).count();
+        if (sinceInput <= m_boostHoldMs) return 1.0;
+        if (sinceInput >= m_boostHoldMs + m_decayMs) return 0.0;
+        return 1.0 - static_cast<double>(sinceInput - m_boostHoldMs) / m_decayMs;
+    }
+
+    int CurrentIntervalMs() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return IntervalLocked(Clock::now());
+    }
+
+    const LatencyHistogram& InputToCapture() const { return m_inputToCapture; }
+    const LatencyHistogram& InputToFrame() const { return m_inputToFrame; }
+
+private:
+    int IntervalLocked(Clock::time_point now) const {
+        if (m_video) return m_boostIntervalMs;
+
+        // Exponential back-off while nothing changes
+        int baseIntervalMs = m_idleIntervalMs;
+        if (m_unchangedFrames >= m_unchangedThreshold) {
+            int doublings = std::min(m_unchangedFrames - m_unchangedThreshold + 1, 16);
+            baseIntervalMs = static_cast<int>(std::min<long long>(
+                static_cast<long long>(m_idleIntervalMs) << doublings, m_heartbeatIntervalMs));
+        }
+
+        if (!m_hasLastInput) return baseIntervalMs;
+
+        long long sinceInput = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_lastInput).count();
+        if (sinceInput <= m_boostHoldMs) return m_boostIntervalMs;
+        if (sinceInput >= m_boostHoldMs + m_decayMs) return baseIntervalMs;
+
+        // Linear decay from the boosted interval back to idle
+        long long decayed = sinceInput - m_boostHoldMs;
+        return m_boostIntervalMs + static_cast<int>((baseIntervalMs - m_boostIntervalMs) * decayed / m_decayMs);
+    }
+
+    Clock::time_point NextFrameTimeLocked() const {
+        Clock::time_point now = Clock::now();
+        Clock::time_point due = m_lastFrameStart + std::chrono::milliseconds(IntervalLocked(now));
+        if (m_hasPendingInput) {
+            Clock::time_point expedited = std::max(
+                m_pendingInjectTime + std::chrono::milliseconds(m_expediteDelayMs),
+                m_lastFrameStart + std::chrono::milliseconds(m_expediteDelayMs));
+            due = std::min(due, expedited);
+        }
+        if (m_captureRequested) {
+            due = std::min(due, m_lastFrameStart + std::chrono::milliseconds(m_boostIntervalMs));
+        }
+        return due;
+    }
+
+    const int m_idleIntervalMs;
+    const int m_boostIntervalMs;
+    const int m_heartbeatIntervalMs;
+    const int m_unchangedThreshold;
+    const int m_expediteDelayMs;
+    const int m_boostHoldMs;
+    const int m_decayMs;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    int m_unchangedFrames;
+    Clock::time_point m_lastFrameStart;
+    Clock::time_point m_lastInput;
+    Clock::time_point m_pendingInputTime;   // when the oldest uncaptured click or key press was received
+    Clock::time_point m_pendingInjectTime;  // when it reached the OS
+    bool m_hasLastInput;
+    bool m_hasPendingInput;
+    bool m_captureRequested;
+    bool m_stopped;
+    bool m_pull;
+    bool m_updateRequested;
+    bool m_video;
+
+    LatencyHistogram m_inputToCapture;
+    LatencyHistogram m_inputToFrame;
+};
+
+#endif // FRAME_SCHEDULER_H
@@ -0,0 +1,482 @@
+// ===== glyph_cache.h =====
+// Text areas as a background color plus glyphs from a cache the host and
+// viewer keep in step (MSG_GLYPH_FRAME). Terminals and editors draw the
+// same few glyphs again and again at positions no tile grid lines up
+// with; once a glyph is cached it costs a placement of three or four
+// bytes wherever it lands.
+//
+// The background is the color of most of the area's pixels. Every other
+// pixel belongs to a glyph: a connected component (8 neighbours) of
+// non-background pixels, at most GLYPH_MAX_SIZE square. Areas with a
+// larger component, too little background or too many tiny components
+// are not text and are left to other encodings. So are areas of text
+// that does not repeat: while fewer than half of recent glyphs came from
+// the cache, only one area in GLYPH_PROBE_INTERVAL is taken, enough to
+// notice when text starts repeating again.
+//
+// A GlyphFrame is followed by
+//   definitionCount x {uint16 slot, uint8 width, uint8 height,
+//                      mask of width * height bits (row-major, LSB first),
+//                      B, G, R of every set bit, in mask order}
+//   placementCount  x {slot, y - previous y, zigzag(x - previous x)}
+//                     as LEB128 varints; positions are the glyph's top left
+//                     corner in area coordinates, from (0, 0), in raster
+//                     order of the glyph's first pixel, so y never decreases
+// Definitions fill (or replace) cache slots before any placement is
+// drawn. The host picks the slots, evicting with a clock, and never evicts
+// a slot used earlier in the same area, so the viewer only ever stores
+// what it is told.
+//
+// FillSyntheticTerminal paints scrolling text into a capture so the cache
+// can be measured without a real terminal (see tests/codec_bench.cpp).
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "dirty_tiles.h"
+#include "protocol.h"
+
+#define GLYPH_MAX_SIZE 32         // largest glyph width and height
+#define GLYPH_CACHE_SLOTS 2048    // glyphs each side keeps per stream
+#define GLYPH_PIXELS_PER_GLYPH 32 // fewest area pixels per component for an area to count as text
+#define GLYPH_MIN_HIT_RATE 0.5    // share of glyphs found in the cache, recent areas weighted most
+#define GLYPH_PROBE_INTERVAL 8    // areas taken below that rate: one in this many
+#define GLYPH_DEFINITION_MAX (4 + GLYPH_MAX_SIZE * GLYPH_MAX_SIZE / 8 + GLYPH_MAX_SIZE * GLYPH_MAX_SIZE * 3)
+#define GLYPH_PLACEMENT_MAX 8     // varint bytes: 2 for the slot, 3 for each offset
+
+inline uint32_t GlyphPixel(const unsigned char* pixel) {
+    return pixel[0] | (pixel[1] << 8) | (static_cast<uint32_t>(pixel[2]) << 16);
+}
+
+inline void PutGlyphU16(unsigned char* out, uint16_t value) {
+    out[0] = static_cast<unsigned char>(value);
+    out[1] = static_cast<unsigned char>(value >> 8);
+}
+
+inline uint16_t GetGlyphU16(const unsigned char* in) {
+    return static_cast<uint16_t>(in[0] | (in[1] << 8));
+}
+
+inline void PutGlyphVarint(std::vector<unsigned char>& out, uint32_t value) {
+    for (; value >= 0x80; value >>= 7) out.push_back(static_cast<unsigned char>(value | 0x80));
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+// False past `end` or beyond 28 bits
+inline bool GetGlyphVarint(const unsigned char*& in, const unsigned char* end, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 28; shift += 7) {
+        if (in == end) return false;
+        uint8_t byte = *in++;
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+class GlyphEncoder {
+public:
+    GlyphEncoder()
+        : m_slots(GLYPH_CACHE_SLOTS), m_table(GLYPH_CACHE_SLOTS * 2, -1),
+          m_store(static_cast<size_t>(GLYPH_CACHE_SLOTS) * GLYPH_DEFINITION_MAX), m_hand(0), m_generation(0),
+          m_fresh(true), m_hitRate(1.0), m_declined(0), m_lastDefinitions(0), m_lastPlacements(0) {}
+
+    // Scratch for areas up to `pixels` in size, so encoding does not allocate
+    void Reserve(size_t pixels) {
+        m_seen.reserve(pixels);
+        m_stack.reserve(pixels);
+        m_members.reserve(pixels);
+        size_t glyphs = pixels / GLYPH_PIXELS_PER_GLYPH + 1;
+        m_glyphs.reserve(glyphs);
+        m_glyphBytes.reserve(glyphs * GLYPH_DEFINITION_MAX);
+        m_definitions.reserve(glyphs * GLYPH_DEFINITION_MAX);
+        m_placements.reserve(glyphs * GLYPH_PLACEMENT_MAX);
+    }
+
+    // Append `width` x `height` top-down BGRA pixels to `out` as a
+    // MSG_GLYPH_FRAME payload (GlyphFrame first); false, with the cache
+    // untouched, if the area does not look like text or is unlikely to pay off
+    bool Encode(const unsigned char* pixels, size_t stride, int width, int height, GlyphFrame frame,
+                std::vector<unsigned char>& out) {
+        uint32_t background;
+        if (width <= 0 || height <= 0 || !FindBackground(pixels, stride, width, height, background)) return false;
+        if (!Segment(pixels, stride, width, height, background)) return false;
+        if (m_hitRate < GLYPH_MIN_HIT_RATE && ++m_declined % GLYPH_PROBE_INTERVAL) return false;
+
+        // Nothing below can fail: the area is committed to the cache
+        m_generation++;
+        m_definitions.clear();
+        m_placements.clear();
+        m_lastDefinitions = 0;
+        int previousX = 0, previousY = 0;
+        for (const Glyph& glyph : m_glyphs) {
+            const unsigned char* bytes = m_glyphBytes.data() + glyph.offset;
+            int slot = Find(glyph.hash, bytes, glyph.size);
+            if (slot < 0) {
+                slot = Evict();
+                Slot& entry = m_slots[slot];
+                entry.hash = glyph.hash;
+                entry.size = glyph.size;
+                memcpy(m_store.data() + static_cast<size_t>(slot) * GLYPH_DEFINITION_MAX, bytes, glyph.size);
+                Insert(slot);
+                unsigned char id[2];
+                PutGlyphU16(id, static_cast<uint16_t>(slot));
+                m_definitions.insert(m_definitions.end(), id, id + 2);
+                m_definitions.insert(m_definitions.end(), bytes, bytes + glyph.size);
+                m_lastDefinitions++;
+            }
+            m_slots[slot].referenced = true;
+            m_slots[slot].generation = m_generation;
+            int dx = glyph.x - previousX;
+            PutGlyphVarint(m_placements, static_cast<uint32_t>(slot));
+            PutGlyphVarint(m_placements, static_cast<uint32_t>(glyph.y - previousY));
+            PutGlyphVarint(m_placements, dx < 0 ? static_cast<uint32_t>(-dx) * 2 - 1 : static_cast<uint32_t>(dx) * 2);
+            previousX = glyph.x;
+            previousY = glyph.y;
+        }
+        m_lastPlacements = m_glyphs.size();
+        if (m_lastPlacements) {
+            double hits = static_cast<double>(m_lastPlacements - m_lastDefinitions) / m_lastPlacements;
+            m_hitRate = 0.75 * m_hitRate + 0.25 * hits;
+        }
+
+        frame.flags = m_fresh ? GLYPH_FRAME_RESET : 0;
+        frame.width = static_cast<uint16_t>(width);
+        frame.height = static_cast<uint16_t>(height);
+        frame.background = background;
+        frame.definitionCount = static_cast<uint16_t>(m_lastDefinitions);
+        frame.placementCount = static_cast<uint16_t>(m_lastPlacements);
+        frame.dataSize = static_cast<uint32_t>(m_definitions.size() + m_placements.size());
+        out.insert(out.end(), reinterpret_cast<const unsigned char*>(&frame),
+                   reinterpret_cast<const unsigned char*>(&frame) + sizeof(frame));
+        out.insert(out.end(), m_definitions.begin(), m_definitions.end());
+        out.insert(out.end(), m_placements.begin(), m_placements.end());
+        m_fresh = false;
+        return true;
+    }
+
+    // Glyphs of the last encoded area, and how many of them were new
+    size_t LastPlacements() const { return m_lastPlacements; }
+    size_t LastDefinitions() const { return m_lastDefinitions; }
+
+private:
+    struct Slot {
+        uint64_t hash = 0;
+        size_t size = 0;          // 0 while unused
+        bool referenced = false;  // used since the clock hand last passed
+        uint32_t generation = 0;  // area that last used it
+    };
+
+    struct Glyph {
+        uint64_t hash;
+        size_t offset; // of its definition (without slot) in m_glyphBytes
+        size_t size;
+        int x;
+        int y;
+    };
+
+    // Majority vote over the area, then a check that it is the majority
+    static bool FindBackground(const unsigned char* pixels, size_t stride, int width, int height,
+                               uint32_t& background) {
+        uint32_t candidate = 0;
+        size_t votes = 0;
+        for (int y = 0; y < height; ++y) {
+            const unsigned char* row = pixels + static_cast<size_t>(y) * stride;
+            for (int x = 0; x < width; ++x) {
+                uint32_t pixel = GlyphPixel(row + x * 4);
+                if (!votes) {
+                    candidate = pixel;
+                    votes = 1;
+                } else if (pixel == candidate) {
+                    votes++;
+                } else {
+                    votes--;
+                }
+            }
+        }
+        size_t count = 0;
+        for (int y = 0; y < height; ++y) {
+            const unsigned char* row = pixels + static_cast<size_t>(y) * stride;
+            for (int x = 0; x < width; ++x) count += GlyphPixel(row + x * 4) == candidate;
+        }
+        background = candidate;
+        return count * 2 > static_cast<size_t>(width) * height;
+    }
+
+    // Cut the non-background pixels into glyphs, in raster order of their
+    // first pixel, each serialized into m_glyphBytes
+    bool Segment(const unsigned char* pixels, size_t stride, int width, int height, uint32_t background) {
+        size_t area = static_cast<size_t>(width) * height;
+        size_t limit = std::min<size_t>(area / GLYPH_PIXELS_PER_GLYPH + 1, GLYPH_CACHE_SLOTS - 1);
+        m_seen.assign(area, 0);
+        m_glyphs.clear();
+        m_glyphBytes.clear();
+        for (int y = 0; y < height; ++y) {
+            const unsigned char* row = pixels + static_cast<size_t>(y) * stride;
+            for (int x = 0; x < width; ++x) {
+                size_t index = static_cast<size_t>(y) * width + x;
+                if (m_seen[index] || GlyphPixel(row + x * 4) == background) continue;
+                if (m_glyphs.size() == limit) return false;
+
+                // Flood fill from (x, y), keeping to GLYPH_MAX_SIZE
+                int left = x, right = x, top = y, bottom = y;
+                m_stack.clear();
+                m_members.clear();
+                m_stack.push_back(static_cast<uint32_t>(index));
+                m_seen[index] = 1;
+                while (!m_stack.empty()) {
+                    uint32_t member = m_stack.back();
+                    m_stack.pop_back();
+                    m_members.push_back(member);
+                    int mx = static_cast<int>(member % width), my = static_cast<int>(member / width);
+                    left = std::min(left, mx);
+                    right = std::max(right, mx);
+                    top = std::min(top, my);
+                    bottom = std::max(bottom, my);
+                    if (right - left >= GLYPH_MAX_SIZE || bottom - top >= GLYPH_MAX_SIZE) return false;
+                    for (int ny = std::max(0, my - 1); ny <= std::min(height - 1, my + 1); ++ny) {
+                        const unsigned char* neighbours = pixels + static_cast<size_t>(ny) * stride;
+                        for (int nx = std::max(0, mx - 1); nx <= std::min(width - 1, mx + 1); ++nx) {
+                            size_t next = static_cast<size_t>(ny) * width + nx;
+                            if (m_seen[next] || GlyphPixel(neighbours + nx * 4) == background) continue;
+                            m_seen[next] = 1;
+                            m_stack.push_back(static_cast<uint32_t>(next));
+                        }
+                    }
+                }
+                Serialize(pixels, stride, width, left, top, right - left + 1, bottom - top + 1);
+            }
+        }
+        return true;
+    }
+
+    // Definition (without slot) of the component in m_members
+    void Serialize(const unsigned char* pixels, size_t stride, int areaWidth, int left, int top, int width,
+                   int height) {
+        Glyph glyph;
+        glyph.offset = m_glyphBytes.size();
+        glyph.x = left;
+        glyph.y = top;
+        size_t maskBytes = (static_cast<size_t>(width) * height + 7) / 8;
+        m_glyphBytes.resize(glyph.offset + 2 + maskBytes);
+        unsigned char* mask = m_glyphBytes.data() + glyph.offset + 2;
+        m_glyphBytes[glyph.offset] = static_cast<unsigned char>(width);
+        m_glyphBytes[glyph.offset + 1] = static_cast<unsigned char>(height);
+        memset(mask, 0, maskBytes);
+        for (uint32_t member : m_members) {
+            size_t bit = static_cast<size_t>(member / areaWidth - top) * width + (member % areaWidth - left);
+            mask[bit / 8] |= static_cast<unsigned char>(1 << (bit % 8));
+        }
+        m_glyphBytes.resize(m_glyphBytes.size() + m_members.size() * 3);
+        mask = m_glyphBytes.data() + glyph.offset + 2;
+        unsigned char* color = mask + maskBytes;
+        for (int gy = 0; gy < height; ++gy) {
+            const unsigned char* row = pixels + static_cast<size_t>(top + gy) * stride + static_cast<size_t>(left) * 4;
+            for (int gx = 0; gx < width; ++gx) {
+                size_t bit = static_cast<size_t>(gy) * width + gx;
+                if (!(mask[bit / 8] & (1 << (bit % 8)))) continue;
+                color[0] = row[gx * 4];
+                color[1] = row[gx * 4 + 1];
+                color[2] = row[gx * 4 + 2];
+                color += 3;
+            }
+        }
+        glyph.size = m_glyphBytes.size() - glyph.offset;
+
+        uint64_t hash = 14695981039346656037ull; // FNV-1a
+        for (size_t i = glyph.offset; i < m_glyphBytes.size(); ++i) hash = (hash ^ m_glyphBytes[i]) * 1099511628211ull;
+        glyph.hash = hash;
+        m_glyphs.push_back(glyph);
+    }
+
+    // Open addressing over m_table, linear probing
+    size_t Home(uint64_t hash) const { return static_cast<size_t>(hash ^ (hash >> 29)) & (m_table.size() - 1); }
+
+    int Find(uint64_t hash, const unsigned char* bytes, size_t size) const {
+        for (size_t i = Home(hash);; i = (i + 1) & (m_table.size() - 1)) {
+            int slot = m_table[i];
+            if (slot < 0) return -1;
+            const Slot& entry = m_slots[slot];
+            if (entry.hash == hash && entry.size == size &&
+                !memcmp(m_store.data() + static_cast<size_t>(slot) * GLYPH_DEFINITION_MAX, bytes, size)) {
+                return slot;
+            }
+        }
+    }
+
+    void Insert(int slot) {
+        size_t i = Home(m_slots[slot].hash);
+        while (m_table[i] >= 0) i = (i + 1) & (m_table.size() - 1);
+        m_table[i] = slot;
+    }
+
+    // Backward-shift deletion keeps every probe sequence unbroken
+    void Remove(int slot) {
+        size_t mask = m_table.size() - 1;
+        size_t i = Home(m_slots[slot].hash);
+        while (m_table[i] != slot) i = (i + 1) & mask;
+        for (size_t j = (i + 1) & mask; m_table[j] >= 0; j = (j + 1) & mask) {
+            size_t home = Home(m_slots[m_table[j]].hash);
+            // Move j back into the hole unless its home lies cyclically in (i, j]
+            bool stays = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+            if (stays) continue;
+            m_table[i] = m_table[j];
+            i = j;
+        }
+        m_table[i] = -1;
+    }
+
+    // Clock: the first slot not used lately, nor in the current area
+    int Evict() {
+        for (;;) {
+            int slot = m_hand;
+            m_hand = (m_hand + 1) % GLYPH_CACHE_SLOTS;
+            Slot& entry = m_slots[slot];
+            if (entry.generation == m_generation && entry.size) continue;
+            if (entry.referenced) {
+                entry.referenced = false;
+                continue;
+            }
+            if (entry.size) Remove(slot);
+            entry.size = 0;
+            return slot;
+        }
+    }
+
+    std::vector<Slot> m_slots;
+    std::vector<int> m_table;           // slot per bucket, -1 if empty
+    std::vector<unsigned char> m_store; // definition of each slot, GLYPH_DEFINITION_MAX apart
+    int m_hand;
+    uint32_t m_generation;
+    bool m_fresh;                       // the viewer may still hold an older cache
+    double m_hitRate;                   // moving average over the areas taken
+    uint32_t m_declined;
+    std::vector<unsigned char> m_seen;
+    std::vector<uint32_t> m_stack;
+    std::vector<uint32_t> m_members;
+    std::vector<Glyph> m_glyphs;
+    std::vector<unsigned char> m_glyphBytes;
+    std::vector<unsigned char> m_definitions;
+    std::vector<unsigned char> m_placements;
+    size_t m_lastDefinitions;
+    size_t m_lastPlacements;
+};
+
+class GlyphDecoder {
+public:
+    GlyphDecoder()
+        : m_pixels(static_cast<size_t>(GLYPH_CACHE_SLOTS) * GLYPH_MAX_SIZE * GLYPH_MAX_SIZE * 4),
+          m_width(GLYPH_CACHE_SLOTS, 0), m_height(GLYPH_CACHE_SLOTS, 0) {}
+
+    // Draw the area into `pixels` (frame.width x frame.height BGRA);
+    // false if the payload is malformed or uses a slot never defined
+    bool Decode(const GlyphFrame& frame, const unsigned char* data, size_t size, unsigned char* pixels,
+                size_t stride) {
+        if (frame.flags & GLYPH_FRAME_RESET) std::fill(m_width.begin(), m_width.end(), 0);
+        const unsigned char* end = data + size;
+        for (int i = 0; i < frame.definitionCount; ++i) {
+            if (end - data < 4) return false;
+            int slot = GetGlyphU16(data), width = data[2], height = data[3];
+            data += 4;
+            if (slot >= GLYPH_CACHE_SLOTS || !width || !height || width > GLYPH_MAX_SIZE || height > GLYPH_MAX_SIZE) {
+                return false;
+            }
+            size_t maskBytes = (static_cast<size_t>(width) * height + 7) / 8;
+            if (static_cast<size_t>(end - data) < maskBytes) return false;
+            const unsigned char* mask = data;
+            const unsigned char* color = data + maskBytes;
+            unsigned char* out = Glyph(slot);
+            for (int bit = 0; bit < width * height; ++bit, out += 4) {
+                if (!(mask[bit / 8] & (1 << (bit % 8)))) {
+                    out[3] = 0;
+                    continue;
+                }
+                if (end - color < 3) return false;
+                out[0] = color[0];
+                out[1] = color[1];
+                out[2] = color[2];
+                out[3] = 0xFF;
+                color += 3;
+            }
+            m_width[slot] = static_cast<uint8_t>(width);
+            m_height[slot] = static_cast<uint8_t>(height);
+            data = color;
+        }
+        for (int y = 0; y < frame.height; ++y) {
+            uint32_t* row = reinterpret_cast<uint32_t*>(pixels + static_cast<size_t>(y) * stride);
+            std::fill(row, row + frame.width, frame.background | 0xFF000000u);
+        }
+        long long x = 0, y = 0;
+        for (int i = 0; i < frame.placementCount; ++i) {
+            uint32_t slot, dy, dx;
+            if (!GetGlyphVarint(data, end, slot) || !GetGlyphVarint(data, end, dy) ||
+                !GetGlyphVarint(data, end, dx)) {
+                return false;
+            }
+            x += dx & 1 ? -static_cast<long long>((dx + 1) / 2) : static_cast<long long>(dx / 2);
+            y += dy;
+            if (slot >= GLYPH_CACHE_SLOTS || !m_width[slot]) return false;
+            int width = m_width[slot], height = m_height[slot];
+            if (x < 0 || x + width > frame.width || y + height > frame.height) return false;
+            const unsigned char* glyph = Glyph(slot);
+            for (int gy = 0; gy < height; ++gy) {
+                unsigned char* out = pixels + static_cast<size_t>(y + gy) * stride + static_cast<size_t>(x) * 4;
+                for (int gx = 0; gx < width; ++gx, glyph += 4, out += 4) {
+                    if (glyph[3]) memcpy(out, glyph, 4);
+                }
+            }
+        }
+        return data == end;
+    }
+
+private:
+    unsigned char* Glyph(int slot) {
+        return m_pixels.data() + static_cast<size_t>(slot) * GLYPH_MAX_SIZE * GLYPH_MAX_SIZE * 4;
+    }
+
+    std::vector<unsigned char> m_pixels; // width x height BGRA per slot, alpha 0 off the glyph
+    std::vector<uint8_t> m_width;        // 0 while undefined
+    std::vector<uint8_t> m_height;
+};
+
+// Lines of seven-segment characters in a few colors over `area` of top-down
+// BGRA rows, scrolled up one line per frame like a terminal printing output
+inline void FillSyntheticTerminal(unsigned char* pixels, size_t stride, const TileRect& area, uint32_t frame) {
+    static const uint32_t colors[4] = {0xD0D0D0, 0x6AB0F3, 0x98C379, 0xE5C07B};
+    const int cellWidth = 8, cellHeight = 16;
+    for (int y = 0; y < area.height; ++y) {
+        uint32_t* row = reinterpret_cast<uint32_t*>(pixels + static_cast<size_t>(area.y + y) * stride) + area.x;
+        std::fill(row, row + area.width, 0xFF1E1E1Eu);
+    }
+    for (int line = 0; line < area.height / cellHeight; ++line) {
+        uint32_t text = (line + frame) * 2654435761u;
+        int length = static_cast<int>((text >> 8) % (area.width / cellWidth + 1));
+        for (int column = 0; column < length; ++column) {
+            uint32_t code = ((text >> 3) + column * 40503u) * 2246822519u >> 26; // 64 characters
+            if (code < 8) continue;                                             // spaces
+            uint32_t segments = (code * 37 + 11) & 0x7F;
+            uint32_t color = colors[(text + column / 6) & 3] | 0xFF000000u;
+            int cx = area.x + column * cellWidth, cy = area.y + line * cellHeight;
+            auto put = [&](int x, int y) {
+                *reinterpret_cast<uint32_t*>(pixels + static_cast<size_t>(cy + y) * stride + (cx + x) * 4) = color;
+            };
+            for (int i = 1; i <= 6; ++i) {
+                if (segments & 1) put(i, 1);   // top
+                if (segments & 2) put(i, 7);   // middle
+                if (segments & 4) put(i, 13);  // bottom
+            }
+            for (int i = 1; i <= 7; ++i) {
+                if (segments & 8) put(1, i);       // upper left
+                if (segments & 16) put(6, i);      // upper right
+                if (segments & 32) put(1, i + 6);  // lower left
+                if (segments & 64) put(6, i + 6);  // lower right
+            }
+        }
+    }
+}
+
+#endif // GLYPH_CACHE_H
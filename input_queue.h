@@ -0,0 +1,376 @@
+// ===== input_queue.h =====
+// Host-side input injection pipeline.
+//
+// The network thread parses input messages and enqueues them on a lock-free
+// MPSC queue; a dedicated injection thread drains everything pending on each
+// wakeup, coalesces runs of absolute mouse moves and hands the batch to the
+// injector backend in one call (one SendInput array on Windows). Per-event
+// enqueue-to-inject latency is recorded in a LatencyHistogram.
+//
+// The core is platform neutral. Backends: Win32InputInjector (SendInput)
+// and MockInputInjector, which records batches for testing on Linux.
+#ifndef INPUT_QUEUE_H
+#define INPUT_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "latency_histogram.h"
+#include "text_input.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+// Input event kinds
+#define INPUT_EVENT_MOUSE_MOVE 1     // absolute move to (x, y)
+#define INPUT_EVENT_MOUSE_BUTTON 2   // data = platform button flags
+#define INPUT_EVENT_MOUSE_WHEEL 3    // data = wheel delta
+#define INPUT_EVENT_KEY_DOWN 4       // keyCode = virtual key
+#define INPUT_EVENT_KEY_UP 5
+#define INPUT_EVENT_UNICODE 6        // keyCode = UTF-16 unit, pressed and released
+
+struct InputEvent {
+    uint8_t kind;
+    uint16_t keyCode;
+    int32_t x;
+    int32_t y;
+    int32_t data;
+    std::chrono::steady_clock::time_point enqueueTime;
+
+    static InputEvent MouseMove(int x, int y) {
+        InputEvent e = {}; e.kind = INPUT_EVENT_MOUSE_MOVE; e.x = x; e.y = y; return e;
+    }
+    static InputEvent MouseButton(uint32_t flags) {
+        InputEvent e = {}; e.kind = INPUT_EVENT_MOUSE_BUTTON; e.data = static_cast<int32_t>(flags); return e;
+    }
+    static InputEvent MouseWheel(int delta) {
+        InputEvent e = {}; e.kind = INPUT_EVENT_MOUSE_WHEEL; e.data = delta; return e;
+    }
+    static InputEvent Key(uint16_t keyCode, bool down) {
+        InputEvent e = {}; e.kind = down ? INPUT_EVENT_KEY_DOWN : INPUT_EVENT_KEY_UP; e.keyCode = keyCode; return e;
+    }
+    static InputEvent Unicode(char16_t unit) {
+        InputEvent e = {}; e.kind = INPUT_EVENT_UNICODE; e.keyCode = unit; return e;
+    }
+};
+
+// Bounded lock-free multi-producer queue (Vyukov's sequence-numbered ring).
+// Any thread may push; only the injection thread pops.
+template <typename T, size_t Capacity>
+class MpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    MpscQueue() : m_enqueuePos(0), m_dequeuePos(0) {
+        for (size_t i = 0; i < Capacity; ++i) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool TryPush(const T& value) {
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = m_cells[pos & (Capacity - 1)];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool TryPop(T& value) {
+        size_t pos = m_dequeuePos;
+        Cell& cell = m_cells[pos & (Capacity - 1)];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0) {
+            return false; // empty (or producer still writing this cell)
+        }
+        value = cell.value;
+        cell.sequence.store(pos + Capacity, std::memory_order_release);
+        m_dequeuePos = pos + 1;
+        return true;
+    }
+
+    bool Empty() const {
+        const Cell& cell = m_cells[m_dequeuePos & (Capacity - 1)];
+        return cell.sequence.load(std::memory_order_acquire) != m_dequeuePos + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    Cell m_cells[Capacity];
+    alignas(64) std::atomic<size_t> m_enqueuePos;
+    alignas(64) size_t m_dequeuePos; // consumer only
+};
+
+// Backend that turns a batch of events into OS input
+class InputInjector {
+public:
+    virtual ~InputInjector() {}
+    virtual void Inject(const InputEvent* events, size_t count) = 0;
+};
+
+// Records every batch instead of injecting, for tests and benchmarks
+class MockInputInjector : public InputInjector {
+public:
+    void Inject(const InputEvent* events, size_t count) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_batches.push_back(std::vector<InputEvent>(events, events + count));
+    }
+
+    std::vector<std::vector<InputEvent>> Batches() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_batches;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<std::vector<InputEvent>> m_batches;
+};
+
+#if defined(_WIN32)
+
+class Win32InputInjector : public InputInjector {
+public:
+    void Inject(const InputEvent* events, size_t count) override {
+        m_inputs.clear();
+
+        // Absolute coordinates are normalized to 0..65535 over the virtual desktop
+        int originX = GetSystemMetrics(SM_XVIRTUALSCREEN);
+        int originY = GetSystemMetrics(SM_YVIRTUALSCREEN);
+        int spanX = GetSystemMetrics(SM_CXVIRTUALSCREEN) - 1;
+        int spanY = GetSystemMetrics(SM_CYVIRTUALSCREEN) - 1;
+        if (spanX < 1) spanX = 1;
+        if (spanY < 1) spanY = 1;
+
+        for (size_t i = 0; i < count; ++i) {
+            const InputEvent& e = events[i];
+            INPUT input = {};
+
+            switch (e.kind) {
+                case INPUT_EVENT_MOUSE_MOVE:
+                    input.type = INPUT_MOUSE;
+                    input.mi.dx = static_cast<LONG>((static_cast<int64_t>(e.x - originX) * 65535) / spanX);
+                    input.mi.dy = static_cast<LONG>((static_cast<int64_t>(e.y - originY) * 65535) / spanY);
+                    input.mi.dwFlags = MOUSEEVENTF_MOVE | MOUSEEVENTF_ABSOLUTE | MOUSEEVENTF_VIRTUALDESK;
+                    m_inputs.push_back(input);
+                    break;
+                case INPUT_EVENT_MOUSE_BUTTON:
+                    input.type = INPUT_MOUSE;
+                    input.mi.dwFlags = static_cast<DWORD>(e.data);
+                    m_inputs.push_back(input);
+                    break;
+                case INPUT_EVENT_MOUSE_WHEEL:
+                    input.type = INPUT_MOUSE;
+                    input.mi.dwFlags = MOUSEEVENTF_WHEEL;
+                    input.mi.mouseData = static_cast<DWORD>(e.data);
+                    m_inputs.push_back(input);
+                    break;
+                case INPUT_EVENT_KEY_DOWN:
+                case INPUT_EVENT_KEY_UP:
+                    input.type = INPUT_KEYBOARD;
+                    input.ki.wVk = e.keyCode;
+                    input.ki.dwFlags = e.kind == INPUT_EVENT_KEY_UP ? KEYEVENTF_KEYUP : 0;
+                    m_inputs.push_back(input);
+                    break;
+                case INPUT_EVENT_UNICODE: {
+                    input.type = INPUT_KEYBOARD;
+                    WORD vk = ControlCharToVirtualKey(static_cast<char16_t>(e.keyCode));
+                    if (vk) {
+                        input.ki.wVk = vk;
+                    } else {
+                        input.ki.wScan = e.keyCode;
+                        input.ki.dwFlags = KEYEVENTF_UNICODE;
+                    }
+                    m_inputs.push_back(input);
+                    input.ki.dwFlags |= KEYEVENTF_KEYUP;
+                    m_inputs.push_back(input);
+                    break;
+                }
+            }
+        }
+
+        if (!m_inputs.empty()) {
+            SendInput(static_cast<UINT>(m_inputs.size()), m_inputs.data(), sizeof(INPUT));
+        }
+    }
+
+private:
+    std::vector<INPUT> m_inputs; // reused across batches
+};
+
+#endif
+
+// Drop all but the last of each run of consecutive absolute moves. Moves
+// separated by a button or key event are kept so drags stay exact.
+inline size_t CoalesceInputEvents(InputEvent* events, size_t count) {
+    size_t out = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (events[i].kind == INPUT_EVENT_MOUSE_MOVE && out > 0 &&
+            events[out - 1].kind == INPUT_EVENT_MOUSE_MOVE) {
+            // Keep the oldest enqueue time so latency reflects the whole run
+            std::chrono::steady_clock::time_point first = events[out - 1].enqueueTime;
+            events[out - 1] = events[i];
+            events[out - 1].enqueueTime = first;
+        } else {
+            events[out++] = events[i];
+        }
+    }
+    return out;
+}
+
+class InputInjectionQueue {
+public:
+    static const size_t QUEUE_CAPACITY = 4096;
+    static const size_t MAX_BATCH = 512;
+
+    // Called on the injection thread after each batch with whether it held
+    // clicks or key presses, and the oldest enqueue time of those (of the
+    // whole batch if it held none)
+    typedef std::function<void(std::chrono::steady_clock::time_point, bool)> InjectedCallback;
+
+    InputInjectionQueue() : m_running(false), m_sleeping(false),
+                            m_enqueued(0), m_injected(0), m_coalesced(0), m_batches(0) {}
+
+    ~InputInjectionQueue() { Stop(); }
+
+    void Start(std::unique_ptr<InputInjector> injector, InjectedCallback onInjected = InjectedCallback()) {
+        Stop();
+        m_injector = std::move(injector);
+        m_onInjected = onInjected;
+        m_running = true;
+        m_thread = std::thread(&InputInjectionQueue::InjectionThread, this);
+    }
+
+    void Stop() {
+        if (!m_running.exchange(false)) return;
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_wakeup.notify_one();
+        }
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    // Called from any thread. Lock-free while the ring has room; when it is
+    // full (injection stalled with QUEUE_CAPACITY events pending) it spins
+    // until the injection thread makes room, since dropping a key or
+    // button event would leave it stuck down on the host
+    void Enqueue(InputEvent event) {
+        event.enqueueTime = std::chrono::steady_clock::now();
+        while (!m_queue.TryPush(event)) {
+            Wake();
+            std::this_thread::yield();
+        }
+        m_enqueued.fetch_add(1, std::memory_order_relaxed);
+        Wake();
+    }
+
+    const LatencyHistogram& Latency() const { return m_latency; }
+    uint64_t EnqueuedCount() const { return m_enqueued.load(); }
+    uint64_t InjectedCount() const { return m_injected.load(); }
+    uint64_t CoalescedCount() const { return m_coalesced.load(); }
+    uint64_t BatchCount() const { return m_batches.load(); }
+
+private:
+    // Called after a push. The fence here and the one after m_sleeping is
+    // set pair up: either the producer sees the injection thread going to
+    // sleep, or the injection thread sees the new event before it sleeps.
+    // A release store of the slot and a load of m_sleeping alone could
+    // both read the old values, leaving the event for the 50 ms timeout.
+    void Wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleeping.load()) {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_wakeup.notify_one();
+        }
+    }
+
+    void InjectionThread() {
+        std::vector<InputEvent> batch(MAX_BATCH);
+
+        while (m_running) {
+            size_t count = 0;
+            while (count < MAX_BATCH && m_queue.TryPop(batch[count])) {
+                count++;
+            }
+
+            if (count == 0) {
+                std::unique_lock<std::mutex> lock(m_wakeMutex);
+                m_sleeping = true;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                m_wakeup.wait_for(lock, std::chrono::milliseconds(50), [this] {
+                    return !m_queue.Empty() || !m_running;
+                });
+                m_sleeping = false;
+                continue;
+            }
+
+            size_t injectCount = CoalesceInputEvents(batch.data(), count);
+            m_injector->Inject(batch.data(), injectCount);
+
+            auto now = std::chrono::steady_clock::now();
+            auto oldest = now;
+            auto oldestDiscrete = now;
+            bool discrete = false;
+            for (size_t i = 0; i < injectCount; ++i) {
+                m_latency.Record(now - batch[i].enqueueTime);
+                oldest = std::min(oldest, batch[i].enqueueTime);
+                if (batch[i].kind != INPUT_EVENT_MOUSE_MOVE) {
+                    oldestDiscrete = std::min(oldestDiscrete, batch[i].enqueueTime);
+                    discrete = true;
+                }
+            }
+            if (m_onInjected) {
+                m_onInjected(discrete ? oldestDiscrete : oldest, discrete);
+            }
+
+            m_injected.fetch_add(injectCount, std::memory_order_relaxed);
+            m_coalesced.fetch_add(count - injectCount, std::memory_order_relaxed);
+            m_batches.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue<InputEvent, QUEUE_CAPACITY> m_queue;
+    std::unique_ptr<InputInjector> m_injector;
+    InjectedCallback m_onInjected;
+    std::thread m_thread;
+    std::atomic<bool> m_running;
+
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wakeup;
+    std::atomic<bool> m_sleeping;
+
+    LatencyHistogram m_latency;
+    std::atomic<uint64_t> m_enqueued;
+    std::atomic<uint64_t> m_injected;
+    std::atomic<uint64_t> m_coalesced;
+    std::atomic<uint64_t> m_batches;
+};
+
+#endif // INPUT_QUEUE_H
@@ -0,0 +1,71 @@
+// ===== io_slice.h =====
+// Scatter/gather byte ranges: a message is passed around as a list of
+// slices (header, metadata, payload) instead of being copied into one
+// buffer. Platform neutral; socket_io.h and uring_transport.h write them
+// to sockets and datagram.h cuts them into datagrams.
+#ifndef IO_SLICE_H
+#define IO_SLICE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "latency_histogram.h"
+
+#define MAX_IO_SLICES 8
+
+struct IoSlice {
+    const void* data;
+    size_t size;
+};
+
+// Syscall counts and per-call latency of the gather writes
+struct SendStats {
+    std::atomic<uint64_t> messages;
+    std::atomic<uint64_t> calls;
+    LatencyHistogram latency;
+
+    SendStats() : messages(0), calls(0) {}
+
+    void Reset() {
+        messages.store(0);
+        calls.store(0);
+        latency.Reset();
+    }
+};
+
+// Hands out consecutive byte ranges of a slice list, e.g. to cut one
+// message into pieces without copying it
+class SliceCursor {
+public:
+    SliceCursor(const IoSlice* slices, int count) : m_slices(slices), m_count(count), m_index(0), m_offset(0) {}
+
+    // Slices covering the next `size` bytes; returns how many went into `out`
+    int Take(size_t size, IoSlice* out, int maxOut) {
+        int used = 0;
+        while (size > 0 && m_index < m_count && used < maxOut) {
+            size_t n = std::min(size, m_slices[m_index].size - m_offset);
+            if (n) {
+                out[used].data = static_cast<const char*>(m_slices[m_index].data) + m_offset;
+                out[used].size = n;
+                used++;
+            }
+            m_offset += n;
+            size -= n;
+            if (m_offset == m_slices[m_index].size) {
+                m_index++;
+                m_offset = 0;
+            }
+        }
+        return used;
+    }
+
+private:
+    const IoSlice* m_slices;
+    int m_count;
+    int m_index;
+    size_t m_offset;
+};
+
+#endif // IO_SLICE_H
@@ -0,0 +1,106 @@
+// ===== latency_histogram.h =====
+// Lock-free latency histogram with power-of-two microsecond buckets.
+// Recording is wait-free, so it is safe to call from the network, input
+// and capture threads while another thread prints a summary.
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+class LatencyHistogram {
+public:
+    // Bucket 0 holds 0us, bucket i holds [2^(i-1), 2^i) microseconds
+    static const int BUCKET_COUNT = 32;
+
+    LatencyHistogram() { Reset(); }
+
+    void Reset() {
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+        m_count.store(0, std::memory_order_relaxed);
+        m_sumMicros.store(0, std::memory_order_relaxed);
+        m_maxMicros.store(0, std::memory_order_relaxed);
+    }
+
+    void RecordMicros(uint64_t micros) {
+        int bucket = 0;
+        while (bucket < BUCKET_COUNT - 1 && (1ULL << bucket) <= micros) {
+            bucket++;
+        }
+        m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sumMicros.fetch_add(micros, std::memory_order_relaxed);
+
+        uint64_t currentMax = m_maxMicros.load(std::memory_order_relaxed);
+        while (micros > currentMax &&
+               !m_maxMicros.compare_exchange_weak(currentMax, micros, std::memory_order_relaxed)) {
+        }
+    }
+
+    template <typename Duration>
+    void Record(Duration duration) {
+        long long micros = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        RecordMicros(micros > 0 ? static_cast<uint64_t>(micros) : 0);
+    }
+
+    uint64_t Count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t MaxMicros() const { return m_maxMicros.load(std::memory_order_relaxed); }
+
+    double MeanMicros() const {
+        uint64_t count = Count();
+        return count ? static_cast<double>(m_sumMicros.load(std::memory_order_relaxed)) / count : 0.0;
+    }
+
+    // Upper bound of the bucket containing the given percentile (0-100)
+    uint64_t PercentileMicros(double percentile) const {
+        uint64_t count = Count();
+        if (count == 0) return 0;
+
+        uint64_t target = static_cast<uint64_t>(count * percentile / 100.0);
+        if (target >= count) target = count - 1;
+
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if (seen > target) {
+                return i == 0 ? 0 : (1ULL << i);
+            }
+        }
+        return MaxMicros();
+    }
+
+    std::string Summary() const {
+        std::ostringstream out;
+        out << "n=" << Count()
+            << " mean=" << static_cast<uint64_t>(MeanMicros()) << "us"
+            << " p50<=" << PercentileMicros(50) << "us"
+            << " p90<=" << PercentileMicros(90) << "us"
+            << " p99<=" << PercentileMicros(99) << "us"
+            << " max=" << MaxMicros() << "us";
+        return out.str();
+    }
+
+    // One line per non-empty bucket, for detailed dumps
+    std::string Buckets() const {
+        std::ostringstream out;
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            uint64_t n = m_buckets[i].load(std::memory_order_relaxed);
+            if (n == 0) continue;
+            out << "  <" << (i == 0 ? 1 : (1ULL << i)) << "us: " << n << "\n";
+        }
+        return out.str();
+    }
+
+private:
+    std::atomic<uint64_t> m_buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sumMicros;
+    std::atomic<uint64_t> m_maxMicros;
+};
+
+#endif // LATENCY_HISTOGRAM_H
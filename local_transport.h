@@ -0,0 +1,338 @@
+// ===== local_transport.h =====
+// Shared-memory link for a viewer on the same machine as the host.
+//
+// Host -> viewer traffic goes through a ring of records in a named file
+// mapping instead of the TCP loopback stack; each Send becomes one record
+// (or several, if it is larger than half the ring), so a message header
+// and its payload are contiguous and the viewer can decode frames where
+// they lie. Named auto-reset events are the doorbells, rung only when the
+// other side has said it is about to sleep.
+//
+// Viewer -> host input stays on the TCP connection, which also tells each
+// side when the other one has gone away.
+#ifndef LOCAL_TRANSPORT_H
+#define LOCAL_TRANSPORT_H
+
+#include <windows.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <random>
+
+#include "transport.h"
+
+#define SHARED_RING_SIZE (64 * 1024 * 1024) // host -> viewer ring, enough for two 4K frames
+#define SHARED_RING_MAGIC 0x474E4952         // "RING"
+#define SHARED_RING_WAIT 100                 // ms between liveness checks while blocked
+
+// Lives at the start of the mapping; the data area starts one page in
+struct SharedRingHeader {
+    uint32_t magic;
+    uint32_t capacity;
+    alignas(64) std::atomic<uint64_t> writePos;   // bytes ever written
+    alignas(64) std::atomic<uint64_t> readPos;    // bytes ever released by the reader
+    alignas(64) std::atomic<uint32_t> writerWaiting;
+    std::atomic<uint32_t> readerWaiting;
+    std::atomic<uint32_t> closed;
+};
+
+class SharedRing {
+public:
+    static const uint32_t DATA_OFFSET = 4096;
+    static const uint32_t WRAP = 0xFFFFFFFF; // record length that means "continue at offset 0"
+
+    SharedRing()
+        : m_mapping(NULL), m_dataEvent(NULL), m_spaceEvent(NULL), m_header(nullptr), m_data(nullptr),
+          m_recordPos(0), m_recordRemaining(0), m_recordEnd(0) {}
+
+    ~SharedRing() {
+        if (m_header) UnmapViewOfFile(m_header);
+        if (m_mapping) CloseHandle(m_mapping);
+        if (m_dataEvent) CloseHandle(m_dataEvent);
+        if (m_spaceEvent) CloseHandle(m_spaceEvent);
+    }
+
+    // Host side: a fresh ring under a random name in this logon session
+    bool Create(uint32_t capacity) {
+        std::random_device rd;
+        snprintf(m_name, sizeof(m_name), "Local\\RemoteDesktop-%lu-%08x%08x",
+                 (unsigned long)GetCurrentProcessId(), (unsigned)rd(), (unsigned)rd());
+
+        uint64_t total = (uint64_t)DATA_OFFSET + capacity;
+        m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                       (DWORD)(total >> 32), (DWORD)total, m_name);
+        if (!m_mapping || !OpenEvents(true)) return false;
+        if (!Map()) return false;
+
+        new (m_header) SharedRingHeader();
+        m_header->capacity = capacity;
+        m_header->writePos.store(0);
+        m_header->readPos.store(0);
+        m_header->writerWaiting.store(0);
+        m_header->readerWaiting.store(0);
+        m_header->closed.store(0);
+        m_header->magic = SHARED_RING_MAGIC;
+        return true;
+    }
+
+    // Viewer side: the ring named in the host's offer
+    bool Open(const char* name, uint32_t capacity) {
+        snprintf(m_name, sizeof(m_name), "%s", name);
+        m_mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, m_name);
+        if (!m_mapping || !OpenEvents(false) || !Map()) return false;
+        return m_header->magic == SHARED_RING_MAGIC && m_header->capacity == capacity;
+    }
+
+    const char* Name() const { return m_name; }
+    uint32_t Capacity() const { return m_header->capacity; }
+    bool Closed() const { return m_header->closed.load() != 0; }
+
+    void Close() {
+        m_header->closed.store(1);
+        SetEvent(m_dataEvent);
+        SetEvent(m_spaceEvent);
+    }
+
+    // Writer: append the slices as one or more records. `alive` is
+    // polled while the ring is full.
+    template <typename Alive>
+    bool Write(const IoSlice* slices, int count, Alive alive) {
+        uint32_t capacity = m_header->capacity;
+        size_t maxRecord = capacity / 2 - 8;
+        size_t total = 0;
+        for (int i = 0; i < count; ++i) total += slices[i].size;
+
+        int slice = 0;
+        size_t sliceOffset = 0;
+        while (total > 0) {
+            size_t chunk = std::min(total, maxRecord);
+            uint64_t recordSize = 8 + ((chunk + 7) & ~(size_t)7);
+            uint64_t writePos = m_header->writePos.load(std::memory_order_relaxed);
+            uint64_t untilEnd = capacity - (writePos % capacity);
+            uint64_t needed = recordSize + (untilEnd < recordSize ? untilEnd : 0);
+            if (!WaitForSpace(writePos, needed, alive)) return false;
+
+            if (untilEnd < recordSize) {
+                uint32_t wrap = WRAP;
+                memcpy(m_data + writePos % capacity, &wrap, sizeof(wrap));
+                writePos += untilEnd;
+            }
+            unsigned char* out = m_data + writePos % capacity;
+            uint32_t length = (uint32_t)chunk;
+            memcpy(out, &length, sizeof(length));
+            out += 8;
+            for (size_t left = chunk; left > 0;) {
+                size_t n = std::min(left, slices[slice].size - sliceOffset);
+                memcpy(out, static_cast<const unsigned char*>(slices[slice].data) + sliceOffset, n);
+                out += n;
+                left -= n;
+                sliceOffset += n;
+                if (sliceOffset == slices[slice].size) {
+                    slice++;
+                    sliceOffset = 0;
+                }
+            }
+            while (slice < count && slices[slice].size == 0) slice++;
+
+            m_header->writePos.store(writePos + recordSize, std::memory_order_release);
+            if (m_header->readerWaiting.load()) SetEvent(m_dataEvent);
+            total -= chunk;
+        }
+        return true;
+    }
+
+    // Reader: copy the next `size` bytes of the stream
+    template <typename Alive>
+    bool Read(void* data, size_t size, Alive alive) {
+        unsigned char* out = static_cast<unsigned char*>(data);
+        while (size > 0) {
+            if (!m_recordRemaining && !NextRecord(alive)) return false;
+            size_t n = std::min(size, m_recordRemaining);
+            memcpy(out, m_data + m_recordPos, n);
+            out += n;
+            size -= n;
+            m_recordPos += n;
+            m_recordRemaining -= n;
+        }
+        return true;
+    }
+
+    // Reader: the next `size` bytes in place, if the current record holds
+    // them all. Valid until the next Read or ReadInPlace.
+    template <typename Alive>
+    const void* ReadInPlace(size_t size, Alive alive) {
+        if (!m_recordRemaining && !NextRecord(alive)) return nullptr;
+        if (m_recordRemaining < size) return nullptr;
+        const void* data = m_data + m_recordPos;
+        m_recordPos += size;
+        m_recordRemaining -= size;
+        return data;
+    }
+
+    // Reader: 1 when data is ready, 0 on timeout, -1 once the ring is closed
+    int WaitReadable(int timeoutMs) {
+        if (m_recordRemaining) return 1;
+        if (Available()) return 1;
+        if (Closed()) return -1;
+        m_header->readerWaiting.store(1);
+        if (!Available() && !Closed()) WaitForSingleObject(m_dataEvent, timeoutMs);
+        m_header->readerWaiting.store(0);
+        if (Available()) return 1;
+        return Closed() ? -1 : 0;
+    }
+
+    template <typename Alive>
+    bool PeekByte(uint8_t& byte, Alive alive) {
+        if (!m_recordRemaining && !NextRecord(alive)) return false;
+        byte = m_data[m_recordPos];
+        return true;
+    }
+
+private:
+    bool OpenEvents(bool create) {
+        char name[96];
+        snprintf(name, sizeof(name), "%s-data", m_name);
+        m_dataEvent = create ? CreateEventA(NULL, FALSE, FALSE, name)
+                             : OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, name);
+        snprintf(name, sizeof(name), "%s-space", m_name);
+        m_spaceEvent = create ? CreateEventA(NULL, FALSE, FALSE, name)
+                              : OpenEventA(EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, name);
+        return m_dataEvent && m_spaceEvent;
+    }
+
+    bool Map() {
+        void* view = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        if (!view) return false;
+        m_header = static_cast<SharedRingHeader*>(view);
+        m_data = static_cast<unsigned char*>(view) + DATA_OFFSET;
+        return true;
+    }
+
+    // Reader: a record past the one last consumed has been written
+    bool Available() const {
+        return m_header->writePos.load(std::memory_order_acquire) != m_recordEnd;
+    }
+
+    template <typename Alive>
+    bool WaitForSpace(uint64_t writePos, uint64_t needed, Alive alive) {
+        for (;;) {
+            if (Closed()) return false;
+            if (m_header->capacity - (writePos - m_header->readPos.load(std::memory_order_acquire)) >= needed) {
+                return true;
+            }
+            m_header->writerWaiting.store(1);
+            if (m_header->capacity - (writePos - m_header->readPos.load()) < needed && !Closed()) {
+                WaitForSingleObject(m_spaceEvent, SHARED_RING_WAIT);
+            }
+            m_header->writerWaiting.store(0);
+            if (!alive()) return false;
+        }
+    }
+
+    // Release the finished record and step to the start of the next one
+    template <typename Alive>
+    bool NextRecord(Alive alive) {
+        uint32_t capacity = m_header->capacity;
+        if (m_recordEnd != m_header->readPos.load(std::memory_order_relaxed)) {
+            m_header->readPos.store(m_recordEnd, std::memory_order_release);
+            if (m_header->writerWaiting.load()) SetEvent(m_spaceEvent);
+        }
+        for (;;) {
+            int ready = WaitReadable(SHARED_RING_WAIT);
+            if (ready < 0) return false;
+            if (ready == 0) {
+                if (!alive()) return false;
+                continue;
+            }
+
+            uint64_t readPos = m_header->readPos.load(std::memory_order_relaxed);
+            uint32_t length;
+            memcpy(&length, m_data + readPos % capacity, sizeof(length));
+            if (length == WRAP) {
+                readPos += capacity - readPos % capacity;
+                m_header->readPos.store(readPos, std::memory_order_release);
+                m_recordEnd = readPos;
+                continue;
+            }
+            m_recordPos = readPos % capacity + 8;
+            m_recordRemaining = length;
+            m_recordEnd = readPos + 8 + ((length + 7) & ~(uint64_t)7);
+            return true;
+        }
+    }
+
+    char m_name[64];
+    HANDLE m_mapping;
+    HANDLE m_dataEvent;
+    HANDLE m_spaceEvent;
+    SharedRingHeader* m_header;
+    unsigned char* m_data;
+
+    // Reader position inside the current record
+    size_t m_recordPos;
+    size_t m_recordRemaining;
+    uint64_t m_recordEnd;
+};
+
+// A TCP transport with one direction moved onto a shared ring: the host
+// sends through its ring, the viewer receives from it. Everything else,
+// and the liveness check, stays on the socket.
+class LocalTransport : public Transport {
+public:
+    LocalTransport(std::shared_ptr<Transport> link, std::unique_ptr<SharedRing> ring, bool sendThroughRing)
+        : m_link(std::move(link)), m_ring(std::move(ring)), m_sendThroughRing(sendThroughRing) {}
+
+    bool Send(const IoSlice* slices, int count) override {
+        if (!m_sendThroughRing) return m_link->Send(slices, count);
+        return m_ring->Write(slices, count, []() { return true; });
+    }
+
+    bool Receive(void* data, size_t size) override {
+        if (m_sendThroughRing) return m_link->Receive(data, size);
+        return m_ring->Read(data, size, [this]() { return LinkAlive(); });
+    }
+
+    const void* ReceiveInPlace(size_t size) override {
+        if (m_sendThroughRing) return m_link->ReceiveInPlace(size);
+        return m_ring->ReadInPlace(size, [this]() { return LinkAlive(); });
+    }
+
+    int WaitReadable(int timeoutMs) override {
+        if (m_sendThroughRing) return m_link->WaitReadable(timeoutMs);
+        int ready = m_ring->WaitReadable(timeoutMs);
+        return ready == 0 && !LinkAlive() ? -1 : ready;
+    }
+
+    bool Peek(uint8_t& byte) override {
+        if (m_sendThroughRing) return m_link->Peek(byte);
+        return m_ring->PeekByte(byte, [this]() { return LinkAlive(); });
+    }
+
+    void Maintain() override { m_link->Maintain(); }
+
+    void Shutdown() override {
+        m_ring->Close();
+        m_link->Shutdown();
+    }
+
+    const char* Name() const override { return "Shared memory"; }
+
+    std::string Status() const override {
+        return std::to_string(m_ring->Capacity() >> 20) + " MB ring, input over " + m_link->Name();
+    }
+
+private:
+    // The socket carries nothing towards the ring's reader once the ring
+    // is up, so anything readable there means the host has gone
+    bool LinkAlive() { return m_link->WaitReadable(0) == 0; }
+
+    std::shared_ptr<Transport> m_link;
+    std::unique_ptr<SharedRing> m_ring;
+    bool m_sendThroughRing;
+};
+
+#endif // LOCAL_TRANSPORT_H
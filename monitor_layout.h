@@ -0,0 +1,116 @@
+// ===== monitor_layout.h =====
+// Monitors as streams. The host numbers its monitors, primary first and
+// then left to right, and every frame message carries the stream id of
+// the monitor it belongs to, so all of them share one connection. The
+// viewer subscribes to the streams it shows (one monitor or all) and
+// draws each shown monitor on its canvas where it sits on the host's
+// virtual desktop, scaled so the shown area fills the canvas.
+//
+// Platform neutral: the host enumerates monitors and the viewer paints
+// with Win32 around these helpers.
+#ifndef MONITOR_LAYOUT_H
+#define MONITOR_LAYOUT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "dirty_tiles.h"
+#include "protocol.h"
+
+// Host: primary first, then by position; at most MAX_STREAMS of them,
+// numbered in that order
+inline void NumberMonitors(std::vector<MonitorDescriptor>& monitors) {
+    std::stable_sort(monitors.begin(), monitors.end(), [](const MonitorDescriptor& a, const MonitorDescriptor& b) {
+        if (a.primary != b.primary) return a.primary > b.primary;
+        return a.x != b.x ? a.x < b.x : a.y < b.y;
+    });
+    if (monitors.size() > MAX_STREAMS) monitors.resize(MAX_STREAMS);
+    for (size_t i = 0; i < monitors.size(); ++i) {
+        monitors[i].streamId = static_cast<uint8_t>(i);
+    }
+}
+
+// Bit n of a SubscribeEvent mask asks for stream n
+inline bool StreamSubscribed(uint32_t mask, uint8_t streamId) {
+    return streamId < MAX_STREAMS && ((mask >> streamId) & 1) != 0;
+}
+
+// The mask a viewer showing one stream, or all of them for a negative
+// `viewStream`, subscribes with
+inline uint32_t SubscriptionMask(int viewStream) {
+    return viewStream < 0 || viewStream >= MAX_STREAMS ? static_cast<uint32_t>(ALL_STREAMS) : 1u << viewStream;
+}
+
+// Whether an UpdateRequest (or a repair) for `requested` covers the stream
+inline bool StreamRequested(uint8_t requested, uint8_t streamId) {
+    return requested == UPDATE_ALL_STREAMS || requested == streamId;
+}
+
+// Viewer: the descriptors of a MSG_MONITOR_LIST payload; false if the
+// list is empty, too long, cut short or uses a stream id twice
+inline bool ParseMonitorList(const unsigned char* payload, size_t length, std::vector<MonitorDescriptor>& monitors) {
+    MonitorList list;
+    if (length < sizeof(list)) return false;
+    memcpy(&list, payload, sizeof(list));
+    if (list.count == 0 || list.count > MAX_STREAMS ||
+        length < sizeof(MonitorList) + list.count * sizeof(MonitorDescriptor)) {
+        return false;
+    }
+    monitors.resize(list.count);
+    memcpy(monitors.data(), payload + sizeof(MonitorList), list.count * sizeof(MonitorDescriptor));
+    uint32_t seen = 0;
+    for (const MonitorDescriptor& monitor : monitors) {
+        if (monitor.streamId >= MAX_STREAMS || ((seen >> monitor.streamId) & 1)) return false;
+        seen |= 1u << monitor.streamId;
+    }
+    return true;
+}
+
+// Whether the viewer draws a stream: `viewStream`, or every one if negative
+inline bool StreamShown(int viewStream, uint8_t streamId) {
+    return viewStream < 0 || viewStream == streamId;
+}
+
+// A monitor's bounds on the virtual desktop
+inline TileRect MonitorArea(const MonitorDescriptor& monitor) {
+    TileRect area = {monitor.x, monitor.y, static_cast<int>(monitor.width), static_cast<int>(monitor.height)};
+    return area;
+}
+
+// Smallest area holding both; an area of zero width counts as empty
+inline TileRect BoundingArea(const TileRect& a, const TileRect& b) {
+    if (a.width <= 0) return b;
+    if (b.width <= 0) return a;
+    int left = std::min(a.x, b.x), top = std::min(a.y, b.y);
+    int right = std::max(a.x + a.width, b.x + b.width), bottom = std::max(a.y + a.height, b.y + b.height);
+    TileRect area = {left, top, right - left, bottom - top};
+    return area;
+}
+
+// The desktop area `view` stretched over a canvas of `canvasWidth` x
+// `canvasHeight`: where desktop point (x, y) is drawn
+inline void DesktopToCanvas(const TileRect& view, int canvasWidth, int canvasHeight, int x, int y, int& canvasX,
+                            int& canvasY) {
+    canvasX = view.width > 0 ? static_cast<int>(static_cast<int64_t>(x - view.x) * canvasWidth / view.width) : 0;
+    canvasY = view.height > 0 ? static_cast<int>(static_cast<int64_t>(y - view.y) * canvasHeight / view.height) : 0;
+}
+
+// And back: the desktop point under a canvas point, e.g. for mouse input
+inline void CanvasToDesktop(const TileRect& view, int canvasWidth, int canvasHeight, int canvasX, int canvasY, int& x,
+                            int& y) {
+    x = view.x + (canvasWidth > 0 ? static_cast<int>(static_cast<int64_t>(canvasX) * view.width / canvasWidth) : 0);
+    y = view.y + (canvasHeight > 0 ? static_cast<int>(static_cast<int64_t>(canvasY) * view.height / canvasHeight) : 0);
+}
+
+// Where a desktop area (a monitor) is drawn on the canvas
+inline TileRect CanvasPlacement(const TileRect& view, int canvasWidth, int canvasHeight, const TileRect& area) {
+    int left, top, right, bottom;
+    DesktopToCanvas(view, canvasWidth, canvasHeight, area.x, area.y, left, top);
+    DesktopToCanvas(view, canvasWidth, canvasHeight, area.x + area.width, area.y + area.height, right, bottom);
+    TileRect placement = {left, top, right - left, bottom - top};
+    return placement;
+}
+
+#endif // MONITOR_LAYOUT_H
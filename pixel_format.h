@@ -0,0 +1,196 @@
+// ===== pixel_format.h =====
+// Pixel format descriptions and converters for raw frames.
+//
+// Each format has a PixelTraits specialization that loads a pixel as
+// 0x00RRGGBB and stores one back, so ConvertPixels<From, To> compiles to a
+// tight per-row loop with no per-pixel format switch. Identical formats are
+// copied row by row. ConvertFrame dispatches at runtime for negotiated
+// formats. Preview frames are box-filtered down by a power of two and
+// blown back up on the viewer.
+#ifndef PIXEL_FORMAT_H
+#define PIXEL_FORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "protocol.h"
+
+constexpr int BytesPerPixel(int format) {
+    return format == PIXEL_FORMAT_BGRA32 ? 4 :
+           format == PIXEL_FORMAT_BGR24 ? 3 :
+           format == PIXEL_FORMAT_RGB565 ? 2 :
+           format == PIXEL_FORMAT_PALETTE8 || format == PIXEL_FORMAT_GRAY8 ? 1 : 0;
+}
+
+// Bytes per row, rounded up to `alignment` (a power of two; BMP rows use 4)
+constexpr size_t RowStride(int format, int width, size_t alignment = 1) {
+    return (static_cast<size_t>(width) * BytesPerPixel(format) + alignment - 1) & ~(alignment - 1);
+}
+
+template <int Format> struct PixelTraits;
+
+template <> struct PixelTraits<PIXEL_FORMAT_BGRA32> {
+    static constexpr int kBytes = 4;
+    static uint32_t Load(const unsigned char* p) {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value & 0x00FFFFFF;
+    }
+    static void Store(unsigned char* p, uint32_t rgb) {
+        uint32_t value = rgb | 0xFF000000;
+        memcpy(p, &value, sizeof(value));
+    }
+};
+
+template <> struct PixelTraits<PIXEL_FORMAT_BGR24> {
+    static constexpr int kBytes = 3;
+    static uint32_t Load(const unsigned char* p) {
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16);
+    }
+    static void Store(unsigned char* p, uint32_t rgb) {
+        p[0] = static_cast<unsigned char>(rgb);
+        p[1] = static_cast<unsigned char>(rgb >> 8);
+        p[2] = static_cast<unsigned char>(rgb >> 16);
+    }
+};
+
+template <> struct PixelTraits<PIXEL_FORMAT_RGB565> {
+    static constexpr int kBytes = 2;
+    static uint32_t Load(const unsigned char* p) {
+        uint32_t v = static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8);
+        // Replicate the high bits so white expands to 0xFF, not 0xF8
+        uint32_t r = (v >> 11) & 0x1F, g = (v >> 5) & 0x3F, b = v & 0x1F;
+        r = (r << 3) | (r >> 2);
+        g = (g << 2) | (g >> 4);
+        b = (b << 3) | (b >> 2);
+        return (r << 16) | (g << 8) | b;
+    }
+    static void Store(unsigned char* p, uint32_t rgb) {
+        uint32_t v = ((rgb >> 8) & 0xF800) | ((rgb >> 5) & 0x07E0) | ((rgb >> 3) & 0x001F);
+        p[0] = static_cast<unsigned char>(v);
+        p[1] = static_cast<unsigned char>(v >> 8);
+    }
+};
+
+// BT.601 luma in 8.8 fixed point; expands back to equal R, G and B
+inline uint32_t Luma(uint32_t rgb) {
+    return (((rgb >> 16) & 0xFF) * 77 + ((rgb >> 8) & 0xFF) * 150 + (rgb & 0xFF) * 29) >> 8;
+}
+
+template <> struct PixelTraits<PIXEL_FORMAT_GRAY8> {
+    static constexpr int kBytes = 1;
+    static uint32_t Load(const unsigned char* p) { return p[0] * 0x010101u; }
+    static void Store(unsigned char* p, uint32_t rgb) { p[0] = static_cast<unsigned char>(Luma(rgb)); }
+};
+
+static_assert(PixelTraits<PIXEL_FORMAT_BGRA32>::kBytes == BytesPerPixel(PIXEL_FORMAT_BGRA32), "BGRA32 size");
+static_assert(PixelTraits<PIXEL_FORMAT_BGR24>::kBytes == BytesPerPixel(PIXEL_FORMAT_BGR24), "BGR24 size");
+static_assert(PixelTraits<PIXEL_FORMAT_RGB565>::kBytes == BytesPerPixel(PIXEL_FORMAT_RGB565), "RGB565 size");
+static_assert(PixelTraits<PIXEL_FORMAT_GRAY8>::kBytes == BytesPerPixel(PIXEL_FORMAT_GRAY8), "GRAY8 size");
+
+// Convert `height` rows of `width` pixels. With `flip` the first source
+// row becomes the last destination row (bottom-up <-> top-down).
+template <int From, int To>
+void ConvertPixels(const unsigned char* src, size_t srcStride, unsigned char* dst, size_t dstStride,
+                   int width, int height, bool flip) {
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* in = src + static_cast<size_t>(y) * srcStride;
+        unsigned char* out = dst + static_cast<size_t>(flip ? height - 1 - y : y) * dstStride;
+        if (From == To) {
+            memcpy(out, in, static_cast<size_t>(width) * PixelTraits<From>::kBytes);
+            continue;
+        }
+        for (int x = 0; x < width; ++x) {
+            PixelTraits<To>::Store(out, PixelTraits<From>::Load(in));
+            in += PixelTraits<From>::kBytes;
+            out += PixelTraits<To>::kBytes;
+        }
+    }
+}
+
+template <int From>
+bool ConvertFrom(const unsigned char* src, size_t srcStride, unsigned char* dst, size_t dstStride,
+                 int dstFormat, int width, int height, bool flip) {
+    switch (dstFormat) {
+        case PIXEL_FORMAT_BGRA32: ConvertPixels<From, PIXEL_FORMAT_BGRA32>(src, srcStride, dst, dstStride, width, height, flip); return true;
+        case PIXEL_FORMAT_BGR24: ConvertPixels<From, PIXEL_FORMAT_BGR24>(src, srcStride, dst, dstStride, width, height, flip); return true;
+        case PIXEL_FORMAT_RGB565: ConvertPixels<From, PIXEL_FORMAT_RGB565>(src, srcStride, dst, dstStride, width, height, flip); return true;
+        case PIXEL_FORMAT_GRAY8: ConvertPixels<From, PIXEL_FORMAT_GRAY8>(src, srcStride, dst, dstStride, width, height, flip); return true;
+    }
+    return false;
+}
+
+// Runtime dispatch for formats picked during negotiation. Returns false
+// for unknown formats and for PALETTE8, which needs its palette
+// (see color_depth.h).
+inline bool ConvertFrame(int srcFormat, const unsigned char* src, size_t srcStride,
+                         int dstFormat, unsigned char* dst, size_t dstStride,
+                         int width, int height, bool flip) {
+    switch (srcFormat) {
+        case PIXEL_FORMAT_BGRA32: return ConvertFrom<PIXEL_FORMAT_BGRA32>(src, srcStride, dst, dstStride, dstFormat, width, height, flip);
+        case PIXEL_FORMAT_BGR24: return ConvertFrom<PIXEL_FORMAT_BGR24>(src, srcStride, dst, dstStride, dstFormat, width, height, flip);
+        case PIXEL_FORMAT_RGB565: return ConvertFrom<PIXEL_FORMAT_RGB565>(src, srcStride, dst, dstStride, dstFormat, width, height, flip);
+        case PIXEL_FORMAT_GRAY8: return ConvertFrom<PIXEL_FORMAT_GRAY8>(src, srcStride, dst, dstStride, dstFormat, width, height, flip);
+    }
+    return false;
+}
+
+// Pixels along one side of an area of `size` pixels shrunk by 1 << scale
+constexpr int ScaledSize(int size, int scale) {
+    return (size + (1 << scale) - 1) >> scale;
+}
+
+// Average each (1 << scale)-pixel square of BGRA rows into one BGRA pixel;
+// squares on the right and bottom edges may be partial
+inline void DownscaleBGRA(const unsigned char* src, size_t srcStride, int width, int height, int scale,
+                          unsigned char* dst, size_t dstStride) {
+    int block = 1 << scale;
+    for (int by = 0; by < ScaledSize(height, scale); ++by) {
+        int y0 = by * block;
+        int rows = height - y0 < block ? height - y0 : block;
+        unsigned char* out = dst + static_cast<size_t>(by) * dstStride;
+        for (int bx = 0; bx < ScaledSize(width, scale); ++bx) {
+            int x0 = bx * block;
+            int columns = width - x0 < block ? width - x0 : block;
+            uint32_t sum[3] = {0, 0, 0};
+            for (int y = 0; y < rows; ++y) {
+                const unsigned char* in = src + static_cast<size_t>(y0 + y) * srcStride + static_cast<size_t>(x0) * 4;
+                for (int x = 0; x < columns; ++x, in += 4) {
+                    sum[0] += in[0];
+                    sum[1] += in[1];
+                    sum[2] += in[2];
+                }
+            }
+            uint32_t count = static_cast<uint32_t>(rows * columns);
+            out[bx * 4 + 0] = static_cast<unsigned char>((sum[0] + count / 2) / count);
+            out[bx * 4 + 1] = static_cast<unsigned char>((sum[1] + count / 2) / count);
+            out[bx * 4 + 2] = static_cast<unsigned char>((sum[2] + count / 2) / count);
+            out[bx * 4 + 3] = 0xFF;
+        }
+    }
+}
+
+// Viewer side: draw downscaled pixels over a `width` x `height` BGRA area,
+// each one as a (1 << scale)-pixel square
+inline bool ExpandScaled(int format, const unsigned char* src, size_t srcStride, int scale,
+                         int width, int height, unsigned char* dst, size_t dstStride) {
+    int block = 1 << scale;
+    std::vector<unsigned char> row(static_cast<size_t>(ScaledSize(width, scale)) * 4);
+    for (int by = 0; by < ScaledSize(height, scale); ++by) {
+        if (!ConvertFrame(format, src + static_cast<size_t>(by) * srcStride, srcStride, PIXEL_FORMAT_BGRA32,
+                          row.data(), row.size(), ScaledSize(width, scale), 1, false)) {
+            return false;
+        }
+        for (int y = by * block; y < height && y < (by + 1) * block; ++y) {
+            unsigned char* out = dst + static_cast<size_t>(y) * dstStride;
+            for (int x = 0; x < width; ++x) {
+                memcpy(out + static_cast<size_t>(x) * 4, &row[static_cast<size_t>(x >> scale) * 4], 4);
+            }
+        }
+    }
+    return true;
+}
+
+#endif // PIXEL_FORMAT_H
@@ -0,0 +1,136 @@
+// ===== plane_batch.h =====
+// Tile batches encoded on the encoder pool, ready to go out as one
+// MSG_RAW_FRAME per rectangle: bit plane passes (PackPlanes) and exact
+// tiles (predictive or QOI). Each rectangle gets a RawFrame header, and
+// the encoded bytes of all of them are packed back to back in send order.
+//
+// `Capture` is anything with Pixels(), Stride(), Width() and Height() over
+// top-down BGRA rows, like the host's ScreenCapture. Buffers keep their
+// capacity across frames, so a warmed-up batch does not allocate.
+#ifndef PLANE_BATCH_H
+#define PLANE_BATCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "predictive_codec.h"
+#include "progressive.h"
+#include "protocol.h"
+#include "qoi_codec.h"
+#include "thread_pool.h"
+
+struct PlaneBatch {
+    struct Task {
+        size_t job;
+        int x;          // tile column inside the job's rectangle
+        int width;
+        size_t offset;  // byte offset of that column in each packed row
+    };
+    std::vector<RawFrame> headers;
+    std::vector<size_t> offsets;
+    std::vector<Task> tasks;
+    std::vector<unsigned char> data;
+
+    // Room for every tile of a frame, so no later batch has to grow
+    void Reserve(size_t tiles, size_t bytes) {
+        headers.reserve(tiles);
+        offsets.reserve(tiles);
+        tasks.reserve(tiles);
+        data.reserve(bytes);
+    }
+};
+
+// Pack every job on the pool, one task per tile. A tile column is 64
+// pixels, a whole number of bytes in every pass, so tasks write their own
+// byte ranges of the shared rows.
+template <typename Capture, typename Job>
+void EncodePlaneBatch(WorkStealingPool& pool, const Capture& capture, uint8_t streamId, const std::vector<Job>& jobs,
+                      PlaneBatch& batch) {
+    batch.headers.resize(jobs.size());
+    batch.offsets.resize(jobs.size());
+    batch.tasks.clear();
+
+    size_t total = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const TileRect& rect = jobs[i].rect;
+        RawFrame& rawFrame = batch.headers[i];
+        rawFrame = RawFrame();
+        rawFrame.streamId = streamId;
+        rawFrame.format = static_cast<uint8_t>(jobs[i].format);
+        rawFrame.screenWidth = static_cast<uint16_t>(capture.Width());
+        rawFrame.screenHeight = static_cast<uint16_t>(capture.Height());
+        rawFrame.x = static_cast<uint16_t>(rect.x);
+        rawFrame.y = static_cast<uint16_t>(rect.y);
+        rawFrame.width = static_cast<uint16_t>(rect.width);
+        rawFrame.height = static_cast<uint16_t>(rect.height);
+        rawFrame.stride = static_cast<uint32_t>(PlaneRowBytes(jobs[i].format, rect.width));
+        rawFrame.dataSize = rawFrame.stride * rect.height;
+        batch.offsets[i] = total;
+        total += rawFrame.dataSize;
+
+        for (int x = 0; x < rect.width; x += TILE_SIZE) {
+            PlaneBatch::Task task = {i, x, std::min(TILE_SIZE, rect.width - x), PlaneRowBytes(jobs[i].format, x)};
+            batch.tasks.push_back(task);
+        }
+    }
+    batch.data.resize(total);
+
+    pool.ParallelFor(batch.tasks.size(), [&capture, &batch](size_t t) {
+        const PlaneBatch::Task& task = batch.tasks[t];
+        const RawFrame& rawFrame = batch.headers[task.job];
+        PackPlanes(rawFrame.format,
+                   capture.Pixels() + static_cast<size_t>(rawFrame.y) * capture.Stride() +
+                       static_cast<size_t>(rawFrame.x + task.x) * 4,
+                   capture.Stride(), task.width, rawFrame.height,
+                   batch.data.data() + batch.offsets[task.job] + task.offset, rawFrame.stride);
+    });
+}
+
+// Encode tiles exact on the pool: TILE_PREDICTIVE with one predictive
+// encoder (with its scratch buffers) per pool thread, or TILE_QOI, which
+// needs none. Each tile gets a slot of its largest size and is sent at
+// the size it came out.
+template <typename Capture>
+void EncodeExactBatch(WorkStealingPool& pool, const Capture& capture, uint8_t streamId, int format,
+                      const std::vector<TileRect>& tiles, std::vector<PredictiveEncoder>& encoders, PlaneBatch& batch) {
+    batch.headers.resize(tiles.size());
+    batch.offsets.resize(tiles.size());
+    batch.tasks.clear();
+
+    size_t total = 0;
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        const TileRect& tile = tiles[i];
+        RawFrame& rawFrame = batch.headers[i];
+        rawFrame = RawFrame();
+        rawFrame.streamId = streamId;
+        rawFrame.format = static_cast<uint8_t>(format);
+        rawFrame.screenWidth = static_cast<uint16_t>(capture.Width());
+        rawFrame.screenHeight = static_cast<uint16_t>(capture.Height());
+        rawFrame.x = static_cast<uint16_t>(tile.x);
+        rawFrame.y = static_cast<uint16_t>(tile.y);
+        rawFrame.width = static_cast<uint16_t>(tile.width);
+        rawFrame.height = static_cast<uint16_t>(tile.height);
+        batch.offsets[i] = total;
+        total += format == TILE_QOI ? QoiMaxSize(tile.width, tile.height) : PredictiveMaxSize(tile.width, tile.height);
+    }
+    batch.data.resize(total);
+    if (tiles.empty()) return;
+
+    std::atomic<size_t> next(0);
+    pool.ParallelFor(pool.ThreadCount(), [&capture, format, &tiles, &encoders, &batch, &next](size_t worker) {
+        for (size_t i = next++; i < tiles.size(); i = next++) {
+            const TileRect& tile = tiles[i];
+            const unsigned char* pixels =
+                capture.Pixels() + static_cast<size_t>(tile.y) * capture.Stride() + static_cast<size_t>(tile.x) * 4;
+            unsigned char* out = batch.data.data() + batch.offsets[i];
+            batch.headers[i].dataSize = static_cast<uint32_t>(
+                format == TILE_QOI ? QoiEncode(pixels, capture.Stride(), tile.width, tile.height, out)
+                                   : encoders[worker].Encode(pixels, capture.Stride(), tile.width, tile.height, out));
+        }
+    });
+}
+
+#endif // PLANE_BATCH_H
@@ -0,0 +1,698 @@
+// ===== predictive_codec.h =====
+// Lossless codec for tiles of text and UI (TILE_PREDICTIVE raw frames).
+//
+// Pixels are decorrelated with the reversible subtract-green transform
+// (G, B - G, R - G, modulo 256) and each channel is predicted by the
+// LOCO-I median edge detector from its left, upper and upper-left
+// neighbors. The prediction errors, folded to 0..255, are Huffman coded
+// with one canonical code per channel. Pixels predicted exactly in all
+// three channels are coded as runs, using extra symbols of the green
+// code, so flat background costs next to nothing.
+//
+// Payload: one mode byte. PREDICTIVE_STORED is followed by BGR24 rows.
+// PREDICTIVE_CODED is followed by one bit stream, most significant bit
+// first: the code lengths of the green (256 + PREDICTIVE_RUN_CLASSES
+// symbols), blue and red codes, each as 4-bit lengths where a zero is
+// followed by 4 bits counting further zeros; then, in raster order, per
+// pixel the green, blue and red symbols, or a run symbol 256 + k with k
+// extra bits: a run of (1 << k) + extra exactly predicted pixels.
+// PREDICTIVE_SHARED is followed by a table id byte and the same bit
+// stream without the code lengths: the codes are those of a
+// PredictiveTable both ends already hold, used when that comes out
+// smaller than sending the tile's own codes.
+// Pixels outside the tile count as zero for prediction.
+#ifndef PREDICTIVE_CODEC_H
+#define PREDICTIVE_CODEC_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PREDICTIVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define PREDICTIVE_STORED 0
+#define PREDICTIVE_CODED 1
+#define PREDICTIVE_SHARED 2
+#define PREDICTIVE_RUN_CLASSES 16      // runs up to 65535 pixels per symbol
+#define PREDICTIVE_MAX_CODE 15         // longest Huffman code, bits
+#define PREDICTIVE_LOOKUP_BITS 10      // codes up to this long decode with one table lookup
+#define PREDICTIVE_TABLES 33           // shared table ids: 0 trained offline, 1 + stream id built from recent tiles
+#define PREDICTIVE_MAX_SHARED 2        // shared tables an encoder tries per tile
+#define PREDICTIVE_TABLE_BYTES ((256 + PREDICTIVE_RUN_CLASSES + 256 + 256) / 2) // packed 4-bit lengths
+
+// Largest payload for a width x height area
+inline size_t PredictiveMaxSize(int width, int height) {
+    return 1 + static_cast<size_t>(width) * height * 3;
+}
+
+namespace predictive_detail {
+
+const int kAlphabet[3] = {256 + PREDICTIVE_RUN_CLASSES, 256, 256};
+
+inline uint8_t Med(uint8_t a, uint8_t b, uint8_t c) {
+    uint8_t low = std::min(a, b), high = std::max(a, b);
+    if (c >= high) return low;
+    if (c <= low) return high;
+    return static_cast<uint8_t>(a + b - c);
+}
+
+// Prediction error modulo 256 folded so small errors get small symbols
+inline int Fold(uint8_t error) { return error < 128 ? 2 * error : 2 * (256 - error) - 1; }
+inline uint8_t Unfold(int symbol) {
+    return static_cast<uint8_t>((symbol & 1) ? 256 - (symbol + 1) / 2 : symbol / 2);
+}
+
+// Huffman code lengths for `count` symbols, limited to PREDICTIVE_MAX_CODE
+inline void BuildLengths(const uint32_t* frequencies, int count, uint8_t* lengths) {
+    uint32_t weights[1024];
+    int parents[1024];
+    int order[512];
+    uint32_t scaled[512];
+    for (int i = 0; i < count; ++i) scaled[i] = frequencies[i];
+    while (true) {
+        int leaves = 0;
+        for (int i = 0; i < count; ++i) {
+            lengths[i] = 0;
+            if (scaled[i]) order[leaves++] = i;
+        }
+        if (leaves == 0) return;
+        if (leaves == 1) {
+            lengths[order[0]] = 1;
+            return;
+        }
+        std::sort(order, order + leaves, [&scaled](int a, int b) {
+            return scaled[a] != scaled[b] ? scaled[a] < scaled[b] : a < b;
+        });
+
+        // Two queues: sorted leaves, and internal nodes in creation order
+        for (int i = 0; i < leaves; ++i) weights[i] = scaled[order[i]];
+        int nextLeaf = 0, nextNode = leaves, nodes = leaves;
+        auto takeSmallest = [&]() {
+            if (nextLeaf < leaves && (nextNode == nodes || weights[nextLeaf] <= weights[nextNode])) return nextLeaf++;
+            return nextNode++;
+        };
+        while (nodes < 2 * leaves - 1) {
+            int first = takeSmallest(), second = takeSmallest();
+            weights[nodes] = weights[first] + weights[second];
+            parents[first] = parents[second] = nodes;
+            nodes++;
+        }
+        int depth[1024];
+        depth[nodes - 1] = 0;
+        int longest = 0;
+        for (int node = nodes - 2; node >= 0; --node) {
+            depth[node] = depth[parents[node]] + 1;
+            if (node < leaves) longest = std::max(longest, depth[node]);
+        }
+        if (longest <= PREDICTIVE_MAX_CODE) {
+            for (int i = 0; i < leaves; ++i) lengths[order[i]] = static_cast<uint8_t>(depth[i]);
+            return;
+        }
+        // Flatten the distribution and try again
+        for (int i = 0; i < count; ++i) {
+            if (scaled[i]) scaled[i] = (scaled[i] >> 1) | 1;
+        }
+    }
+}
+
+// Canonical code: shorter codes first, symbols in order within a length
+struct CanonicalCode {
+    uint16_t counts[PREDICTIVE_MAX_CODE + 1];
+    uint16_t firstCode[PREDICTIVE_MAX_CODE + 1];
+    uint16_t firstIndex[PREDICTIVE_MAX_CODE + 1];
+    uint16_t sorted[512];           // symbols by (length, symbol)
+
+    // False if the lengths oversubscribe the code space
+    bool Build(const uint8_t* lengths, int count) {
+        memset(counts, 0, sizeof(counts));
+        for (int i = 0; i < count; ++i) counts[lengths[i]]++;
+        counts[0] = 0;
+        int left = 1;
+        for (int length = 1; length <= PREDICTIVE_MAX_CODE; ++length) {
+            left = (left << 1) - counts[length];
+            if (left < 0) return false;
+        }
+        uint16_t code = 0, index = 0;
+        for (int length = 1; length <= PREDICTIVE_MAX_CODE; ++length) {
+            code = static_cast<uint16_t>((code + counts[length - 1]) << 1);
+            firstCode[length] = code;
+            firstIndex[length] = index;
+            index = static_cast<uint16_t>(index + counts[length]);
+        }
+        uint16_t next[PREDICTIVE_MAX_CODE + 1];
+        memcpy(next, firstIndex, sizeof(next));
+        for (int i = 0; i < count; ++i) {
+            if (lengths[i]) sorted[next[lengths[i]]++] = static_cast<uint16_t>(i);
+        }
+        return true;
+    }
+};
+
+// Canonical code values for `lengths`; false if they oversubscribe the code space
+inline bool AssignCodes(const uint8_t* lengths, int count, uint16_t* codes) {
+    CanonicalCode canonical = CanonicalCode();
+    if (!canonical.Build(lengths, count)) return false;
+    uint16_t next[PREDICTIVE_MAX_CODE + 1];
+    memcpy(next, canonical.firstCode, sizeof(next));
+    for (int i = 0; i < count; ++i) {
+        if (lengths[i]) codes[i] = next[lengths[i]]++;
+    }
+    return true;
+}
+
+class BitWriter {
+public:
+    BitWriter(uint8_t* out, size_t capacity) : m_out(out), m_capacity(capacity), m_size(0), m_buffer(0), m_bits(0) {}
+
+    void Put(uint32_t value, int count) {
+        m_buffer = (m_buffer << count) | (value & ((1ull << count) - 1));
+        m_bits += count;
+        while (m_bits >= 8) {
+            m_bits -= 8;
+            if (m_size < m_capacity) m_out[m_size] = static_cast<uint8_t>(m_buffer >> m_bits);
+            m_size++;
+        }
+    }
+
+    // Bytes written, or more than the capacity if it did not fit
+    size_t Finish() {
+        if (m_bits) Put(0, 8 - m_bits);
+        return m_size;
+    }
+
+    bool Full() const { return m_size > m_capacity; }
+
+private:
+    uint8_t* m_out;
+    size_t m_capacity;
+    size_t m_size;
+    uint64_t m_buffer;
+    int m_bits;
+};
+
+// Reads zeros past the end; Overrun() tells whether any were consumed
+class BitReader {
+public:
+    BitReader(const uint8_t* data, size_t size)
+        : m_data(data), m_size(size), m_position(0), m_buffer(0), m_bits(0), m_consumed(0) {}
+
+    uint32_t Peek(int count) {
+        if (m_bits < count) Refill();
+        return static_cast<uint32_t>(m_buffer >> (64 - count));
+    }
+
+    void Skip(int count) {
+        if (m_bits < count) Refill();
+        m_buffer <<= count;
+        m_bits -= count;
+        m_consumed += count;
+    }
+
+    uint32_t Get(int count) {
+        if (!count) return 0;
+        uint32_t value = Peek(count);
+        Skip(count);
+        return value;
+    }
+
+    bool Overrun() const { return m_consumed > m_size * 8; }
+
+private:
+    void Refill() {
+        while (m_bits <= 56) {
+            uint64_t byte = m_position < m_size ? m_data[m_position] : 0;
+            m_position++;
+            m_buffer |= byte << (56 - m_bits);
+            m_bits += 8;
+        }
+    }
+
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_position;
+    uint64_t m_buffer;  // next bits, most significant first
+    int m_bits;
+    size_t m_consumed;
+};
+
+} // namespace predictive_detail
+
+// Codes for every symbol of each channel, held by both ends (MSG_CODE_TABLE)
+// so tiles can leave out their own
+struct PredictiveTable {
+    uint8_t id;
+    uint8_t lengths[3][512];
+    uint16_t codes[3][512];
+
+    // From symbol counts, each raised by one so that every symbol has a code
+    void Build(const uint64_t (*counts)[512]) {
+        for (int c = 0; c < 3; ++c) {
+            int count = predictive_detail::kAlphabet[c];
+            uint64_t largest = *std::max_element(counts[c], counts[c] + count);
+            uint64_t divisor = largest / (1u << 20) + 1; // keeps tree weights in 32 bits
+            uint32_t frequencies[512];
+            for (int i = 0; i < count; ++i) frequencies[i] = static_cast<uint32_t>(counts[c][i] / divisor) + 1;
+            predictive_detail::BuildLengths(frequencies, count, lengths[c]);
+            predictive_detail::AssignCodes(lengths[c], count, codes[c]);
+        }
+    }
+
+    // PREDICTIVE_TABLE_BYTES, two lengths per byte, high nibble first
+    void Pack(unsigned char* out) const {
+        int nibble = 0;
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < predictive_detail::kAlphabet[c]; ++i, ++nibble) {
+                if (nibble & 1) out[nibble / 2] |= lengths[c][i];
+                else out[nibble / 2] = static_cast<unsigned char>(lengths[c][i] << 4);
+            }
+        }
+    }
+
+    // False unless every symbol has a code and the codes are valid
+    bool Unpack(const unsigned char* in) {
+        int nibble = 0;
+        for (int c = 0; c < 3; ++c) {
+            int count = predictive_detail::kAlphabet[c];
+            for (int i = 0; i < count; ++i, ++nibble) {
+                lengths[c][i] = static_cast<uint8_t>((nibble & 1) ? in[nibble / 2] & 15 : in[nibble / 2] >> 4);
+                if (!lengths[c][i]) return false;
+            }
+            if (!predictive_detail::AssignCodes(lengths[c], count, codes[c])) return false;
+        }
+        return true;
+    }
+};
+
+// Encoder with its scratch buffers; one per thread
+class PredictiveEncoder {
+public:
+    PredictiveEncoder() : m_extraBits(0), m_shared(), m_sharedCount(0), m_coldBytes(0) {
+        memset(m_totals, 0, sizeof(m_totals));
+    }
+
+    // Buffers for areas up to width x height, so encoding them never allocates
+    void Reserve(int width, int height) {
+        size_t stride = static_cast<size_t>(width) + 32;
+        for (int c = 0; c < 3; ++c) m_planes[c].reserve(stride * (height + 1));
+        for (int c = 0; c < 3; ++c) m_errors[c].reserve(static_cast<size_t>(width) * height);
+        m_tokens.reserve(static_cast<size_t>(width) * height);
+    }
+
+    // Encode width x height BGRA pixels into `out` (PredictiveMaxSize
+    // bytes); returns the payload size
+    size_t Encode(const unsigned char* pixels, size_t stride, int width, int height, unsigned char* out) {
+        Predict(pixels, stride, width, height);
+        Tokenize(width, height);
+
+        // The tile's own codes, or a shared table if that comes out smaller
+        for (int c = 0; c < 3; ++c) {
+            int count = predictive_detail::kAlphabet[c];
+            predictive_detail::BuildLengths(m_frequencies[c], count, m_lengths[c]);
+            predictive_detail::AssignCodes(m_lengths[c], count, m_codes[c]);
+        }
+        const PredictiveTable* shared = nullptr;
+        uint64_t bits = HeaderBits() + SymbolBits(m_lengths);
+        m_coldBytes += std::min<uint64_t>(1 + (bits + m_extraBits + 7) / 8, PredictiveMaxSize(width, height));
+        for (int i = 0; i < m_sharedCount; ++i) {
+            uint64_t sharedBits = 8 + SymbolBits(m_shared[i]->lengths);
+            if (sharedBits < bits) {
+                bits = sharedBits;
+                shared = m_shared[i];
+            }
+        }
+
+        size_t capacity = PredictiveMaxSize(width, height) - 1;
+        size_t size = shared ? 1 + Write(out + 2, capacity - 1, shared->lengths, shared->codes, false)
+                             : Write(out + 1, capacity, m_lengths, m_codes, true);
+        if (size <= capacity) {
+            out[0] = shared ? PREDICTIVE_SHARED : PREDICTIVE_CODED;
+            if (shared) out[1] = shared->id;
+            return 1 + size;
+        }
+        out[0] = PREDICTIVE_STORED;
+        unsigned char* row = out + 1;
+        for (int y = 0; y < height; ++y) {
+            const unsigned char* in = pixels + static_cast<size_t>(y) * stride;
+            for (int x = 0; x < width; ++x, in += 4, row += 3) {
+                row[0] = in[0];
+                row[1] = in[1];
+                row[2] = in[2];
+            }
+        }
+        return 1 + static_cast<size_t>(width) * height * 3;
+    }
+
+    // Tables to try for every tile, up to PREDICTIVE_MAX_SHARED; they must
+    // stay unchanged while this encoder is in use
+    void SetSharedTables(const PredictiveTable* const* tables, int count) {
+        m_sharedCount = std::min(count, PREDICTIVE_MAX_SHARED);
+        for (int i = 0; i < m_sharedCount; ++i) m_shared[i] = tables[i];
+    }
+
+    // Add the symbol counts of the tiles encoded since the last call to
+    // `counts`, and what they would have taken with their own codes only
+    // to `coldBytes`
+    void CollectStatistics(uint64_t (*counts)[512], uint64_t& coldBytes) {
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < predictive_detail::kAlphabet[c]; ++i) counts[c][i] += m_totals[c][i];
+        }
+        memset(m_totals, 0, sizeof(m_totals));
+        coldBytes += m_coldBytes;
+        m_coldBytes = 0;
+    }
+
+private:
+    // Code lengths as Write puts them in front of the symbols
+    uint64_t HeaderBits() const {
+        uint64_t bits = 0;
+        for (int c = 0; c < 3; ++c) {
+            int count = predictive_detail::kAlphabet[c];
+            for (int i = 0; i < count;) {
+                bits += 4;
+                if (m_lengths[c][i]) {
+                    i++;
+                    continue;
+                }
+                int zeros = 0;
+                while (zeros < 15 && i + 1 + zeros < count && !m_lengths[c][i + 1 + zeros]) zeros++;
+                bits += 4;
+                i += 1 + zeros;
+            }
+        }
+        return bits;
+    }
+
+    // Symbols of the tile under `lengths`; run extra bits are the same for every code
+    uint64_t SymbolBits(const uint8_t (*lengths)[512]) const {
+        uint64_t bits = 0;
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < predictive_detail::kAlphabet[c]; ++i) {
+                bits += static_cast<uint64_t>(m_frequencies[c][i]) * lengths[c][i];
+            }
+        }
+        return bits;
+    }
+
+    // Channel planes with a zero row above and a zero column left of the
+    // tile, then the prediction errors of every pixel
+    void Predict(const unsigned char* pixels, size_t stride, int width, int height) {
+        size_t planeStride = static_cast<size_t>(width) + 32;
+        for (int c = 0; c < 3; ++c) {
+            m_planes[c].assign(planeStride * (height + 1), 0);
+            m_errors[c].resize(static_cast<size_t>(width) * height);
+        }
+        for (int y = 0; y < height; ++y) {
+            const unsigned char* in = pixels + static_cast<size_t>(y) * stride;
+            uint8_t* green = &m_planes[0][(y + 1) * planeStride + 16];
+            uint8_t* blue = &m_planes[1][(y + 1) * planeStride + 16];
+            uint8_t* red = &m_planes[2][(y + 1) * planeStride + 16];
+            for (int x = 0; x < width; ++x, in += 4) {
+                green[x] = in[1];
+                blue[x] = static_cast<uint8_t>(in[0] - in[1]);
+                red[x] = static_cast<uint8_t>(in[2] - in[1]);
+            }
+        }
+        for (int c = 0; c < 3; ++c) {
+            for (int y = 0; y < height; ++y) {
+                const uint8_t* current = &m_planes[c][(y + 1) * planeStride + 16];
+                const uint8_t* above = current - planeStride;
+                uint8_t* errors = &m_errors[c][static_cast<size_t>(y) * width];
+                int x = 0;
+#ifdef PREDICTIVE_SSE2
+                // Every neighbor is known up front, so 16 pixels at a time
+                for (; x + 16 <= width; x += 16) {
+                    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current + x - 1));
+                    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x));
+                    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x - 1));
+                    __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current + x));
+                    __m128i low = _mm_min_epu8(a, b), high = _mm_max_epu8(a, b);
+                    __m128i gradient = _mm_sub_epi8(_mm_add_epi8(a, b), c);
+                    __m128i aboveHigh = _mm_cmpeq_epi8(_mm_max_epu8(c, high), c);  // c >= high
+                    __m128i belowLow = _mm_cmpeq_epi8(_mm_min_epu8(c, low), c);    // c <= low
+                    __m128i prediction = _mm_or_si128(
+                        _mm_and_si128(aboveHigh, low),
+                        _mm_andnot_si128(aboveHigh, _mm_or_si128(_mm_and_si128(belowLow, high),
+                                                                  _mm_andnot_si128(belowLow, gradient))));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(errors + x), _mm_sub_epi8(value, prediction));
+                }
+#endif
+                for (; x < width; ++x) {
+                    errors[x] = static_cast<uint8_t>(current[x] - predictive_detail::Med(current[x - 1], above[x],
+                                                                                        above[x - 1]));
+                }
+            }
+        }
+    }
+
+    // Symbols (run tokens carry their length above bit 16) and their counts
+    void Tokenize(int width, int height) {
+        for (int c = 0; c < 3; ++c) memset(m_frequencies[c], 0, sizeof(m_frequencies[c]));
+        m_tokens.clear();
+        m_extraBits = 0;
+        size_t pixels = static_cast<size_t>(width) * height;
+        uint32_t run = 0;
+        for (size_t i = 0; i <= pixels; ++i) {
+            bool exact = i < pixels && !m_errors[0][i] && !m_errors[1][i] && !m_errors[2][i];
+            if (exact && run < 0xFFFF) {
+                run++;
+                continue;
+            }
+            if (run) {
+                int runClass = 0;
+                while ((run >> (runClass + 1)) != 0) runClass++;
+                m_frequencies[0][256 + runClass]++;
+                m_extraBits += runClass;
+                m_tokens.push_back(run << 8); // top bit clear: a run, not a pixel
+                run = exact ? 1 : 0;
+                if (exact) continue;
+            }
+            if (i == pixels) break;
+            int green = predictive_detail::Fold(m_errors[0][i]);
+            int blue = predictive_detail::Fold(m_errors[1][i]);
+            int red = predictive_detail::Fold(m_errors[2][i]);
+            m_frequencies[0][green]++;
+            m_frequencies[1][blue]++;
+            m_frequencies[2][red]++;
+            m_tokens.push_back(static_cast<uint32_t>(green | (blue << 8) | (red << 16)) | 0x80000000u);
+        }
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < predictive_detail::kAlphabet[c]; ++i) m_totals[c][i] += m_frequencies[c][i];
+        }
+    }
+
+    // The symbols under the given codes, after their lengths if `header`
+    size_t Write(uint8_t* out, size_t capacity, const uint8_t (*lengths)[512], const uint16_t (*codes)[512],
+                 bool header) {
+        predictive_detail::BitWriter writer(out, capacity);
+        for (int c = 0; c < 3 && header; ++c) {
+            int count = predictive_detail::kAlphabet[c];
+            for (int i = 0; i < count;) {
+                writer.Put(lengths[c][i], 4);
+                if (lengths[c][i]) {
+                    i++;
+                    continue;
+                }
+                int zeros = 0;
+                while (zeros < 15 && i + 1 + zeros < count && !lengths[c][i + 1 + zeros]) zeros++;
+                writer.Put(static_cast<uint32_t>(zeros), 4);
+                i += 1 + zeros;
+            }
+        }
+        for (uint32_t token : m_tokens) {
+            if (writer.Full()) break;
+            if (token & 0x80000000u) {
+                for (int c = 0; c < 3; ++c) {
+                    int symbol = (token >> (8 * c)) & 0xFF;
+                    writer.Put(codes[c][symbol], lengths[c][symbol]);
+                }
+            } else {
+                uint32_t run = token >> 8;
+                int runClass = 0;
+                while ((run >> (runClass + 1)) != 0) runClass++;
+                writer.Put(codes[0][256 + runClass], lengths[0][256 + runClass]);
+                writer.Put(run - (1u << runClass), runClass);
+            }
+        }
+        return writer.Finish();
+    }
+
+    std::vector<uint8_t> m_planes[3];
+    std::vector<uint8_t> m_errors[3];
+    std::vector<uint32_t> m_tokens;
+    uint32_t m_frequencies[3][512];
+    uint8_t m_lengths[3][512];
+    uint16_t m_codes[3][512];
+    uint64_t m_extraBits;      // run lengths' extra bits in the current tile
+    const PredictiveTable* m_shared[PREDICTIVE_MAX_SHARED];
+    int m_sharedCount;
+    uint64_t m_totals[3][512]; // since CollectStatistics
+    uint64_t m_coldBytes;
+};
+
+class PredictiveDecoder {
+public:
+    PredictiveDecoder() : m_shared(PREDICTIVE_TABLES), m_sharedValid(PREDICTIVE_TABLES, false) {}
+
+    // Store shared table `id` from PREDICTIVE_TABLE_BYTES packed lengths; false if invalid
+    bool SetTable(int id, const unsigned char* packed) {
+        if (id < 0 || id >= PREDICTIVE_TABLES) return false;
+        PredictiveTable table;
+        m_sharedValid[id] = false;
+        if (!table.Unpack(packed)) return false;
+        for (int c = 0; c < 3; ++c) {
+            if (!BuildTable(table.lengths[c], c, m_shared[id])) return false;
+        }
+        m_sharedValid[id] = true;
+        return true;
+    }
+
+    // Decode a payload into width x height BGRA pixels; false if malformed
+    bool Decode(const unsigned char* data, size_t size, int width, int height, unsigned char* pixels,
+                size_t stride) {
+        if (size < 1 || width <= 0 || height <= 0) return false;
+        if (data[0] == PREDICTIVE_STORED) {
+            if (size - 1 < static_cast<size_t>(width) * height * 3) return false;
+            const unsigned char* in = data + 1;
+            for (int y = 0; y < height; ++y) {
+                unsigned char* out = pixels + static_cast<size_t>(y) * stride;
+                for (int x = 0; x < width; ++x, in += 3, out += 4) {
+                    out[0] = in[0];
+                    out[1] = in[1];
+                    out[2] = in[2];
+                    out[3] = 0xFF;
+                }
+            }
+            return true;
+        }
+        const Table* table = &m_tile;
+        size_t header = 1;
+        if (data[0] == PREDICTIVE_SHARED) {
+            if (size < 2 || data[1] >= PREDICTIVE_TABLES || !m_sharedValid[data[1]]) return false;
+            table = &m_shared[data[1]];
+            header = 2;
+        } else if (data[0] != PREDICTIVE_CODED) {
+            return false;
+        }
+
+        predictive_detail::BitReader reader(data + header, size - header);
+        for (int c = 0; c < 3 && table == &m_tile; ++c) {
+            if (!ReadCode(reader, c)) return false;
+        }
+
+        size_t rowLength = static_cast<size_t>(width) + 1;
+        m_rows.assign(rowLength * 2 * 3, 0);
+        uint32_t run = 0;
+        for (int y = 0; y < height; ++y) {
+            uint8_t* rows[3][2];
+            for (int c = 0; c < 3; ++c) {
+                rows[c][0] = &m_rows[(c * 2 + (y & 1)) * rowLength];        // this row, from index 1
+                rows[c][1] = &m_rows[(c * 2 + ((y + 1) & 1)) * rowLength];  // the row above
+            }
+            unsigned char* out = pixels + static_cast<size_t>(y) * stride;
+            for (int x = 0; x < width; ++x, out += 4) {
+                uint8_t errors[3] = {0, 0, 0};
+                if (!run) {
+                    int symbol = Symbol(reader, *table, 0);
+                    if (symbol < 0) return false;
+                    if (symbol >= 256) {
+                        int runClass = symbol - 256;
+                        run = (1u << runClass) + reader.Get(runClass);
+                    } else {
+                        errors[0] = predictive_detail::Unfold(symbol);
+                        int blue = Symbol(reader, *table, 1), red = Symbol(reader, *table, 2);
+                        if (blue < 0 || red < 0) return false;
+                        errors[1] = predictive_detail::Unfold(blue);
+                        errors[2] = predictive_detail::Unfold(red);
+                    }
+                }
+                if (run) run--;
+                uint8_t values[3];
+                for (int c = 0; c < 3; ++c) {
+                    uint8_t* current = rows[c][0];
+                    const uint8_t* above = rows[c][1];
+                    values[c] = static_cast<uint8_t>(predictive_detail::Med(current[x], above[x + 1], above[x]) +
+                                                     errors[c]);
+                    current[x + 1] = values[c];
+                }
+                out[0] = static_cast<uint8_t>(values[1] + values[0]);
+                out[1] = values[0];
+                out[2] = static_cast<uint8_t>(values[2] + values[0]);
+                out[3] = 0xFF;
+            }
+        }
+        return !reader.Overrun() && run == 0;
+    }
+
+private:
+    struct Table {
+        predictive_detail::CanonicalCode codes[3];
+        uint16_t lookup[3][1 << PREDICTIVE_LOOKUP_BITS];
+    };
+
+    bool ReadCode(predictive_detail::BitReader& reader, int c) {
+        int count = predictive_detail::kAlphabet[c];
+        uint8_t lengths[512];
+        for (int i = 0; i < count;) {
+            lengths[i] = static_cast<uint8_t>(reader.Get(4));
+            if (lengths[i]) {
+                i++;
+                continue;
+            }
+            int zeros = static_cast<int>(reader.Get(4));
+            if (i + 1 + zeros > count) return false;
+            for (int z = 1; z <= zeros; ++z) lengths[i + z] = 0;
+            i += 1 + zeros;
+        }
+        return !reader.Overrun() && BuildTable(lengths, c, m_tile);
+    }
+
+    bool BuildTable(const uint8_t* lengths, int c, Table& table) {
+        int count = predictive_detail::kAlphabet[c];
+        if (!table.codes[c].Build(lengths, count)) return false;
+
+        // Codes up to PREDICTIVE_LOOKUP_BITS long: symbol and length by table
+        uint16_t next[PREDICTIVE_MAX_CODE + 1];
+        memcpy(next, table.codes[c].firstCode, sizeof(next));
+        for (int i = 0; i < (1 << PREDICTIVE_LOOKUP_BITS); ++i) table.lookup[c][i] = 0;
+        for (int i = 0; i < count; ++i) {
+            int length = lengths[i];
+            if (!length) continue;
+            uint16_t code = next[length]++;
+            if (length > PREDICTIVE_LOOKUP_BITS) continue;
+            int shift = PREDICTIVE_LOOKUP_BITS - length;
+            for (int fill = 0; fill < (1 << shift); ++fill) {
+                table.lookup[c][(code << shift) | fill] = static_cast<uint16_t>((i << 4) | length);
+            }
+        }
+        return true;
+    }
+
+    // Next symbol of channel c's code, -1 if the bits match no code
+    static int Symbol(predictive_detail::BitReader& reader, const Table& table, int c) {
+        uint16_t entry = table.lookup[c][reader.Peek(PREDICTIVE_LOOKUP_BITS)];
+        if (entry) {
+            reader.Skip(entry & 15);
+            return entry >> 4;
+        }
+        const predictive_detail::CanonicalCode& code = table.codes[c];
+        for (int length = PREDICTIVE_LOOKUP_BITS + 1; length <= PREDICTIVE_MAX_CODE; ++length) {
+            uint32_t bits = reader.Peek(length);
+            if (bits >= code.firstCode[length] && bits - code.firstCode[length] < code.counts[length]) {
+                reader.Skip(length);
+                return code.sorted[code.firstIndex[length] + bits - code.firstCode[length]];
+            }
+        }
+        return -1;
+    }
+
+    Table m_tile;                   // codes sent with the current tile
+    std::vector<Table> m_shared;    // by table id
+    std::vector<bool> m_sharedValid;
+    std::vector<uint8_t> m_rows;
+};
+
+#endif // PREDICTIVE_CODEC_H
@@ -0,0 +1,227 @@
+// ===== progressive.h =====
+// Progressive refinement of changed screen areas.
+//
+// Changed tiles first go out as the top four bits of each channel
+// (PLANES_HIGH4, 1.5 bytes per pixel). Once a tile has stopped changing,
+// the refiner hands it out again for the middle and then the low two bits,
+// so static content converges to the exact pixels while moving content
+// only ever pays for the coarse pass. The three passes together cost the
+// same as one 24-bit frame.
+//
+// Refinement is sized by a byte budget so it only uses link capacity
+// that change updates leave free.
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "dirty_tiles.h"
+#include "protocol.h"
+
+inline int PlaneShift(int format) {
+    return format == PLANES_HIGH4 ? 4 : format == PLANES_MID2 ? 2 : 0;
+}
+
+inline int PlaneBits(int format) {
+    return format == PLANES_HIGH4 ? 4 : 2;
+}
+
+inline size_t PlaneRowBytes(int format, int width) {
+    return (static_cast<size_t>(width) * 3 * PlaneBits(format) + 7) / 8;
+}
+
+// Pack one bit plane group of B, G, R from BGRA rows
+inline void PackPlanes(int format, const unsigned char* bgra, size_t stride, int width, int height,
+                       unsigned char* out, size_t outStride) {
+    const int shift = PlaneShift(format);
+    const int bits = PlaneBits(format);
+    const uint32_t mask = (1u << bits) - 1;
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* p = bgra + static_cast<size_t>(y) * stride;
+        unsigned char* o = out + static_cast<size_t>(y) * outStride;
+        uint32_t acc = 0;
+        int count = 0;
+        for (int x = 0; x < width; ++x, p += 4) {
+            for (int c = 0; c < 3; ++c) {
+                acc |= ((p[c] >> shift) & mask) << count;
+                count += bits;
+            }
+            while (count >= 8) {
+                *o++ = static_cast<unsigned char>(acc);
+                acc >>= 8;
+                count -= 8;
+            }
+        }
+        if (count > 0) *o = static_cast<unsigned char>(acc);
+    }
+}
+
+// Merge a bit plane group into BGRA rows. Bits below the received ones
+// are set to the middle of their range until a later pass fills them.
+inline void UnpackPlanes(int format, const unsigned char* in, size_t inStride, int width, int height,
+                         unsigned char* bgra, size_t stride, bool flip) {
+    const int shift = PlaneShift(format);
+    const int bits = PlaneBits(format);
+    const uint32_t mask = (1u << bits) - 1;
+    const unsigned char keep = static_cast<unsigned char>(0xFF << (shift + bits));
+    const unsigned char fill = shift ? static_cast<unsigned char>(1 << (shift - 1)) : 0;
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* i = in + static_cast<size_t>(y) * inStride;
+        unsigned char* p = bgra + static_cast<size_t>(flip ? height - 1 - y : y) * stride;
+        uint32_t acc = 0;
+        int count = 0;
+        for (int x = 0; x < width; ++x, p += 4) {
+            for (int c = 0; c < 3; ++c) {
+                if (count < bits) {
+                    acc |= static_cast<uint32_t>(*i++) << count;
+                    count += 8;
+                }
+                p[c] = static_cast<unsigned char>((p[c] & keep) | ((acc & mask) << shift) | fill);
+                acc >>= bits;
+                count -= bits;
+            }
+            p[3] = 0xFF;
+        }
+    }
+}
+
+// Send rate of the socket, learned from sends that actually had to wait
+// for the link (fast sends only went into the socket buffer)
+class ThroughputEstimator {
+public:
+    explicit ThroughputEstimator(double initialBytesPerSecond) : m_bytesPerSecond(initialBytesPerSecond) {}
+
+    void Record(size_t bytes, std::chrono::steady_clock::duration elapsed) {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        if (seconds < 0.002 || bytes == 0) return;
+        m_bytesPerSecond = m_bytesPerSecond * 0.75 + (bytes / seconds) * 0.25;
+    }
+
+    double BytesPerSecond() const { return m_bytesPerSecond; }
+
+private:
+    double m_bytesPerSecond;
+};
+
+// Per-tile quality and age, and the choice of which tiles to refine next
+class TileRefiner {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Refinement {
+        TileRect rect;
+        int format;                // PLANES_MID2 or PLANES_LOW2
+        Clock::time_point changed; // when the tile last changed
+    };
+
+    explicit TileRefiner(int settleMs = 100) : m_settleMs(settleMs), m_width(0), m_height(0), m_columns(0), m_pending(0) {}
+
+    // Forget all tiles, e.g. after a resize or format switch
+    void Reset(int width, int height) {
+        m_width = width;
+        m_height = height;
+        m_columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+        int rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+        m_quality.assign(static_cast<size_t>(m_columns) * rows, QUALITY_EXACT);
+        m_changed.assign(m_quality.size(), Clock::time_point());
+        m_candidates.reserve(m_quality.size());
+        m_pending = 0;
+    }
+
+    // The tile was just sent as PLANES_HIGH4
+    void Changed(const TileRect& tile, Clock::time_point now) {
+        size_t index = Index(tile);
+        if (index >= m_quality.size()) return;
+        if (m_quality[index] == QUALITY_EXACT) m_pending++;
+        m_quality[index] = QUALITY_HIGH4;
+        m_changed[index] = now;
+    }
+
+    // Stop refining the tiles in `area`: they were sent exact, or a lossy
+    // stream owns them for now
+    void Discard(const TileRect& area) {
+        if (m_quality.empty() || area.width <= 0 || area.height <= 0) return;
+        int rows = static_cast<int>(m_quality.size()) / m_columns;
+        for (int ty = std::max(0, area.y / TILE_SIZE); ty <= std::min(rows - 1, (area.y + area.height - 1) / TILE_SIZE); ++ty) {
+            for (int tx = std::max(0, area.x / TILE_SIZE);
+                 tx <= std::min(m_columns - 1, (area.x + area.width - 1) / TILE_SIZE); ++tx) {
+                uint8_t& quality = m_quality[static_cast<size_t>(ty) * m_columns + tx];
+                if (quality != QUALITY_EXACT) m_pending--;
+                quality = QUALITY_EXACT;
+            }
+        }
+    }
+
+    bool HasPending() const { return m_pending > 0; }
+    int Width() const { return m_width; }
+    int Height() const { return m_height; }
+
+    // Tiles static for at least the settle time, coarsest first and then
+    // oldest first, until `byteBudget` is used. At least one tile is
+    // returned when any is ready, so refinement always makes progress.
+    void Next(Clock::time_point now, size_t byteBudget, std::vector<Refinement>& out) {
+        out.clear();
+        m_candidates.clear();
+        Clock::time_point settled = now - std::chrono::milliseconds(m_settleMs);
+        for (size_t i = 0; i < m_quality.size(); ++i) {
+            if (m_quality[i] != QUALITY_EXACT && m_changed[i] <= settled) m_candidates.push_back(i);
+        }
+        std::sort(m_candidates.begin(), m_candidates.end(), [this](size_t a, size_t b) {
+            if (m_quality[a] != m_quality[b]) return m_quality[a] < m_quality[b];
+            return m_changed[a] < m_changed[b];
+        });
+
+        size_t used = 0;
+        for (size_t index : m_candidates) {
+            Refinement refinement;
+            refinement.rect = Rect(index);
+            refinement.format = m_quality[index] == QUALITY_HIGH4 ? PLANES_MID2 : PLANES_LOW2;
+            refinement.changed = m_changed[index];
+            size_t bytes = RefinementBytes(refinement);
+            if (!out.empty() && used + bytes > byteBudget) break;
+            used += bytes;
+            out.push_back(refinement);
+
+            m_quality[index]++;
+            if (m_quality[index] == QUALITY_EXACT) m_pending--;
+        }
+    }
+
+    static size_t RefinementBytes(const Refinement& refinement) {
+        return PlaneRowBytes(refinement.format, refinement.rect.width) * refinement.rect.height;
+    }
+
+private:
+    enum { QUALITY_HIGH4 = 1, QUALITY_MID2 = 2, QUALITY_EXACT = 3 };
+
+    size_t Index(const TileRect& tile) const {
+        return static_cast<size_t>(tile.y / TILE_SIZE) * m_columns + tile.x / TILE_SIZE;
+    }
+
+    TileRect Rect(size_t index) const {
+        int x = static_cast<int>(index % m_columns) * TILE_SIZE;
+        int y = static_cast<int>(index / m_columns) * TILE_SIZE;
+        TileRect rect = {x, y, std::min(TILE_SIZE, m_width - x), std::min(TILE_SIZE, m_height - y)};
+        return rect;
+    }
+
+    const int m_settleMs;
+    int m_width;
+    int m_height;
+    int m_columns;
+    size_t m_pending;
+    std::vector<uint8_t> m_quality;
+    std::vector<Clock::time_point> m_changed;
+    std::vector<size_t> m_candidates;
+};
+
+// A rectangle and the pass to send for it
+struct PlaneJob {
+    TileRect rect;
+    int format;
+};
+
+#endif // PROGRESSIVE_H
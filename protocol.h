@@ -0,0 +1,372 @@
+// ===== protocol.h =====
+// Wire protocol shared by server.cpp and viewer.cpp
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstdint>
+
+// Viewer -> host event types (first byte of every input message)
+#define EVENT_MOUSE 1
+#define EVENT_KEYBOARD 2
+#define EVENT_TEXT 3
+#define EVENT_CAPABILITIES 4   // sent once, after screen dimensions with HANDSHAKE_TYPED set
+#define EVENT_SUBSCRIBE 5      // choose which monitor streams to receive
+#define EVENT_SET_FORMAT 6     // switch the raw frame pixel format mid-session
+#define EVENT_SHARED_MEMORY 7  // answer to MSG_SHARED_MEMORY, before any other event
+#define EVENT_DATAGRAM 8       // answer to MSG_DATAGRAM_OFFER, before any other event
+#define EVENT_DATAGRAM_LOSS 9  // DatagramLossReport followed by `count` uint32 message ids
+#define EVENT_UPDATE_REQUEST 10 // UpdateRequest: send the next update of a stream (CAP_PULL)
+
+// Text run encodings
+#define TEXT_ENCODING_UTF16 1   // little-endian UTF-16 code units
+#define TEXT_ENCODING_UTF8 2
+
+#define MAX_TEXT_RUN 4096       // code units per text message
+
+#define PROTOCOL_VERSION 2
+
+// Capability flags announced by the viewer. A viewer that sends no
+// capabilities gets the original stream of bare ScreenFrame + BMP data.
+#define CAP_CURSOR_CHANNEL 0x0001  // cursor sent as separate position/shape messages
+#define CAP_RAW_BGRA32 0x0002      // accepts MSG_RAW_FRAME in these pixel formats;
+#define CAP_RAW_BGR24 0x0004       // the host picks the widest one offered
+#define CAP_RAW_RGB565 0x0008
+#define CAP_RAW_PALETTE8 0x0010    // reduced color depths: never picked at connect,
+#define CAP_RAW_GRAY8 0x0020       // only when requested with EVENT_SET_FORMAT
+#define CAP_PROGRESSIVE 0x0040     // accepts PLANES_* refinement passes
+#define CAP_SHARED_MEMORY 0x0080   // can receive through a shared ring when on the host's machine
+#define CAP_CHUNKED 0x0100         // accepts bulk messages cut into MESSAGE_MORE pieces
+#define CAP_DATAGRAM 0x0200        // can receive MSG_RAW_FRAME messages over UDP
+#define CAP_PULL 0x0400            // paces frames itself with EVENT_UPDATE_REQUEST
+#define CAP_PREVIEW 0x0800         // accepts downscaled RawFrame previews (RawFrame::scale)
+#define CAP_VIDEO 0x1000           // accepts MSG_VIDEO_FRAME for full-screen motion
+#define CAP_PREDICTIVE 0x2000      // accepts TILE_PREDICTIVE raw frames
+#define CAP_QOI 0x4000             // accepts TILE_QOI raw frames
+#define CAP_GLYPHS 0x8000          // accepts MSG_GLYPH_FRAME and keeps a glyph cache per stream
+#define CAP_CODE_TABLES 0x10000    // accepts MSG_CODE_TABLE and PREDICTIVE_SHARED tiles
+
+// Host -> viewer message types (sessions that announced capabilities)
+#define MSG_FRAME 1             // ScreenFrame followed by image data
+#define MSG_CURSOR_POSITION 2   // CursorPosition
+#define MSG_CURSOR_SHAPE 3      // CursorShape followed by BGRA pixels
+#define MSG_MONITOR_LIST 4      // MonitorList followed by `count` MonitorDescriptor
+#define MSG_RAW_FRAME 5         // RawFrame followed by pixel rows
+#define MSG_SHARED_MEMORY 6     // SharedMemoryOffer; only ever the first message
+#define MSG_DATAGRAM_OFFER 7    // DatagramOffer; only ever the first message
+#define MSG_UPDATE_END 8        // UpdateEnd: the update asked for is complete (CAP_PULL)
+#define MSG_VIDEO_FRAME 9       // VideoFrame followed by `dataSize` bytes of coded frame (CAP_VIDEO)
+#define MSG_GLYPH_FRAME 10      // GlyphFrame followed by `dataSize` bytes of glyph data (CAP_GLYPHS)
+#define MSG_CODE_TABLE 11       // CodeTable followed by `dataSize` bytes of code lengths (CAP_CODE_TABLES)
+
+// MessageHeader flags (CAP_CHUNKED sessions). A large message may be sent
+// in pieces, each with its own header and the message's type. Only one
+// message is in pieces at a time; complete messages (flags 0) can arrive
+// between its pieces.
+#define MESSAGE_MORE 0x01       // the payload continues in a later piece
+#define MESSAGE_CONTINUED 0x02  // appends to the message in pieces
+
+// Raw frame pixel formats (little-endian)
+#define PIXEL_FORMAT_BGRA32 1   // B, G, R, unused
+#define PIXEL_FORMAT_BGR24 2    // B, G, R
+#define PIXEL_FORMAT_RGB565 3   // 5-6-5 bits, red in the high bits
+#define PIXEL_FORMAT_PALETTE8 4 // palette indices; the payload starts with the palette
+#define PIXEL_FORMAT_GRAY8 5    // luma only
+#define PIXEL_FORMAT_COUNT 6
+
+#define PALETTE_SIZE 256        // PALETTE8 palette: 256 BGRA entries before the rows
+
+// Progressive refinement passes (CAP_PROGRESSIVE), sent as RawFrame
+// formats for changed areas of full-color streams. Each pixel contributes
+// its B, G, R bits, in that order, to a little-endian bit stream; every
+// row starts on a byte boundary.
+#define PLANES_HIGH4 16         // bits 7..4, 12 bits per pixel; replaces the area
+#define PLANES_MID2 17          // bits 3..2, 6 bits per pixel; refines PLANES_HIGH4
+#define PLANES_LOW2 18          // bits 1..0, 6 bits per pixel; makes the area exact
+
+// Compressed RawFrame formats for changed areas of full-color streams;
+// `stride` is unused
+#define TILE_PREDICTIVE 20      // exact pixels, coded as described in predictive_codec.h
+#define TILE_QOI 21             // exact pixels, coded as described in qoi_codec.h; keyframes
+
+// RawFrame flags
+#define RAW_FRAME_BOTTOM_UP 0x01 // first row in the payload is the bottom one
+
+// One capture stream per monitor; stream 0 is the primary monitor
+#define MAX_STREAMS 32
+#define ALL_STREAMS 0xFFFFFFFF
+
+#define MAX_CURSOR_SIZE 256
+
+// Viewers that speak typed messages say so in the password buffer: at
+// most PASSWORD_TYPED_MAX characters, zero-filled, with HANDSHAKE_MAGIC in
+// the last four bytes. Older viewers leave zeros there, or a password too
+// long to end before them; older hosts read up to the terminator only.
+// The host answers a typed viewer with HANDSHAKE_TYPED set in the screen
+// width, and only then does the viewer send EVENT_CAPABILITIES, so
+// neither side has to guess from what arrives when.
+#define PASSWORD_TYPED_MAX 27
+#define HANDSHAKE_MAGIC 0x50544452u // "RDTP" in the last four bytes
+#define HANDSHAKE_TYPED 0x80000000u
+
+struct PasswordAuth {
+    char password[32];
+};
+
+struct MouseEvent {
+    uint8_t type;      // 1=move, 2=left_down, 3=left_up, 4=right_down, 5=right_up
+    int16_t x;
+    int16_t y;
+};
+
+struct KeyboardEvent {
+    uint8_t type;      // 1=key_down, 2=key_up
+    uint16_t keyCode;
+    uint32_t flags;
+};
+
+// Text input: followed by `length` code units in `encoding`
+// (2 bytes each for UTF-16, 1 byte each for UTF-8)
+struct TextInputEvent {
+    uint8_t encoding;
+    uint8_t reserved;
+    uint16_t length;
+};
+
+struct ClientCapabilities {
+    uint32_t version;
+    uint32_t flags;
+};
+
+// Precedes every host -> viewer message; `length` counts the payload only
+struct MessageHeader {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t length;
+};
+
+// Cursor hotspot position in host screen coordinates. The shape is
+// referenced by hash and always sent before the first position using it.
+struct CursorPosition {
+    int32_t x;
+    int32_t y;
+    uint64_t shapeHash;
+    uint8_t visible;
+    uint8_t reserved[7];
+};
+
+// Followed by width * height BGRA pixels, top-down, straight alpha
+struct CursorShape {
+    uint64_t hash;
+    uint16_t width;
+    uint16_t height;
+    uint16_t hotspotX;
+    uint16_t hotspotY;
+};
+
+struct ScreenFrame {
+    uint32_t dataSize;
+    uint32_t width;
+    uint32_t height;
+};
+
+// MSG_FRAME payload: which monitor the frame belongs to, then the frame
+struct StreamFrame {
+    uint8_t streamId;
+    uint8_t reserved[3];
+    ScreenFrame frame;
+};
+
+// MSG_RAW_FRAME payload. The pixels cover `width` x `height` at (x, y)
+// inside a monitor of screenWidth x screenHeight, one row every `stride`
+// bytes; rows may carry padding that is not part of the image. A preview
+// (scale > 0) has one pixel per (1 << scale)-pixel square of that area.
+#define PREVIEW_SCALE 3         // 1/8 size: a 1080p monitor previews in ~65 KB of RGB565
+
+struct RawFrame {
+    uint8_t streamId;
+    uint8_t format;
+    uint8_t flags;
+    uint8_t scale;
+    uint16_t screenWidth;
+    uint16_t screenHeight;
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+    uint32_t stride;
+    uint32_t dataSize;
+};
+
+// MSG_VIDEO_FRAME payload: a whole monitor coded by the inter-frame codec
+// (bitstream described in video_codec.h). Frames other than keyframes
+// build on the previous video frame of the stream; raw frames in between
+// do not count as one, so the host sends a keyframe after them.
+#define VIDEO_FRAME_KEY 0x01    // decodable on its own
+
+struct VideoFrame {
+    uint8_t streamId;
+    uint8_t flags;
+    uint8_t quantizer;      // coefficient step, in units of 16
+    uint8_t reserved;
+    uint16_t width;
+    uint16_t height;
+    uint16_t sliceCount;
+    uint16_t reserved2;
+    uint32_t dataSize;
+};
+
+// MSG_GLYPH_FRAME payload: an area of text as a background color and
+// glyphs, defined inline or taken from the stream's glyph cache (layout
+// in glyph_cache.h). Never sent as datagrams: each one builds on the cache
+// the ones before it left.
+#define GLYPH_FRAME_RESET 0x01  // empty the stream's glyph cache first
+
+struct GlyphFrame {
+    uint8_t streamId;
+    uint8_t flags;
+    uint16_t definitionCount;
+    uint16_t screenWidth;
+    uint16_t screenHeight;
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+    uint32_t background;    // B, G, R, unused
+    uint16_t placementCount;
+    uint16_t reserved;
+    uint32_t dataSize;
+};
+
+// MSG_CODE_TABLE payload: a code table predictive tiles may name instead
+// of carrying their own (PredictiveTable::Pack in predictive_codec.h).
+// Table 0 is trained offline and sent before the monitor list; table
+// 1 + streamId is rebuilt from that stream's recent tiles. Replaces any
+// earlier table with the same id. Never sent as datagrams, and always
+// before the first tile naming it.
+struct CodeTable {
+    uint8_t id;
+    uint8_t reserved[3];
+    uint32_t dataSize;      // PREDICTIVE_TABLE_BYTES
+};
+
+// Monitor bounds in virtual desktop coordinates (what mouse events use)
+struct MonitorDescriptor {
+    uint8_t streamId;
+    uint8_t primary;
+    uint16_t reserved;
+    int32_t x;
+    int32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct MonitorList {
+    uint32_t count;
+};
+
+// Bit n set = receive stream n
+struct SubscribeEvent {
+    uint32_t streamMask;
+};
+
+// CAP_PULL viewers get no frames until they ask. The host keeps
+// collecting changes meanwhile and answers with everything that changed
+// since the last update (incremental), or with the whole area. An
+// incremental request is held until something changes. A zero width
+// means the whole stream. The first update of each stream is unasked.
+#define UPDATE_ALL_STREAMS 0xFF
+
+struct UpdateRequest {
+    uint8_t streamId;       // or UPDATE_ALL_STREAMS
+    uint8_t incremental;    // 0 = resend the area even if unchanged
+    uint16_t reserved;
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+};
+
+// Ends the messages that answer one UpdateRequest for a stream. It goes
+// over TCP, so it can overtake frames still on their way over UDP: with
+// UPDATE_END_DATAGRAMS set, the update is complete once the viewer has
+// rebuilt or given up on every frame datagram message before throughId.
+#define UPDATE_END_DATAGRAMS 0x01
+
+struct UpdateEnd {
+    uint8_t streamId;
+    uint8_t flags;          // UPDATE_END_*
+    uint16_t reserved;
+    uint32_t throughId;     // first datagram message id after the update
+};
+
+// Ask for frames in a PIXEL_FORMAT_* the viewer announced; the next frame
+// of every stream is sent in full in the new format
+struct SetFormatEvent {
+    uint8_t format;
+    uint8_t reserved[3];
+};
+
+// Sent to a CAP_SHARED_MEMORY viewer connected from the host's machine.
+// If the viewer accepts, every later host -> viewer message arrives
+// through the named ring instead of the socket; input stays on the socket.
+struct SharedMemoryOffer {
+    char name[64];
+    uint32_t size;          // ring data bytes
+};
+
+struct SharedMemoryReply {
+    uint8_t accepted;
+    uint8_t reserved[3];
+};
+
+// Sent to a remote CAP_DATAGRAM viewer. If it accepts, it sends a hello
+// datagram (dataCount 0) from its UDP socket to `port`, and the host may
+// then send MSG_RAW_FRAME messages, header included, as datagrams instead
+// of over TCP. Everything else stays on TCP.
+struct DatagramOffer {
+    uint16_t port;
+    uint16_t reserved;
+    uint32_t token;         // carried by every datagram of the session
+};
+
+struct DatagramReply {
+    uint8_t accepted;
+    uint8_t reserved[3];
+};
+
+#define DATAGRAM_PAYLOAD 1200   // largest fragment, fits common path MTUs
+
+// Starts every datagram. A message of messageSize bytes is cut into
+// dataCount fragments of DATAGRAM_PAYLOAD bytes (the last one shorter).
+// Parity fragment p, numbered dataCount + p, is the XOR of data fragments
+// p * groupSize .. (p + 1) * groupSize - 1, each zero-padded to its own
+// length, so any one lost fragment of a group can be rebuilt. Host
+// datagrams with dataCount 0 carry no message: messageId is then the id
+// the next message will get, so the viewer can tell that earlier ones
+// were lost.
+struct DatagramHeader {
+    uint32_t token;
+    uint32_t messageId;     // consecutive from 0
+    uint32_t messageSize;
+    uint16_t fragment;
+    uint16_t dataCount;
+    uint8_t groupSize;
+    uint8_t reserved;
+    uint16_t length;        // bytes after this header
+};
+
+// Viewer -> host, a few times a second while datagrams arrive. The ids
+// are messages that could not be rebuilt, whose screen areas the host
+// sends again; the counters (cumulative) let it measure the loss rate.
+struct DatagramLossReport {
+    uint32_t throughId;     // every message before this one was delivered or lost
+    uint32_t received;      // datagrams that arrived for those messages
+    uint32_t recovered;     // fragments rebuilt from parity
+    uint16_t count;
+    uint16_t reserved;
+};
+
+#define MAX_LOSS_REPORT 64
+
+#endif // PROTOCOL_H
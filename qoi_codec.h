@@ -0,0 +1,144 @@
+// ===== qoi_codec.h =====
+// Single-pass lossless codec for keyframes (TILE_QOI raw frames): the
+// ops of the QOI image format, without its header and end marker, on
+// opaque pixels. Nothing is predicted beyond the previous pixel and a
+// 64-entry cache of recent colors, so encoding and decoding are a few
+// compares per pixel, and long runs of one color (most of a desktop)
+// cost one byte per 62 pixels.
+//
+// Ops, in raster order, starting from black:
+//   00iiiiii  the color cached at index i
+//   01rrggbb  r, g, b each differ from the previous pixel by -2..1 (+2 bias)
+//   10gggggg  green differs by -32..31 (+32 bias), then one byte
+//   rrrrbbbb  red - green and blue - green differences by -8..7 (+8 bias)
+//   11llllll  the previous pixel 1..62 times (l + 1)
+//   11111110  then R, G, B bytes
+// Every decoded color is cached at (r * 3 + g * 5 + b * 7 + 255 * 11) % 64.
+#ifndef QOI_CODEC_H
+#define QOI_CODEC_H
+
+#include <cstdint>
+#include <cstring>
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_MAX_RUN 62
+
+// Largest payload for a width x height area
+inline size_t QoiMaxSize(int width, int height) {
+    return static_cast<size_t>(width) * height * 4;
+}
+
+inline int QoiHash(uint8_t r, uint8_t g, uint8_t b) {
+    return (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+}
+
+// Encode width x height top-down BGRA pixels; returns the payload size
+inline size_t QoiEncode(const unsigned char* pixels, size_t stride, int width, int height, unsigned char* out) {
+    uint32_t cache[64];
+    memset(cache, 0, sizeof(cache));
+    uint32_t previous = 0;  // B, G, R in the low bytes
+    unsigned char* start = out;
+    int run = 0;
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* in = pixels + static_cast<size_t>(y) * stride;
+        for (int x = 0; x < width; ++x, in += 4) {
+            uint32_t pixel = in[0] | (in[1] << 8) | (static_cast<uint32_t>(in[2]) << 16);
+            if (pixel == previous) {
+                if (++run == QOI_MAX_RUN) {
+                    *out++ = static_cast<unsigned char>(QOI_OP_RUN | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run) {
+                *out++ = static_cast<unsigned char>(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+
+            uint8_t b = in[0], g = in[1], r = in[2];
+            int index = QoiHash(r, g, b);
+            if (cache[index] == pixel) {
+                *out++ = static_cast<unsigned char>(QOI_OP_INDEX | index);
+            } else {
+                cache[index] = pixel;
+                int dr = static_cast<int8_t>(r - static_cast<uint8_t>(previous >> 16));
+                int dg = static_cast<int8_t>(g - static_cast<uint8_t>(previous >> 8));
+                int db = static_cast<int8_t>(b - static_cast<uint8_t>(previous));
+                int drg = dr - dg, dbg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    *out++ = static_cast<unsigned char>(QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+                } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                    *out++ = static_cast<unsigned char>(QOI_OP_LUMA | (dg + 32));
+                    *out++ = static_cast<unsigned char>(((drg + 8) << 4) | (dbg + 8));
+                } else {
+                    *out++ = QOI_OP_RGB;
+                    *out++ = r;
+                    *out++ = g;
+                    *out++ = b;
+                }
+            }
+            previous = pixel;
+        }
+    }
+    if (run) *out++ = static_cast<unsigned char>(QOI_OP_RUN | (run - 1));
+    return static_cast<size_t>(out - start);
+}
+
+// Decode into width x height BGRA pixels; false if the payload is
+// malformed or does not cover the area exactly
+inline bool QoiDecode(const unsigned char* data, size_t size, int width, int height, unsigned char* pixels,
+                      size_t stride) {
+    uint32_t cache[64];
+    memset(cache, 0, sizeof(cache));
+    uint8_t r = 0, g = 0, b = 0;
+    const unsigned char* end = data + size;
+    int run = 0;
+    for (int y = 0; y < height; ++y) {
+        unsigned char* out = pixels + static_cast<size_t>(y) * stride;
+        for (int x = 0; x < width; ++x, out += 4) {
+            if (run) {
+                run--;
+            } else {
+                if (data == end) return false;
+                uint8_t op = *data++;
+                if (op == QOI_OP_RGB) {
+                    if (end - data < 3) return false;
+                    r = data[0];
+                    g = data[1];
+                    b = data[2];
+                    data += 3;
+                } else if ((op & 0xC0) == QOI_OP_INDEX) {
+                    uint32_t cached = cache[op];
+                    b = static_cast<uint8_t>(cached);
+                    g = static_cast<uint8_t>(cached >> 8);
+                    r = static_cast<uint8_t>(cached >> 16);
+                } else if ((op & 0xC0) == QOI_OP_DIFF) {
+                    r = static_cast<uint8_t>(r + ((op >> 4) & 3) - 2);
+                    g = static_cast<uint8_t>(g + ((op >> 2) & 3) - 2);
+                    b = static_cast<uint8_t>(b + (op & 3) - 2);
+                } else if ((op & 0xC0) == QOI_OP_LUMA) {
+                    if (data == end) return false;
+                    int dg = (op & 0x3F) - 32;
+                    uint8_t next = *data++;
+                    r = static_cast<uint8_t>(r + dg + (next >> 4) - 8);
+                    g = static_cast<uint8_t>(g + dg);
+                    b = static_cast<uint8_t>(b + dg + (next & 0x0F) - 8);
+                } else {
+                    run = op & 0x3F; // this pixel, then `run` more
+                }
+                cache[QoiHash(r, g, b)] = b | (g << 8) | (static_cast<uint32_t>(r) << 16);
+            }
+            out[0] = b;
+            out[1] = g;
+            out[2] = r;
+            out[3] = 0xFF;
+        }
+    }
+    return run == 0 && data == end;
+}
+
+#endif // QOI_CODEC_H
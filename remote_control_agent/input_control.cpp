@@ -2,19 +2,44 @@
 #include "input_control.h"
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include "../input_queue.h"
+
+// All simulated input goes through one injection thread, which batches
+// whatever the network thread queued into a single SendInput call
+static InputInjectionQueue& GetInputQueue() {
+    static InputInjectionQueue queue;
+    static std::once_flag started;
+    std::call_once(started, [] {
+        queue.Start(std::unique_ptr<InputInjector>(new Win32InputInjector()));
+    });
+    return queue;
+}
 
 void MoveMouse(int x, int y) {
-    SetCursorPos(x, y);
+    GetInputQueue().Enqueue(InputEvent::MouseMove(x, y));
 }
 
 void SimulateMouseClick() {
-    INPUT input[2] = {};
+    GetInputQueue().Enqueue(InputEvent::MouseButton(MOUSEEVENTF_LEFTDOWN));
+    GetInputQueue().Enqueue(InputEvent::MouseButton(MOUSEEVENTF_LEFTUP));
+}
+
+void SimulateMouseDown(uint32_t mouseFlag) {
+    GetInputQueue().Enqueue(InputEvent::MouseButton(mouseFlag));
+}
 
-    input[0].type = INPUT_MOUSE;
-    input[0].mi.dwFlags = MOUSEEVENTF_LEFTDOWN;
+void SimulateMouseUp(uint32_t mouseFlag) {
+    GetInputQueue().Enqueue(InputEvent::MouseButton(mouseFlag));
+}
 
-    input[1].type = INPUT_MOUSE;
-    input[1].mi.dwFlags = MOUSEEVENTF_LEFTUP;
+void SimulateKeyDown(uint16_t keyCode) {
+    GetInputQueue().Enqueue(InputEvent::Key(keyCode, true));
+}
 
-    SendInput(2, input, sizeof(INPUT));
-}
\ No newline at end of file
+void SimulateKeyUp(uint16_t keyCode) {
+    GetInputQueue().Enqueue(InputEvent::Key(keyCode, false));
+}
+
+void SimulateScroll(int delta) {
+    GetInputQueue().Enqueue(InputEvent::MouseWheel(delta));
+}
@@ -0,0 +1,53 @@
+// ===== send_gate.h =====
+// Priority lock for the host's outgoing stream.
+//
+// Bulk messages (frames) are written in bounded pieces and take the gate
+// once per piece; urgent messages (cursor updates) take it once. While an
+// urgent sender is waiting no bulk piece is admitted, so a cursor update
+// waits for at most one piece instead of a whole multi-megabyte frame.
+#ifndef SEND_GATE_H
+#define SEND_GATE_H
+
+#include <condition_variable>
+#include <mutex>
+
+class SendGate {
+public:
+    SendGate() : m_busy(false), m_urgentWaiting(0) {}
+
+    void Lock(bool urgent) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (urgent) m_urgentWaiting++;
+        m_released.wait(lock, [this, urgent]() { return !m_busy && (urgent || m_urgentWaiting == 0); });
+        if (urgent) m_urgentWaiting--;
+        m_busy = true;
+    }
+
+    void Unlock() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busy = false;
+        }
+        m_released.notify_all();
+    }
+
+    // Scoped hold of the gate
+    class Hold {
+    public:
+        Hold(SendGate& gate, bool urgent) : m_gate(gate) { m_gate.Lock(urgent); }
+        ~Hold() { m_gate.Unlock(); }
+
+    private:
+        Hold(const Hold&);
+        Hold& operator=(const Hold&);
+        SendGate& m_gate;
+    };
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_released;
+    bool m_busy;
+    int m_urgentWaiting;
+};
+
+#endif // SEND_GATE_H
@@ -16,6 +16,34 @@
 #include <chrono>
 #include <random>
 #include <sstream>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+
+#include "protocol.h"
+#include "text_input.h"
+#include "input_queue.h"
+#include "frame_scheduler.h"
+#include "dirty_tiles.h"
+#include "pixel_format.h"
+#include "color_depth.h"
+#include "progressive.h"
+#include "thread_pool.h"
+#include "alloc_counter.h"
+#include "local_transport.h"
+#include "send_gate.h"
+#include "datagram.h"
+#include "tile_priority.h"
+#include "video_region.h"
+#include "video_codec.h"
+#include "predictive_codec.h"
+#include "qoi_codec.h"
+#include "glyph_cache.h"
+#include "plane_batch.h"
+#include "monitor_layout.h"
+#include "session_stats.h"
 
 #pragma comment(lib, "Ws2_32.lib")
 #pragma comment(lib, "Gdi32.lib")
@@ -24,32 +52,77 @@
 #define PORT 9000
 #define FRAME_RATE 10  // Reduced FPS for better performance
 #define FRAME_INTERVAL (1000 / FRAME_RATE)
+#define BOOST_FRAME_RATE 30  // FPS while the remote user is actively giving input
+#define BOOST_FRAME_INTERVAL (1000 / BOOST_FRAME_RATE)
+#define HEARTBEAT_INTERVAL 2000  // slowest capture interval on a static screen (ms)
+#define IDLE_FRAME_THRESHOLD 5   // unchanged frames before backing off
+#define ENCODE_THREADS 0             // encoder pool size including the stream thread, 0 = all cores
+#define REFINE_TICK 50               // ms between refinement passes on idle streams
+#define REFINE_SETTLE 100            // ms a tile must be static before refinement
+#define INITIAL_THROUGHPUT (8 << 20) // bytes/s assumed until sends show otherwise
+#define WARMUP_ITERATIONS 20         // stream loop passes allowed to allocate after a reset
+#define CURSOR_POLL_INTERVAL 8   // ms between cursor position samples
+#define DATAGRAM_HISTORY 1024     // sent frame messages remembered for repairs
+#define DATAGRAM_SNDBUF (4 << 20)
+#define DATAGRAM_FALLBACK_LOSS 0.3 // loss rate that, three reports running, moves frames back to TCP
+#define TRANSPORT_MAINTAIN_INTERVAL 50 // keepalive ticks (~5 s) between transport upkeep, e.g. SO_SNDBUF
+#define CODE_TABLE_REBUILD_TILES 256   // predictive tiles between rebuilds of a stream's code table
 
 std::atomic<bool> running(true);
-std::atomic<SOCKET> clientSocket(INVALID_SOCKET);
-
-// Protocol structures
-struct PasswordAuth {
-    char password[32];
-};
+std::atomic<uint32_t> g_sessionCaps(0);   // capability flags of the current viewer
+std::atomic<bool> g_typedSession(false);  // viewer announced capabilities
+std::atomic<int> g_frameFormat(0);        // raw frame pixel format, 0 = BMP frames
+std::atomic<uint32_t> g_formatGeneration(0); // bumped on every format switch
+SendGate g_sendGate;                      // one writer at a time on the session transport
+std::mutex g_bulkMutex;                   // one bulk message in pieces at a time
+SendStats g_sendStats;                    // gather writes per message and their latency
+SessionStats g_stats;                     // reset when a viewer connects
 
-struct MouseEvent {
-    uint8_t type;      // 1=move, 2=left_down, 3=left_up, 4=right_down, 5=right_up
-    int16_t x;
-    int16_t y;
-};
-
-struct KeyboardEvent {
-    uint8_t type;      // 1=key_down, 2=key_up
-    uint16_t keyCode;
-    uint32_t flags;
+// Frame datagrams to a remote CAP_DATAGRAM viewer. The packetizer,
+// pacer and history are only touched under `mutex`.
+struct DatagramLink {
+    struct SentMessage {
+        uint32_t id;
+        uint32_t datagrams;
+        uint8_t streamId;
+        TileRect rect;
+    };
+    
+    SOCKET socket;
+    sockaddr_in peer;
+    std::mutex mutex;
+    DatagramPacketizer packetizer;
+    DatagramPacer pacer;
+    std::atomic<bool> active;       // false once frames fell back to TCP
+    SentMessage history[DATAGRAM_HISTORY];
+    uint32_t datagrams;             // sent for the message in progress
+    bool sentSinceMark;
+    uint32_t reportedId;            // messages before this one are in the loss rate
+    uint32_t reportedReceived;
+    int badReports;
+    double lossRate;
+    
+    DatagramLink(SOCKET udp, const sockaddr_in& address, uint32_t token)
+        : socket(udp), peer(address), packetizer(token), pacer(INITIAL_THROUGHPUT), active(true),
+          datagrams(0), sentSinceMark(false), reportedId(0), reportedReceived(0), badReports(0), lossRate(0) {
+        for (SentMessage& entry : history) entry.id = ~0u;
+    }
+    ~DatagramLink() { closesocket(socket); }
+    
+    // Paced sendto. A full socket buffer drops the datagram, which the
+    // viewer then reports like any other loss.
+    void Put(const unsigned char* data, size_t size) {
+        DatagramPacer::Clock::duration wait = pacer.Reserve(size);
+        if (wait > DatagramPacer::Clock::duration::zero()) std::this_thread::sleep_for(wait);
+        sendto(socket, (const char*)data, (int)size, 0, (const sockaddr*)&peer, sizeof(peer));
+    }
 };
 
-struct ScreenFrame {
-    uint32_t dataSize;
-    uint32_t width;
-    uint32_t height;
-};
+// Connection to the current viewer, null between sessions
+std::mutex g_sessionMutex;
+std::shared_ptr<Transport> g_session;
+std::shared_ptr<DatagramLink> g_datagramLink; // frames over UDP, if negotiated
+uint32_t g_sessionGeneration = 0;             // bumped by every BeginSession
 
 std::string g_serverPassword;
 
@@ -67,174 +140,1546 @@ std::string GeneratePassword() {
     return password;
 }
 
-// Helper functions
-bool SendData(SOCKET socket, const void* data, int size) {
-    if (socket == INVALID_SOCKET) return false;
-    
-    const char* ptr = static_cast<const char*>(data);
-    int totalSent = 0;
-    
-    while (totalSent < size) {
-        int sent = send(socket, ptr + totalSent, size - totalSent, 0);
-        if (sent <= 0) {
-            return false;
-        }
-        totalSent += sent;
+std::shared_ptr<Transport> CurrentSession() {
+    std::lock_guard<std::mutex> lock(g_sessionMutex);
+    return g_session;
+}
+
+// As above, with the session's generation: threads that keep per-viewer
+// state compare generations, never handles or pointers, which the next
+// viewer may reuse
+std::shared_ptr<Transport> CurrentSession(uint32_t& generation) {
+    std::lock_guard<std::mutex> lock(g_sessionMutex);
+    generation = g_sessionGeneration;
+    return g_session;
+}
+
+bool IsCurrentSession(const Transport* transport) {
+    std::lock_guard<std::mutex> lock(g_sessionMutex);
+    return g_session.get() == transport;
+}
+
+std::shared_ptr<DatagramLink> CurrentDatagramLink() {
+    std::lock_guard<std::mutex> lock(g_sessionMutex);
+    return g_datagramLink;
+}
+
+void BeginSession(const std::shared_ptr<Transport>& transport, const std::shared_ptr<DatagramLink>& datagrams) {
+    std::lock_guard<std::mutex> lock(g_sessionMutex);
+    g_session = transport;
+    g_datagramLink = datagrams;
+    g_sessionGeneration++;
+}
+
+// Drop the session if it is still the current one; blocked reads and
+// writes on its transport fail from here on
+void EndSession(Transport* transport) {
+    {
+        std::lock_guard<std::mutex> lock(g_sessionMutex);
+        if (g_session.get() != transport) return;
+        g_session.reset();
+        g_datagramLink.reset();
     }
+    transport->Shutdown();
+}
+
+// Send a MSG_RAW_FRAME message, header included, as datagrams and
+// remember which screen area it covered
+bool SendFrameDatagrams(DatagramLink& link, const IoSlice* slices, int count) {
+    const RawFrame& frame = *static_cast<const RawFrame*>(slices[1].data);
+    std::lock_guard<std::mutex> lock(link.mutex);
+    link.datagrams = 0;
+    uint32_t id = link.packetizer.Send(slices, count, [&link](const unsigned char* data, size_t size) {
+        link.datagrams++;
+        link.Put(data, size);
+    });
+    DatagramLink::SentMessage& entry = link.history[id % DATAGRAM_HISTORY];
+    entry.id = id;
+    entry.datagrams = link.datagrams;
+    entry.streamId = frame.streamId;
+    entry.rect.x = frame.x;
+    entry.rect.y = frame.y;
+    entry.rect.width = frame.width;
+    entry.rect.height = frame.height;
+    link.sentSinceMark = true;
     return true;
 }
 
-bool ReceiveData(SOCKET socket, void* data, int size) {
-    if (socket == INVALID_SOCKET) return false;
+// Tell the viewer every frame message so far was sent in full, so it
+// can give up on a lost last one without waiting for the next (caller
+// holds `link.mutex`)
+void SendDatagramMark(DatagramLink& link) {
+    link.packetizer.SendMark([&link](const unsigned char* data, size_t size) { link.Put(data, size); });
+    link.sentSinceMark = false;
+}
+
+// Cursor messages go ahead of frame data
+bool IsUrgentMessage(uint8_t type) {
+    return type == MSG_CURSOR_POSITION || type == MSG_CURSOR_SHAPE;
+}
+
+// Send one host -> viewer message: header, then up to two payload parts,
+// in a single gather write. Legacy sessions get the payload without a header.
+// Large messages to CAP_CHUNKED viewers go out in pieces, and urgent
+// messages are let in between the pieces.
+bool SendServerMessage(Transport& transport, uint8_t type, const void* part1, size_t size1,
+                       const void* part2 = nullptr, size_t size2 = 0) {
+    auto start = std::chrono::steady_clock::now();
+    size_t total = size1 + size2;
+    MessageHeader header = {type, 0, 0, static_cast<uint32_t>(total)};
+    IoSlice slices[3] = {{&header, sizeof(header)}, {part1, size1}, {part2, size2}};
+    bool typed = g_typedSession;
+    bool urgent = IsUrgentMessage(type);
     
-    char* ptr = static_cast<char*>(data);
-    int totalReceived = 0;
+    if (type == MSG_RAW_FRAME) {
+        std::shared_ptr<DatagramLink> datagrams = CurrentDatagramLink();
+        if (datagrams && datagrams->active) return SendFrameDatagrams(*datagrams, slices, 3);
+    }
+    size_t chunkSize = (g_sessionCaps.load() & CAP_CHUNKED) ? transport.ChunkSize() : 0;
     
-    while (totalReceived < size) {
-        int received = recv(socket, ptr + totalReceived, size - totalReceived, 0);
-        if (received <= 0) {
-            return false;
-        }
-        totalReceived += received;
+    if (urgent || !chunkSize || total <= chunkSize) {
+        SendGate::Hold hold(g_sendGate, urgent);
+        if (!transport.Send(typed ? slices : slices + 1, typed ? 3 : 2)) return false;
+        if (urgent) g_stats.cursorSendTime.Record(std::chrono::steady_clock::now() - start);
+        return true;
+    }
+    
+    std::lock_guard<std::mutex> bulk(g_bulkMutex);
+    SliceCursor payload(slices + 1, 2);
+    for (size_t sent = 0; sent < total;) {
+        size_t length = std::min(chunkSize, total - sent);
+        MessageHeader piece = {type, (uint8_t)((sent ? MESSAGE_CONTINUED : 0) | (sent + length < total ? MESSAGE_MORE : 0)),
+                               0, static_cast<uint32_t>(length)};
+        IoSlice pieceSlices[3] = {{&piece, sizeof(piece)}};
+        int count = 1 + payload.Take(length, pieceSlices + 1, 2);
+        
+        SendGate::Hold hold(g_sendGate, false);
+        if (!transport.Send(pieceSlices, count)) return false;
+        sent += length;
     }
     return true;
 }
 
-// Screen capture
-std::vector<unsigned char> CaptureScreenAsBMP() {
-    int screenX = GetSystemMetrics(SM_CXSCREEN);
-    int screenY = GetSystemMetrics(SM_CYSCREEN);
+// Screen capture of one monitor (virtual desktop coordinates). BitBlt
+// writes straight into a top-down 32-bit DIB section that is kept across
+// frames, so frames are hashed and sent from capture memory.
+class ScreenCapture {
+public:
+    ScreenCapture() : m_dc(NULL), m_bitmap(NULL), m_oldBitmap(NULL), m_bits(nullptr), m_width(0), m_height(0) {}
+    ~ScreenCapture() { Release(); }
 
-    HDC hScreen = GetDC(NULL);
-    HDC hDC = CreateCompatibleDC(hScreen);
-    HBITMAP hBitmap = CreateCompatibleBitmap(hScreen, screenX, screenY);
-    
-    if (!hBitmap) {
-        DeleteDC(hDC);
+    bool Capture(const RECT& area) {
+        int width = area.right - area.left;
+        int height = area.bottom - area.top;
+        if (width <= 0 || height <= 0) return false;
+
+        HDC hScreen = GetDC(NULL);
+        if (width != m_width || height != m_height || !m_bitmap) {
+            Release();
+            BITMAPINFO bmi = {};
+            bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+            bmi.bmiHeader.biWidth = width;
+            bmi.bmiHeader.biHeight = -height; // top-down
+            bmi.bmiHeader.biPlanes = 1;
+            bmi.bmiHeader.biBitCount = 32;
+            bmi.bmiHeader.biCompression = BI_RGB;
+
+            void* bits = nullptr;
+            m_bitmap = CreateDIBSection(hScreen, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+            if (!m_bitmap) {
+                ReleaseDC(NULL, hScreen);
+                return false;
+            }
+            m_dc = CreateCompatibleDC(hScreen);
+            m_oldBitmap = SelectObject(m_dc, m_bitmap);
+            m_bits = static_cast<unsigned char*>(bits);
+            m_width = width;
+            m_height = height;
+        }
+
+        BOOL copied = BitBlt(m_dc, 0, 0, width, height, hScreen, area.left, area.top, SRCCOPY);
         ReleaseDC(NULL, hScreen);
-        return {};
+        GdiFlush(); // the bits must be complete before we read them
+        return copied != FALSE;
     }
 
-    HGDIOBJ hOldBitmap = SelectObject(hDC, hBitmap);
-    BitBlt(hDC, 0, 0, screenX, screenY, hScreen, 0, 0, SRCCOPY);
+    const unsigned char* Pixels() const { return m_bits; }
+    int Width() const { return m_width; }
+    int Height() const { return m_height; }
+    size_t Stride() const { return RowStride(PIXEL_FORMAT_BGRA32, m_width); }
 
-    BITMAPINFOHEADER bi = {};
-    bi.biSize = sizeof(BITMAPINFOHEADER);
-    bi.biWidth = screenX;
-    bi.biHeight = screenY;
-    bi.biPlanes = 1;
-    bi.biBitCount = 24;
-    bi.biCompression = BI_RGB;
+private:
+    void Release() {
+        if (m_dc) {
+            SelectObject(m_dc, m_oldBitmap);
+            DeleteDC(m_dc);
+        }
+        if (m_bitmap) DeleteObject(m_bitmap);
+        m_dc = NULL;
+        m_bitmap = NULL;
+        m_oldBitmap = NULL;
+        m_bits = nullptr;
+        m_width = m_height = 0;
+    }
 
-    int rowSize = ((screenX * 3 + 3) / 4) * 4;
-    int imageSize = rowSize * screenY;
-    int fileSize = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + imageSize;
+    HDC m_dc;
+    HBITMAP m_bitmap;
+    HGDIOBJ m_oldBitmap;
+    unsigned char* m_bits;
+    int m_width;
+    int m_height;
+};
+
+template <typename Encoder>
+void EncodeRowBands(int height, Encoder encode);
+
+// 24-bit bottom-up BMP file, for viewers that predate raw frames
+void EncodeAsBMP(const ScreenCapture& capture, std::vector<unsigned char>& bmpData) {
+    int width = capture.Width();
+    int height = capture.Height();
+    size_t rowSize = RowStride(PIXEL_FORMAT_BGR24, width, 4);
+    size_t imageSize = rowSize * height;
+    size_t headerSize = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+    bmpData.assign(headerSize + imageSize, 0);
 
-    std::vector<unsigned char> bmpData(fileSize);
-    
     BITMAPFILEHEADER* fileHeader = reinterpret_cast<BITMAPFILEHEADER*>(bmpData.data());
     fileHeader->bfType = 0x4D42;
-    fileHeader->bfSize = fileSize;
-    fileHeader->bfReserved1 = 0;
-    fileHeader->bfReserved2 = 0;
-    fileHeader->bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+    fileHeader->bfSize = static_cast<DWORD>(bmpData.size());
+    fileHeader->bfOffBits = static_cast<DWORD>(headerSize);
 
     BITMAPINFOHEADER* infoHeader = reinterpret_cast<BITMAPINFOHEADER*>(bmpData.data() + sizeof(BITMAPFILEHEADER));
-    *infoHeader = bi;
-    infoHeader->biSizeImage = imageSize;
+    infoHeader->biSize = sizeof(BITMAPINFOHEADER);
+    infoHeader->biWidth = width;
+    infoHeader->biHeight = height;
+    infoHeader->biPlanes = 1;
+    infoHeader->biBitCount = 24;
+    infoHeader->biCompression = BI_RGB;
+    infoHeader->biSizeImage = static_cast<DWORD>(imageSize);
+
+    // Band [y0, y1) lands flipped at the matching rows from the bottom
+    unsigned char* image = bmpData.data() + headerSize;
+    EncodeRowBands(height, [&capture, image, rowSize, width, height](int y0, int y1) {
+        ConvertPixels<PIXEL_FORMAT_BGRA32, PIXEL_FORMAT_BGR24>(capture.Pixels() + (size_t)y0 * capture.Stride(),
+                                                               capture.Stride(), image + (size_t)(height - y1) * rowSize,
+                                                               rowSize, width, y1 - y0, true);
+    });
+}
+
+// Cursor capture: shape as straight-alpha BGRA, hashed for deduplication
+struct CursorImage {
+    uint64_t hash;
+    int width;
+    int height;
+    int hotspotX;
+    int hotspotY;
+    std::vector<uint32_t> pixels;
+};
 
-    unsigned char* pixelData = bmpData.data() + sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+bool CaptureCursorShape(HCURSOR hCursor, CursorImage& image) {
+    ICONINFO iconInfo;
+    if (!GetIconInfo(hCursor, &iconInfo)) return false;
     
-    if (!GetDIBits(hDC, hBitmap, 0, screenY, pixelData, (BITMAPINFO*)infoHeader, DIB_RGB_COLORS)) {
-        SelectObject(hDC, hOldBitmap);
-        DeleteObject(hBitmap);
-        DeleteDC(hDC);
+    BITMAP maskBitmap = {};
+    GetObjectA(iconInfo.hbmMask, sizeof(maskBitmap), &maskBitmap);
+    
+    // Monochrome cursors stack the AND mask on top of the XOR mask
+    int width = maskBitmap.bmWidth;
+    int maskHeight = maskBitmap.bmHeight;
+    int height = iconInfo.hbmColor ? maskHeight : maskHeight / 2;
+    
+    bool ok = width > 0 && height > 0 && width <= MAX_CURSOR_SIZE && height <= MAX_CURSOR_SIZE;
+    std::vector<uint32_t> color, mask;
+    
+    if (ok) {
+        HDC hScreen = GetDC(NULL);
+        BITMAPINFO bmi = {};
+        bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bmi.bmiHeader.biWidth = width;
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+        
+        mask.resize(width * maskHeight);
+        bmi.bmiHeader.biHeight = -maskHeight; // top-down
+        ok = GetDIBits(hScreen, iconInfo.hbmMask, 0, maskHeight, mask.data(), &bmi, DIB_RGB_COLORS) != 0;
+        
+        if (ok && iconInfo.hbmColor) {
+            color.resize(width * height);
+            bmi.bmiHeader.biHeight = -height;
+            ok = GetDIBits(hScreen, iconInfo.hbmColor, 0, height, color.data(), &bmi, DIB_RGB_COLORS) != 0;
+        }
         ReleaseDC(NULL, hScreen);
-        return {};
     }
+    
+    DeleteObject(iconInfo.hbmMask);
+    if (iconInfo.hbmColor) DeleteObject(iconInfo.hbmColor);
+    if (!ok) return false;
+    
+    image.width = width;
+    image.height = height;
+    image.hotspotX = iconInfo.xHotspot;
+    image.hotspotY = iconInfo.yHotspot;
+    image.pixels.resize(width * height);
+    
+    bool hasAlpha = false;
+    for (uint32_t pixel : color) {
+        if (pixel >> 24) { hasAlpha = true; break; }
+    }
+    
+    for (int i = 0; i < width * height; ++i) {
+        bool andBit = (mask[i] & 0xFFFFFF) != 0;
+        if (!color.empty()) {
+            image.pixels[i] = hasAlpha ? color[i] : (andBit ? 0 : (color[i] | 0xFF000000));
+        } else {
+            bool xorBit = (mask[i + width * height] & 0xFFFFFF) != 0;
+            if (andBit && !xorBit) image.pixels[i] = 0;                 // transparent
+            else if (!andBit && xorBit) image.pixels[i] = 0xFFFFFFFF;   // white
+            else image.pixels[i] = 0xFF000000;                          // black (inverted areas too)
+        }
+    }
+    
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint32_t dims[4] = {(uint32_t)width, (uint32_t)height, (uint32_t)image.hotspotX, (uint32_t)image.hotspotY};
+    for (uint32_t v : dims) hash = (hash ^ v) * 0x100000001b3ULL;
+    for (uint32_t v : image.pixels) hash = (hash ^ v) * 0x100000001b3ULL;
+    image.hash = hash;
+    return true;
+}
 
-    SelectObject(hDC, hOldBitmap);
-    DeleteObject(hBitmap);
-    DeleteDC(hDC);
-    ReleaseDC(NULL, hScreen);
+// Monitor enumeration; the primary monitor always becomes stream 0
+BOOL CALLBACK EnumMonitorProc(HMONITOR hMonitor, HDC, LPRECT, LPARAM data) {
+    auto* monitors = reinterpret_cast<std::vector<MonitorDescriptor>*>(data);
+    MONITORINFO info = {};
+    info.cbSize = sizeof(info);
+    if (GetMonitorInfoA(hMonitor, &info)) {
+        MonitorDescriptor monitor = {};
+        monitor.primary = (info.dwFlags & MONITORINFOF_PRIMARY) ? 1 : 0;
+        monitor.x = info.rcMonitor.left;
+        monitor.y = info.rcMonitor.top;
+        monitor.width = info.rcMonitor.right - info.rcMonitor.left;
+        monitor.height = info.rcMonitor.bottom - info.rcMonitor.top;
+        monitors->push_back(monitor);
+    }
+    return TRUE;
+}
 
-    return bmpData;
+std::vector<MonitorDescriptor> EnumerateMonitors() {
+    std::vector<MonitorDescriptor> monitors;
+    EnumDisplayMonitors(NULL, NULL, EnumMonitorProc, reinterpret_cast<LPARAM>(&monitors));
+    
+    if (monitors.empty()) {
+        MonitorDescriptor primary = {};
+        primary.primary = 1;
+        primary.width = GetSystemMetrics(SM_CXSCREEN);
+        primary.height = GetSystemMetrics(SM_CYSCREEN);
+        monitors.push_back(primary);
+    }
+    NumberMonitors(monitors);
+    return monitors;
 }
 
-// Input simulation
+// One capture stream per monitor with its own dirty tracking and rate control
+struct MonitorStream {
+    MonitorDescriptor monitor;
+    FrameScheduler scheduler;
+    std::thread thread;
+    std::mutex requestMutex;       // guards what the viewer asked for, below
+    std::vector<TileRect> repairs; // areas the viewer lost, resent with the next frame
+    uint32_t requestSerial;        // bumped by every update request (CAP_PULL)
+    bool fullUpdate;               // a pending request was not incremental
+    TileRect updateArea;           // union of the pending requests, width 0 = whole stream
+    
+    explicit MonitorStream(const MonitorDescriptor& descriptor)
+        : monitor(descriptor),
+          scheduler(FRAME_INTERVAL, BOOST_FRAME_INTERVAL, HEARTBEAT_INTERVAL, IDLE_FRAME_THRESHOLD),
+          requestSerial(0), fullUpdate(false), updateArea() {}
+};
+
+std::mutex g_streamsMutex;
+std::vector<std::unique_ptr<MonitorStream>> g_streams;
+std::atomic<uint32_t> g_subscribedStreams(1); // primary only until the viewer asks
+
+// Input simulation: events are queued here on the network thread and
+// injected in batches by the input injection thread
+InputInjectionQueue g_inputQueue;
+
 void MoveMouse(int x, int y) {
-    SetCursorPos(x, y);
+    g_inputQueue.Enqueue(InputEvent::MouseMove(x, y));
 }
 
 void SimulateMouseDown(uint32_t mouseFlag) {
-    INPUT input = {};
-    input.type = INPUT_MOUSE;
-    input.mi.dwFlags = mouseFlag;
-    SendInput(1, &input, sizeof(INPUT));
+    g_inputQueue.Enqueue(InputEvent::MouseButton(mouseFlag));
 }
 
 void SimulateMouseUp(uint32_t mouseFlag) {
-    INPUT input = {};
-    input.type = INPUT_MOUSE;
-    input.mi.dwFlags = mouseFlag;
-    SendInput(1, &input, sizeof(INPUT));
+    g_inputQueue.Enqueue(InputEvent::MouseButton(mouseFlag));
 }
 
 void SimulateKeyDown(uint16_t keyCode) {
-    INPUT input = {};
-    input.type = INPUT_KEYBOARD;
-    input.ki.wVk = keyCode;
-    input.ki.dwFlags = 0;
-    SendInput(1, &input, sizeof(INPUT));
+    g_inputQueue.Enqueue(InputEvent::Key(keyCode, true));
 }
 
 void SimulateKeyUp(uint16_t keyCode) {
-    INPUT input = {};
-    input.type = INPUT_KEYBOARD;
-    input.ki.wVk = keyCode;
-    input.ki.dwFlags = KEYEVENTF_KEYUP;
-    SendInput(1, &input, sizeof(INPUT));
+    g_inputQueue.Enqueue(InputEvent::Key(keyCode, false));
+}
+
+void SimulateTextInput(const std::u16string& text) {
+    for (char16_t unit : text) {
+        g_inputQueue.Enqueue(InputEvent::Unicode(unit));
+    }
+}
+
+void PrintInputStats() {
+    std::cout << "Input injection: " << g_inputQueue.InjectedCount() << " events in "
+              << g_inputQueue.BatchCount() << " batches, "
+              << g_inputQueue.CoalescedCount() << " moves coalesced" << std::endl;
+    std::cout << "Input latency: " << g_inputQueue.Latency().Summary() << std::endl;
+    
+    std::lock_guard<std::mutex> lock(g_streamsMutex);
+    for (auto& stream : g_streams) {
+        const FrameScheduler& scheduler = stream->scheduler;
+        if (scheduler.InputToFrame().Count() == 0) continue;
+        std::cout << "Monitor " << (int)stream->monitor.streamId << " click-to-capture: "
+                  << scheduler.InputToCapture().Summary() << std::endl;
+        std::cout << "Monitor " << (int)stream->monitor.streamId << " click-to-frame: "
+                  << scheduler.InputToFrame().Summary() << std::endl;
+        std::cout << scheduler.InputToFrame().Buckets();
+    }
+}
+
+// The viewer lost a frame message for this area: send it again from a
+// fresh capture
+void RepairStreamArea(uint8_t streamId, const TileRect& area) {
+    std::lock_guard<std::mutex> lock(g_streamsMutex);
+    for (auto& stream : g_streams) {
+        if (stream->monitor.streamId != streamId) continue;
+        {
+            std::lock_guard<std::mutex> repairLock(stream->requestMutex);
+            stream->repairs.push_back(area);
+        }
+        stream->scheduler.RequestCapture();
+    }
+}
+
+// A CAP_PULL viewer asked for the next update of one stream or all of them
+void RequestStreamUpdate(const UpdateRequest& request) {
+    std::lock_guard<std::mutex> lock(g_streamsMutex);
+    for (auto& stream : g_streams) {
+        if (!StreamRequested(request.streamId, stream->monitor.streamId)) continue;
+        std::lock_guard<std::mutex> requestLock(stream->requestMutex);
+        TileRect& area = stream->updateArea;
+        bool pending = stream->scheduler.UpdateRequested();
+        if (request.width == 0 || (pending && area.width == 0)) {
+            area = TileRect();
+        } else if (!pending) {
+            area.x = request.x;
+            area.y = request.y;
+            area.width = request.width;
+            area.height = request.height;
+        } else { // bounding box of both
+            int right = std::max(area.x + area.width, request.x + request.width);
+            int bottom = std::max(area.y + area.height, request.y + request.height);
+            area.x = std::min(area.x, (int)request.x);
+            area.y = std::min(area.y, (int)request.y);
+            area.width = right - area.x;
+            area.height = bottom - area.y;
+        }
+        stream->fullUpdate = stream->fullUpdate || !request.incremental;
+        stream->requestSerial++;
+        stream->scheduler.RequestUpdate();
+    }
 }
 
-// Screen streaming thread
-void ScreenStreamingThread() {
-    std::cout << "Screen streaming thread started" << std::endl;
+// Called by the input injection thread: expedite a capture on every monitor
+void NotifyStreamsOfInput(std::chrono::steady_clock::time_point inputTime, bool discrete) {
+    std::lock_guard<std::mutex> lock(g_streamsMutex);
+    for (auto& stream : g_streams) {
+        stream->scheduler.NotifyInput(inputTime, discrete);
+    }
+}
+
+// Capture soon on every monitor, for a reason other than input
+void RequestStreamCaptures() {
+    std::lock_guard<std::mutex> lock(g_streamsMutex);
+    for (auto& stream : g_streams) {
+        stream->scheduler.RequestCapture();
+    }
+}
+
+std::chrono::steady_clock::time_point g_connectTime; // set before the session's streams start
+
+uint64_t GetProcessCpuMicros() {
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0;
+    }
+    uint64_t kernel = ((uint64_t)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime;
+    uint64_t user = ((uint64_t)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime;
+    return (kernel + user) / 10; // 100ns units
+}
+
+void PrintStreamingStats(std::chrono::steady_clock::time_point since, uint64_t cpuMicrosAtStart,
+                         uint64_t capturedAtStart, uint64_t sentAtStart, uint64_t bytesAtStart) {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+    if (seconds <= 0) return;
     
-    auto lastFrameTime = std::chrono::steady_clock::now();
+    double cpuPercent = 100.0 * (GetProcessCpuMicros() - cpuMicrosAtStart) / (seconds * 1000000.0);
+    double bytesPerMinute = (g_stats.bytesSent.load() - bytesAtStart) * 60.0 / seconds;
     
-    while (running) {
-        SOCKET currentClient = clientSocket.load();
-        if (currentClient == INVALID_SOCKET) {
+    std::cout << "Streaming: " << (g_stats.framesCaptured.load() - capturedAtStart) << " captured, "
+              << (g_stats.framesSent.load() - sentAtStart) << " sent in " << (int)seconds << "s, "
+              << g_stats.cursorMessages.load() << " cursor messages this session, "
+              << (uint64_t)(bytesPerMinute / 1024) << " KB/min, CPU " << cpuPercent << "%, intervals";
+    
+    std::lock_guard<std::mutex> lock(g_streamsMutex);
+    uint32_t subscribed = g_subscribedStreams.load();
+    for (auto& stream : g_streams) {
+        uint8_t id = stream->monitor.streamId;
+        std::cout << " [" << (int)id << "] ";
+        if (StreamSubscribed(subscribed, id)) std::cout << stream->scheduler.CurrentIntervalMs() << "ms";
+        else std::cout << "off";
+    }
+    std::cout << std::endl;
+    g_stats.Print(std::cout);
+    std::shared_ptr<Transport> transport = CurrentSession();
+    if (transport) {
+        std::string status;
+        {
+            SendGate::Hold hold(g_sendGate, false);
+            status = transport->Status();
+        }
+        std::cout << "  " << transport->Name() << ": ";
+        if (g_sendStats.messages.load()) {
+            std::cout << g_sendStats.calls.load() << " sends for " << g_sendStats.messages.load()
+                      << " messages, send " << g_sendStats.latency.Summary() << ", ";
+        }
+        std::cout << status << std::endl;
+    }
+    std::shared_ptr<DatagramLink> datagrams = CurrentDatagramLink();
+    if (datagrams) {
+        std::lock_guard<std::mutex> linkLock(datagrams->mutex);
+        std::cout << "  UDP: " << (datagrams->active ? "frames" : "off after loss") << ", loss "
+                  << (int)(datagrams->lossRate * 100) << "%, parity 1 in " << datagrams->packetizer.GroupSize()
+                  << ", pacing " << (uint64_t)(datagrams->pacer.BytesPerSecond() / 1024) << " KB/s" << std::endl;
+    }
+}
+
+std::unique_ptr<WorkStealingPool> g_encodePool;
+
+bool SendPlaneBatch(Transport& transport, const PlaneBatch& batch, size_t& bytesSent) {
+    bytesSent = 0;
+    for (size_t i = 0; i < batch.headers.size(); ++i) {
+        const RawFrame& rawFrame = batch.headers[i];
+        if (!SendServerMessage(transport, MSG_RAW_FRAME, &rawFrame, sizeof(rawFrame),
+                               batch.data.data() + batch.offsets[i], rawFrame.dataSize)) {
+            return false;
+        }
+        bytesSent += sizeof(rawFrame) + rawFrame.dataSize;
+    }
+    return true;
+}
+
+// GlyphFrame messages stored back to back, each ending at the offset in `ends`
+bool SendGlyphFrames(Transport& transport, const std::vector<unsigned char>& data, const std::vector<size_t>& ends,
+                     size_t& bytesSent) {
+    bytesSent = 0;
+    size_t start = 0;
+    for (size_t end : ends) {
+        if (!SendServerMessage(transport, MSG_GLYPH_FRAME, data.data() + start, sizeof(GlyphFrame),
+                               data.data() + start + sizeof(GlyphFrame), end - start - sizeof(GlyphFrame))) {
+            return false;
+        }
+        bytesSent += end - start;
+        start = end;
+    }
+    return true;
+}
+
+// Predictive code tables shared with the viewer (CAP_CODE_TABLES). The
+// trained one is built from the symbol counts in the file named by
+// RD_CODE_TABLE; with RD_CODE_TABLE_TRAIN set, each session adds the
+// counts of the tiles it sent to that file, so it can be trained on real
+// desktop use. The files hold the green (with runs), blue and red counts
+// as whitespace-separated numbers.
+PredictiveTable g_trainedTable;
+bool g_hasTrainedTable = false;
+std::mutex g_trainingMutex;
+uint64_t g_trainingCounts[3][512]; // this session's, under g_trainingMutex
+
+bool ReadCodeCounts(const char* path, uint64_t (*counts)[512]) {
+    std::ifstream file(path);
+    uint64_t stored[3][512] = {};
+    for (int c = 0; c < 3; ++c) {
+        for (int i = 0; i < predictive_detail::kAlphabet[c]; ++i) {
+            if (!(file >> stored[c][i])) return false;
+        }
+    }
+    for (int c = 0; c < 3; ++c) {
+        for (int i = 0; i < 512; ++i) counts[c][i] += stored[c][i];
+    }
+    return true;
+}
+
+bool WriteCodeCounts(const char* path, const uint64_t (*counts)[512]) {
+    std::ofstream file(path, std::ios::trunc);
+    for (int c = 0; c < 3; ++c) {
+        for (int i = 0; i < predictive_detail::kAlphabet[c]; ++i) {
+            file << counts[c][i] << (i + 1 < predictive_detail::kAlphabet[c] ? ' ' : '\n');
+        }
+    }
+    return static_cast<bool>(file);
+}
+
+void LoadTrainedCodeTable() {
+    const char* path = getenv("RD_CODE_TABLE");
+    if (!path) return;
+    uint64_t counts[3][512] = {};
+    if (!ReadCodeCounts(path, counts)) {
+        std::cerr << "Cannot read code table counts from " << path << std::endl;
+        return;
+    }
+    g_trainedTable.Build(counts);
+    g_trainedTable.id = 0;
+    g_hasTrainedTable = true;
+    std::cout << "Code table trained from " << path << std::endl;
+}
+
+void AddTrainingCounts(const uint64_t (*counts)[512]) {
+    if (!getenv("RD_CODE_TABLE_TRAIN")) return;
+    std::lock_guard<std::mutex> lock(g_trainingMutex);
+    for (int c = 0; c < 3; ++c) {
+        for (int i = 0; i < 512; ++i) g_trainingCounts[c][i] += counts[c][i];
+    }
+}
+
+// Merge the session's counts into the training file (a missing one is started)
+void SaveTrainingCounts() {
+    const char* path = getenv("RD_CODE_TABLE_TRAIN");
+    if (!path) return;
+    std::lock_guard<std::mutex> lock(g_trainingMutex);
+    ReadCodeCounts(path, g_trainingCounts);
+    if (WriteCodeCounts(path, g_trainingCounts)) std::cout << "Code table counts saved to " << path << std::endl;
+    else std::cerr << "Cannot write code table counts to " << path << std::endl;
+    memset(g_trainingCounts, 0, sizeof(g_trainingCounts));
+}
+
+bool SendCodeTable(Transport& transport, const PredictiveTable& table) {
+    CodeTable header = {};
+    header.id = table.id;
+    header.dataSize = PREDICTIVE_TABLE_BYTES;
+    unsigned char packed[PREDICTIVE_TABLE_BYTES];
+    table.Pack(packed);
+    if (!SendServerMessage(transport, MSG_CODE_TABLE, &header, sizeof(header), packed, sizeof(packed))) return false;
+    g_stats.codeTablesSent++;
+    return true;
+}
+
+// Whether this session's predictive tiles may use shared code tables. Not
+// over datagrams: a tile could arrive before the table it names.
+bool CodeTablesUsable() {
+    uint32_t caps = g_sessionCaps.load();
+    return (caps & CAP_PREDICTIVE) && (caps & CAP_CODE_TABLES) && !CurrentDatagramLink();
+}
+
+// Whether this session's text tiles may go out as glyph placements. Not
+// over datagrams: glyph frames travel over TCP and tiles over UDP, so a
+// stale tile could land on top of a newer glyph frame.
+bool GlyphsUsable() {
+    uint32_t caps = g_sessionCaps.load();
+    return (caps & CAP_PREDICTIVE) && (caps & CAP_GLYPHS) && !CurrentDatagramLink();
+}
+
+// Run a row-independent encoder over bands of one tile height in parallel
+template <typename Encoder>
+void EncodeRowBands(int height, Encoder encode) {
+    size_t bands = (height + TILE_SIZE - 1) / TILE_SIZE;
+    g_encodePool->ParallelFor(bands, [height, &encode](size_t band) {
+        int y0 = (int)band * TILE_SIZE;
+        encode(y0, std::min(height, y0 + TILE_SIZE));
+    });
+}
+
+// Time-to-first-frame and time-to-full-quality, once per stream and session
+void ReportConnectMilestone(uint8_t streamId, const char* milestone) {
+    auto elapsed = std::chrono::steady_clock::now() - g_connectTime;
+    std::cout << "Monitor " << (int)streamId << ": " << milestone << " "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms after connect"
+              << std::endl;
+}
+
+// `area` of the capture in RGB565, averaged down to one pixel per
+// (1 << scale) square. Used for the preview of the whole monitor sent
+// ahead of the first full-resolution frame, and for video regions.
+bool SendScaledArea(Transport& transport, const ScreenCapture& capture, uint8_t streamId, const TileRect& area,
+                    int scale, std::vector<unsigned char>& scaled, std::vector<unsigned char>& encoded,
+                    PaletteQuantizer& quantizer, size_t& bytesSent) {
+    int width = ScaledSize(area.width, scale);
+    int height = ScaledSize(area.height, scale);
+    const unsigned char* pixels = capture.Pixels() + (size_t)area.y * capture.Stride() + (size_t)area.x * 4;
+    size_t stride = capture.Stride();
+    if (scale) {
+        scaled.resize((size_t)width * height * 4);
+        DownscaleBGRA(pixels, stride, area.width, area.height, scale, scaled.data(), (size_t)width * 4);
+        pixels = scaled.data();
+        stride = (size_t)width * 4;
+    }
+    encoded.resize(EncodedFrameSize(PIXEL_FORMAT_RGB565, width, height));
+    EncodeFrame(PIXEL_FORMAT_RGB565, pixels, stride, width, height, encoded.data(), quantizer);
+    
+    RawFrame rawFrame = {};
+    rawFrame.streamId = streamId;
+    rawFrame.format = PIXEL_FORMAT_RGB565;
+    rawFrame.scale = (uint8_t)scale;
+    rawFrame.screenWidth = (uint16_t)capture.Width();
+    rawFrame.screenHeight = (uint16_t)capture.Height();
+    rawFrame.x = (uint16_t)area.x;
+    rawFrame.y = (uint16_t)area.y;
+    rawFrame.width = (uint16_t)area.width;
+    rawFrame.height = (uint16_t)area.height;
+    rawFrame.stride = (uint32_t)RowStride(PIXEL_FORMAT_RGB565, width);
+    rawFrame.dataSize = (uint32_t)encoded.size();
+    bytesSent += sizeof(rawFrame) + encoded.size();
+    return SendServerMessage(transport, MSG_RAW_FRAME, &rawFrame, sizeof(rawFrame), encoded.data(), encoded.size());
+}
+
+// Full-resolution tiles as separate raw frames, in the order given.
+// Used for the first frame so the area around the cursor arrives first.
+bool SendRawTiles(Transport& transport, const ScreenCapture& capture, uint8_t streamId, int format,
+                  const std::vector<TileRect>& tiles, std::vector<unsigned char>& encoded,
+                  PaletteQuantizer& quantizer, size_t& bytesSent) {
+    for (const TileRect& tile : tiles) {
+        RawFrame rawFrame = {};
+        rawFrame.streamId = streamId;
+        rawFrame.format = (uint8_t)format;
+        rawFrame.screenWidth = (uint16_t)capture.Width();
+        rawFrame.screenHeight = (uint16_t)capture.Height();
+        rawFrame.x = (uint16_t)tile.x;
+        rawFrame.y = (uint16_t)tile.y;
+        rawFrame.width = (uint16_t)tile.width;
+        rawFrame.height = (uint16_t)tile.height;
+        
+        // Every format, BGRA32 included, is packed at the tile's own width so
+        // a tile never carries the rest of the screen row
+        const unsigned char* pixels = capture.Pixels() + (size_t)tile.y * capture.Stride() + (size_t)tile.x * 4;
+        encoded.resize(EncodedFrameSize(format, tile.width, tile.height));
+        EncodeFrame(format, pixels, capture.Stride(), tile.width, tile.height, encoded.data(), quantizer);
+        rawFrame.stride = (uint32_t)RowStride(format, tile.width);
+        rawFrame.dataSize = (uint32_t)encoded.size();
+        if (!SendServerMessage(transport, MSG_RAW_FRAME, &rawFrame, sizeof(rawFrame), encoded.data(), encoded.size())) {
+            return false;
+        }
+        bytesSent += sizeof(rawFrame) + rawFrame.dataSize;
+    }
+    return true;
+}
+
+// Take note of the pending update request a capture is about to answer
+uint32_t ClaimUpdate(MonitorStream* stream) {
+    std::lock_guard<std::mutex> lock(stream->requestMutex);
+    return stream->requestSerial;
+}
+
+// A pull-mode update is out: tell the viewer, and wait for its next
+// request unless one arrived after `claimed`
+bool FinishUpdate(MonitorStream* stream, Transport& transport, uint32_t claimed) {
+    {
+        std::lock_guard<std::mutex> lock(stream->requestMutex);
+        if (stream->requestSerial == claimed) {
+            stream->updateArea = TileRect();
+            stream->scheduler.UpdateDelivered();
+        }
+    }
+    UpdateEnd end = {stream->monitor.streamId, 0, 0, 0};
+    std::shared_ptr<DatagramLink> datagrams = CurrentDatagramLink();
+    if (datagrams && datagrams->active) {
+        // The end goes over TCP; the viewer waits for the frames before it on UDP
+        std::lock_guard<std::mutex> lock(datagrams->mutex);
+        end.flags = UPDATE_END_DATAGRAMS;
+        end.throughId = datagrams->packetizer.NextId();
+        SendDatagramMark(*datagrams);
+    }
+    return SendServerMessage(transport, MSG_UPDATE_END, &end, sizeof(end));
+}
+
+// Screen streaming thread, one per monitor for the lifetime of a session
+void MonitorStreamingThread(MonitorStream* stream, std::shared_ptr<Transport> transport) {
+    const MonitorDescriptor& monitor = stream->monitor;
+    RECT area = {monitor.x, monitor.y, (LONG)(monitor.x + monitor.width), (LONG)(monitor.y + monitor.height)};
+    
+    ScreenCapture capture;
+    DirtyTileTracker tileTracker;
+    std::vector<unsigned char> bmpData;   // reused across frames
+    std::vector<unsigned char> encoded;
+    PaletteQuantizer quantizer;
+    uint32_t formatGeneration = g_formatGeneration.load();
+    bool wasSubscribed = false;
+    
+    TileRefiner refiner(REFINE_SETTLE);
+    ThroughputEstimator throughput(INITIAL_THROUGHPUT);
+    std::vector<TileRect> runs;
+    std::vector<TileRect> deferredTiles;
+    TilePrioritizer prioritizer;
+    std::vector<TileRect> repairs;
+    repairs.reserve(DATAGRAM_HISTORY);
+    std::vector<TileRect> requestedTiles;
+    
+    // A playing video is detected and sent on its own as lossy RGB565, at
+    // the capture rate and downscaled as far as the link needs; the rest
+    // of the screen stays lossless (progressive sessions only)
+    VideoRegionDetector videoDetector;
+    bool videoActive = false;
+    TileRect videoRegion = {};
+    int videoScale = 1;
+    std::vector<TileRect> uiTiles;
+    std::vector<unsigned char> scaled;
+    bool videoCapable = (g_sessionCaps.load() & CAP_PREVIEW) && (g_sessionCaps.load() & CAP_RAW_RGB565);
+    
+    // Streams that are mostly full-screen motion switch to the inter-frame
+    // codec if the viewer takes it
+    FullMotionSwitch fullMotion;
+    VideoEncoder videoEncoder;
+    std::vector<unsigned char> codedFrame;
+    bool codecCapable = (g_sessionCaps.load() & CAP_VIDEO) != 0;
+    bool wasMotion = false;
+    bool pull = (g_sessionCaps.load() & CAP_PULL) != 0; // viewer-paced
+    
+    // The first frame of a session takes a fast path: a small preview,
+    // then full-resolution tiles nearest the cursor first
+    bool firstFrame = true;
+    bool awaitingFullQuality = false;
+    std::vector<TileRect> firstTiles;
+    std::vector<PlaneJob> coarseJobs;
+    
+    // Text and UI tiles skip the coarse pass and go out exact, compressed
+    // by the predictive codec, if the viewer takes it
+    bool predictive = (g_sessionCaps.load() & CAP_PREDICTIVE) != 0;
+    std::vector<TileRect> exactTiles;
+    PlaneBatch exactBatch;
+    std::vector<PredictiveEncoder> predictiveEncoders(predictive ? g_encodePool->ThreadCount() : 0);
+    for (PredictiveEncoder& encoder : predictiveEncoders) encoder.Reserve(TILE_SIZE, TILE_SIZE);
+    
+    // Predictive tiles may name a code table the viewer holds instead of
+    // carrying their own codes: the trained one, sent at connect, and one
+    // rebuilt every CODE_TABLE_REBUILD_TILES tiles from this stream's recent
+    // tiles, sent when it changes
+    bool codeTables = predictive && CodeTablesUsable();
+    const PredictiveTable* sharedTables[PREDICTIVE_MAX_SHARED];
+    int sharedCount = 0;
+    if (codeTables && g_hasTrainedTable) sharedTables[sharedCount++] = &g_trainedTable;
+    PredictiveTable recentTable = {};
+    recentTable.id = (uint8_t)(1 + monitor.streamId);
+    bool recentTableSent = false;
+    uint64_t recentCounts[3][512] = {};
+    uint64_t tileCounts[3][512];
+    size_t tilesSinceTable = 0;
+    for (PredictiveEncoder& encoder : predictiveEncoders) encoder.SetSharedTables(sharedTables, sharedCount);
+    
+    // A frame in which every tile changed is a keyframe: it goes out whole
+    // and exact, QOI-coded in bands of one tile row, the band under the
+    // cursor first, if the viewer takes it
+    bool qoiCapable = (g_sessionCaps.load() & CAP_QOI) != 0;
+    std::vector<TileRect> keyBands;
+    PlaneBatch keyBatch;
+    
+    // Of the text tiles, areas whose glyphs repeat go out as placements of
+    // glyphs the viewer has cached (viewers that take predictive tiles too)
+    bool glyphs = predictive && GlyphsUsable();
+    GlyphEncoder glyphEncoder;
+    std::vector<unsigned char> glyphData;  // GlyphFrame messages, back to back
+    std::vector<size_t> glyphEnds;
+    if (glyphs) glyphEncoder.Reserve(PRIORITY_RUN_TILES * TILE_SIZE * TILE_SIZE);
+    std::vector<TileRefiner::Refinement> refinements;
+    PlaneBatch planeBatch;
+    bool refinerValid = false;
+    
+    // Buffers above are kept for the whole session; after a warm-up no
+    // pass of this loop touches the heap (checked in allocation-counting builds)
+    SteadyStateCheck allocationCheck("Monitor stream", WARMUP_ITERATIONS);
+    
+    while (running && IsCurrentSession(transport.get())) {
+        allocationCheck.Checkpoint();
+        
+        // Monitors nobody is looking at are neither captured nor encoded
+        if (!StreamSubscribed(g_subscribedStreams.load(), monitor.streamId)) {
+            wasSubscribed = false;
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
             continue;
         }
         
-        auto currentTime = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-            currentTime - lastFrameTime).count();
+        // A new subscription or pixel format always starts with a full frame
+        if (!wasSubscribed || formatGeneration != g_formatGeneration.load()) {
+            tileTracker.Invalidate();
+            formatGeneration = g_formatGeneration.load();
+            wasSubscribed = true;
+            refinerValid = false;
+            videoEncoder.ForceKeyframe();
+            allocationCheck.Rearm();
+        }
+        
+        // Full-color streams send changes coarse first, then refine tiles
+        // that have gone static in the time between frames
+        int format = g_frameFormat.load();
+        bool progressive = (g_sessionCaps.load() & CAP_PROGRESSIVE) &&
+                           (format == PIXEL_FORMAT_BGRA32 || format == PIXEL_FORMAT_BGR24);
+        
+        // Sleeps until the frame interval elapses or input expedites a capture.
+        // Pull-mode viewers also get refinements only when they ask.
+        if (progressive && refinerValid && refiner.HasPending() && stream->scheduler.UpdateRequested()) {
+            auto now = std::chrono::steady_clock::now();
+            if (!stream->scheduler.WaitForNextFrame(now + std::chrono::milliseconds(REFINE_TICK))) {
+                now = std::chrono::steady_clock::now();
+                size_t budget = (size_t)(throughput.BytesPerSecond() * REFINE_TICK / 1000.0);
+                refiner.Next(now, budget, refinements);
+                
+                size_t refineBytes = 0;
+                uint32_t claimed = ClaimUpdate(stream);
+                EncodePlaneBatch(*g_encodePool, capture, monitor.streamId, refinements, planeBatch);
+                auto sendStart = std::chrono::steady_clock::now();
+                if (!SendPlaneBatch(*transport, planeBatch, refineBytes) ||
+                    (pull && !refinements.empty() && !FinishUpdate(stream, *transport, claimed))) {
+                    std::cout << "Failed to send refinement, client disconnected" << std::endl;
+                    EndSession(transport.get());
+                    break;
+                }
+                auto sendEnd = std::chrono::steady_clock::now();
+                throughput.Record(refineBytes, sendEnd - sendStart);
+                for (const TileRefiner::Refinement& refinement : refinements) {
+                    if (refinement.format == PLANES_LOW2) g_stats.changeToExact.Record(sendEnd - refinement.changed);
+                }
+                g_stats.bytesSent += refineBytes;
+                g_stats.refinementBytes += refineBytes;
+                if (awaitingFullQuality && !refiner.HasPending()) {
+                    ReportConnectMilestone(monitor.streamId, "full quality");
+                    awaitingFullQuality = false;
+                }
+                continue;
+            }
+        } else {
+            stream->scheduler.WaitForNextFrame();
+        }
+        if (!running || !IsCurrentSession(transport.get())) break;
+        
+        // Lost areas are sent again; a full update request resends its area
+        uint32_t claimed;
+        bool fullUpdate;
+        TileRect requestArea;
+        {
+            std::lock_guard<std::mutex> lock(stream->requestMutex);
+            repairs.swap(stream->repairs);
+            claimed = stream->requestSerial;
+            fullUpdate = stream->fullUpdate;
+            stream->fullUpdate = false;
+            requestArea = stream->updateArea;
+        }
+        for (const TileRect& repair : repairs) tileTracker.InvalidateArea(repair);
+        repairs.clear();
+        if (fullUpdate) {
+            if (requestArea.width) tileTracker.InvalidateArea(requestArea);
+            else tileTracker.Invalidate();
+            videoEncoder.ForceKeyframe();
+        }
+        
+        FrameScheduler::FrameTicket ticket = stream->scheduler.BeginFrame();
+        if (!capture.Capture(area)) continue;
+        g_stats.framesCaptured++;
+        
+        // Skip the send entirely when nothing on screen changed
+        bool changed = tileTracker.Update(capture.Pixels(), capture.Width(), capture.Height(),
+                                          (int)capture.Stride(), 4, false) > 0;
+        
+        // Full-screen motion goes to the inter-frame codec. Back on tiles,
+        // the whole screen is sent again losslessly.
+        bool motion = false;
+        if (codecCapable && format) {
+            fullMotion.Update(tileTracker.DirtyTiles().size(), (size_t)tileTracker.Columns() * tileTracker.Rows());
+            motion = fullMotion.Active();
+            if (motion != wasMotion) {
+                std::cout << "Monitor " << (int)monitor.streamId
+                          << (motion ? ": full-screen motion, using the inter-frame codec"
+                                     : ": motion stopped, back to tiles") << std::endl;
+                if (motion) {
+                    videoEncoder.ForceKeyframe();
+                } else {
+                    tileTracker.Invalidate();
+                    refinerValid = false;
+                }
+                wasMotion = motion;
+                allocationCheck.Rearm();
+            }
+        }
+        
+        // Fed unchanged frames too, so a region is released once the video stops
+        if (progressive && videoCapable && !motion) {
+            if (videoDetector.Width() != capture.Width() || videoDetector.Height() != capture.Height()) {
+                videoDetector.Reset(capture.Width(), capture.Height());
+            }
+            videoDetector.Update(tileTracker.DirtyTiles(), capture.Pixels(), capture.Stride());
+            const TileRect& region = videoDetector.Region();
+            bool moved = videoDetector.Active() && (region.x != videoRegion.x || region.y != videoRegion.y ||
+                                                    region.width != videoRegion.width ||
+                                                    region.height != videoRegion.height);
+            // What the lossy stream left behind is sent again exactly
+            if (videoActive && (!videoDetector.Active() || moved)) tileTracker.InvalidateArea(videoRegion);
+            if (videoDetector.Active() && (!videoActive || moved)) {
+                if (!videoActive) g_stats.videoRegions++;
+                std::cout << "Monitor " << (int)monitor.streamId << ": video region " << region.width << "x"
+                          << region.height << " at " << region.x << "," << region.y << std::endl;
+                allocationCheck.Rearm(); // buffers grow to the new size
+            }
+            videoActive = videoDetector.Active();
+            videoRegion = region;
+        } else if (videoActive) {
+            tileTracker.InvalidateArea(videoRegion);
+            videoActive = false;
+        }
+        stream->scheduler.SetVideoActive(videoActive || motion);
+        
+        // An update asked for one area: changes elsewhere stay dirty for later
+        const std::vector<TileRect>* dirtyTiles = &tileTracker.DirtyTiles();
+        if (changed && progressive && requestArea.width) {
+            requestedTiles.clear();
+            for (const TileRect& tile : tileTracker.DirtyTiles()) {
+                bool inside = tile.x < requestArea.x + requestArea.width && requestArea.x < tile.x + tile.width &&
+                              tile.y < requestArea.y + requestArea.height && requestArea.y < tile.y + tile.height;
+                if (inside) requestedTiles.push_back(tile);
+                else tileTracker.InvalidateArea(tile);
+            }
+            dirtyTiles = &requestedTiles;
+            changed = !requestedTiles.empty();
+        }
+        stream->scheduler.FrameResult(changed);
+        if (!changed) continue;
+        
+        // Progressive frames keep the state of every tile of the screen
+        if (progressive && !motion &&
+            (!refinerValid || refiner.Width() != capture.Width() || refiner.Height() != capture.Height())) {
+            refiner.Reset(capture.Width(), capture.Height());
+            prioritizer.Reset(capture.Width(), capture.Height());
+            refinerValid = true;
+            
+            size_t tiles = (size_t)tileTracker.Columns() * tileTracker.Rows();
+            planeBatch.Reserve(tiles, (size_t)capture.Width() * capture.Height() * 2);
+            runs.reserve(tiles);
+            deferredTiles.reserve(tiles);
+            requestedTiles.reserve(tiles);
+            uiTiles.reserve(tiles);
+            coarseJobs.reserve(tiles);
+            exactTiles.reserve(tiles);
+            if (predictive) exactBatch.Reserve(tiles, tiles * PredictiveMaxSize(TILE_SIZE, TILE_SIZE));
+            if (glyphs) {
+                glyphData.reserve((size_t)capture.Width() * capture.Height());
+                glyphEnds.reserve(tiles);
+            }
+            refinements.reserve(tiles);
+            allocationCheck.Rearm();
+        }
+        bool keyframe = qoiCapable && !motion &&
+                        (format == PIXEL_FORMAT_BGRA32 || format == PIXEL_FORMAT_BGR24) &&
+                        dirtyTiles->size() == (size_t)tileTracker.Columns() * tileTracker.Rows();
+        
+        bool sent = true;
+        size_t frameBytes = 0;
+        POINT cursor = {};
+        GetCursorPos(&cursor);
+        cursor.x -= monitor.x;
+        cursor.y -= monitor.y;
+        if (firstFrame) {
+            if (format && (g_sessionCaps.load() & CAP_PREVIEW)) {
+                TileRect whole = {0, 0, capture.Width(), capture.Height()};
+                if (!SendScaledArea(*transport, capture, monitor.streamId, whole, PREVIEW_SCALE, scaled, encoded,
+                                    quantizer, frameBytes)) {
+                    std::cout << "Failed to send preview, client disconnected" << std::endl;
+                    EndSession(transport.get());
+                    break;
+                }
+                ReportConnectMilestone(monitor.streamId, "preview");
+            }
+        }
+        auto encodeStart = std::chrono::steady_clock::now();
+        if (motion) {
+            // Whole frames, coarser or finer with what the link moves per interval
+            videoEncoder.Encode(capture.Pixels(), capture.Stride(), capture.Width(), capture.Height(),
+                                monitor.streamId, g_encodePool.get(), codedFrame);
+            auto sendStart = std::chrono::steady_clock::now();
+            g_stats.codecEncodeTime.Record(sendStart - encodeStart);
+            sent = SendServerMessage(*transport, MSG_VIDEO_FRAME, codedFrame.data(), sizeof(VideoFrame),
+                                     codedFrame.data() + sizeof(VideoFrame), codedFrame.size() - sizeof(VideoFrame));
+            throughput.Record(codedFrame.size(), std::chrono::steady_clock::now() - sendStart);
+            frameBytes += codedFrame.size();
             
-        if (elapsed >= FRAME_INTERVAL) {
-            auto bmpData = CaptureScreenAsBMP();
-            if (!bmpData.empty()) {
-                ScreenFrame frameHeader;
-                frameHeader.dataSize = static_cast<uint32_t>(bmpData.size());
-                frameHeader.width = GetSystemMetrics(SM_CXSCREEN);
-                frameHeader.height = GetSystemMetrics(SM_CYSCREEN);
+            if (!videoEncoder.LastWasKeyframe()) {
+                videoEncoder.Adapt(codedFrame.size(), (size_t)(throughput.BytesPerSecond() *
+                                                               stream->scheduler.CurrentIntervalMs() / 1000.0));
+            }
+            g_stats.codecFrames++;
+            if (videoEncoder.LastWasKeyframe()) g_stats.codecKeyframes++;
+            g_stats.codecBytes += codedFrame.size();
+            g_stats.codecPsnr += (uint64_t)(videoEncoder.LastPsnr() * 100);
+            g_stats.codecQuantizer.store(videoEncoder.Quantizer());
+        } else if (keyframe) {
+            // The whole screen exact in one pass: nothing is left to refine,
+            // and nothing waits on the prioritizer
+            int width = capture.Width(), height = capture.Height();
+            if (keyBatch.data.capacity() < QoiMaxSize(width, height)) {
+                keyBands.reserve(tileTracker.Rows());
+                keyBatch.Reserve(tileTracker.Rows(), QoiMaxSize(width, height));
+                allocationCheck.Rearm();
+            }
+            keyBands.clear();
+            for (int y = 0; y < height; y += TILE_SIZE) {
+                TileRect band = {0, y, width, std::min(TILE_SIZE, height - y)};
+                keyBands.push_back(band);
+            }
+            OrderTilesFrom(keyBands, cursor.x, cursor.y);
+            if (progressive) {
+                TileRect whole = {0, 0, width, height};
+                refiner.Discard(whole);
+                prioritizer.Reset(width, height);
+            }
+            EncodeExactBatch(*g_encodePool, capture, monitor.streamId, TILE_QOI, keyBands, predictiveEncoders,
+                             keyBatch);
+            auto sendStart = std::chrono::steady_clock::now();
+            g_stats.encodeTime[format].Record(sendStart - encodeStart);
+            g_stats.keyframeEncodeTime.Record(sendStart - encodeStart);
+            
+            size_t keyBytes = 0;
+            sent = SendPlaneBatch(*transport, keyBatch, keyBytes);
+            throughput.Record(keyBytes, std::chrono::steady_clock::now() - sendStart);
+            frameBytes += keyBytes;
+            g_stats.keyframes++;
+            g_stats.keyframePixels += (uint64_t)width * height;
+            g_stats.keyframeBytes += keyBytes;
+            g_stats.keyframeBmpBytes += sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) +
+                                  RowStride(PIXEL_FORMAT_BGR24, width, 4) * height;
+        } else if (progressive) {
+            // Coarse pass for changed runs of tiles, those the user is most
+            // likely looking at first, as many as the link takes in one interval
+            // Video tiles go out as one lossy frame and are never refined
+            size_t videoBytes = 0;
+            if (videoActive) {
+                uiTiles.clear();
+                bool videoChanged = false;
+                for (const TileRect& tile : *dirtyTiles) {
+                    bool inside = tile.x < videoRegion.x + videoRegion.width && videoRegion.x < tile.x + tile.width &&
+                                  tile.y < videoRegion.y + videoRegion.height && videoRegion.y < tile.y + tile.height;
+                    if (inside) videoChanged = true;
+                    else uiTiles.push_back(tile);
+                }
+                dirtyTiles = &uiTiles;
+                refiner.Discard(videoRegion);
+                if (videoChanged) {
+                    auto videoStart = std::chrono::steady_clock::now();
+                    if (!SendScaledArea(*transport, capture, monitor.streamId, videoRegion, videoScale, scaled,
+                                        encoded, quantizer, videoBytes)) {
+                        sent = false;
+                    }
+                    throughput.Record(videoBytes, std::chrono::steady_clock::now() - videoStart);
+                    g_stats.videoFrames++;
+                    g_stats.videoBytes += videoBytes;
+                    
+                    // Coarser while a video frame takes over half of what the
+                    // link moves in one interval, finer again below an eighth
+                    double linkBytes = throughput.BytesPerSecond() * stream->scheduler.CurrentIntervalMs() / 1000.0;
+                    if (videoBytes > linkBytes / 2 && videoScale < PREVIEW_SCALE) {
+                        videoScale++;
+                    } else if (videoBytes < linkBytes / 8 && videoScale > 0) {
+                        videoScale--;
+                        allocationCheck.Rearm();
+                    }
+                }
+            }
+            TilePrioritizer::Focus focus = {(int)cursor.x, (int)cursor.y, stream->scheduler.InputActivity(), false, TileRect()};
+            RECT window;
+            HWND foreground = GetForegroundWindow();
+            if (foreground && GetWindowRect(foreground, &window)) {
+                focus.hasWindow = true;
+                focus.window.x = window.left - monitor.x;
+                focus.window.y = window.top - monitor.y;
+                focus.window.width = window.right - window.left;
+                focus.window.height = window.bottom - window.top;
+            }
+            // The first frame is sent whole, just in priority order
+            size_t budget = firstFrame ? SIZE_MAX
+                : (size_t)(throughput.BytesPerSecond() * stream->scheduler.CurrentIntervalMs() / 1000.0);
+            budget -= std::min(budget, videoBytes);
+            prioritizer.Plan(*dirtyTiles, focus, ticket.captureStart, budget, PLANES_HIGH4, runs, deferredTiles);
+            for (const TileRect& tile : deferredTiles) tileTracker.InvalidateArea(tile);
+            if (prioritizer.PerceivedShare() >= 0) {
+                g_stats.perceivedFrames++;
+                g_stats.perceivedPriority += (uint64_t)(prioritizer.PerceivedShare() * 1000);
+                g_stats.perceivedRaster += (uint64_t)(prioritizer.RasterShare() * 1000);
+            }
+            
+            // Runs are split around the text tiles; the rest stays coarse
+            coarseJobs.clear();
+            exactTiles.clear();
+            for (const TileRect& run : runs) {
+                PlaneJob job = {{run.x, run.y, 0, run.height}, PLANES_HIGH4};
+                for (int x = run.x; x < run.x + run.width; x += TILE_SIZE) {
+                    TileRect tile = {x, run.y, std::min(TILE_SIZE, run.x + run.width - x), run.height};
+                    if (predictive && !LooksPhotographic(tile, capture.Pixels(), capture.Stride())) {
+                        exactTiles.push_back(tile);
+                        refiner.Discard(tile);
+                        if (job.rect.width) coarseJobs.push_back(job);
+                        job.rect.x = tile.x + tile.width;
+                        job.rect.width = 0;
+                    } else {
+                        job.rect.width += tile.width;
+                        refiner.Changed(tile, ticket.captureStart);
+                    }
+                }
+                if (job.rect.width) coarseJobs.push_back(job);
+            }
+            EncodePlaneBatch(*g_encodePool, capture, monitor.streamId, coarseJobs, planeBatch);
+            
+            // Adjacent text tiles are one area for the glyph cache; the tiles
+            // of areas it turns down stay with the predictive codec
+            glyphData.clear();
+            glyphEnds.clear();
+            if (glyphs) {
+                auto glyphStart = std::chrono::steady_clock::now();
+                size_t kept = 0;
+                for (size_t i = 0, end; i < exactTiles.size(); i = end) {
+                    TileRect glyphArea = exactTiles[i];
+                    for (end = i + 1; end < exactTiles.size() && exactTiles[end].y == glyphArea.y &&
+                                      exactTiles[end].x == glyphArea.x + glyphArea.width &&
+                                      glyphArea.width < PRIORITY_RUN_TILES * TILE_SIZE; ++end) {
+                        glyphArea.width += exactTiles[end].width;
+                    }
+                    GlyphFrame glyphFrame = {};
+                    glyphFrame.streamId = monitor.streamId;
+                    glyphFrame.screenWidth = (uint16_t)capture.Width();
+                    glyphFrame.screenHeight = (uint16_t)capture.Height();
+                    glyphFrame.x = (uint16_t)glyphArea.x;
+                    glyphFrame.y = (uint16_t)glyphArea.y;
+                    size_t start = glyphData.size();
+                    if (!glyphEncoder.Encode(capture.Pixels() + (size_t)glyphArea.y * capture.Stride() +
+                                                 (size_t)glyphArea.x * 4,
+                                             capture.Stride(), glyphArea.width, glyphArea.height, glyphFrame,
+                                             glyphData)) {
+                        while (i < end) exactTiles[kept++] = exactTiles[i++];
+                        continue;
+                    }
+                    glyphEnds.push_back(glyphData.size());
+                    g_stats.glyphAreas++;
+                    g_stats.glyphRawBytes += (uint64_t)glyphArea.width * glyphArea.height * 3;
+                    g_stats.glyphBytes += glyphData.size() - start;
+                    g_stats.glyphPlacements += glyphEncoder.LastPlacements();
+                    g_stats.glyphDefinitions += glyphEncoder.LastDefinitions();
+                }
+                exactTiles.resize(kept);
+                g_stats.glyphMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - glyphStart).count();
+            }
+            auto exactStart = std::chrono::steady_clock::now();
+            EncodeExactBatch(*g_encodePool, capture, monitor.streamId, TILE_PREDICTIVE, exactTiles,
+                             predictiveEncoders, exactBatch);
+            auto sendStart = std::chrono::steady_clock::now();
+            g_stats.encodeTime[format].Record(sendStart - encodeStart);
+            
+            size_t planeBytes = 0, exactBytes = 0, glyphBytes = 0;
+            sent = sent && SendPlaneBatch(*transport, planeBatch, planeBytes) &&
+                   SendGlyphFrames(*transport, glyphData, glyphEnds, glyphBytes) &&
+                   SendPlaneBatch(*transport, exactBatch, exactBytes);
+            throughput.Record(planeBytes + glyphBytes + exactBytes, std::chrono::steady_clock::now() - sendStart);
+            frameBytes += planeBytes + glyphBytes + exactBytes + videoBytes;
+            if (!exactTiles.empty()) {
+                g_stats.predictiveTiles += exactTiles.size();
+                for (const TileRect& tile : exactTiles) {
+                    g_stats.predictiveRawBytes += (uint64_t)tile.width * tile.height * 3;
+                }
+                g_stats.predictiveBytes += exactBytes;
+                g_stats.predictiveMicros +=
+                    std::chrono::duration_cast<std::chrono::microseconds>(sendStart - exactStart).count();
+                for (size_t i = 0; i < exactBatch.headers.size(); ++i) {
+                    if (exactBatch.data[exactBatch.offsets[i]] == PREDICTIVE_SHARED) g_stats.predictiveSharedTiles++;
+                }
                 
-                if (!SendData(currentClient, &frameHeader, sizeof(frameHeader)) ||
-                    !SendData(currentClient, bmpData.data(), bmpData.size())) {
-                    std::cout << "Failed to send frame, client disconnected" << std::endl;
-                    clientSocket.store(INVALID_SOCKET);
+                memset(tileCounts, 0, sizeof(tileCounts));
+                uint64_t coldBytes = 0;
+                for (PredictiveEncoder& encoder : predictiveEncoders) encoder.CollectStatistics(tileCounts, coldBytes);
+                g_stats.predictiveColdBytes += coldBytes;
+                AddTrainingCounts(tileCounts);
+                
+                // Rebuilt between batches, so no encoder is using it; older
+                // counts are halved so the table follows what is on screen
+                tilesSinceTable += exactTiles.size();
+                if (codeTables) {
+                    for (int c = 0; c < 3; ++c) {
+                        for (int i = 0; i < 512; ++i) recentCounts[c][i] += tileCounts[c][i];
+                    }
+                }
+                if (codeTables && sent && tilesSinceTable >= CODE_TABLE_REBUILD_TILES) {
+                    tilesSinceTable = 0;
+                    uint8_t previous[3][512];
+                    memcpy(previous, recentTable.lengths, sizeof(previous));
+                    recentTable.Build(recentCounts);
+                    if (!recentTableSent || memcmp(previous, recentTable.lengths, sizeof(previous)) != 0) {
+                        sent = SendCodeTable(*transport, recentTable);
+                        frameBytes += sizeof(CodeTable) + PREDICTIVE_TABLE_BYTES;
+                    }
+                    if (sent && !recentTableSent) {
+                        recentTableSent = true;
+                        sharedTables[sharedCount++] = &recentTable;
+                        for (PredictiveEncoder& encoder : predictiveEncoders) {
+                            encoder.SetSharedTables(sharedTables, sharedCount);
+                        }
+                    }
+                    for (int c = 0; c < 3; ++c) {
+                        for (int i = 0; i < 512; ++i) recentCounts[c][i] /= 2;
+                    }
                 }
             }
+        } else if (firstFrame && format && format != PIXEL_FORMAT_PALETTE8) {
+            firstTiles.assign(dirtyTiles->begin(), dirtyTiles->end());
+            OrderTilesFrom(firstTiles, cursor.x, cursor.y);
+            sent = SendRawTiles(*transport, capture, monitor.streamId, format, firstTiles, encoded, quantizer,
+                                frameBytes);
+            g_stats.encodeTime[format].Record(std::chrono::steady_clock::now() - encodeStart);
+        } else if (format) {
+            // Raw rows straight from the capture bitmap; other formats are
+            // encoded into a buffer reused across frames
+            RawFrame rawFrame = {};
+            rawFrame.streamId = monitor.streamId;
+            rawFrame.format = (uint8_t)format;
+            rawFrame.screenWidth = (uint16_t)capture.Width();
+            rawFrame.screenHeight = (uint16_t)capture.Height();
+            rawFrame.width = rawFrame.screenWidth;
+            rawFrame.height = rawFrame.screenHeight;
             
-            lastFrameTime = currentTime;
+            const unsigned char* pixels = capture.Pixels();
+            rawFrame.stride = (uint32_t)capture.Stride();
+            rawFrame.dataSize = rawFrame.stride * capture.Height();
+            if (format != PIXEL_FORMAT_BGRA32) {
+                rawFrame.stride = (uint32_t)RowStride(format, capture.Width());
+                rawFrame.dataSize = (uint32_t)EncodedFrameSize(format, capture.Width(), capture.Height());
+                encoded.resize(rawFrame.dataSize);
+                if (format == PIXEL_FORMAT_PALETTE8) {
+                    // One palette for the whole frame, so not split up
+                    EncodeFrame(format, pixels, capture.Stride(), capture.Width(), capture.Height(),
+                                encoded.data(), quantizer);
+                } else {
+                    size_t stride = capture.Stride();
+                    int width = capture.Width();
+                    unsigned char* out = encoded.data();
+                    uint32_t outStride = rawFrame.stride;
+                    EncodeRowBands(capture.Height(), [&](int y0, int y1) {
+                        EncodeFrame(format, pixels + (size_t)y0 * stride, stride, width, y1 - y0,
+                                    out + (size_t)y0 * outStride, quantizer);
+                    });
+                }
+                pixels = encoded.data();
+            }
+            g_stats.encodeTime[format].Record(std::chrono::steady_clock::now() - encodeStart);
+            
+            sent = SendServerMessage(*transport, MSG_RAW_FRAME, &rawFrame, sizeof(rawFrame), pixels, rawFrame.dataSize);
+            frameBytes = sizeof(rawFrame) + rawFrame.dataSize;
+        } else {
+            EncodeAsBMP(capture, bmpData);
+            g_stats.encodeTime[0].Record(std::chrono::steady_clock::now() - encodeStart);
+            StreamFrame streamFrame = {};
+            streamFrame.streamId = monitor.streamId;
+            streamFrame.frame.dataSize = static_cast<uint32_t>(bmpData.size());
+            streamFrame.frame.width = capture.Width();
+            streamFrame.frame.height = capture.Height();
+            
+            // Legacy viewers only know the bare ScreenFrame header
+            sent = g_typedSession
+                ? SendServerMessage(*transport, MSG_FRAME, &streamFrame, sizeof(streamFrame), bmpData.data(), bmpData.size())
+                : SendServerMessage(*transport, MSG_FRAME, &streamFrame.frame, sizeof(streamFrame.frame), bmpData.data(), bmpData.size());
+            frameBytes = sizeof(streamFrame) + bmpData.size();
+        }
+        if (sent && pull) sent = FinishUpdate(stream, *transport, claimed);
+        if (!sent) {
+            std::cout << "Failed to send frame, client disconnected" << std::endl;
+            EndSession(transport.get());
+            break;
+        }
+        
+        if (firstFrame) {
+            ReportConnectMilestone(monitor.streamId, "first full-resolution frame");
+            firstFrame = false;
+            awaitingFullQuality = true;
+        }
+        if (awaitingFullQuality && !(progressive && refiner.HasPending())) {
+            ReportConnectMilestone(monitor.streamId, "full quality");
+            awaitingFullQuality = false;
+        }
+        
+        stream->scheduler.FrameSent(ticket);
+        g_stats.framesSent++;
+        g_stats.bytesSent += frameBytes;
+        g_stats.formatBytes[format] += frameBytes;
+    }
+}
+
+// Create one stream per monitor and announce them to typed viewers
+bool StartMonitorStreams(const std::shared_ptr<Transport>& transport) {
+    std::vector<MonitorDescriptor> monitors = EnumerateMonitors();
+    if (!g_typedSession) {
+        monitors.resize(1); // legacy viewers only understand the primary screen
+    }
+    
+    std::cout << "Monitors:";
+    for (const MonitorDescriptor& monitor : monitors) {
+        std::cout << " [" << (int)monitor.streamId << "] " << monitor.width << "x" << monitor.height
+                  << "@" << monitor.x << "," << monitor.y << (monitor.primary ? " (primary)" : "");
+    }
+    std::cout << std::endl;
+    
+    g_subscribedStreams.store(1);
+    if (g_typedSession && g_hasTrainedTable && CodeTablesUsable() && !SendCodeTable(*transport, g_trainedTable)) {
+        return false;
+    }
+    if (g_typedSession) {
+        MonitorList list = {(uint32_t)monitors.size()};
+        if (!SendServerMessage(*transport, MSG_MONITOR_LIST, &list, sizeof(list),
+                               monitors.data(), monitors.size() * sizeof(MonitorDescriptor))) {
+            return false;
+        }
+    }
+    
+    std::lock_guard<std::mutex> lock(g_streamsMutex);
+    for (const MonitorDescriptor& monitor : monitors) {
+        g_streams.emplace_back(new MonitorStream(monitor));
+        MonitorStream* stream = g_streams.back().get();
+        stream->scheduler.SetPullMode((g_sessionCaps.load() & CAP_PULL) != 0);
+        stream->thread = std::thread(MonitorStreamingThread, stream, transport);
+    }
+    return true;
+}
+
+void StopMonitorStreams() {
+    std::vector<std::unique_ptr<MonitorStream>> streams;
+    {
+        std::lock_guard<std::mutex> lock(g_streamsMutex);
+        streams.swap(g_streams);
+    }
+    for (auto& stream : streams) {
+        stream->scheduler.Stop();
+    }
+    for (auto& stream : streams) {
+        if (stream->thread.joinable()) stream->thread.join();
+    }
+}
+
+// Cursor tracking thread: sends cursor position and shape as their own
+// small messages so pointer movement never dirties frame tiles
+void CursorTrackingThread() {
+    std::cout << "Cursor tracking thread started" << std::endl;
+    
+    uint32_t lastGeneration = 0; // 0 = no viewer
+    std::unordered_set<uint64_t> sentShapes;
+    std::unordered_map<HCURSOR, uint64_t> handleHashes;
+    CursorPosition lastPosition = {};
+    
+    while (running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(CURSOR_POLL_INTERVAL));
+        
+        uint32_t generation = 0;
+        std::shared_ptr<Transport> currentClient = CurrentSession(generation);
+        if (!currentClient || !(g_sessionCaps.load() & CAP_CURSOR_CHANNEL)) {
+            lastGeneration = 0;
+            continue;
+        }
+        
+        // Shapes are cached per viewer
+        if (generation != lastGeneration) {
+            sentShapes.clear();
+            lastPosition = CursorPosition();
+            lastPosition.visible = 0xFF; // force the first update
+            lastGeneration = generation;
+        }
+        
+        CURSORINFO cursorInfo = {};
+        cursorInfo.cbSize = sizeof(cursorInfo);
+        if (!GetCursorInfo(&cursorInfo)) continue;
+        
+        CursorPosition position = {};
+        position.x = cursorInfo.ptScreenPos.x;
+        position.y = cursorInfo.ptScreenPos.y;
+        position.visible = (cursorInfo.flags & CURSOR_SHOWING) && cursorInfo.hCursor ? 1 : 0;
+        
+        if (position.visible) {
+            auto known = handleHashes.find(cursorInfo.hCursor);
+            if (known != handleHashes.end() && sentShapes.count(known->second)) {
+                position.shapeHash = known->second;
+            } else {
+                CursorImage image;
+                if (!CaptureCursorShape(cursorInfo.hCursor, image)) continue;
+                handleHashes[cursorInfo.hCursor] = image.hash;
+                position.shapeHash = image.hash;
+                
+                // Remembered only once sent: a shape the viewer never got is retried
+                if (!sentShapes.count(image.hash)) {
+                    CursorShape shape = {image.hash, (uint16_t)image.width, (uint16_t)image.height,
+                                         (uint16_t)image.hotspotX, (uint16_t)image.hotspotY};
+                    if (!SendServerMessage(*currentClient, MSG_CURSOR_SHAPE, &shape, sizeof(shape),
+                                           image.pixels.data(), image.pixels.size() * sizeof(uint32_t))) {
+                        continue;
+                    }
+                    sentShapes.insert(image.hash);
+                    g_stats.cursorMessages++;
+                }
+            }
         }
         
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (position.x != lastPosition.x || position.y != lastPosition.y ||
+            position.visible != lastPosition.visible || position.shapeHash != lastPosition.shapeHash) {
+            if (SendServerMessage(*currentClient, MSG_CURSOR_POSITION, &position, sizeof(position))) {
+                lastPosition = position;
+                g_stats.cursorMessages++;
+            }
+        }
     }
     
-    std::cout << "Screen streaming thread ended" << std::endl;
+    std::cout << "Cursor tracking thread ended" << std::endl;
+}
+
+// Act on a viewer's loss report: resend what it lost, adapt the parity
+// and send rate to the loss it measured, and give up on datagrams if
+// the link keeps losing most of them
+void HandleDatagramLoss(DatagramLink& link, const DatagramLossReport& report, const uint32_t* lostIds) {
+    DatagramLink::SentMessage lost[MAX_LOSS_REPORT];
+    int lostCount = 0;
+    bool fallBack = false;
+    {
+        std::lock_guard<std::mutex> lock(link.mutex);
+        for (int i = 0; i < report.count; ++i) {
+            const DatagramLink::SentMessage& entry = link.history[lostIds[i] % DATAGRAM_HISTORY];
+            if (entry.id == lostIds[i]) lost[lostCount++] = entry;
+        }
+        
+        // Datagrams sent for the messages accounted for since the last report
+        uint32_t span = report.throughId - link.reportedId;
+        uint64_t sent = 0;
+        bool known = span > 0 && span <= DATAGRAM_HISTORY && span <= link.packetizer.NextId() - link.reportedId;
+        for (uint32_t id = link.reportedId; known && id != report.throughId; ++id) {
+            const DatagramLink::SentMessage& entry = link.history[id % DATAGRAM_HISTORY];
+            if (entry.id != id) known = false;
+            else sent += entry.datagrams;
+        }
+        uint32_t received = report.received - link.reportedReceived;
+        link.reportedId = report.throughId;
+        link.reportedReceived = report.received;
+        
+        if (known && sent > 0) {
+            link.lossRate = received >= sent ? 0.0 : 1.0 - (double)received / sent;
+            link.packetizer.SetGroupSize(FecGroupSize(link.lossRate));
+            link.pacer.Feedback(link.lossRate);
+            link.badReports = link.lossRate > DATAGRAM_FALLBACK_LOSS ? link.badReports + 1 : 0;
+            fallBack = link.badReports >= 3 && link.active;
+        }
+    }
+    
+    // Stream locks are taken outside the link's (the stats report nests them the other way)
+    for (int i = 0; i < lostCount; ++i) RepairStreamArea(lost[i].streamId, lost[i].rect);
+    if (fallBack) {
+        std::cout << "Datagram loss " << (int)(link.lossRate * 100) << "%, sending frames over TCP" << std::endl;
+        link.active = false;
+        g_formatGeneration++; // full frame over TCP
+        RequestStreamCaptures();
+    }
 }
 
 // Input handling thread
@@ -242,30 +1687,25 @@ void InputHandlingThread() {
     std::cout << "Input handling thread started" << std::endl;
     
     while (running) {
-        SOCKET currentClient = clientSocket.load();
-        if (currentClient == INVALID_SOCKET) {
+        std::shared_ptr<Transport> currentClient = CurrentSession();
+        if (!currentClient) {
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
             continue;
         }
         
-        fd_set readSet;
-        FD_ZERO(&readSet);
-        FD_SET(currentClient, &readSet);
-        
-        timeval timeout = {0, 10000}; // 10ms timeout
-        int result = select(0, &readSet, nullptr, nullptr, &timeout);
+        int result = currentClient->WaitReadable(10);
         
-        if (result > 0 && FD_ISSET(currentClient, &readSet)) {
+        if (result > 0) {
             uint8_t eventType;
-            if (!ReceiveData(currentClient, &eventType, sizeof(eventType))) {
+            if (!currentClient->Receive(&eventType, sizeof(eventType))) {
                 std::cout << "Client disconnected" << std::endl;
-                clientSocket.store(INVALID_SOCKET);
+                EndSession(currentClient.get());
                 continue;
             }
             
             if (eventType == 1) { // Mouse event
                 MouseEvent mouseEvent;
-                if (ReceiveData(currentClient, &mouseEvent, sizeof(mouseEvent))) {
+                if (currentClient->Receive(&mouseEvent, sizeof(mouseEvent))) {
                     switch (mouseEvent.type) {
                         case 1: // Mouse move
                             MoveMouse(mouseEvent.x, mouseEvent.y);
@@ -287,7 +1727,7 @@ void InputHandlingThread() {
             }
             else if (eventType == 2) { // Keyboard event
                 KeyboardEvent keyEvent;
-                if (ReceiveData(currentClient, &keyEvent, sizeof(keyEvent))) {
+                if (currentClient->Receive(&keyEvent, sizeof(keyEvent))) {
                     if (keyEvent.type == 1) {
                         SimulateKeyDown(keyEvent.keyCode);
                     } else if (keyEvent.type == 2) {
@@ -295,26 +1735,189 @@ void InputHandlingThread() {
                     }
                 }
             }
+            else if (eventType == EVENT_SUBSCRIBE) { // Monitor selection
+                SubscribeEvent subscribe;
+                if (currentClient->Receive(&subscribe, sizeof(subscribe))) {
+                    g_subscribedStreams.store(subscribe.streamMask);
+                    RequestStreamCaptures();
+                }
+            }
+            else if (eventType == EVENT_SET_FORMAT) { // Color depth switch
+                SetFormatEvent request;
+                if (currentClient->Receive(&request, sizeof(request))) {
+                    static const uint32_t formatCaps[PIXEL_FORMAT_COUNT] = {
+                        0, CAP_RAW_BGRA32, CAP_RAW_BGR24, CAP_RAW_RGB565, CAP_RAW_PALETTE8, CAP_RAW_GRAY8};
+                    if (request.format > 0 && request.format < PIXEL_FORMAT_COUNT &&
+                        (g_sessionCaps.load() & formatCaps[request.format])) {
+                        std::cout << "Viewer switched to " << FormatName(request.format) << " frames" << std::endl;
+                        g_frameFormat.store(request.format);
+                        g_formatGeneration++;
+                        RequestStreamCaptures();
+                    }
+                }
+            }
+            else if (eventType == EVENT_CAPABILITIES) { // Only honoured at connect
+                ClientCapabilities caps;
+                currentClient->Receive(&caps, sizeof(caps));
+            }
+            else if (eventType == EVENT_UPDATE_REQUEST) { // Viewer ready for the next update
+                UpdateRequest request;
+                if (currentClient->Receive(&request, sizeof(request))) {
+                    RequestStreamUpdate(request);
+                }
+            }
+            else if (eventType == EVENT_DATAGRAM_LOSS) { // Frame messages lost over UDP
+                DatagramLossReport report;
+                uint32_t lostIds[MAX_LOSS_REPORT];
+                if (!currentClient->Receive(&report, sizeof(report)) || report.count > MAX_LOSS_REPORT ||
+                    !currentClient->Receive(lostIds, report.count * sizeof(uint32_t))) {
+                    std::cout << "Invalid loss report, client disconnected" << std::endl;
+                    EndSession(currentClient.get());
+                    continue;
+                }
+                std::shared_ptr<DatagramLink> datagrams = CurrentDatagramLink();
+                if (datagrams) HandleDatagramLoss(*datagrams, report, lostIds);
+            }
+            else if (eventType == EVENT_TEXT) { // Unicode text run
+                TextInputEvent textEvent;
+                if (currentClient->Receive(&textEvent, sizeof(textEvent))) {
+                    if (textEvent.length > MAX_TEXT_RUN ||
+                        (textEvent.encoding != TEXT_ENCODING_UTF16 && textEvent.encoding != TEXT_ENCODING_UTF8)) {
+                        std::cout << "Invalid text input message, client disconnected" << std::endl;
+                        EndSession(currentClient.get());
+                        continue;
+                    }
+                    
+                    std::vector<unsigned char> textData(TextRunByteSize(textEvent.encoding, textEvent.length));
+                    if (textData.empty() || currentClient->Receive(textData.data(), textData.size())) {
+                        SimulateTextInput(DecodeTextRun(textEvent.encoding, textData.data(), textEvent.length));
+                    }
+                }
+            }
         }
-        else if (result == SOCKET_ERROR) {
-            std::cout << "Select error, client disconnected" << std::endl;
-            clientSocket.store(INVALID_SOCKET);
+        else if (result < 0) {
+            std::cout << "Client disconnected" << std::endl;
+            EndSession(currentClient.get());
         }
     }
     
     std::cout << "Input handling thread ended" << std::endl;
 }
 
-void HandleClient(SOCKET socket) {
+// The EVENT_CAPABILITIES message of a viewer that announced itself typed
+bool ReceiveCapabilities(Transport& transport, ClientCapabilities& caps) {
+    uint8_t eventType = 0;
+    return transport.Receive(&eventType, 1) && eventType == EVENT_CAPABILITIES &&
+           transport.Receive(&caps, sizeof(caps));
+}
+
+// Whether the viewer marked its password buffer as a typed viewer's
+bool AnnouncesTyped(const PasswordAuth& auth) {
+    uint32_t magic;
+    memcpy(&magic, auth.password + sizeof(auth.password) - sizeof(magic), sizeof(magic));
+    return magic == HANDSHAKE_MAGIC && memchr(auth.password, 0, PASSWORD_TYPED_MAX + 1);
+}
+
+// Offer a shared ring to a viewer on this machine. Returns the transport
+// for the session: the ring if the viewer opened it, the socket if the
+// ring could not be set up or was declined, null if the viewer broke off.
+std::shared_ptr<Transport> OfferSharedMemory(const std::shared_ptr<Transport>& link) {
+    std::unique_ptr<SharedRing> ring(new SharedRing());
+    if (!ring->Create(SHARED_RING_SIZE)) {
+        std::cout << "Shared memory unavailable (error " << GetLastError() << "), using TCP" << std::endl;
+        return link;
+    }
+    
+    SharedMemoryOffer offer = {};
+    strncpy_s(offer.name, ring->Name(), sizeof(offer.name) - 1);
+    offer.size = SHARED_RING_SIZE;
+    if (!SendServerMessage(*link, MSG_SHARED_MEMORY, &offer, sizeof(offer))) return nullptr;
+    
+    uint8_t eventType = 0;
+    SharedMemoryReply reply = {};
+    if (link->WaitReadable(2000) <= 0 || !link->Receive(&eventType, sizeof(eventType)) ||
+        eventType != EVENT_SHARED_MEMORY || !link->Receive(&reply, sizeof(reply))) {
+        return nullptr;
+    }
+    if (!reply.accepted) {
+        std::cout << "Viewer could not open shared memory, using TCP" << std::endl;
+        return link;
+    }
+    std::cout << "Viewer is local: frames go through shared memory" << std::endl;
+    return std::make_shared<LocalTransport>(link, std::move(ring), true);
+}
+
+// Offer frames over UDP to a remote viewer. `link` is left empty if the
+// viewer declines or no datagram gets through; returns false only if the
+// viewer broke off.
+bool OfferDatagrams(Transport& transport, std::shared_ptr<DatagramLink>& link) {
+    SOCKET udp = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (udp == INVALID_SOCKET) return true;
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    int addressSize = sizeof(address);
+    if (bind(udp, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR ||
+        getsockname(udp, (sockaddr*)&address, &addressSize) == SOCKET_ERROR) {
+        closesocket(udp);
+        return true;
+    }
+    
+    std::random_device rd;
+    DatagramOffer offer = {};
+    offer.port = ntohs(address.sin_port);
+    offer.token = rd();
+    uint8_t eventType = 0;
+    DatagramReply reply = {};
+    if (!SendServerMessage(transport, MSG_DATAGRAM_OFFER, &offer, sizeof(offer)) ||
+        transport.WaitReadable(2000) <= 0 || !transport.Receive(&eventType, sizeof(eventType)) ||
+        eventType != EVENT_DATAGRAM || !transport.Receive(&reply, sizeof(reply))) {
+        closesocket(udp);
+        return false;
+    }
+    if (!reply.accepted) {
+        closesocket(udp);
+        return true;
+    }
+    
+    // The viewer's hello tells us where to send (it may be behind NAT)
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (std::chrono::steady_clock::now() < deadline) {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(udp, &readSet);
+        timeval timeout = {0, 100000};
+        if (select(0, &readSet, nullptr, nullptr, &timeout) <= 0) continue;
+        
+        DatagramHeader hello = {};
+        sockaddr_in peer = {};
+        int peerSize = sizeof(peer);
+        int received = recvfrom(udp, (char*)&hello, sizeof(hello), 0, (sockaddr*)&peer, &peerSize);
+        if (received != sizeof(hello) || hello.token != offer.token || hello.dataCount != 0) continue;
+        
+        int bufferSize = DATAGRAM_SNDBUF;
+        setsockopt(udp, SOL_SOCKET, SO_SNDBUF, (const char*)&bufferSize, sizeof(bufferSize));
+        link = std::make_shared<DatagramLink>(udp, peer, offer.token);
+        std::cout << "Frames go over UDP port " << offer.port << std::endl;
+        return true;
+    }
+    std::cout << "No datagram from the viewer, using TCP" << std::endl;
+    closesocket(udp);
+    return true;
+}
+
+// Runs one viewer session on the accepting thread; the transport is
+// closed when the last thread using it lets go
+void HandleClient(std::shared_ptr<Transport> transport) {
+    g_connectTime = std::chrono::steady_clock::now();
     std::cout << "=== NEW CLIENT CONNECTION ===" << std::endl;
     std::cout << "Client attempting connection..." << std::endl;
     
     // Receive authentication
     PasswordAuth auth;
-    if (!ReceiveData(socket, &auth, sizeof(auth))) {
+    if (!transport->Receive(&auth, sizeof(auth))) {
         std::cout << "ERROR: Failed to receive authentication data" << std::endl;
         std::cout << "Error code: " << WSAGetLastError() << std::endl;
-        closesocket(socket);
         return;
     }
     
@@ -322,31 +1925,74 @@ void HandleClient(SOCKET socket) {
     std::cout << "Expected password: '" << g_serverPassword << "'" << std::endl;
     
     // Check password
-    if (g_serverPassword != std::string(auth.password)) {
+    bool typed = AnnouncesTyped(auth);
+    if (g_serverPassword != std::string(auth.password, strnlen(auth.password, sizeof(auth.password)))) {
         std::cout << "AUTHENTICATION FAILED - Wrong password!" << std::endl;
         std::cout << "Client provided: '" << auth.password << "'" << std::endl;
         std::cout << "Expected: '" << g_serverPassword << "'" << std::endl;
-        closesocket(socket);
         return;
     }
     
     std::cout << "*** AUTHENTICATION SUCCESSFUL! ***" << std::endl;
     
-    // Set the global client socket
-    clientSocket.store(socket);
-    
     // Send initial screen dimensions
     uint32_t width = GetSystemMetrics(SM_CXSCREEN);
     uint32_t height = GetSystemMetrics(SM_CYSCREEN);
     
     std::cout << "Sending screen dimensions: " << width << "x" << height << std::endl;
     
-    if (!SendData(socket, &width, sizeof(width)) ||
-        !SendData(socket, &height, sizeof(height))) {
+    uint32_t announcedWidth = typed ? width | HANDSHAKE_TYPED : width;
+    IoSlice dimensions[2] = {{&announcedWidth, sizeof(announcedWidth)}, {&height, sizeof(height)}};
+    if (!transport->Send(dimensions, 2)) {
         std::cout << "ERROR: Failed to send initial screen info" << std::endl;
         std::cout << "Error code: " << WSAGetLastError() << std::endl;
-        clientSocket.store(INVALID_SOCKET);
-        closesocket(socket);
+        return;
+    }
+    
+    // Typed viewers announce their capabilities before streaming starts
+    ClientCapabilities caps = {};
+    if (typed && !ReceiveCapabilities(*transport, caps)) {
+        std::cout << "ERROR: Viewer did not send its capabilities" << std::endl;
+        return;
+    }
+    g_typedSession.store(typed);
+    g_sessionCaps.store(typed ? caps.flags : 0);
+    
+    // Widest raw format the viewer accepts; BMP frames otherwise. Reduced
+    // color depths are only used when the viewer asks for them.
+    uint32_t flags = typed ? caps.flags : 0;
+    g_frameFormat.store((flags & CAP_RAW_BGRA32) ? PIXEL_FORMAT_BGRA32 :
+                        (flags & CAP_RAW_BGR24) ? PIXEL_FORMAT_BGR24 :
+                        (flags & CAP_RAW_RGB565) ? PIXEL_FORMAT_RGB565 : 0);
+    std::cout << (typed ? "Viewer capabilities: 0x" : "Legacy viewer (no capabilities)")
+              << std::hex << (typed ? caps.flags : 0) << std::dec << std::endl;
+    
+    // A viewer on this machine gets everything but its input through shared memory
+    std::shared_ptr<DatagramLink> datagrams;
+    if (typed && (caps.flags & CAP_SHARED_MEMORY) && transport->PeerIsLocal()) {
+        transport = OfferSharedMemory(transport);
+        if (!transport) {
+            std::cout << "ERROR: Viewer did not answer the shared memory offer" << std::endl;
+            return;
+        }
+    }
+    // Anywhere else frames may go over UDP, where a lost packet does not stall the stream
+    else if (typed && (caps.flags & CAP_DATAGRAM)) {
+        if (!OfferDatagrams(*transport, datagrams)) {
+            std::cout << "ERROR: Viewer did not answer the datagram offer" << std::endl;
+            return;
+        }
+    }
+    
+    g_stats.Reset();
+    g_sendStats.Reset();
+    
+    // Hand the connection to the input, cursor and stream threads
+    BeginSession(transport, datagrams);
+    if (!StartMonitorStreams(transport)) {
+        std::cout << "ERROR: Failed to send monitor list" << std::endl;
+        EndSession(transport.get());
+        StopMonitorStreams();
         return;
     }
     
@@ -356,23 +2002,35 @@ void HandleClient(SOCKET socket) {
     std::cout << "Press Ctrl+C to stop the server." << std::endl;
     std::cout << "======================================" << std::endl;
     
-    // Keep connection alive and monitor
-    char keepAlive;
+    // Keep connection alive and monitor; the input thread ends the
+    // session when the viewer goes away
     int heartbeatCount = 0;
-    while (running && clientSocket.load() != INVALID_SOCKET) {
-        int result = recv(socket, &keepAlive, 1, MSG_PEEK);
-        if (result <= 0) {
-            int error = WSAGetLastError();
-            if (error != WSAEWOULDBLOCK) {
-                std::cout << "Client connection lost. Error: " << error << std::endl;
-                break;
-            }
-        }
-        
+    auto statsStart = std::chrono::steady_clock::now();
+    uint64_t statsCpu = GetProcessCpuMicros();
+    uint64_t statsCaptured = g_stats.framesCaptured.load();
+    uint64_t statsSent = g_stats.framesSent.load();
+    uint64_t statsBytes = g_stats.bytesSent.load();
+    while (running && IsCurrentSession(transport.get())) {
         heartbeatCount++;
+        if (heartbeatCount % TRANSPORT_MAINTAIN_INTERVAL == 0) {
+            SendGate::Hold hold(g_sendGate, false);
+            transport->Maintain();
+        }
+        if (datagrams) {
+            std::lock_guard<std::mutex> lock(datagrams->mutex);
+            if (datagrams->sentSinceMark) SendDatagramMark(*datagrams);
+        }
         if (heartbeatCount % 50 == 0) { // Every ~5 seconds
             std::cout << "Session active... (heartbeat " << (heartbeatCount/50) << ")" << std::endl;
         }
+        if (heartbeatCount % 600 == 0) { // Every ~minute
+            PrintStreamingStats(statsStart, statsCpu, statsCaptured, statsSent, statsBytes);
+            statsStart = std::chrono::steady_clock::now();
+            statsCpu = GetProcessCpuMicros();
+            statsCaptured = g_stats.framesCaptured.load();
+            statsSent = g_stats.framesSent.load();
+            statsBytes = g_stats.bytesSent.load();
+        }
         
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
@@ -380,8 +2038,11 @@ void HandleClient(SOCKET socket) {
     std::cout << std::endl;
     std::cout << "=== SESSION ENDED ===" << std::endl;
     std::cout << "Client disconnected" << std::endl;
-    clientSocket.store(INVALID_SOCKET);
-    closesocket(socket);
+    PrintInputStats();
+    g_stats.PrintFormats(std::cout);
+    EndSession(transport.get());
+    StopMonitorStreams();
+    SaveTrainingCounts();
 }
 
 int main() {
@@ -434,8 +2095,13 @@ int main() {
     std::cout << "Server listening on port " << PORT << "..." << std::endl;
     
     // Start background threads
-    std::thread screenThread(ScreenStreamingThread);
+    g_encodePool.reset(new WorkStealingPool(ENCODE_THREADS));
+    std::cout << "Encoding on " << g_encodePool->ThreadCount() << " threads" << std::endl;
+    LoadTrainedCodeTable();
+    g_inputQueue.Start(std::unique_ptr<InputInjector>(new Win32InputInjector()),
+                       NotifyStreamsOfInput);
     std::thread inputThread(InputHandlingThread);
+    std::thread cursorThread(CursorTrackingThread);
     
     std::cout << "Waiting for remote connection..." << std::endl;
 
@@ -448,13 +2114,15 @@ int main() {
             continue;
         }
         
-        HandleClient(newClientSocket);
+        HandleClient(std::make_shared<SocketTransport>(newClientSocket, &g_sendStats));
     }
 
     // Cleanup
     running = false;
-    if (screenThread.joinable()) screenThread.join();
     if (inputThread.joinable()) inputThread.join();
+    if (cursorThread.joinable()) cursorThread.join();
+    g_inputQueue.Stop();
+    g_encodePool.reset();
     
     closesocket(serverSocket);
     WSACleanup();
@@ -0,0 +1,176 @@
+// ===== session_stats.h =====
+// What the host measures during a viewer session. The stream, cursor and
+// send threads bump the counters; the session thread resets them when a
+// viewer connects and prints them every minute and at the end. Ratios and
+// averages are only worked out when printing.
+//
+// Platform neutral; CPU use, stream intervals and the transport's own
+// counters are printed next to these by server.cpp.
+#ifndef SESSION_STATS_H
+#define SESSION_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+#include "latency_histogram.h"
+#include "protocol.h"
+
+inline const char* FormatName(int format) {
+    switch (format) {
+        case PIXEL_FORMAT_BGRA32: return "BGRA32";
+        case PIXEL_FORMAT_BGR24: return "BGR24";
+        case PIXEL_FORMAT_RGB565: return "RGB565";
+        case PIXEL_FORMAT_PALETTE8: return "8-bit palette";
+        case PIXEL_FORMAT_GRAY8: return "grayscale";
+    }
+    return "BMP";
+}
+
+struct SessionStats {
+    std::atomic<uint64_t> framesCaptured;
+    std::atomic<uint64_t> framesSent;
+    std::atomic<uint64_t> bytesSent;
+    std::atomic<uint64_t> cursorMessages;
+    LatencyHistogram cursorSendTime;      // send called to written, queued behind frames included
+
+    // Per pixel format (index 0 = BMP frames): encode time and bytes
+    LatencyHistogram encodeTime[PIXEL_FORMAT_COUNT];
+    std::atomic<uint64_t> formatBytes[PIXEL_FORMAT_COUNT];
+
+    std::atomic<uint64_t> refinementBytes;
+    LatencyHistogram changeToExact;       // tile change to last refinement pass sent
+
+    // Share of changed bytes sent before the area around the cursor was
+    // done, in permille, summed over frames: as sent and in raster order
+    std::atomic<uint64_t> perceivedFrames;
+    std::atomic<uint64_t> perceivedPriority;
+    std::atomic<uint64_t> perceivedRaster;
+
+    std::atomic<uint64_t> videoRegions;
+    std::atomic<uint64_t> videoFrames;
+    std::atomic<uint64_t> videoBytes;
+
+    // Inter-frame codec; PSNR is luma, in centi-dB, summed
+    std::atomic<uint64_t> codecFrames;
+    std::atomic<uint64_t> codecKeyframes;
+    std::atomic<uint64_t> codecBytes;
+    std::atomic<uint64_t> codecPsnr;
+    std::atomic<int> codecQuantizer;
+    LatencyHistogram codecEncodeTime;
+
+    // Text tiles sent exact with the predictive codec: their BGR24 size,
+    // coded size and encode time; of those, tiles coded with a shared code
+    // table and what all of them would have taken with their own codes
+    std::atomic<uint64_t> predictiveTiles;
+    std::atomic<uint64_t> predictiveRawBytes;
+    std::atomic<uint64_t> predictiveBytes;
+    std::atomic<uint64_t> predictiveMicros;
+    std::atomic<uint64_t> predictiveSharedTiles;
+    std::atomic<uint64_t> predictiveColdBytes;
+    std::atomic<uint64_t> codeTablesSent;
+
+    // Keyframes sent QOI-coded, and the size they would have as BMP files
+    std::atomic<uint64_t> keyframes;
+    std::atomic<uint64_t> keyframePixels;
+    std::atomic<uint64_t> keyframeBytes;
+    std::atomic<uint64_t> keyframeBmpBytes;
+    LatencyHistogram keyframeEncodeTime;
+
+    // Text areas sent as glyphs: their BGR24 size, coded size, glyphs
+    // placed and defined, encode time
+    std::atomic<uint64_t> glyphAreas;
+    std::atomic<uint64_t> glyphRawBytes;
+    std::atomic<uint64_t> glyphBytes;
+    std::atomic<uint64_t> glyphPlacements;
+    std::atomic<uint64_t> glyphDefinitions;
+    std::atomic<uint64_t> glyphMicros;
+
+    SessionStats() { Reset(); }
+
+    void Reset() {
+        std::atomic<uint64_t>* counters[] = {
+            &framesCaptured, &framesSent, &bytesSent, &cursorMessages, &refinementBytes, &perceivedFrames,
+            &perceivedPriority, &perceivedRaster, &videoRegions, &videoFrames, &videoBytes, &codecFrames,
+            &codecKeyframes, &codecBytes, &codecPsnr, &predictiveTiles, &predictiveRawBytes, &predictiveBytes,
+            &predictiveMicros, &predictiveSharedTiles, &predictiveColdBytes, &codeTablesSent, &keyframes,
+            &keyframePixels, &keyframeBytes, &keyframeBmpBytes, &glyphAreas, &glyphRawBytes, &glyphBytes,
+            &glyphPlacements, &glyphDefinitions, &glyphMicros};
+        for (std::atomic<uint64_t>* counter : counters) counter->store(0);
+        for (int i = 0; i < PIXEL_FORMAT_COUNT; ++i) {
+            encodeTime[i].Reset();
+            formatBytes[i].store(0);
+        }
+        codecQuantizer.store(0);
+        cursorSendTime.Reset();
+        changeToExact.Reset();
+        codecEncodeTime.Reset();
+        keyframeEncodeTime.Reset();
+    }
+
+    // One line per pixel format frames went out in
+    void PrintFormats(std::ostream& out) const {
+        for (int i = 0; i < PIXEL_FORMAT_COUNT; ++i) {
+            uint64_t frames = encodeTime[i].Count();
+            if (!frames) continue;
+            out << "  " << FormatName(i) << ": " << frames << " frames, " << formatBytes[i].load() / frames / 1024
+                << " KB/frame, encode " << encodeTime[i].Summary() << "\n";
+        }
+    }
+
+    // The formats, then a line for each encoding that was used
+    void Print(std::ostream& out) const {
+        PrintFormats(out);
+        if (changeToExact.Count()) {
+            out << "  Refinement: " << refinementBytes.load() / 1024 << " KB total, change-to-exact "
+                << changeToExact.Summary() << "\n";
+        }
+        if (uint64_t frames = perceivedFrames.load()) {
+            out << "  Cursor area complete after " << perceivedPriority.load() / frames / 10
+                << "% of changed bytes (raster order: " << perceivedRaster.load() / frames / 10 << "%)\n";
+        }
+        if (uint64_t frames = videoFrames.load()) {
+            out << "  Video: " << videoRegions.load() << " regions, " << frames << " frames, "
+                << videoBytes.load() / frames / 1024 << " KB/frame\n";
+        }
+        if (uint64_t frames = codecFrames.load()) {
+            out << "  Inter-frame codec: " << frames << " frames (" << codecKeyframes.load() << " key), "
+                << codecBytes.load() / frames / 1024 << " KB/frame, PSNR " << codecPsnr.load() / frames / 100.0
+                << " dB, quantizer " << codecQuantizer.load() << ", encode " << codecEncodeTime.Summary() << "\n";
+        }
+        if (uint64_t bytes = predictiveBytes.load()) {
+            uint64_t raw = predictiveRawBytes.load(), tiles = std::max<uint64_t>(1, predictiveTiles.load());
+            out << "  Exact text tiles: " << predictiveTiles.load() << " tiles, " << bytes / 1024 << " KB, "
+                << raw * 10 / bytes / 10.0 << ":1 against 24-bit pixels, encode "
+                << raw / std::max<uint64_t>(1, predictiveMicros.load()) << " MB/s\n";
+            if (uint64_t shared = predictiveSharedTiles.load()) {
+                uint64_t cold = std::max<uint64_t>(1, predictiveColdBytes.load());
+                uint64_t coded = bytes - std::min<uint64_t>(bytes, predictiveTiles.load() * sizeof(RawFrame));
+                out << "    " << shared * 100 / tiles << "% on shared code tables (" << codeTablesSent.load()
+                    << " sent), " << (cold - std::min(cold, coded)) * 100 / cold
+                    << "% smaller than with their own codes\n";
+            }
+        }
+        if (uint64_t frames = keyframes.load()) {
+            uint64_t bytes = std::max<uint64_t>(1, keyframeBytes.load());
+            out << "  Keyframes: " << frames << ", " << keyframeBytes.load() / frames / 1024 << " KB each, "
+                << keyframeBmpBytes.load() * 10 / bytes / 10.0 << ":1 against BMP, "
+                << keyframePixels.load() * 4 * 10 / bytes / 10.0 << ":1 against raw BGRA, encode "
+                << keyframeEncodeTime.Summary() << "\n";
+        }
+        if (uint64_t bytes = glyphBytes.load()) {
+            uint64_t placements = std::max<uint64_t>(1, glyphPlacements.load());
+            out << "  Glyph areas: " << glyphAreas.load() << ", " << bytes / 1024 << " KB, "
+                << glyphRawBytes.load() * 10 / bytes / 10.0 << ":1 against 24-bit pixels, "
+                << (placements - std::min<uint64_t>(placements, glyphDefinitions.load())) * 100 / placements
+                << "% of glyphs cached, encode " << glyphRawBytes.load() / std::max<uint64_t>(1, glyphMicros.load())
+                << " MB/s\n";
+        }
+        if (cursorSendTime.Count()) {
+            out << "  Cursor send (queued behind frames included): " << cursorSendTime.Summary() << "\n";
+        }
+    }
+};
+
+#endif // SESSION_STATS_H
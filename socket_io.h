@@ -0,0 +1,147 @@
+// ===== socket_io.h =====
+// Socket output helpers shared by the host and the viewer.
+//
+// A message is handed to the kernel as one gather write (WSASend over
+// header, metadata and payload slices) instead of a send() per part, and
+// sockets run with Nagle disabled so small input and control messages go
+// out immediately. The host sizes its send buffer from the measured
+// bandwidth-delay product so a fast, long link can be kept full without
+// queueing seconds of stale frames on a slow one.
+#ifndef SOCKET_IO_H
+#define SOCKET_IO_H
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mstcpip.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include "io_slice.h"
+
+#define MIN_SOCKET_BUFFER (64 * 1024)
+#define MAX_SOCKET_BUFFER (16 * 1024 * 1024)
+#define DEFAULT_RTT_MICROS 50000 // assumed when the OS cannot report the RTT
+
+// Write all slices with as few WSASend calls as the socket allows
+// (one, unless the kernel accepts only part of the data)
+inline bool SendSlices(SOCKET socket, const IoSlice* slices, int count, SendStats* stats = nullptr) {
+    if (socket == INVALID_SOCKET || count > MAX_IO_SLICES) return false;
+
+    WSABUF buffers[MAX_IO_SLICES];
+    DWORD bufferCount = 0;
+    for (int i = 0; i < count; ++i) {
+        if (!slices[i].size) continue;
+        buffers[bufferCount].buf = const_cast<char*>(static_cast<const char*>(slices[i].data));
+        buffers[bufferCount].len = static_cast<ULONG>(slices[i].size);
+        bufferCount++;
+    }
+    if (stats) stats->messages++;
+
+    WSABUF* next = buffers;
+    while (bufferCount > 0) {
+        DWORD sent = 0;
+        auto start = std::chrono::steady_clock::now();
+        int result = WSASend(socket, next, bufferCount, &sent, 0, NULL, NULL);
+        if (stats) {
+            stats->calls++;
+            stats->latency.Record(std::chrono::steady_clock::now() - start);
+        }
+        if (result == SOCKET_ERROR || sent == 0) return false;
+
+        // Skip what went out and retry with the rest
+        while (bufferCount > 0 && sent >= next->len) {
+            sent -= next->len;
+            next++;
+            bufferCount--;
+        }
+        if (bufferCount > 0) {
+            next->buf += sent;
+            next->len -= sent;
+        }
+    }
+    return true;
+}
+
+// Nagle off: input events and small control messages must not wait for
+// an ACK of the previous segment
+inline void SetLowLatency(SOCKET socket) {
+    BOOL noDelay = TRUE;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+}
+
+// Smoothed RTT as measured by the TCP stack (Windows 10 1703 and later)
+inline bool GetRoundTripMicros(SOCKET socket, uint32_t& rttMicros) {
+#ifdef SIO_TCP_INFO
+    DWORD version = 0;
+    TCP_INFO_v0 info = {};
+    DWORD returned = 0;
+    if (WSAIoctl(socket, SIO_TCP_INFO, &version, sizeof(version), &info, sizeof(info),
+                 &returned, NULL, NULL) == 0 && info.RttUs > 0) {
+        rttMicros = info.RttUs;
+        return true;
+    }
+#else
+    (void)socket;
+#endif
+    rttMicros = 0;
+    return false;
+}
+
+// Sizes SO_SNDBUF to twice the bandwidth-delay product. The rate is the
+// peak seen over short windows, which approaches the link rate whenever
+// the link is the bottleneck.
+class SendBufferTuner {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    SendBufferTuner() : m_windowBytes(0), m_peakBytesPerSecond(0), m_rttMicros(0), m_bufferSize(0) {}
+
+    void Reset() {
+        m_windowStart = Clock::now();
+        m_windowBytes = 0;
+        m_peakBytesPerSecond = 0;
+        m_rttMicros = 0;
+        m_bufferSize = 0;
+    }
+
+    // Called with every message sent
+    void Sent(size_t bytes) { m_windowBytes += bytes; }
+
+    // Called periodically; re-applies SO_SNDBUF when the target moved by
+    // more than a quarter
+    void Update(SOCKET socket) {
+        Clock::time_point now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - m_windowStart).count();
+        if (seconds < 0.5) return;
+        double rate = m_windowBytes / seconds;
+        m_peakBytesPerSecond = std::max(rate, m_peakBytesPerSecond * 0.9);
+        m_windowStart = now;
+        m_windowBytes = 0;
+
+        uint32_t rtt = 0;
+        m_rttMicros = GetRoundTripMicros(socket, rtt) ? rtt : DEFAULT_RTT_MICROS;
+
+        double bdp = m_peakBytesPerSecond * m_rttMicros / 1000000.0;
+        int target = static_cast<int>(std::min<double>(std::max<double>(bdp * 2, MIN_SOCKET_BUFFER), MAX_SOCKET_BUFFER));
+        if (m_bufferSize == 0 || target > m_bufferSize * 5 / 4 || target < m_bufferSize * 3 / 4) {
+            if (setsockopt(socket, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&target), sizeof(target)) == 0) {
+                m_bufferSize = target;
+            }
+        }
+    }
+
+    int BufferSize() const { return m_bufferSize; }
+    uint32_t RttMicros() const { return m_rttMicros; }
+    double PeakBytesPerSecond() const { return m_peakBytesPerSecond; }
+
+private:
+    Clock::time_point m_windowStart;
+    size_t m_windowBytes;
+    double m_peakBytesPerSecond;
+    uint32_t m_rttMicros;
+    int m_bufferSize;
+};
+
+#endif // SOCKET_IO_H
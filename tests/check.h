@@ -0,0 +1,22 @@
+// ===== tests/check.h =====
+// Minimal assertions for the test programs: a failed CHECK prints where
+// and continues, and CHECK_RESULT() is the exit code
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdio>
+
+static int g_checkFailures = 0;
+
+#define CHECK(condition)                                                          \
+    do {                                                                          \
+        if (!(condition)) {                                                       \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+                         #condition);                                             \
+            g_checkFailures++;                                                    \
+        }                                                                         \
+    } while (0)
+
+#define CHECK_RESULT() (g_checkFailures ? (std::fprintf(stderr, "%d checks failed\n", g_checkFailures), 1) : 0)
+
+#endif // CHECK_H
@@ -0,0 +1,1110 @@
+// ===== tests/codec_bench.cpp =====
+// Throughput and size of the tile codecs on synthetic 1920x1080 screens:
+// terminal text (FillSyntheticTerminal) and moving noise
+// (FillSyntheticVideo), coded the way the host does: predictive tile by
+// tile, on their own codes and with a shared table built from the same
+// screen, and QOI in keyframe bands of one tile row. Next to them, LZ on
+// the same tiles and bands as 24-bit pixels (zlib if the bench was built
+// with it, RD_HAVE_ZLIB, otherwise a small LZ77 of its own), on tiles
+// also primed with a dictionary sampled from the same screen, and the
+// BMP frames keyframes used to be sent as.
+//
+// The scaling run encodes a 3840x2160 screen, text on one half and noise
+// on the other, tile by tile with EncodeExactBatch on pools of 1 up to
+// [threads] threads (all cores by default) and reports the speedup.
+//
+// Each reduced color depth is timed with EncodeFrame on both screens.
+//
+// The idle soak runs ten simulated minutes of a static terminal whose
+// clock changes once a minute, at a fixed rate and with FrameScheduler
+// backing off, and reports captures, CPU and bytes per minute.
+//
+// The video region run plays a video in a window over terminal text and
+// reports how soon and how closely VideoRegionDetector finds it, and the
+// bytes per frame with the region sent lossy against all of it exact.
+//
+// The glyph run scrolls terminal output a line per frame and compares
+// the bytes of its changed tiles sent through the glyph cache, as the
+// host does, against all of them as predictive tiles.
+//
+// The video codec run pans 1080p frames of a smooth picture and of text
+// through VideoEncoder held to 2 to 20 Mbit/s at 30 fps and reports the
+// bitrate reached, PSNR, and encode and decode frame rates.
+//
+// The lossy link run sends frame messages as datagrams through
+// DatagramImpairment at 0 to 10% loss, with reordering and jitter, and
+// reports what arrives, what parity rebuilt and what parity costs.
+//
+// The control channel run sends cursor updates over a loopback TCP
+// connection through a SendGate, on an idle link and while 8 MB frames
+// keep it saturated, sent whole and in 64 KB pieces, and reports how long
+// the updates take to arrive. The send run writes messages of header,
+// metadata and payload as a send() per part, with Nagle on and off, and
+// as one gather write, and reports syscalls and round trip per message
+// (POSIX sockets only).
+//
+// The transport run pushes 1 GB of frame pieces over loopback TCP with
+// blocking gather writes, EpollTransport and IoUringTransport, copied and
+// zero-copy, and reports throughput and process CPU per GB, both ends
+// included (Linux only).
+// Not a test; run it by hand (codec_bench [frames] [threads]) to compare
+// changes.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef RD_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include "uring_transport.h"
+#endif
+
+#include "color_depth.h"
+#include "datagram.h"
+#include "frame_scheduler.h"
+#include "glyph_cache.h"
+#include "io_slice.h"
+#include "latency_histogram.h"
+#include "plane_batch.h"
+#include "predictive_codec.h"
+#include "protocol.h"
+#include "qoi_codec.h"
+#include "send_gate.h"
+#include "tile_priority.h"
+#include "video_codec.h"
+#include "video_region.h"
+
+typedef std::vector<unsigned char> Bytes;
+typedef std::chrono::steady_clock Clock;
+
+#define SCREEN_WIDTH 1920
+#define SCREEN_HEIGHT 1080
+
+struct Screen {
+    const char* name;
+    Bytes pixels;
+    size_t stride;
+    std::vector<TileRect> tiles;
+};
+
+static Screen MakeScreen(const char* name, void (*fill)(unsigned char*, size_t, const TileRect&, uint32_t)) {
+    Screen screen;
+    screen.name = name;
+    screen.stride = (size_t)SCREEN_WIDTH * 4;
+    screen.pixels.resize(screen.stride * SCREEN_HEIGHT);
+    fill(screen.pixels.data(), screen.stride, TileRect{0, 0, SCREEN_WIDTH, SCREEN_HEIGHT}, 1);
+    for (int y = 0; y < SCREEN_HEIGHT; y += TILE_SIZE) {
+        for (int x = 0; x < SCREEN_WIDTH; x += TILE_SIZE) {
+            screen.tiles.push_back(TileRect{x, y, std::min(TILE_SIZE, SCREEN_WIDTH - x),
+                                            std::min(TILE_SIZE, SCREEN_HEIGHT - y)});
+        }
+    }
+    return screen;
+}
+
+static double Seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void Report(const char* codec, const Screen& screen, int frames, size_t bytes, double encode, double decode) {
+    double megapixels = (double)SCREEN_WIDTH * SCREEN_HEIGHT * frames / 1e6;
+    printf("%-12s %-9s %8.1f KB/frame %6.2f%% of BGRA  encode %7.1f MP/s  decode %7.1f MP/s\n", codec,
+           screen.name, bytes / 1024.0 / frames, 100.0 * bytes / ((double)screen.stride * SCREEN_HEIGHT * frames),
+           megapixels / encode, megapixels / decode);
+}
+
+// With `table`, the encoder may name it and the decoder holds it
+static void BenchPredictive(const Screen& screen, int frames, const PredictiveTable* table) {
+    PredictiveEncoder encoder;
+    PredictiveDecoder decoder;
+    encoder.Reserve(TILE_SIZE, TILE_SIZE);
+    if (table) {
+        unsigned char packed[PREDICTIVE_TABLE_BYTES];
+        table->Pack(packed);
+        decoder.SetTable(table->id, packed);
+        encoder.SetSharedTables(&table, 1);
+    }
+    std::vector<Bytes> payloads(screen.tiles.size(), Bytes(PredictiveMaxSize(TILE_SIZE, TILE_SIZE)));
+    std::vector<size_t> sizes(screen.tiles.size());
+    Bytes decoded(screen.pixels.size());
+
+    size_t bytes = 0;
+    Clock::time_point start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        for (size_t i = 0; i < screen.tiles.size(); ++i) {
+            const TileRect& tile = screen.tiles[i];
+            const unsigned char* pixels = screen.pixels.data() + (size_t)tile.y * screen.stride + (size_t)tile.x * 4;
+            sizes[i] = encoder.Encode(pixels, screen.stride, tile.width, tile.height, payloads[i].data());
+            bytes += sizes[i];
+        }
+    }
+    double encode = Seconds(start);
+    start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        for (size_t i = 0; i < screen.tiles.size(); ++i) {
+            const TileRect& tile = screen.tiles[i];
+            unsigned char* pixels = decoded.data() + (size_t)tile.y * screen.stride + (size_t)tile.x * 4;
+            if (!decoder.Decode(payloads[i].data(), sizes[i], tile.width, tile.height, pixels, screen.stride)) {
+                printf("predictive: tile %zu failed to decode\n", i);
+                return;
+            }
+        }
+    }
+    Report(table ? "predictive+" : "predictive", screen, frames, bytes, encode, Seconds(start));
+}
+
+// ---- LZ reference ----
+// What the tile codecs are held against: zlib's deflate at its default
+// level when built with zlib, otherwise the small LZ77 below. Every tile
+// or band is compressed on its own, as 24-bit pixels, cold or primed
+// with a dictionary both ends hold.
+
+#ifdef RD_HAVE_ZLIB
+#define LZ_NAME "zlib"
+
+static size_t LzMaxSize(size_t size) {
+    return compressBound((uLong)size);
+}
+
+static size_t LzCompress(const unsigned char* data, size_t size, const Bytes& dictionary, unsigned char* out,
+                         size_t outSize) {
+    z_stream stream = {};
+    if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK) return 0;
+    if (!dictionary.empty()) deflateSetDictionary(&stream, dictionary.data(), (uInt)dictionary.size());
+    stream.next_in = const_cast<unsigned char*>(data);
+    stream.avail_in = (uInt)size;
+    stream.next_out = out;
+    stream.avail_out = (uInt)outSize;
+    bool done = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+    size_t written = stream.total_out;
+    deflateEnd(&stream);
+    return done ? written : 0;
+}
+
+static bool LzDecompress(const unsigned char* data, size_t size, const Bytes& dictionary, unsigned char* out,
+                         size_t outSize) {
+    z_stream stream = {};
+    if (inflateInit(&stream) != Z_OK) return false;
+    stream.next_in = const_cast<unsigned char*>(data);
+    stream.avail_in = (uInt)size;
+    stream.next_out = out;
+    stream.avail_out = (uInt)outSize;
+    int result = inflate(&stream, Z_FINISH);
+    if (result == Z_NEED_DICT && inflateSetDictionary(&stream, dictionary.data(), (uInt)dictionary.size()) == Z_OK) {
+        result = inflate(&stream, Z_FINISH);
+    }
+    bool done = result == Z_STREAM_END && stream.total_out == outSize;
+    inflateEnd(&stream);
+    return done;
+}
+
+#else
+#define LZ_NAME "lz77"
+#define LZ_HASH_BITS 14
+
+// Greedy LZ77: tokens of a literal count, the literals, a match length
+// (0 ends the data) and the match offset, numbers as LEB128 varints.
+// Matches of 4 bytes or more are found through a hash of the next 4 bytes
+// and may reach back into the dictionary, which comes right before the data.
+static void PutLzVarint(unsigned char*& out, size_t value) {
+    while (value >= 0x80) {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+}
+
+static bool GetLzVarint(const unsigned char*& in, const unsigned char* end, size_t& value) {
+    value = 0;
+    for (int shift = 0; in < end && shift < 64; shift += 7) {
+        unsigned char byte = *in++;
+        value |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static size_t LzMaxSize(size_t size) {
+    return size + 32;
+}
+
+static size_t LzCompress(const unsigned char* input, size_t inputSize, const Bytes& dictionary, unsigned char* out,
+                         size_t) {
+    // Entries left over from earlier calls are checked like any other
+    static std::vector<uint32_t> head(1u << LZ_HASH_BITS, 0);
+    static Bytes window;
+    window.assign(dictionary.begin(), dictionary.end());
+    window.insert(window.end(), input, input + inputSize);
+    const unsigned char* data = window.data();
+    size_t size = window.size();
+    auto hash = [data](size_t pos) {
+        uint32_t word;
+        memcpy(&word, data + pos, 4);
+        return (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+    };
+    for (size_t pos = 0; pos + 4 <= dictionary.size(); ++pos) head[hash(pos)] = (uint32_t)pos;
+    unsigned char* start = out;
+    size_t pos = dictionary.size(), literals = pos;
+    while (pos + 4 <= size) {
+        uint32_t& slot = head[hash(pos)];
+        size_t candidate = slot;
+        slot = (uint32_t)pos;
+        if (candidate >= pos || memcmp(data + candidate, data + pos, 4) != 0) {
+            pos++;
+            continue;
+        }
+        size_t length = 4;
+        while (pos + length < size && data[candidate + length] == data[pos + length]) length++;
+        PutLzVarint(out, pos - literals);
+        memcpy(out, data + literals, pos - literals);
+        out += pos - literals;
+        PutLzVarint(out, length);
+        PutLzVarint(out, pos - candidate);
+        pos += length;
+        literals = pos;
+    }
+    PutLzVarint(out, size - literals);
+    memcpy(out, data + literals, size - literals);
+    out += size - literals;
+    PutLzVarint(out, 0);
+    return out - start;
+}
+
+static bool LzDecompress(const unsigned char* data, size_t size, const Bytes& dictionary, unsigned char* out,
+                         size_t outSize) {
+    static Bytes window;
+    window.assign(dictionary.begin(), dictionary.end());
+    window.resize(dictionary.size() + outSize);
+    const unsigned char* end = data + size;
+    size_t written = dictionary.size(), count, length, offset;
+    for (;;) {
+        if (!GetLzVarint(data, end, count) || count > (size_t)(end - data) || count > window.size() - written) {
+            return false;
+        }
+        memcpy(window.data() + written, data, count);
+        data += count;
+        written += count;
+        if (!GetLzVarint(data, end, length)) return false;
+        if (!length) break;
+        if (!GetLzVarint(data, end, offset) || !offset || offset > written || length > window.size() - written) {
+            return false;
+        }
+        for (size_t i = 0; i < length; ++i, ++written) window[written] = window[written - offset];
+    }
+    if (written != window.size()) return false;
+    memcpy(out, window.data() + dictionary.size(), outSize);
+    return true;
+}
+#endif
+
+// Every tile packed to 24-bit pixels and LZ-compressed on its own, primed
+// with `dictionary` if it is not empty
+static void BenchLz(const Screen& screen, int frames, const Bytes& dictionary) {
+    Bytes packed(RowStride(PIXEL_FORMAT_BGR24, TILE_SIZE) * TILE_SIZE), unpacked(packed.size());
+    std::vector<Bytes> payloads(screen.tiles.size(), Bytes(LzMaxSize(packed.size())));
+    std::vector<size_t> sizes(screen.tiles.size());
+    PaletteQuantizer quantizer;
+
+    size_t bytes = 0;
+    Clock::time_point start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        for (size_t i = 0; i < screen.tiles.size(); ++i) {
+            const TileRect& tile = screen.tiles[i];
+            const unsigned char* pixels = screen.pixels.data() + (size_t)tile.y * screen.stride + (size_t)tile.x * 4;
+            EncodeFrame(PIXEL_FORMAT_BGR24, pixels, screen.stride, tile.width, tile.height, packed.data(), quantizer);
+            sizes[i] = LzCompress(packed.data(), EncodedFrameSize(PIXEL_FORMAT_BGR24, tile.width, tile.height),
+                                  dictionary, payloads[i].data(), payloads[i].size());
+            bytes += sizes[i];
+        }
+    }
+    double encode = Seconds(start);
+    start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        for (size_t i = 0; i < screen.tiles.size(); ++i) {
+            const TileRect& tile = screen.tiles[i];
+            if (!LzDecompress(payloads[i].data(), sizes[i], dictionary, unpacked.data(),
+                              EncodedFrameSize(PIXEL_FORMAT_BGR24, tile.width, tile.height))) {
+                printf(LZ_NAME ": tile %zu failed to decode\n", i);
+                return;
+            }
+        }
+    }
+    Report(dictionary.empty() ? LZ_NAME : LZ_NAME "+dict", screen, frames, bytes, encode, Seconds(start));
+}
+
+static void BenchQoi(const Screen& screen, int frames) {
+    std::vector<Bytes> payloads;
+    std::vector<size_t> sizes;
+    for (int y = 0; y < SCREEN_HEIGHT; y += TILE_SIZE) {
+        payloads.push_back(Bytes(QoiMaxSize(SCREEN_WIDTH, std::min(TILE_SIZE, SCREEN_HEIGHT - y))));
+        sizes.push_back(0);
+    }
+    Bytes decoded(screen.pixels.size());
+
+    size_t bytes = 0;
+    Clock::time_point start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        for (size_t band = 0; band < payloads.size(); ++band) {
+            int y = (int)band * TILE_SIZE;
+            sizes[band] = QoiEncode(screen.pixels.data() + (size_t)y * screen.stride, screen.stride, SCREEN_WIDTH,
+                                    std::min(TILE_SIZE, SCREEN_HEIGHT - y), payloads[band].data());
+            bytes += sizes[band];
+        }
+    }
+    double encode = Seconds(start);
+    start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        for (size_t band = 0; band < payloads.size(); ++band) {
+            int y = (int)band * TILE_SIZE;
+            if (!QoiDecode(payloads[band].data(), sizes[band], SCREEN_WIDTH, std::min(TILE_SIZE, SCREEN_HEIGHT - y),
+                           decoded.data() + (size_t)y * screen.stride, screen.stride)) {
+                printf("qoi: band %zu failed to decode\n", band);
+                return;
+            }
+        }
+    }
+    Report("qoi", screen, frames, bytes, encode, Seconds(start));
+}
+
+// What QOI keyframes replace: a BMP file of the whole frame (24-bit,
+// bottom-up rows padded to 4 bytes), and the same bands LZ-compressed
+static void BenchKeyframeReference(const Screen& screen, int frames) {
+    const size_t bmpHeaders = 14 + 40, bmpStride = RowStride(PIXEL_FORMAT_BGR24, SCREEN_WIDTH, 4);
+    Bytes bmp(bmpHeaders + bmpStride * SCREEN_HEIGHT), decoded(screen.pixels.size());
+    Clock::time_point start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        ConvertFrame(PIXEL_FORMAT_BGRA32, screen.pixels.data(), screen.stride, PIXEL_FORMAT_BGR24,
+                     bmp.data() + bmpHeaders, bmpStride, SCREEN_WIDTH, SCREEN_HEIGHT, true);
+    }
+    double encode = Seconds(start);
+    start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        ConvertFrame(PIXEL_FORMAT_BGR24, bmp.data() + bmpHeaders, bmpStride, PIXEL_FORMAT_BGRA32, decoded.data(),
+                     screen.stride, SCREEN_WIDTH, SCREEN_HEIGHT, true);
+    }
+    Report("bmp", screen, frames, bmp.size() * frames, encode, Seconds(start));
+
+    size_t bandBytes = RowStride(PIXEL_FORMAT_BGR24, SCREEN_WIDTH) * TILE_SIZE;
+    Bytes packed(bandBytes);
+    std::vector<Bytes> payloads;
+    std::vector<size_t> sizes;
+    for (int y = 0; y < SCREEN_HEIGHT; y += TILE_SIZE) {
+        payloads.push_back(Bytes(LzMaxSize(bandBytes)));
+        sizes.push_back(0);
+    }
+    PaletteQuantizer quantizer;
+    size_t bytes = 0;
+    start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        for (size_t band = 0; band < payloads.size(); ++band) {
+            int y = (int)band * TILE_SIZE, height = std::min(TILE_SIZE, SCREEN_HEIGHT - y);
+            EncodeFrame(PIXEL_FORMAT_BGR24, screen.pixels.data() + (size_t)y * screen.stride, screen.stride,
+                        SCREEN_WIDTH, height, packed.data(), quantizer);
+            sizes[band] = LzCompress(packed.data(), EncodedFrameSize(PIXEL_FORMAT_BGR24, SCREEN_WIDTH, height),
+                                     Bytes(), payloads[band].data(), payloads[band].size());
+            bytes += sizes[band];
+        }
+    }
+    encode = Seconds(start);
+    start = Clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        for (size_t band = 0; band < payloads.size(); ++band) {
+            int height = std::min(TILE_SIZE, SCREEN_HEIGHT - (int)band * TILE_SIZE);
+            if (!LzDecompress(payloads[band].data(), sizes[band], Bytes(), packed.data(),
+                              EncodedFrameSize(PIXEL_FORMAT_BGR24, SCREEN_WIDTH, height))) {
+                printf(LZ_NAME ": band %zu failed to decode\n", band);
+                return;
+            }
+        }
+    }
+    Report(LZ_NAME " bands", screen, frames, bytes, encode, Seconds(start));
+}
+
+// The table the host would build after sending this screen
+static PredictiveTable TrainTable(const Screen& screen) {
+    PredictiveEncoder encoder;
+    Bytes payload(PredictiveMaxSize(TILE_SIZE, TILE_SIZE));
+    for (const TileRect& tile : screen.tiles) {
+        const unsigned char* pixels = screen.pixels.data() + (size_t)tile.y * screen.stride + (size_t)tile.x * 4;
+        encoder.Encode(pixels, screen.stride, tile.width, tile.height, payload.data());
+    }
+    uint64_t counts[3][512] = {};
+    uint64_t coldBytes = 0;
+    encoder.CollectStatistics(counts, coldBytes);
+    PredictiveTable table = {};
+    table.id = 1;
+    table.Build(counts);
+    return table;
+}
+
+// An LZ dictionary from the same screen: the middle rows of evenly spaced
+// tiles as 24-bit pixels, up to the 32 KB deflate can reach back
+static Bytes TrainDictionary(const Screen& screen) {
+    const int rows = 8;
+    const size_t rowBytes = RowStride(PIXEL_FORMAT_BGR24, TILE_SIZE), limit = 32 * 1024;
+    size_t samples = limit / (rowBytes * rows);
+    Bytes dictionary(samples * rowBytes * rows);
+    PaletteQuantizer quantizer;
+    for (size_t i = 0; i < samples; ++i) {
+        const TileRect& tile = screen.tiles[i * screen.tiles.size() / samples];
+        size_t y = (size_t)(tile.y + tile.height / 2 - rows / 2);
+        EncodeFrame(PIXEL_FORMAT_BGR24, screen.pixels.data() + y * screen.stride + (size_t)tile.x * 4, screen.stride,
+                    TILE_SIZE, rows, dictionary.data() + i * rowBytes * rows, quantizer);
+    }
+    return dictionary;
+}
+
+static void BenchColorDepth(const Screen& screen, int frames) {
+    static const struct {
+        int format;
+        const char* name;
+    } modes[] = {{PIXEL_FORMAT_BGR24, "bgr24"}, {PIXEL_FORMAT_RGB565, "rgb565"}, {PIXEL_FORMAT_PALETTE8, "palette8"},
+                 {PIXEL_FORMAT_GRAY8, "gray8"}};
+    PaletteQuantizer quantizer;
+    for (const auto& mode : modes) {
+        Bytes encoded(EncodedFrameSize(mode.format, SCREEN_WIDTH, SCREEN_HEIGHT));
+        Clock::time_point start = Clock::now();
+        for (int frame = 0; frame < frames; ++frame) {
+            EncodeFrame(mode.format, screen.pixels.data(), screen.stride, SCREEN_WIDTH, SCREEN_HEIGHT, encoded.data(),
+                        quantizer);
+        }
+        double seconds = Seconds(start);
+        printf("%-12s %-9s %8.1f KB/frame %6.2f%% of BGRA  encode %7.2f ms/frame\n", mode.name, screen.name,
+               encoded.size() / 1024.0, 100.0 * encoded.size() / ((double)screen.stride * SCREEN_HEIGHT),
+               seconds * 1000 / frames);
+    }
+}
+
+// A 4K capture as plane_batch.h reads it
+struct Screen4K {
+    size_t stride;
+    Bytes pixels;
+
+    Screen4K() : stride((size_t)3840 * 4), pixels(stride * 2160) {
+        FillSyntheticTerminal(pixels.data(), stride, TileRect{0, 0, 1920, 2160}, 1);
+        FillSyntheticVideo(pixels.data(), stride, TileRect{1920, 0, 1920, 2160}, 1);
+    }
+    const unsigned char* Pixels() const { return pixels.data(); }
+    size_t Stride() const { return stride; }
+    int Width() const { return 3840; }
+    int Height() const { return 2160; }
+};
+
+static void BenchScaling(int frames, unsigned maxThreads) {
+    Screen4K screen;
+    std::vector<TileRect> tiles;
+    for (int y = 0; y < screen.Height(); y += TILE_SIZE) {
+        for (int x = 0; x < screen.Width(); x += TILE_SIZE) {
+            tiles.push_back(TileRect{x, y, std::min(TILE_SIZE, screen.Width() - x),
+                                     std::min(TILE_SIZE, screen.Height() - y)});
+        }
+    }
+    double single = 0;
+    for (unsigned threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+        WorkStealingPool pool(threads);
+        std::vector<PredictiveEncoder> encoders(pool.ThreadCount());
+        for (PredictiveEncoder& encoder : encoders) encoder.Reserve(TILE_SIZE, TILE_SIZE);
+        PlaneBatch batch;
+        EncodeExactBatch(pool, screen, 0, TILE_PREDICTIVE, tiles, encoders, batch); // warm-up
+        Clock::time_point start = Clock::now();
+        for (int frame = 0; frame < frames; ++frame) {
+            EncodeExactBatch(pool, screen, 0, TILE_PREDICTIVE, tiles, encoders, batch);
+        }
+        double seconds = Seconds(start) / frames;
+        if (threads == 1) single = seconds;
+        printf("scaling 4K   %2u threads %8.1f ms/frame  %5.2fx\n", threads, seconds * 1000, single / seconds);
+        if (threads == maxThreads) break;
+    }
+}
+
+// One simulated session: capture on the scheduler's interval, hash, and
+// encode what changed. CPU is process time for that work, not wall time.
+static void SoakIdle(const char* mode, FrameScheduler& scheduler, Screen screen, int minutes) {
+    DirtyTileTracker tracker;
+    PredictiveEncoder encoder;
+    encoder.Reserve(TILE_SIZE, TILE_SIZE);
+    Bytes payload(PredictiveMaxSize(TILE_SIZE, TILE_SIZE));
+    TileRect clock = {SCREEN_WIDTH - 8 * TILE_SIZE, 0, 8 * TILE_SIZE, TILE_SIZE};
+
+    long long elapsedMs = 0, nextTickMs = 0;
+    uint32_t tick = 0;
+    size_t captures = 0, bytes = 0;
+    std::clock_t start = std::clock();
+    while (elapsedMs < minutes * 60000LL) {
+        if (elapsedMs >= nextTickMs) {
+            FillSyntheticTerminal(screen.pixels.data(), screen.stride, clock, ++tick);
+            nextTickMs += 60000;
+        }
+        captures++;
+        size_t dirty = tracker.Update(screen.pixels.data(), SCREEN_WIDTH, SCREEN_HEIGHT, (int)screen.stride, 4, false);
+        for (const TileRect& tile : tracker.DirtyTiles()) {
+            const unsigned char* pixels = screen.pixels.data() + (size_t)tile.y * screen.stride + (size_t)tile.x * 4;
+            bytes += encoder.Encode(pixels, screen.stride, tile.width, tile.height, payload.data());
+        }
+        scheduler.FrameResult(dirty > 0);
+        elapsedMs += scheduler.CurrentIntervalMs();
+    }
+    double cpu = (double)(std::clock() - start) / CLOCKS_PER_SEC;
+    printf("idle soak %-9s %7.1f captures/min  %8.1f ms CPU/min  %8.1f KB/min\n", mode, (double)captures / minutes,
+           cpu * 1000 / minutes, bytes / 1024.0 / minutes);
+}
+
+static void BenchIdleSoak(const Screen& screen) {
+    const int minutes = 10;
+    FrameScheduler fixed(100, 33, 100, 1 << 30);
+    FrameScheduler adaptive(100, 33, 2000, 5);
+    SoakIdle("fixed", fixed, screen, minutes);
+    SoakIdle("adaptive", adaptive, screen, minutes);
+}
+
+// A terminal screen with a 640x360 video playing in a window: how soon
+// and how well VideoRegionDetector finds the video, and bytes per frame
+// with every changed tile exact (predictive) against the region sent as
+// RGB565 at full and half scale and only the tiles around it exact
+static void BenchVideoRegion(int frames) {
+    frames = std::max(frames, 60);
+    Screen screen = MakeScreen("video-in-window", FillSyntheticTerminal);
+    const TileRect video = {410, 300, 640, 360};
+    DirtyTileTracker tracker;
+    VideoRegionDetector detector;
+    detector.Reset(SCREEN_WIDTH, SCREEN_HEIGHT);
+    PredictiveEncoder encoder;
+    encoder.Reserve(TILE_SIZE, TILE_SIZE);
+    PaletteQuantizer quantizer;
+    Bytes payload(PredictiveMaxSize(TILE_SIZE, TILE_SIZE)), scaled, encoded;
+
+    int firstDetected = -1, detected = 0;
+    double overlap = 0;
+    size_t exactBytes = 0, regionBytes[2] = {}, regionFrames = 0;
+    tracker.Update(screen.pixels.data(), SCREEN_WIDTH, SCREEN_HEIGHT, (int)screen.stride, 4, false);
+    for (int frame = 0; frame < frames; ++frame) {
+        FillSyntheticVideo(screen.pixels.data(), screen.stride, video, frame + 1);
+        tracker.Update(screen.pixels.data(), SCREEN_WIDTH, SCREEN_HEIGHT, (int)screen.stride, 4, false);
+        detector.Update(tracker.DirtyTiles(), screen.pixels.data(), screen.stride);
+        const TileRect& region = detector.Region();
+        if (detector.Active()) {
+            if (firstDetected < 0) firstDetected = frame;
+            detected++;
+            overlap += RegionOverlap(region, video);
+        }
+
+        size_t exact = 0, outside = 0;
+        for (const TileRect& tile : tracker.DirtyTiles()) {
+            const unsigned char* pixels = screen.pixels.data() + (size_t)tile.y * screen.stride + (size_t)tile.x * 4;
+            size_t size = sizeof(RawFrame) + encoder.Encode(pixels, screen.stride, tile.width, tile.height,
+                                                            payload.data());
+            exact += size;
+            bool inside = detector.Active() && tile.x >= region.x && tile.y >= region.y &&
+                          tile.x + tile.width <= region.x + region.width &&
+                          tile.y + tile.height <= region.y + region.height;
+            if (!inside) outside += size;
+        }
+        exactBytes += exact;
+        if (!detector.Active()) continue;
+        regionFrames++;
+        for (int scale = 0; scale < 2; ++scale) {
+            int width = ScaledSize(region.width, scale), height = ScaledSize(region.height, scale);
+            scaled.resize((size_t)width * height * 4);
+            DownscaleBGRA(screen.pixels.data() + (size_t)region.y * screen.stride + (size_t)region.x * 4,
+                          screen.stride, region.width, region.height, scale, scaled.data(), (size_t)width * 4);
+            encoded.resize(EncodedFrameSize(PIXEL_FORMAT_RGB565, width, height));
+            EncodeFrame(PIXEL_FORMAT_RGB565, scaled.data(), (size_t)width * 4, width, height, encoded.data(),
+                        quantizer);
+            regionBytes[scale] += outside + sizeof(RawFrame) + encoded.size();
+        }
+    }
+    printf("video region first found at frame %d, found in %d%% of frames after, overlap %.0f%%\n", firstDetected,
+           firstDetected < 0 ? 0 : detected * 100 / (frames - firstDetected), detected ? overlap * 100 / detected : 0);
+    printf("video region %8.1f KB/frame all exact, %8.1f KB/frame region RGB565, %8.1f KB/frame at half scale\n",
+           exactBytes / 1024.0 / frames, regionBytes[0] / 1024.0 / std::max<size_t>(1, regionFrames),
+           regionBytes[1] / 1024.0 / std::max<size_t>(1, regionFrames));
+}
+
+// Terminal output scrolling a line per frame, its changed tiles sent
+// the way the host sends text: runs of up to PRIORITY_RUN_TILES tiles in
+// a row as glyph areas, tiles the glyph cache turns down predictive,
+// against every changed tile predictive
+static void BenchGlyphs(int frames) {
+    frames = std::max(frames, 30);
+    Screen screen = MakeScreen("scrolling", FillSyntheticTerminal);
+    const TileRect whole = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+    DirtyTileTracker tracker;
+    PredictiveEncoder encoder;
+    encoder.Reserve(TILE_SIZE, TILE_SIZE);
+    GlyphEncoder glyphEncoder;
+    glyphEncoder.Reserve(PRIORITY_RUN_TILES * TILE_SIZE * TILE_SIZE);
+    Bytes payload(PredictiveMaxSize(TILE_SIZE, TILE_SIZE)), glyphData;
+
+    size_t tileBytes = 0, glyphBytes = 0, placements = 0, definitions = 0, pixels = 0;
+    double tileSeconds = 0, glyphSeconds = 0;
+    tracker.Update(screen.pixels.data(), SCREEN_WIDTH, SCREEN_HEIGHT, (int)screen.stride, 4, false);
+    for (int frame = 0; frame < frames; ++frame) {
+        FillSyntheticTerminal(screen.pixels.data(), screen.stride, whole, frame + 2);
+        tracker.Update(screen.pixels.data(), SCREEN_WIDTH, SCREEN_HEIGHT, (int)screen.stride, 4, false);
+        const std::vector<TileRect>& tiles = tracker.DirtyTiles();
+        auto tileSize = [&](const TileRect& tile) {
+            const unsigned char* data = screen.pixels.data() + (size_t)tile.y * screen.stride + (size_t)tile.x * 4;
+            return sizeof(RawFrame) + encoder.Encode(data, screen.stride, tile.width, tile.height, payload.data());
+        };
+
+        Clock::time_point start = Clock::now();
+        for (const TileRect& tile : tiles) tileBytes += tileSize(tile);
+        tileSeconds += Seconds(start);
+
+        start = Clock::now();
+        for (size_t i = 0; i < tiles.size();) {
+            TileRect area = tiles[i];
+            size_t end = i + 1;
+            for (; end < tiles.size() && tiles[end].y == area.y && tiles[end].x == area.x + area.width &&
+                   area.width < PRIORITY_RUN_TILES * TILE_SIZE; ++end) {
+                area.width += tiles[end].width;
+            }
+            pixels += (size_t)area.width * area.height;
+            GlyphFrame glyphFrame = {};
+            glyphData.clear();
+            if (glyphEncoder.Encode(screen.pixels.data() + (size_t)area.y * screen.stride + (size_t)area.x * 4,
+                                    screen.stride, area.width, area.height, glyphFrame, glyphData)) {
+                glyphBytes += glyphData.size();
+                placements += glyphEncoder.LastPlacements();
+                definitions += glyphEncoder.LastDefinitions();
+            } else {
+                for (size_t k = i; k < end; ++k) glyphBytes += tileSize(tiles[k]);
+            }
+            i = end;
+        }
+        glyphSeconds += Seconds(start);
+    }
+    printf("terminal scroll %8.1f KB/frame as tiles, %8.1f KB/frame with glyphs (%zu%% of glyphs cached)  "
+           "encode %7.1f MP/s against %7.1f MP/s\n", tileBytes / 1024.0 / frames, glyphBytes / 1024.0 / frames,
+           placements ? (placements - definitions) * 100 / placements : 0, pixels / 1e6 / glyphSeconds,
+           pixels / 1e6 / tileSeconds);
+}
+
+// 1080p panning 8 pixels a frame across a smooth picture and across
+// terminal text, coded by VideoEncoder with its own rate control held to
+// a range of bitrates at 30 fps: bitrate reached, luma PSNR, and encode
+// (on `threads` threads) and decode frame rates
+static void BenchVideoCodec(int frames, unsigned threads) {
+    frames = std::max(frames, 60);
+    const int pan = 8, sourceWidth = 2 * SCREEN_WIDTH;
+    const size_t sourceStride = (size_t)sourceWidth * 4;
+    Bytes smooth(sourceStride * SCREEN_HEIGHT), text(sourceStride * SCREEN_HEIGHT);
+    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+        for (int x = 0; x < sourceWidth; ++x) {
+            unsigned char* out = &smooth[(size_t)y * sourceStride + (size_t)x * 4];
+            out[0] = (unsigned char)(128 + 90 * std::sin(x / 23.0) * std::cos(y / 31.0));
+            out[1] = (unsigned char)(128 + 100 * std::sin((x + 2 * y) / 41.0));
+            out[2] = (unsigned char)(128 + 80 * std::cos((x - y) / 17.0));
+            out[3] = 0xFF;
+        }
+    }
+    FillSyntheticTerminal(text.data(), sourceStride, TileRect{0, 0, sourceWidth, SCREEN_HEIGHT}, 1);
+
+    static const struct {
+        const char* name;
+        const Bytes* source;
+    } scenes[] = {{"smooth", &smooth}, {"text", &text}};
+    const double megabits[] = {2, 5, 10, 20};
+    WorkStealingPool pool(threads);
+    Bytes encoded;
+    for (const auto& scene : scenes) {
+        for (double rate : megabits) {
+            size_t budget = (size_t)(rate * 1e6 / 8 / 30);
+            VideoEncoder encoder;
+            VideoDecoder decoder;
+            size_t bytes = 0;
+            double psnr = 0, encodeSeconds = 0, decodeSeconds = 0;
+            for (int frame = 0; frame < frames; ++frame) {
+                const unsigned char* pixels = scene.source->data() + (size_t)(frame * pan % SCREEN_WIDTH) * 4;
+                Clock::time_point start = Clock::now();
+                encoder.Encode(pixels, sourceStride, SCREEN_WIDTH, SCREEN_HEIGHT, 0, &pool, encoded);
+                encodeSeconds += Seconds(start);
+                encoder.Adapt(encoded.size(), budget);
+                bytes += encoded.size();
+                psnr += encoder.LastPsnr();
+
+                VideoFrame header;
+                memcpy(&header, encoded.data(), sizeof(header));
+                start = Clock::now();
+                if (!decoder.Decode(header, encoded.data() + sizeof(header), encoded.size() - sizeof(header))) {
+                    printf("video codec: frame %d failed to decode\n", frame);
+                    return;
+                }
+                decodeSeconds += Seconds(start);
+            }
+            printf("video codec %-6s %4.0f Mbit/s target %6.2f Mbit/s  PSNR %5.1f dB  quantizer %2d  "
+                   "encode %6.1f fps (%u threads)  decode %6.1f fps\n", scene.name, rate,
+                   bytes * 8 * 30 / 1e6 / frames, psnr / frames, encoder.Quantizer(), frames / encodeSeconds,
+                   pool.ThreadCount(), frames / decodeSeconds);
+        }
+    }
+}
+
+// Frame messages of 2 to 60 KB through DatagramImpairment at rising loss
+// rates, with the parity group FecGroupSize picks for each: how many
+// arrive, how many parity rebuilt, and what the parity costs
+static void LossyLink(unsigned lossPercent) {
+    const uint32_t token = 0x5EED1234u, messages = 2000;
+    char spec[64];
+    snprintf(spec, sizeof(spec), "loss=%u,reorder=3,jitter=4,seed=%u", lossPercent, lossPercent + 1);
+    DatagramImpairment impairment;
+    impairment.Parse(spec);
+    DatagramPacketizer packetizer(token);
+    packetizer.SetGroupSize(FecGroupSize(lossPercent / 100.0));
+    DatagramReassembler reassembler(token);
+
+    Bytes message(60 * 1024);
+    for (size_t i = 0; i < message.size(); ++i) message[i] = (unsigned char)(i * 131 + (i >> 7));
+    size_t payloadBytes = 0, wireBytes = 0, delivered = 0, lost = 0;
+    auto emit = [&reassembler](const unsigned char* data, size_t size) { reassembler.Accept(data, size); };
+    auto count = [&impairment, &emit, &wireBytes](const unsigned char* data, size_t size) {
+        wireBytes += size;
+        impairment.Send(data, size, emit);
+    };
+    auto deliver = [&delivered](const unsigned char*, size_t) { delivered++; };
+    auto giveUp = [&lost](uint32_t) { lost++; };
+    DatagramReassembler::Clock::time_point now = DatagramReassembler::Clock::now();
+    Clock::time_point start = Clock::now();
+    for (uint32_t i = 0; i < messages; ++i) {
+        IoSlice slice = {message.data(), 2048 + (i * 7919) % (message.size() - 2048)};
+        payloadBytes += slice.size;
+        packetizer.Send(&slice, 1, count);
+        now += std::chrono::milliseconds(5);
+        reassembler.Poll(now, deliver, giveUp);
+    }
+    impairment.Flush(emit);
+    packetizer.SendMark(emit);
+    reassembler.Poll(now, deliver, giveUp);
+    reassembler.Poll(now + std::chrono::seconds(1), deliver, giveUp);
+    double seconds = Seconds(start);
+    printf("udp loss %2u%%  parity 1 in %2d  %6.2f%% delivered  %5u rebuilt  %5zu lost  overhead %5.1f%%  "
+           "%7.1f MB/s\n", lossPercent, packetizer.GroupSize(), 100.0 * delivered / messages, reassembler.Recovered(),
+           lost, 100.0 * wireBytes / payloadBytes - 100, payloadBytes / 1e6 / seconds);
+}
+
+static void BenchLossyLink() {
+    const unsigned rates[] = {0, 1, 3, 5, 10};
+    for (unsigned rate : rates) LossyLink(rate);
+}
+
+#ifndef _WIN32
+// A connected pair of TCP sockets on 127.0.0.1, by default with Nagle off
+// on the sending side like the host's
+static bool ConnectLoopback(int& client, int& server, bool noDelay = true) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    bool ok = listener >= 0 && bind(listener, (sockaddr*)&address, sizeof(address)) == 0 && listen(listener, 1) == 0 &&
+              getsockname(listener, (sockaddr*)&address, &size) == 0;
+    client = ok ? socket(AF_INET, SOCK_STREAM, 0) : -1;
+    ok = ok && client >= 0 && connect(client, (sockaddr*)&address, sizeof(address)) == 0;
+    server = ok ? accept(listener, nullptr, nullptr) : -1;
+    if (listener >= 0) close(listener);
+    int one = 1;
+    if (client >= 0 && noDelay) setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return ok && server >= 0;
+}
+
+static bool WriteAll(int socket, const void* data, size_t size) {
+    const char* p = (const char*)data;
+    while (size > 0) {
+        ssize_t sent = send(socket, p, size, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        p += sent;
+        size -= (size_t)sent;
+    }
+    return true;
+}
+
+static bool ReadAll(int socket, void* data, size_t size) {
+    char* p = (char*)data;
+    while (size > 0) {
+        ssize_t received = recv(socket, p, size, 0);
+        if (received <= 0) return false;
+        p += received;
+        size -= (size_t)received;
+    }
+    return true;
+}
+
+// Cursor updates every 2 ms for a second, with `pieceSize` 0 for an idle
+// link, SIZE_MAX for frames sent whole, or the size of each frame piece.
+// Messages are framed like SendServerMessage frames them.
+static void ControlLatency(const char* mode, size_t pieceSize) {
+    int client, server;
+    if (!ConnectLoopback(client, server)) {
+        printf("control: no loopback connection\n");
+        return;
+    }
+    LatencyHistogram latency;
+    std::atomic<uint64_t> frameBytes(0);
+    std::thread reader([server, &latency, &frameBytes]() {
+        MessageHeader header;
+        Bytes payload;
+        while (ReadAll(server, &header, sizeof(header))) {
+            payload.resize(header.length);
+            if (!ReadAll(server, payload.data(), payload.size())) break;
+            if (header.type == MSG_CURSOR_POSITION) {
+                Clock::time_point sent;
+                memcpy(&sent, payload.data(), sizeof(sent));
+                latency.Record(Clock::now() - sent);
+            } else {
+                frameBytes += header.length;
+            }
+        }
+    });
+
+    SendGate gate;
+    std::atomic<bool> running(pieceSize != 0);
+    std::thread frames([client, pieceSize, &gate, &running]() {
+        Bytes frame(8 << 20, 0x5A);
+        while (running) {
+            for (size_t sent = 0; sent < frame.size() && running;) {
+                size_t length = std::min(pieceSize, frame.size() - sent);
+                MessageHeader piece = {MSG_RAW_FRAME,
+                                       (uint8_t)((sent ? MESSAGE_CONTINUED : 0) |
+                                                 (sent + length < frame.size() ? MESSAGE_MORE : 0)),
+                                       0, (uint32_t)length};
+                SendGate::Hold hold(gate, false);
+                if (!WriteAll(client, &piece, sizeof(piece)) || !WriteAll(client, frame.data() + sent, length)) return;
+                sent += length;
+            }
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < 500; ++i) {
+        unsigned char message[sizeof(MessageHeader) + sizeof(Clock::time_point)];
+        MessageHeader header = {MSG_CURSOR_POSITION, 0, 0, sizeof(Clock::time_point)};
+        Clock::time_point now = Clock::now();
+        memcpy(message, &header, sizeof(header));
+        memcpy(message + sizeof(header), &now, sizeof(now));
+        {
+            SendGate::Hold hold(gate, true);
+            WriteAll(client, message, sizeof(message));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    double seconds = Seconds(start);
+    running = false;
+    frames.join();
+    shutdown(client, SHUT_WR);
+    reader.join();
+    close(client);
+    close(server);
+    printf("control %-16s cursor p50 <=%6llu us  p99 <=%7llu us  max %7llu us  frames %7.1f MB/s\n", mode,
+           (unsigned long long)latency.PercentileMicros(50), (unsigned long long)latency.PercentileMicros(99),
+           (unsigned long long)latency.MaxMicros(), frameBytes / seconds / 1e6);
+}
+
+static void BenchControlLatency() {
+    ControlLatency("idle link", 0);
+    ControlLatency("whole frames", SIZE_MAX);
+    ControlLatency("64 KB pieces", 64 * 1024);
+}
+
+// Write the slices with one writev, again for whatever the kernel did not
+// take; returns the number of calls
+static int WriteGathered(int socket, const IoSlice* slices, int count) {
+    iovec vectors[MAX_IO_SLICES];
+    for (int i = 0; i < count; ++i) vectors[i] = iovec{const_cast<void*>(slices[i].data), slices[i].size};
+    iovec* next = vectors;
+    int calls = 0;
+    while (count > 0) {
+        ssize_t sent = writev(socket, next, count);
+        calls++;
+        if (sent <= 0) return calls;
+        while (count > 0 && (size_t)sent >= next->iov_len) {
+            sent -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count > 0) {
+            next->iov_base = (char*)next->iov_base + sent;
+            next->iov_len -= (size_t)sent;
+        }
+    }
+    return calls;
+}
+
+// A send() per slice; returns the number of calls
+static int WriteSeparately(int socket, const IoSlice* slices, int count) {
+    int calls = 0;
+    for (int i = 0; i < count; ++i) {
+        const char* p = (const char*)slices[i].data;
+        size_t left = slices[i].size;
+        while (left > 0) {
+            ssize_t sent = send(socket, p, left, MSG_NOSIGNAL);
+            calls++;
+            if (sent <= 0) return calls;
+            p += sent;
+            left -= (size_t)sent;
+        }
+    }
+    return calls;
+}
+
+// Messages of a header, a RawFrame and `payloadSize` bytes, each answered
+// with one byte once the receiver has all of it, like a viewer waiting for
+// a frame before it asks for the next one
+static void SendRoundTrip(const char* mode, bool gathered, bool noDelay, size_t payloadSize, int messages) {
+    int client, server;
+    if (!ConnectLoopback(client, server, noDelay)) {
+        printf("send: no loopback connection\n");
+        return;
+    }
+    std::thread echo([server, payloadSize, messages]() {
+        Bytes message(sizeof(MessageHeader) + sizeof(RawFrame) + payloadSize);
+        char ack = 1;
+        for (int i = 0; i < messages; ++i) {
+            if (!ReadAll(server, message.data(), message.size()) || !WriteAll(server, &ack, 1)) return;
+        }
+    });
+
+    MessageHeader header = {MSG_RAW_FRAME, 0, 0, (uint32_t)(sizeof(RawFrame) + payloadSize)};
+    RawFrame rawFrame = RawFrame();
+    Bytes payload(payloadSize, 0x5A);
+    IoSlice slices[3] = {{&header, sizeof(header)}, {&rawFrame, sizeof(rawFrame)}, {payload.data(), payload.size()}};
+    LatencyHistogram latency;
+    uint64_t calls = 0;
+    for (int i = 0; i < messages; ++i) {
+        Clock::time_point start = Clock::now();
+        calls += gathered ? WriteGathered(client, slices, 3) : WriteSeparately(client, slices, 3);
+        char ack;
+        if (!ReadAll(client, &ack, 1)) break;
+        latency.Record(Clock::now() - start);
+    }
+    echo.join();
+    close(client);
+    close(server);
+    printf("send %-16s %7zu B  %5.2f calls/message  round trip p50 <=%6llu us  p99 <=%7llu us\n", mode, payloadSize,
+           (double)calls / messages, (unsigned long long)latency.PercentileMicros(50),
+           (unsigned long long)latency.PercentileMicros(99));
+}
+
+static void BenchSend() {
+    const size_t sizes[] = {16, 4096, 256 * 1024};
+    for (size_t size : sizes) {
+        SendRoundTrip("part by part", false, false, size, 100); // Nagle on: slow, so fewer
+        SendRoundTrip("parts, NODELAY", false, true, size, 1000);
+        SendRoundTrip("one writev", true, true, size, 1000);
+    }
+}
+#endif
+
+#ifdef __linux__
+enum LoopbackSender { SEND_BLOCKING, SEND_EPOLL, SEND_URING, SEND_URING_ZERO_COPY };
+
+// 1 GB as messages of a header and `pieceSize` bytes, sent with `how` to a
+// reader that takes them with plain recv calls
+static void TransportThroughput(const char* mode, LoopbackSender how, size_t pieceSize) {
+    int client, server;
+    if (!ConnectLoopback(client, server)) {
+        printf("transport: no loopback connection\n");
+        return;
+    }
+    std::unique_ptr<Transport> transport;
+    if (how == SEND_EPOLL) {
+        transport.reset(new EpollTransport(client));
+    } else if (how != SEND_BLOCKING) {
+        std::unique_ptr<IoRing> sendRing(new IoRing()), receiveRing(new IoRing());
+        if (!sendRing->Create(URING_ENTRIES) || !receiveRing->Create(URING_ENTRIES)) {
+            printf("transport %-20s no io_uring here\n", mode);
+            close(client);
+            close(server);
+            return;
+        }
+        transport.reset(new IoUringTransport(client, std::move(sendRing), std::move(receiveRing), nullptr,
+                                             how == SEND_URING_ZERO_COPY));
+    }
+
+    size_t messageSize = sizeof(MessageHeader) + pieceSize, messages = ((size_t)1 << 30) / messageSize;
+    std::thread reader([server, messages, messageSize]() {
+        Bytes buffer(1 << 20);
+        for (size_t left = messages * messageSize; left > 0;) {
+            ssize_t received = recv(server, buffer.data(), std::min(left, buffer.size()), 0);
+            if (received <= 0) return;
+            left -= (size_t)received;
+        }
+    });
+
+    MessageHeader header = {MSG_RAW_FRAME, MESSAGE_MORE, 0, (uint32_t)pieceSize};
+    Bytes payload(pieceSize, 0x5A);
+    IoSlice slices[2] = {{&header, sizeof(header)}, {payload.data(), payload.size()}};
+    std::clock_t cpu = std::clock();
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < messages; ++i) {
+        if (transport ? !transport->Send(slices, 2) : WriteGathered(client, slices, 2) == 0) break;
+    }
+    reader.join();
+    double seconds = Seconds(start), cpuSeconds = (double)(std::clock() - cpu) / CLOCKS_PER_SEC;
+    double gigabytes = (double)messages * messageSize / 1e9;
+    if (!transport) close(client);
+    transport.reset();
+    close(server);
+    printf("transport %-20s %5zu KB messages  %8.1f MB/s  %6.0f ms CPU/GB\n", mode, pieceSize / 1024,
+           gigabytes * 1000 / seconds, cpuSeconds * 1000 / gigabytes);
+}
+
+static void BenchTransport() {
+    const size_t sizes[] = {4 * 1024, BULK_CHUNK_SIZE, 1024 * 1024};
+    for (size_t size : sizes) {
+        TransportThroughput("blocking writev", SEND_BLOCKING, size);
+        TransportThroughput("epoll", SEND_EPOLL, size);
+        TransportThroughput("io_uring", SEND_URING, size);
+        TransportThroughput("io_uring zero-copy", SEND_URING_ZERO_COPY, size);
+    }
+}
+#endif
+
+int main(int argc, char** argv) {
+    int frames = argc > 1 ? std::max(1, atoi(argv[1])) : 10;
+    unsigned threads = argc > 2 ? (unsigned)std::max(1, atoi(argv[2]))
+                                : std::max(1u, std::thread::hardware_concurrency());
+    Screen screens[] = {MakeScreen("terminal", FillSyntheticTerminal), MakeScreen("video", FillSyntheticVideo)};
+    for (const Screen& screen : screens) {
+        PredictiveTable table = TrainTable(screen);
+        BenchPredictive(screen, frames, nullptr);
+        BenchPredictive(screen, frames, &table);
+        BenchLz(screen, frames, Bytes());
+        BenchLz(screen, frames, TrainDictionary(screen));
+        BenchQoi(screen, frames);
+        BenchKeyframeReference(screen, frames);
+        BenchColorDepth(screen, frames);
+    }
+    BenchScaling(frames, threads);
+    BenchIdleSoak(screens[0]);
+    BenchVideoRegion(frames);
+    BenchGlyphs(frames);
+    BenchVideoCodec(frames, threads);
+    BenchLossyLink();
+#ifndef _WIN32
+    BenchControlLatency();
+    BenchSend();
+#endif
+#ifdef __linux__
+    BenchTransport();
+#endif
+    return 0;
+}
@@ -0,0 +1,134 @@
+// ===== tests/color_depth_test.cpp =====
+// Reduced color-depth encoders: the SSE2 row quantizers agree with the
+// scalar PixelTraits code at every row length, the dither stays within one
+// 15-bit step, and palette frames expand back close to the source.
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "color_depth.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+static Bytes Bgra(int width, int height, uint32_t seed) {
+    Bytes pixels((size_t)width * height * 4);
+    uint32_t state = seed * 2654435761u + 1;
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        pixels[i] = (i & 3) == 3 ? 0xFF : (unsigned char)state;
+    }
+    return pixels;
+}
+
+// Lengths on both sides of the 4- and 16-pixel vector loops
+static void TestRowQuantizers() {
+    Bytes row = Bgra(67, 1, 1);
+    for (int width = 0; width <= 67; ++width) {
+        Bytes rgb565(width * 2 + 1, 0xAB), gray(width + 1, 0xAB);
+        QuantizeRowRGB565(row.data(), rgb565.data(), width);
+        QuantizeRowGray8(row.data(), gray.data(), width);
+        for (int x = 0; x < width; ++x) {
+            unsigned char expected[2];
+            uint32_t rgb = PixelTraits<PIXEL_FORMAT_BGRA32>::Load(&row[x * 4]);
+            PixelTraits<PIXEL_FORMAT_RGB565>::Store(expected, rgb);
+            CHECK(rgb565[x * 2] == expected[0] && rgb565[x * 2 + 1] == expected[1]);
+            CHECK(gray[x] == Luma(rgb));
+        }
+        CHECK(rgb565[width * 2] == 0xAB && gray[width] == 0xAB); // nothing written past the row
+    }
+}
+
+static void TestDither() {
+    Bytes row = Bgra(35, 1, 2);
+    row[0] = row[1] = row[2] = 0xFF; // saturates rather than wrapping
+    std::vector<uint32_t> colors(35);
+    for (int y = 0; y < 4; ++y) {
+        DitherRow555(row.data(), colors.data(), 35, y);
+        for (int x = 0; x < 35; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                int level = (colors[x] >> (c * 5)) & 0x1F;
+                int source = row[x * 4 + c];
+                CHECK(level == std::min(source + kBayer4x4[y & 3][x & 3], 255) >> 3);
+            }
+        }
+        CHECK(colors[0] == 0x7FFF);
+    }
+}
+
+// Encode with EncodeFrame and expand back to BGRA
+static Bytes PaletteRoundTrip(PaletteQuantizer& quantizer, const Bytes& bgra, int width, int height) {
+    Bytes encoded(EncodedFrameSize(PIXEL_FORMAT_PALETTE8, width, height));
+    CHECK(encoded.size() == (size_t)width * height + PALETTE_SIZE * 4);
+    CHECK(EncodeFrame(PIXEL_FORMAT_PALETTE8, bgra.data(), (size_t)width * 4, width, height, encoded.data(), quantizer));
+    Bytes back(bgra.size());
+    ExpandPalette8(encoded.data(), encoded.data() + PALETTE_SIZE * 4, width, back.data(), (size_t)width * 4, width,
+                   height, false);
+    return back;
+}
+
+static int MaxError(const Bytes& a, const Bytes& b) {
+    int error = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if ((i & 3) != 3) error = std::max(error, std::abs(a[i] - b[i]));
+    }
+    return error;
+}
+
+static void TestPalette() {
+    PaletteQuantizer quantizer;
+    const int width = 96, height = 40;
+
+    // A screen of a few flat colors keeps each of them within dither range
+    Bytes blocks((size_t)width * height * 4);
+    const uint32_t colors[6] = {0x000000, 0xFFFFFF, 0x1E1E1E, 0x3C78D8, 0xE06C75, 0x98C379};
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            PixelTraits<PIXEL_FORMAT_BGRA32>::Store(&blocks[((size_t)y * width + x) * 4], colors[(x / 16 + y / 20) % 6]);
+        }
+    }
+    CHECK(MaxError(PaletteRoundTrip(quantizer, blocks, width, height), blocks) <= 12);
+
+    // Noise has far more colors than the palette: the error is bounded,
+    // not small, and every pixel is opaque
+    Bytes noise = Bgra(width, height, 3);
+    Bytes back = PaletteRoundTrip(quantizer, noise, width, height);
+    long long total = 0;
+    for (size_t i = 0; i < noise.size(); ++i) {
+        if ((i & 3) == 3) CHECK(back[i] == 0xFF);
+        else total += std::abs(noise[i] - back[i]);
+    }
+    CHECK(total / (noise.size() * 3 / 4) < 40);
+
+    // The palette follows the frame: the first screen comes back as before
+    CHECK(MaxError(PaletteRoundTrip(quantizer, blocks, width, height), blocks) <= 12);
+}
+
+static void TestEncodeFrame() {
+    const int width = 21, height = 5;
+    Bytes bgra = Bgra(width, height, 4);
+    PaletteQuantizer quantizer;
+    const int formats[] = {PIXEL_FORMAT_BGRA32, PIXEL_FORMAT_BGR24, PIXEL_FORMAT_RGB565, PIXEL_FORMAT_GRAY8};
+    for (int format : formats) {
+        Bytes encoded(EncodedFrameSize(format, width, height));
+        CHECK(encoded.size() == RowStride(format, width) * height);
+        CHECK(EncodeFrame(format, bgra.data(), (size_t)width * 4, width, height, encoded.data(), quantizer));
+        Bytes direct(encoded.size());
+        ConvertFrame(PIXEL_FORMAT_BGRA32, bgra.data(), width * 4, format, direct.data(), RowStride(format, width), width,
+                     height, false);
+        CHECK(direct == encoded);
+    }
+    Bytes out(16);
+    CHECK(!EncodeFrame(0, bgra.data(), (size_t)width * 4, width, height, out.data(), quantizer));
+}
+
+int main() {
+    TestRowQuantizers();
+    TestDither();
+    TestPalette();
+    TestEncodeFrame();
+    return CHECK_RESULT();
+}
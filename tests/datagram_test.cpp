@@ -0,0 +1,266 @@
+// ===== tests/datagram_test.cpp =====
+// DatagramPacketizer and DatagramReassembler: XOR parity repair, in-order
+// delivery, giving up on messages that cannot be rebuilt, a long run
+// through DatagramImpairment (loss, duplication, reordering, jitter), and
+// UpdateEndGate holding update ends until their frames are in.
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "datagram.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+typedef DatagramReassembler::Clock Clock;
+
+#define TOKEN 0x5EED1234u
+
+static Bytes Message(uint32_t seed, size_t size) {
+    Bytes message(size);
+    uint32_t state = seed * 2654435761u + 1;
+    for (unsigned char& byte : message) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        byte = (unsigned char)state;
+    }
+    return message;
+}
+
+// All datagrams of one message, sent as two slices like header + payload
+static std::vector<Bytes> Packetize(DatagramPacketizer& packetizer, const Bytes& message) {
+    std::vector<Bytes> datagrams;
+    size_t split = std::min<size_t>(message.size(), 40);
+    IoSlice slices[2] = {{message.data(), split}, {message.data() + split, message.size() - split}};
+    packetizer.Send(slices, 2, [&datagrams](const unsigned char* data, size_t size) {
+        datagrams.push_back(Bytes(data, data + size));
+    });
+    return datagrams;
+}
+
+struct Receiver {
+    DatagramReassembler reassembler;
+    std::vector<Bytes> delivered;
+    std::vector<uint32_t> lost;
+
+    Receiver() : reassembler(TOKEN) {}
+
+    void Poll(Clock::time_point now) {
+        reassembler.Poll(now, [this](const unsigned char* data, size_t size) { delivered.push_back(Bytes(data, data + size)); },
+                         [this](uint32_t id) { lost.push_back(id); });
+    }
+};
+
+static uint16_t Fragment(const Bytes& datagram) {
+    DatagramHeader header;
+    memcpy(&header, datagram.data(), sizeof(header));
+    return header.fragment;
+}
+
+static void TestCleanDelivery() {
+    DatagramPacketizer packetizer(TOKEN);
+    packetizer.SetGroupSize(4);
+    Receiver receiver;
+    const size_t sizes[] = {1, DATAGRAM_PAYLOAD, DATAGRAM_PAYLOAD + 1, 10 * DATAGRAM_PAYLOAD + 7, 200000};
+    std::vector<Bytes> sent;
+    for (size_t size : sizes) {
+        sent.push_back(Message((uint32_t)size, size));
+        std::vector<Bytes> datagrams = Packetize(packetizer, sent.back());
+        size_t dataCount = (size + DATAGRAM_PAYLOAD - 1) / DATAGRAM_PAYLOAD;
+        CHECK(datagrams.size() == dataCount + ParityCount((int)dataCount, 4));
+        for (const Bytes& datagram : datagrams) {
+            CHECK(datagram.size() <= sizeof(DatagramHeader) + DATAGRAM_PAYLOAD);
+            CHECK(receiver.reassembler.Accept(datagram.data(), datagram.size()));
+        }
+    }
+    receiver.Poll(Clock::now());
+    CHECK(receiver.delivered == sent);
+    CHECK(receiver.lost.empty());
+    CHECK(receiver.reassembler.Recovered() == 0);
+}
+
+// One lost data fragment per parity group, the short last one included,
+// is rebuilt from parity
+static void TestParityRepair() {
+    for (int groupSize = 1; groupSize <= 16; groupSize *= 2) {
+        DatagramPacketizer packetizer(TOKEN);
+        packetizer.SetGroupSize(groupSize);
+        Receiver receiver;
+        Bytes message = Message(groupSize, 37 * DATAGRAM_PAYLOAD + 123);
+        std::vector<Bytes> datagrams = Packetize(packetizer, message);
+        int dataCount = 38, dropped = 0;
+        for (const Bytes& datagram : datagrams) {
+            int fragment = Fragment(datagram);
+            bool lastOfGroup = fragment < dataCount &&
+                               (fragment % groupSize == groupSize - 1 || fragment == dataCount - 1);
+            if (lastOfGroup) {
+                dropped++;
+                continue;
+            }
+            receiver.reassembler.Accept(datagram.data(), datagram.size());
+        }
+        receiver.Poll(Clock::now());
+        CHECK(receiver.delivered.size() == 1 && receiver.delivered[0] == message);
+        CHECK((int)receiver.reassembler.Recovered() == dropped);
+    }
+}
+
+// Two losses in one group cannot be repaired: the message is given up on
+// after the reorder wait, and later ones still arrive in order
+static void TestUnrecoverable() {
+    DatagramPacketizer packetizer(TOKEN);
+    packetizer.SetGroupSize(4);
+    Receiver receiver;
+    Bytes first = Message(1, 8 * DATAGRAM_PAYLOAD), second = Message(2, 3000);
+    for (const Bytes& datagram : Packetize(packetizer, first)) {
+        uint16_t fragment = Fragment(datagram);
+        if (fragment != 1 && fragment != 2) receiver.reassembler.Accept(datagram.data(), datagram.size());
+    }
+    for (const Bytes& datagram : Packetize(packetizer, second)) {
+        receiver.reassembler.Accept(datagram.data(), datagram.size());
+    }
+    Clock::time_point start = Clock::now();
+    receiver.Poll(start);
+    CHECK(receiver.delivered.empty()); // held back behind the gap
+    receiver.Poll(start + std::chrono::milliseconds(DATAGRAM_REORDER_WAIT / 2));
+    CHECK(receiver.delivered.empty());
+    receiver.Poll(start + std::chrono::milliseconds(DATAGRAM_REORDER_WAIT + 1));
+    CHECK(receiver.lost.size() == 1 && receiver.lost[0] == 0);
+    CHECK(receiver.delivered.size() == 1 && receiver.delivered[0] == second);
+    CHECK(receiver.reassembler.NextId() == 2);
+}
+
+// The last message's loss only shows once a mark says it was sent in full
+static void TestMarkEndsWait() {
+    DatagramPacketizer packetizer(TOKEN);
+    Receiver receiver;
+    Packetize(packetizer, Message(3, 100)); // never arrives
+    Clock::time_point start = Clock::now();
+    receiver.Poll(start + std::chrono::seconds(1));
+    CHECK(receiver.lost.empty());
+    packetizer.SendMark([&receiver](const unsigned char* data, size_t size) {
+        receiver.reassembler.Accept(data, size);
+    });
+    receiver.Poll(start + std::chrono::seconds(1));
+    receiver.Poll(start + std::chrono::seconds(2));
+    CHECK(receiver.lost.size() == 1 && receiver.lost[0] == 0);
+}
+
+static void TestReorderAndDuplicates() {
+    DatagramPacketizer packetizer(TOKEN);
+    Receiver receiver;
+    std::vector<Bytes> sent, all;
+    for (uint32_t i = 0; i < 10; ++i) {
+        sent.push_back(Message(i, 500 + i * 700));
+        for (const Bytes& datagram : Packetize(packetizer, sent.back())) all.push_back(datagram);
+    }
+    for (size_t i = all.size(); i-- > 0;) {
+        receiver.reassembler.Accept(all[i].data(), all[i].size());
+        receiver.reassembler.Accept(all[i].data(), all[i].size());
+    }
+    receiver.Poll(Clock::now());
+    CHECK(receiver.delivered == sent);
+    CHECK(receiver.lost.empty());
+}
+
+static void TestRejectsForeign() {
+    DatagramPacketizer packetizer(TOKEN + 1);
+    DatagramReassembler reassembler(TOKEN);
+    std::vector<Bytes> datagrams = Packetize(packetizer, Message(4, 2000));
+    CHECK(!reassembler.Accept(datagrams[0].data(), datagrams[0].size()));
+    DatagramPacketizer own(TOKEN);
+    datagrams = Packetize(own, Message(4, 2000));
+    CHECK(!reassembler.Accept(datagrams[0].data(), datagrams[0].size() - 1)); // truncated
+    CHECK(!reassembler.Accept(datagrams[0].data(), sizeof(DatagramHeader) - 1));
+    CHECK(reassembler.Accept(datagrams[0].data(), datagrams[0].size()));
+}
+
+// A long impaired run: what arrives is exact and in order, every message is
+// either delivered or reported lost, and parity saves most of the losses
+static void TestImpairedLink() {
+    DatagramImpairment impairment;
+    CHECK(impairment.Parse("loss=3,duplicate=2,reorder=5,jitter=6,seed=7"));
+    DatagramPacketizer packetizer(TOKEN);
+    packetizer.SetGroupSize(FecGroupSize(0.03));
+    Receiver receiver;
+    const uint32_t messages = 400;
+    std::vector<Bytes> sent;
+    Clock::time_point now = Clock::now();
+    auto emit = [&receiver](const unsigned char* data, size_t size) { receiver.reassembler.Accept(data, size); };
+    for (uint32_t i = 0; i < messages; ++i) {
+        sent.push_back(Message(i, 100 + (i * 977) % 20000));
+        for (const Bytes& datagram : Packetize(packetizer, sent.back())) {
+            impairment.Send(datagram.data(), datagram.size(), emit);
+        }
+        now += std::chrono::milliseconds(5);
+        receiver.Poll(now);
+    }
+    impairment.Flush(emit);
+    packetizer.SendMark(emit);
+    receiver.Poll(now);
+    receiver.Poll(now + std::chrono::seconds(1));
+
+    CHECK(receiver.delivered.size() + receiver.lost.size() == messages);
+    CHECK(receiver.reassembler.NextId() == messages);
+    CHECK(receiver.reassembler.Recovered() > 0);
+    CHECK(receiver.lost.size() < messages / 10);
+    size_t next = 0;
+    for (const Bytes& message : receiver.delivered) {
+        while (next < sent.size() && sent[next] != message) next++; // skips the lost ones
+        CHECK(next < sent.size());
+        next++;
+    }
+    for (size_t i = 1; i < receiver.lost.size(); ++i) CHECK(receiver.lost[i] > receiver.lost[i - 1]);
+}
+
+// An update end that overtook its frames is held until the reassembler
+// has delivered or given up on every one of them
+static void TestUpdateEndGate() {
+    DatagramPacketizer packetizer(TOKEN);
+    Receiver receiver;
+    UpdateEndGate gate;
+    std::vector<Bytes> first = Packetize(packetizer, Message(5, 3000));
+    std::vector<Bytes> second = Packetize(packetizer, Message(6, 3000));
+    uint32_t throughId = packetizer.NextId();
+
+    CHECK(!gate.Arrived(2, throughId, receiver.reassembler.NextId()));
+    CHECK(gate.Arrived(3, 0, receiver.reassembler.NextId())); // nothing went over UDP
+    for (const Bytes& datagram : first) receiver.reassembler.Accept(datagram.data(), datagram.size());
+    receiver.Poll(Clock::now());
+    CHECK(gate.Release(receiver.reassembler.NextId()) == 0); // half of the update is in
+    for (size_t i = 1; i < second.size(); ++i) receiver.reassembler.Accept(second[i].data(), second[i].size());
+    receiver.Poll(Clock::now());
+    CHECK(gate.Release(receiver.reassembler.NextId()) == 1u << 2); // rebuilt from parity
+    CHECK(gate.Release(receiver.reassembler.NextId()) == 0);       // released once
+
+    // A lost frame completes the update too, once given up on
+    Packetize(packetizer, Message(7, 100));
+    CHECK(!gate.Arrived(31, packetizer.NextId(), receiver.reassembler.NextId()));
+    packetizer.SendMark([&receiver](const unsigned char* data, size_t size) {
+        receiver.reassembler.Accept(data, size);
+    });
+    Clock::time_point start = Clock::now();
+    receiver.Poll(start);
+    CHECK(gate.Release(receiver.reassembler.NextId()) == 0);
+    receiver.Poll(start + std::chrono::milliseconds(DATAGRAM_REORDER_WAIT + 1));
+    CHECK(gate.Release(receiver.reassembler.NextId()) == 1u << 31);
+
+    // Ids wrap around
+    UpdateEndGate wrapped;
+    CHECK(!wrapped.Arrived(0, 5, 0xFFFFFFF0u));
+    CHECK(wrapped.Release(0xFFFFFFFFu) == 0);
+    CHECK(wrapped.Release(5) == 1);
+}
+
+int main() {
+    TestCleanDelivery();
+    TestParityRepair();
+    TestUnrecoverable();
+    TestMarkEndsWait();
+    TestReorderAndDuplicates();
+    TestRejectsForeign();
+    TestImpairedLink();
+    TestUpdateEndGate();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,123 @@
+// ===== tests/dirty_tiles_test.cpp =====
+// DirtyTileTracker change detection: HashTile seeing every byte of a tile
+// and only that tile, partial edge tiles, bottom-up rows, and Invalidate
+// and InvalidateArea forcing tiles out again.
+#include <cstdint>
+#include <vector>
+
+#include "dirty_tiles.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+#define WIDTH 300  // 4 full tile columns and a 44-pixel one
+#define HEIGHT 150 // 2 full tile rows and a 22-pixel one
+#define STRIDE (WIDTH * 4 + 8)
+
+static Bytes Frame() {
+    Bytes pixels((size_t)STRIDE * HEIGHT);
+    for (size_t i = 0; i < pixels.size(); ++i) pixels[i] = (unsigned char)(i * 31 + (i >> 9));
+    return pixels;
+}
+
+static bool Contains(const std::vector<TileRect>& tiles, int x, int y, int width, int height) {
+    for (const TileRect& tile : tiles) {
+        if (tile.x == x && tile.y == y && tile.width == width && tile.height == height) return true;
+    }
+    return false;
+}
+
+static void TestHashTile() {
+    Bytes pixels = Frame();
+    const unsigned char* rows[TILE_SIZE];
+    for (int r = 0; r < TILE_SIZE; ++r) rows[r] = pixels.data() + (size_t)r * STRIDE;
+    uint64_t hash = HashTile(rows, TILE_SIZE, 0, TILE_SIZE * 4);
+
+    // Every byte of the tile counts, the word-sized middle and the tail alike
+    for (size_t rowBytes : {(size_t)TILE_SIZE * 4, (size_t)13}) {
+        uint64_t base = HashTile(rows, TILE_SIZE, 0, rowBytes);
+        for (size_t offset = 0; offset < rowBytes; offset += 5) {
+            pixels[7 * STRIDE + offset] ^= 0x01;
+            CHECK(HashTile(rows, TILE_SIZE, 0, rowBytes) != base);
+            pixels[7 * STRIDE + offset] ^= 0x01;
+        }
+    }
+
+    // Bytes outside it do not
+    pixels[TILE_SIZE * 4] ^= 0xFF;
+    pixels[(size_t)TILE_SIZE * STRIDE] ^= 0xFF;
+    CHECK(HashTile(rows, TILE_SIZE, 0, TILE_SIZE * 4) == hash);
+
+    // Swapping two rows changes it
+    const unsigned char* swapped[TILE_SIZE];
+    for (int r = 0; r < TILE_SIZE; ++r) swapped[r] = rows[r];
+    swapped[3] = rows[4];
+    swapped[4] = rows[3];
+    CHECK(HashTile(swapped, TILE_SIZE, 0, TILE_SIZE * 4) != hash);
+}
+
+static void TestUpdate() {
+    Bytes pixels = Frame();
+    DirtyTileTracker tracker;
+    CHECK(tracker.Update(pixels.data(), WIDTH, HEIGHT, STRIDE, 4, false) == 15); // first frame: all of it
+    CHECK(tracker.Columns() == 5 && tracker.Rows() == 3);
+    CHECK(Contains(tracker.DirtyTiles(), 256, 128, 44, 22));
+    CHECK(tracker.Update(pixels.data(), WIDTH, HEIGHT, STRIDE, 4, false) == 0);
+
+    // One pixel in the partial corner tile, one on a tile boundary
+    pixels[(size_t)149 * STRIDE + 299 * 4] ^= 0x80;
+    pixels[(size_t)64 * STRIDE + 64 * 4 + 2] ^= 0x80;
+    CHECK(tracker.Update(pixels.data(), WIDTH, HEIGHT, STRIDE, 4, false) == 2);
+    CHECK(Contains(tracker.DirtyTiles(), 256, 128, 44, 22));
+    CHECK(Contains(tracker.DirtyTiles(), 64, 64, 64, 64));
+
+    // Padding past the last pixel of a row is not part of any tile
+    pixels[(size_t)10 * STRIDE + WIDTH * 4 + 3] ^= 0xFF;
+    CHECK(tracker.Update(pixels.data(), WIDTH, HEIGHT, STRIDE, 4, false) == 0);
+
+    // A new size starts over
+    CHECK(tracker.Update(pixels.data(), WIDTH - 10, HEIGHT, STRIDE, 4, false) == 15);
+}
+
+// Bottom-up rows: the last stored row is tile row 0
+static void TestBottomUp() {
+    Bytes pixels = Frame();
+    DirtyTileTracker tracker;
+    tracker.Update(pixels.data(), WIDTH, HEIGHT, STRIDE, 4, true);
+    pixels[(size_t)(HEIGHT - 1) * STRIDE] ^= 0x01; // top-left pixel on screen
+    CHECK(tracker.Update(pixels.data(), WIDTH, HEIGHT, STRIDE, 4, true) == 1);
+    CHECK(Contains(tracker.DirtyTiles(), 0, 0, 64, 64));
+    pixels[0] ^= 0x01; // bottom-left
+    CHECK(tracker.Update(pixels.data(), WIDTH, HEIGHT, STRIDE, 4, true) == 1);
+    CHECK(Contains(tracker.DirtyTiles(), 0, 128, 64, 22));
+}
+
+static void TestInvalidate() {
+    Bytes pixels = Frame();
+    DirtyTileTracker tracker;
+    tracker.InvalidateArea(TileRect{0, 0, WIDTH, HEIGHT}); // nothing to invalidate yet
+    tracker.Update(pixels.data(), WIDTH, HEIGHT, STRIDE, 4, false);
+
+    // Every tile the area touches, and no other
+    tracker.InvalidateArea(TileRect{63, 63, 2, 2});
+    CHECK(tracker.Update(pixels.data(), WIDTH, HEIGHT, STRIDE, 4, false) == 4);
+    CHECK(Contains(tracker.DirtyTiles(), 0, 0, 64, 64) && Contains(tracker.DirtyTiles(), 64, 64, 64, 64));
+
+    // Clipped to the screen; empty areas are ignored
+    tracker.InvalidateArea(TileRect{280, 140, 500, 500});
+    tracker.InvalidateArea(TileRect{0, 0, 0, 50});
+    CHECK(tracker.Update(pixels.data(), WIDTH, HEIGHT, STRIDE, 4, false) == 1);
+    CHECK(Contains(tracker.DirtyTiles(), 256, 128, 44, 22));
+
+    tracker.Invalidate();
+    CHECK(tracker.Update(pixels.data(), WIDTH, HEIGHT, STRIDE, 4, false) == 15);
+    CHECK(tracker.Update(pixels.data(), WIDTH, HEIGHT, STRIDE, 4, false) == 0);
+}
+
+int main() {
+    TestHashTile();
+    TestUpdate();
+    TestBottomUp();
+    TestInvalidate();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,167 @@
+// ===== tests/frame_scheduler_test.cpp =====
+// FrameScheduler timing: idle and boosted intervals, expedited captures
+// after clicks but not mouse motion, back-off on static screens, pull mode
+// and click-to-frame accounting. Bounds are loose so loaded machines pass.
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "frame_scheduler.h"
+#include "check.h"
+
+typedef FrameScheduler::Clock Clock;
+
+#define IDLE_MS 100
+#define BOOST_MS 33
+#define HEARTBEAT_MS 2000
+
+static long long MillisSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+static void TestIdleInterval() {
+    FrameScheduler scheduler(IDLE_MS, BOOST_MS, HEARTBEAT_MS);
+    CHECK(scheduler.CurrentIntervalMs() == IDLE_MS);
+    scheduler.BeginFrame();
+    auto start = Clock::now();
+    scheduler.WaitForNextFrame();
+    long long waited = MillisSince(start);
+    CHECK(waited >= IDLE_MS - 5 && waited < IDLE_MS + 100);
+}
+
+static void TestClickExpedites() {
+    FrameScheduler scheduler(IDLE_MS, BOOST_MS, HEARTBEAT_MS);
+    scheduler.BeginFrame();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto click = Clock::now();
+    scheduler.NotifyInput(click, true);
+    scheduler.WaitForNextFrame();
+    CHECK(MillisSince(click) < BOOST_MS);
+    CHECK(scheduler.CurrentIntervalMs() == BOOST_MS);
+    CHECK(scheduler.InputActivity() == 1.0);
+
+    FrameScheduler::FrameTicket ticket = scheduler.BeginFrame();
+    CHECK(ticket.hasInput && ticket.inputTime == click);
+    scheduler.FrameSent(ticket);
+    CHECK(scheduler.InputToFrame().Count() == 1 && scheduler.InputToCapture().Count() == 1);
+}
+
+// A mouse moving for 600 ms gets frames at the boost interval, not one per
+// injected batch
+static void TestMotionBoostsOnly() {
+    FrameScheduler scheduler(IDLE_MS, BOOST_MS, HEARTBEAT_MS);
+    std::atomic<bool> moving(true);
+    std::thread mouse([&scheduler, &moving] {
+        while (moving) {
+            scheduler.NotifyInput(Clock::now(), false);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    auto start = Clock::now();
+    int frames = 0;
+    while (MillisSince(start) < 600) {
+        scheduler.WaitForNextFrame(start + std::chrono::milliseconds(600));
+        FrameScheduler::FrameTicket ticket = scheduler.BeginFrame();
+        CHECK(!ticket.hasInput);
+        scheduler.FrameSent(ticket);
+        frames++;
+    }
+    moving = false;
+    mouse.join();
+    CHECK(frames >= 600 / IDLE_MS && frames <= 600 / BOOST_MS + 3);
+    CHECK(scheduler.InputToFrame().Count() == 0);
+}
+
+// A click after a move is timed from the click
+static void TestClickAfterMove() {
+    FrameScheduler scheduler(IDLE_MS, BOOST_MS, HEARTBEAT_MS);
+    auto move = Clock::now();
+    scheduler.NotifyInput(move, false);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto click = Clock::now();
+    scheduler.NotifyInput(click, true);
+    FrameScheduler::FrameTicket ticket = scheduler.BeginFrame();
+    CHECK(ticket.hasInput && ticket.inputTime == click);
+}
+
+static void TestBackOff() {
+    FrameScheduler scheduler(IDLE_MS, BOOST_MS, HEARTBEAT_MS, 5);
+    for (int i = 0; i < 4; ++i) scheduler.FrameResult(false);
+    CHECK(scheduler.CurrentIntervalMs() == IDLE_MS);
+    scheduler.FrameResult(false);
+    CHECK(scheduler.CurrentIntervalMs() == 2 * IDLE_MS);
+    for (int i = 0; i < 20; ++i) scheduler.FrameResult(false);
+    CHECK(scheduler.CurrentIntervalMs() == HEARTBEAT_MS);
+    scheduler.FrameResult(true);
+    CHECK(scheduler.CurrentIntervalMs() == IDLE_MS);
+
+    for (int i = 0; i < 20; ++i) scheduler.FrameResult(false);
+    scheduler.NotifyInput(Clock::now(), false);
+    CHECK(scheduler.CurrentIntervalMs() == BOOST_MS);
+
+    scheduler.SetVideoActive(true);
+    scheduler.FrameResult(false);
+    CHECK(scheduler.CurrentIntervalMs() == BOOST_MS);
+}
+
+// A capture asked for without input (a repair) comes at the boost rate but
+// leaves the back-off, the boost and the latency stats alone
+static void TestRequestCapture() {
+    FrameScheduler scheduler(IDLE_MS, BOOST_MS, HEARTBEAT_MS, 5);
+    for (int i = 0; i < 20; ++i) scheduler.FrameResult(false);
+    scheduler.BeginFrame();
+    auto start = Clock::now();
+    scheduler.RequestCapture();
+    scheduler.WaitForNextFrame();
+    CHECK(MillisSince(start) < BOOST_MS + 50);
+    CHECK(scheduler.CurrentIntervalMs() == HEARTBEAT_MS);
+    CHECK(scheduler.InputActivity() == 0.0);
+
+    FrameScheduler::FrameTicket ticket = scheduler.BeginFrame();
+    CHECK(!ticket.hasInput);
+    scheduler.FrameSent(ticket);
+    CHECK(scheduler.InputToFrame().Count() == 0);
+    CHECK(!scheduler.WaitForNextFrame(Clock::now() + std::chrono::milliseconds(50))); // request consumed
+}
+
+static void TestPullMode() {
+    FrameScheduler scheduler(10, 10, HEARTBEAT_MS);
+    scheduler.SetPullMode(true);
+    CHECK(scheduler.UpdateRequested()); // the first update goes unasked
+    scheduler.BeginFrame();
+    scheduler.UpdateDelivered();
+    CHECK(!scheduler.UpdateRequested());
+    CHECK(!scheduler.WaitForNextFrame(Clock::now() + std::chrono::milliseconds(50)));
+
+    std::thread viewer([&scheduler] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        scheduler.RequestUpdate();
+    });
+    CHECK(scheduler.WaitForNextFrame(Clock::now() + std::chrono::seconds(5)));
+    viewer.join();
+}
+
+static void TestStop() {
+    FrameScheduler scheduler(HEARTBEAT_MS, BOOST_MS, HEARTBEAT_MS);
+    scheduler.BeginFrame();
+    std::thread stopper([&scheduler] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        scheduler.Stop();
+    });
+    auto start = Clock::now();
+    scheduler.WaitForNextFrame();
+    CHECK(MillisSince(start) < HEARTBEAT_MS / 2);
+    stopper.join();
+}
+
+int main() {
+    TestIdleInterval();
+    TestClickExpedites();
+    TestMotionBoostsOnly();
+    TestClickAfterMove();
+    TestBackOff();
+    TestRequestCapture();
+    TestPullMode();
+    TestStop();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,167 @@
+// ===== tests/glyph_cache_test.cpp =====
+// GlyphEncoder and GlyphDecoder kept in step: scrolling terminal text is
+// drawn back exactly and mostly from the cache, eviction under many
+// distinct glyphs never leaves the viewer with a stale slot, and areas
+// that are not text, or payloads that are broken, are refused.
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "glyph_cache.h"
+#include "video_region.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+#define AREA_WIDTH 256
+#define AREA_HEIGHT 256
+
+struct Area {
+    size_t stride;
+    Bytes pixels;
+
+    Area() : stride((size_t)AREA_WIDTH * 4 + 16), pixels(stride * AREA_HEIGHT) {}
+    TileRect Rect() const { return TileRect{0, 0, AREA_WIDTH, AREA_HEIGHT}; }
+};
+
+// Decode one encoded MSG_GLYPH_FRAME payload and compare it with the area
+static bool DrawsBack(GlyphDecoder& decoder, const Bytes& encoded, const Area& area) {
+    GlyphFrame frame;
+    memcpy(&frame, encoded.data(), sizeof(frame));
+    if (frame.dataSize != encoded.size() - sizeof(frame)) return false;
+    Bytes drawn((size_t)AREA_WIDTH * AREA_HEIGHT * 4);
+    if (!decoder.Decode(frame, encoded.data() + sizeof(frame), frame.dataSize, drawn.data(), AREA_WIDTH * 4)) {
+        return false;
+    }
+    for (int y = 0; y < AREA_HEIGHT; ++y) {
+        for (int x = 0; x < AREA_WIDTH; ++x) {
+            const unsigned char* a = area.pixels.data() + (size_t)y * area.stride + x * 4;
+            const unsigned char* b = drawn.data() + ((size_t)y * AREA_WIDTH + x) * 4;
+            if (memcmp(a, b, 3) != 0) return false;
+        }
+    }
+    return true;
+}
+
+static GlyphFrame Header() {
+    GlyphFrame frame = {};
+    frame.streamId = 1;
+    return frame;
+}
+
+static void TestTerminal() {
+    GlyphEncoder encoder;
+    GlyphDecoder decoder;
+    encoder.Reserve((size_t)AREA_WIDTH * AREA_HEIGHT);
+    Area area;
+    size_t placements = 0, definitions = 0;
+    for (uint32_t frame = 0; frame < 20; ++frame) {
+        FillSyntheticTerminal(area.pixels.data(), area.stride, area.Rect(), frame);
+        Bytes encoded;
+        CHECK(encoder.Encode(area.pixels.data(), area.stride, AREA_WIDTH, AREA_HEIGHT, Header(), encoded));
+        CHECK(((encoded[1] & GLYPH_FRAME_RESET) != 0) == (frame == 0));
+        CHECK(DrawsBack(decoder, encoded, area));
+        if (frame) {
+            placements += encoder.LastPlacements();
+            definitions += encoder.LastDefinitions();
+        }
+    }
+    CHECK(placements > 0 && definitions * 10 < placements); // scrolled text comes from the cache
+}
+
+// Random shapes in 8x8 cells, three in four from a small common set and
+// the rest new, so the cache fills and slots get evicted and reused
+static void FillShapes(Area& area, uint32_t frame, uint32_t& unique) {
+    for (int y = 0; y < AREA_HEIGHT; ++y) {
+        uint32_t* row = reinterpret_cast<uint32_t*>(area.pixels.data() + (size_t)y * area.stride);
+        std::fill(row, row + AREA_WIDTH, 0xFF202020u);
+    }
+    uint32_t state = frame * 2654435761u + 7;
+    for (int cy = 0; cy < AREA_HEIGHT; cy += 8) {
+        for (int cx = 0; cx < AREA_WIDTH; cx += 8) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            uint32_t shape = state % 4 ? state % 32 : 1000 + unique++;
+            uint32_t bits = shape * 2246822519u + 0x9E3779B9u;
+            bits ^= bits >> 15;
+            bits *= 2654435761u;
+            uint32_t color = 0xFF000000u | (0x40 + shape % 7 * 0x20) << 16 | 0xC0C0;
+            for (int i = 0; i < 25; ++i) {
+                if (!(bits >> i & 1) && i != 12) continue; // the center pixel is always set
+                int x = cx + 1 + i % 5, y = cy + 1 + i / 5;
+                *reinterpret_cast<uint32_t*>(area.pixels.data() + (size_t)y * area.stride + x * 4) = color;
+            }
+        }
+    }
+}
+
+static void TestEviction() {
+    GlyphEncoder encoder;
+    GlyphDecoder decoder;
+    Area area;
+    uint32_t unique = 0;
+    size_t definitions = 0;
+    int taken = 0;
+    for (uint32_t frame = 0; frame < 30; ++frame) {
+        FillShapes(area, frame, unique);
+        Bytes encoded;
+        if (!encoder.Encode(area.pixels.data(), area.stride, AREA_WIDTH, AREA_HEIGHT, Header(), encoded)) continue;
+        taken++;
+        definitions += encoder.LastDefinitions();
+        CHECK(DrawsBack(decoder, encoded, area));
+    }
+    CHECK(taken > 10);
+    CHECK(definitions > GLYPH_CACHE_SLOTS); // the cache went round at least once
+}
+
+static void TestNotText() {
+    GlyphEncoder encoder;
+    Area area;
+    FillSyntheticVideo(area.pixels.data(), area.stride, area.Rect(), 0);
+    Bytes encoded;
+    CHECK(!encoder.Encode(area.pixels.data(), area.stride, AREA_WIDTH, AREA_HEIGHT, Header(), encoded));
+    CHECK(encoded.empty());
+
+    // A filled rectangle larger than any glyph
+    FillSyntheticTerminal(area.pixels.data(), area.stride, area.Rect(), 0);
+    for (int y = 10; y < 60; ++y) {
+        uint32_t* row = reinterpret_cast<uint32_t*>(area.pixels.data() + (size_t)y * area.stride);
+        std::fill(row + 10, row + 60, 0xFFFF0000u);
+    }
+    CHECK(!encoder.Encode(area.pixels.data(), area.stride, AREA_WIDTH, AREA_HEIGHT, Header(), encoded));
+}
+
+static void TestMalformed() {
+    GlyphEncoder encoder;
+    Area area;
+    FillSyntheticTerminal(area.pixels.data(), area.stride, area.Rect(), 1);
+    Bytes first, second;
+    CHECK(encoder.Encode(area.pixels.data(), area.stride, AREA_WIDTH, AREA_HEIGHT, Header(), first));
+    CHECK(encoder.Encode(area.pixels.data(), area.stride, AREA_WIDTH, AREA_HEIGHT, Header(), second));
+
+    GlyphFrame frame;
+    memcpy(&frame, first.data(), sizeof(frame));
+    Bytes drawn((size_t)AREA_WIDTH * AREA_HEIGHT * 4);
+    GlyphDecoder cut;
+    CHECK(!cut.Decode(frame, first.data() + sizeof(frame), frame.dataSize - 1, drawn.data(), AREA_WIDTH * 4));
+    GlyphDecoder trailing;
+    Bytes longer(first.begin() + sizeof(frame), first.end());
+    longer.push_back(0);
+    CHECK(!trailing.Decode(frame, longer.data(), longer.size(), drawn.data(), AREA_WIDTH * 4));
+
+    // The second area only places cached glyphs: a viewer that missed the
+    // first has nothing to draw them from
+    memcpy(&frame, second.data(), sizeof(frame));
+    CHECK(frame.definitionCount == 0 && frame.placementCount > 0);
+    GlyphDecoder missed;
+    CHECK(!missed.Decode(frame, second.data() + sizeof(frame), frame.dataSize, drawn.data(), AREA_WIDTH * 4));
+}
+
+int main() {
+    TestTerminal();
+    TestEviction();
+    TestNotText();
+    TestMalformed();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,151 @@
+// ===== tests/input_queue_test.cpp =====
+// InputInjectionQueue against MockInputInjector: move coalescing, per-
+// producer ordering under concurrent enqueues, the injected callback, and
+// prompt wake-ups of an idle injection thread.
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "input_queue.h"
+#include "check.h"
+
+static bool WaitFor(const InputInjectionQueue& queue, uint64_t events) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (queue.InjectedCount() + queue.CoalescedCount() < events) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+static void TestCoalesce() {
+    auto t0 = std::chrono::steady_clock::now();
+    InputEvent events[6] = {
+        InputEvent::MouseMove(1, 1), InputEvent::MouseMove(2, 2), InputEvent::MouseMove(3, 3),
+        InputEvent::MouseButton(2), InputEvent::MouseMove(4, 4), InputEvent::MouseMove(5, 5),
+    };
+    for (int i = 0; i < 6; ++i) events[i].enqueueTime = t0 + std::chrono::milliseconds(i);
+
+    size_t count = CoalesceInputEvents(events, 6);
+    CHECK(count == 3);
+    CHECK(events[0].kind == INPUT_EVENT_MOUSE_MOVE && events[0].x == 3 && events[0].y == 3);
+    CHECK(events[0].enqueueTime == t0); // oldest of the run
+    CHECK(events[1].kind == INPUT_EVENT_MOUSE_BUTTON);
+    CHECK(events[2].x == 5 && events[2].enqueueTime == t0 + std::chrono::milliseconds(4));
+}
+
+// Key events are never coalesced: every one arrives, each producer's in order
+static void TestConcurrentProducers() {
+    const int producers = 4;
+    const int perProducer = 3000; // more than fits in one batch
+    MockInputInjector* mock = new MockInputInjector();
+    InputInjectionQueue queue;
+    queue.Start(std::unique_ptr<InputInjector>(mock));
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&queue, p] {
+            for (int i = 0; i < perProducer; ++i) queue.Enqueue(InputEvent::Key((uint16_t)(p * 0x4000 + i), true));
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(WaitFor(queue, producers * perProducer));
+
+    int next[producers] = {};
+    size_t total = 0, largestBatch = 0;
+    for (const std::vector<InputEvent>& batch : mock->Batches()) {
+        largestBatch = std::max(largestBatch, batch.size());
+        for (const InputEvent& event : batch) {
+            int p = event.keyCode / 0x4000;
+            CHECK(event.kind == INPUT_EVENT_KEY_DOWN && p < producers);
+            if (p >= producers) continue;
+            CHECK(event.keyCode % 0x4000 == next[p]);
+            next[p]++;
+            total++;
+        }
+    }
+    CHECK(total == (size_t)producers * perProducer);
+    CHECK(largestBatch <= InputInjectionQueue::MAX_BATCH);
+    CHECK(queue.Latency().Count() == total);
+    queue.Stop();
+}
+
+static void TestSingleProducerOrder() {
+    MockInputInjector* mock = new MockInputInjector();
+    InputInjectionQueue queue;
+    queue.Start(std::unique_ptr<InputInjector>(mock));
+    const int count = 5000;
+    for (int i = 0; i < count; ++i) queue.Enqueue(InputEvent::Unicode((char16_t)(0x4E00 + i)));
+    CHECK(WaitFor(queue, count));
+
+    int expected = 0;
+    for (const std::vector<InputEvent>& batch : mock->Batches()) {
+        for (const InputEvent& event : batch) {
+            CHECK(event.kind == INPUT_EVENT_UNICODE && event.keyCode == 0x4E00 + expected);
+            expected++;
+        }
+    }
+    CHECK(expected == count);
+    queue.Stop();
+}
+
+// A burst of moves ending in a click: the last position survives and the
+// callback reports the batch as discrete, timed from the click
+static void TestMovesThenClick() {
+    MockInputInjector* mock = new MockInputInjector();
+    std::atomic<int> discreteBatches(0);
+    std::chrono::steady_clock::time_point clickTime;
+    InputInjectionQueue queue;
+    queue.Start(std::unique_ptr<InputInjector>(mock),
+                [&discreteBatches, &clickTime](std::chrono::steady_clock::time_point time, bool discrete) {
+                    if (discrete && discreteBatches++ == 0) clickTime = time;
+                });
+    for (int i = 0; i < 200; ++i) queue.Enqueue(InputEvent::MouseMove(i, 2 * i));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    auto beforeClick = std::chrono::steady_clock::now();
+    queue.Enqueue(InputEvent::MouseButton(2));
+    CHECK(WaitFor(queue, 201));
+    queue.Stop();
+
+    const InputEvent* lastMove = nullptr;
+    int buttons = 0;
+    for (const std::vector<InputEvent>& batch : mock->Batches()) {
+        for (const InputEvent& event : batch) {
+            if (event.kind == INPUT_EVENT_MOUSE_MOVE) lastMove = &event;
+            if (event.kind == INPUT_EVENT_MOUSE_BUTTON) {
+                buttons++;
+                CHECK(lastMove && lastMove->x == 199 && lastMove->y == 398);
+            }
+        }
+    }
+    CHECK(buttons == 1);
+    CHECK(discreteBatches.load() == 1);
+    CHECK(clickTime >= beforeClick);
+    CHECK(queue.InjectedCount() + queue.CoalescedCount() == 201);
+}
+
+// Each event arrives while the injection thread is idle or about to be:
+// none may wait for the 50 ms wait_for timeout instead of being woken
+static void TestWakeFromIdle() {
+    InputInjectionQueue queue;
+    queue.Start(std::unique_ptr<InputInjector>(new MockInputInjector()));
+    const int count = 300;
+    for (int i = 0; i < count; ++i) {
+        queue.Enqueue(InputEvent::Key((uint16_t)i, true));
+        CHECK(WaitFor(queue, i + 1));
+        std::this_thread::sleep_for(std::chrono::microseconds(50 * (i % 8)));
+    }
+    CHECK(queue.Latency().Count() == count);
+    CHECK(queue.Latency().MaxMicros() < 40000);
+    queue.Stop();
+}
+
+int main() {
+    TestCoalesce();
+    TestConcurrentProducers();
+    TestSingleProducerOrder();
+    TestMovesThenClick();
+    TestWakeFromIdle();
+    return CHECK_RESULT();
+}
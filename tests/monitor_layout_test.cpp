@@ -0,0 +1,160 @@
+// ===== tests/monitor_layout_test.cpp =====
+// Monitors as streams: numbering (primary first, then left to right),
+// subscription masks and update-request routing, MSG_MONITOR_LIST
+// parsing, and mapping between the virtual desktop and the viewer canvas.
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "monitor_layout.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+static MonitorDescriptor Monitor(int x, int y, uint32_t width, uint32_t height, bool primary = false) {
+    MonitorDescriptor monitor = {};
+    monitor.primary = primary ? 1 : 0;
+    monitor.x = x;
+    monitor.y = y;
+    monitor.width = width;
+    monitor.height = height;
+    return monitor;
+}
+
+static Bytes ListPayload(const std::vector<MonitorDescriptor>& monitors, uint32_t count) {
+    MonitorList list = {count};
+    Bytes payload(sizeof(list) + monitors.size() * sizeof(MonitorDescriptor));
+    memcpy(payload.data(), &list, sizeof(list));
+    if (!monitors.empty()) {
+        memcpy(payload.data() + sizeof(list), monitors.data(), monitors.size() * sizeof(MonitorDescriptor));
+    }
+    return payload;
+}
+
+static void TestNumbering() {
+    // Left of the primary, primary, right of it, and one stacked below
+    std::vector<MonitorDescriptor> monitors = {Monitor(1920, 0, 1920, 1080), Monitor(-1280, 0, 1280, 1024),
+                                               Monitor(0, 0, 1920, 1080, true), Monitor(1920, 1080, 1920, 1080)};
+    NumberMonitors(monitors);
+    CHECK(monitors.size() == 4);
+    CHECK(monitors[0].primary == 1 && monitors[0].x == 0);
+    CHECK(monitors[1].x == -1280);
+    CHECK(monitors[2].x == 1920 && monitors[2].y == 0);
+    CHECK(monitors[3].x == 1920 && monitors[3].y == 1080);
+    for (size_t i = 0; i < monitors.size(); ++i) CHECK(monitors[i].streamId == i);
+
+    std::vector<MonitorDescriptor> many;
+    for (int i = 0; i < MAX_STREAMS + 5; ++i) many.push_back(Monitor(i * 100, 0, 100, 100, i == 7));
+    NumberMonitors(many);
+    CHECK(many.size() == MAX_STREAMS);
+    CHECK(many[0].primary == 1 && many[0].x == 700);
+    CHECK(many.back().streamId == MAX_STREAMS - 1);
+}
+
+static void TestSubscription() {
+    CHECK(SubscriptionMask(-1) == (uint32_t)ALL_STREAMS);
+    CHECK(SubscriptionMask(0) == 1u);
+    CHECK(SubscriptionMask(31) == 1u << 31);
+    for (uint8_t id = 0; id < MAX_STREAMS; ++id) {
+        CHECK(StreamSubscribed(ALL_STREAMS, id));
+        CHECK(StreamSubscribed(SubscriptionMask(id), id));
+        CHECK(!StreamSubscribed(SubscriptionMask(id), (uint8_t)((id + 1) % MAX_STREAMS)));
+        CHECK(StreamSubscribed(1, id) == (id == 0)); // the host's default: primary only
+    }
+    CHECK(!StreamSubscribed(ALL_STREAMS, MAX_STREAMS));
+    CHECK(!StreamSubscribed(ALL_STREAMS, 0xFF));
+    CHECK(!StreamSubscribed(0, 0));
+
+    CHECK(StreamRequested(UPDATE_ALL_STREAMS, 0));
+    CHECK(StreamRequested(UPDATE_ALL_STREAMS, 31));
+    CHECK(StreamRequested(3, 3));
+    CHECK(!StreamRequested(3, 4));
+
+    CHECK(StreamShown(-1, 5));
+    CHECK(StreamShown(5, 5));
+    CHECK(!StreamShown(5, 4));
+}
+
+static void TestParseList() {
+    std::vector<MonitorDescriptor> sent = {Monitor(0, 0, 1920, 1080, true), Monitor(-1280, 0, 1280, 1024)};
+    NumberMonitors(sent);
+    std::vector<MonitorDescriptor> parsed;
+    Bytes payload = ListPayload(sent, 2);
+    CHECK(ParseMonitorList(payload.data(), payload.size(), parsed));
+    CHECK(parsed.size() == 2 && memcmp(parsed.data(), sent.data(), 2 * sizeof(MonitorDescriptor)) == 0);
+
+    CHECK(!ParseMonitorList(payload.data(), sizeof(MonitorList) - 1, parsed));
+    CHECK(!ParseMonitorList(payload.data(), payload.size() - 1, parsed)); // cut short
+    payload = ListPayload(sent, 3);
+    CHECK(!ParseMonitorList(payload.data(), payload.size(), parsed)); // claims more than it holds
+    payload = ListPayload(std::vector<MonitorDescriptor>(), 0);
+    CHECK(!ParseMonitorList(payload.data(), payload.size(), parsed));
+    payload = ListPayload(std::vector<MonitorDescriptor>(MAX_STREAMS + 1, sent[0]), MAX_STREAMS + 1);
+    CHECK(!ParseMonitorList(payload.data(), payload.size(), parsed));
+
+    std::vector<MonitorDescriptor> bad = sent;
+    bad[1].streamId = 0; // frames of the two could not be told apart
+    payload = ListPayload(bad, 2);
+    CHECK(!ParseMonitorList(payload.data(), payload.size(), parsed));
+    bad[1].streamId = MAX_STREAMS;
+    payload = ListPayload(bad, 2);
+    CHECK(!ParseMonitorList(payload.data(), payload.size(), parsed));
+}
+
+static void TestCanvasMapping() {
+    std::vector<MonitorDescriptor> monitors = {Monitor(0, 0, 1920, 1080, true), Monitor(-1280, -200, 1280, 1024)};
+    NumberMonitors(monitors);
+
+    TileRect all = {0, 0, 0, 0};
+    for (const MonitorDescriptor& monitor : monitors) all = BoundingArea(all, MonitorArea(monitor));
+    CHECK(all.x == -1280 && all.y == -200 && all.width == 3200 && all.height == 1280);
+
+    // Both monitors on a 1600x640 canvas: half size, side by side
+    TileRect left = CanvasPlacement(all, 1600, 640, MonitorArea(monitors[1]));
+    TileRect right = CanvasPlacement(all, 1600, 640, MonitorArea(monitors[0]));
+    CHECK(left.x == 0 && left.y == 0 && left.width == 640 && left.height == 512);
+    CHECK(right.x == 640 && right.y == 100 && right.width == 960 && right.height == 540);
+    CHECK(left.x + left.width == right.x); // no gap or overlap between neighbours
+
+    int x, y;
+    DesktopToCanvas(all, 1600, 640, 0, 0, x, y);
+    CHECK(x == 640 && y == 100);
+    CanvasToDesktop(all, 1600, 640, 0, 0, x, y);
+    CHECK(x == -1280 && y == -200);
+    for (int canvasX = 0; canvasX < 1600; canvasX += 37) {
+        for (int canvasY = 0; canvasY < 640; canvasY += 41) {
+            int desktopX, desktopY, backX, backY;
+            CanvasToDesktop(all, 1600, 640, canvasX, canvasY, desktopX, desktopY);
+            CHECK(desktopX >= all.x && desktopX < all.x + all.width);
+            CHECK(desktopY >= all.y && desktopY < all.y + all.height);
+            DesktopToCanvas(all, 1600, 640, desktopX, desktopY, backX, backY);
+            CHECK(backX == canvasX && backY == canvasY);
+        }
+    }
+
+    // One monitor shown: it fills the canvas on its own
+    TileRect one = MonitorArea(monitors[1]);
+    TileRect alone = CanvasPlacement(one, 800, 600, one);
+    CHECK(alone.x == 0 && alone.y == 0 && alone.width == 800 && alone.height == 600);
+    CanvasToDesktop(one, 800, 600, 400, 300, x, y);
+    CHECK(x == -640 && y == 312);
+
+    // Large desktops do not overflow, and empty views or canvases map to 0
+    TileRect huge = {-2000000000, 0, 2000000000, 1000};
+    DesktopToCanvas(huge, 4000, 10, -1000000000, 500, x, y);
+    CHECK(x == 2000 && y == 5);
+    TileRect empty = {0, 0, 0, 0};
+    CHECK(BoundingArea(empty, one).x == one.x && BoundingArea(one, empty).width == one.width);
+    DesktopToCanvas(empty, 800, 600, 5, 5, x, y);
+    CHECK(x == 0 && y == 0);
+    CanvasToDesktop(one, 0, 0, 5, 5, x, y);
+    CHECK(x == one.x && y == one.y);
+}
+
+int main() {
+    TestNumbering();
+    TestSubscription();
+    TestParseList();
+    TestCanvasMapping();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,145 @@
+// ===== tests/pixel_format_test.cpp =====
+// Raw frame formats: strides, exact BGRA32 <-> BGR24 round trips with and
+// without a flip, RGB565 and GRAY8 within their precision, formats
+// ConvertFrame must refuse, and preview downscaling and expansion.
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "pixel_format.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+#define WIDTH 37
+#define HEIGHT 11
+
+static Bytes Bgra(int width, int height) {
+    Bytes pixels((size_t)width * height * 4);
+    for (size_t i = 0; i < pixels.size(); ++i) pixels[i] = (i & 3) == 3 ? 0xFF : (unsigned char)(i * 73 + (i >> 7));
+    return pixels;
+}
+
+// Largest difference of any B, G or R between two BGRA images
+static int MaxError(const Bytes& a, const Bytes& b) {
+    int error = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if ((i & 3) != 3) error = std::max(error, std::abs(a[i] - b[i]));
+    }
+    return error;
+}
+
+// To `format` and back to BGRA
+static Bytes RoundTrip(const Bytes& bgra, int format, bool flip) {
+    size_t stride = RowStride(format, WIDTH, 4);
+    Bytes packed(stride * HEIGHT), back(bgra.size());
+    CHECK(ConvertFrame(PIXEL_FORMAT_BGRA32, bgra.data(), WIDTH * 4, format, packed.data(), stride, WIDTH, HEIGHT, flip));
+    CHECK(ConvertFrame(format, packed.data(), stride, PIXEL_FORMAT_BGRA32, back.data(), WIDTH * 4, WIDTH, HEIGHT, flip));
+    return back;
+}
+
+static void TestStrides() {
+    static_assert(BytesPerPixel(PIXEL_FORMAT_BGR24) == 3 && BytesPerPixel(PIXEL_FORMAT_RGB565) == 2, "sizes");
+    static_assert(BytesPerPixel(0) == 0, "unknown format");
+    CHECK(RowStride(PIXEL_FORMAT_BGR24, 37) == 111);
+    CHECK(RowStride(PIXEL_FORMAT_BGR24, 37, 4) == 112); // BMP rows
+    CHECK(RowStride(PIXEL_FORMAT_RGB565, 3, 4) == 8);
+    CHECK(RowStride(PIXEL_FORMAT_BGRA32, 5, 16) == 32);
+}
+
+static void TestRoundTrips() {
+    Bytes bgra = Bgra(WIDTH, HEIGHT);
+    CHECK(RoundTrip(bgra, PIXEL_FORMAT_BGR24, false) == bgra);
+    CHECK(RoundTrip(bgra, PIXEL_FORMAT_BGR24, true) == bgra); // flipped twice
+    CHECK(RoundTrip(bgra, PIXEL_FORMAT_BGRA32, false) == bgra);
+    CHECK(MaxError(RoundTrip(bgra, PIXEL_FORMAT_RGB565, false), bgra) <= 7);
+
+    // A flip moves the first source row to the last destination row
+    Bytes bgr((size_t)WIDTH * 3 * HEIGHT);
+    ConvertFrame(PIXEL_FORMAT_BGRA32, bgra.data(), WIDTH * 4, PIXEL_FORMAT_BGR24, bgr.data(), WIDTH * 3, WIDTH, HEIGHT,
+                 true);
+    const unsigned char* last = bgr.data() + (size_t)(HEIGHT - 1) * WIDTH * 3;
+    CHECK(last[0] == bgra[0] && last[1] == bgra[1] && last[2] == bgra[2]);
+
+    // RGB565 keeps black and white exact and is stable once quantized
+    unsigned char white[2], black[2];
+    PixelTraits<PIXEL_FORMAT_RGB565>::Store(white, 0xFFFFFF);
+    PixelTraits<PIXEL_FORMAT_RGB565>::Store(black, 0);
+    CHECK(PixelTraits<PIXEL_FORMAT_RGB565>::Load(white) == 0xFFFFFF);
+    CHECK(PixelTraits<PIXEL_FORMAT_RGB565>::Load(black) == 0);
+    Bytes once = RoundTrip(bgra, PIXEL_FORMAT_RGB565, false);
+    CHECK(RoundTrip(once, PIXEL_FORMAT_RGB565, false) == once);
+}
+
+static void TestGray() {
+    Bytes bgra = Bgra(WIDTH, HEIGHT);
+    Bytes gray = RoundTrip(bgra, PIXEL_FORMAT_GRAY8, false);
+    for (size_t i = 0; i < gray.size(); i += 4) {
+        CHECK(gray[i] == gray[i + 1] && gray[i] == gray[i + 2]);
+        CHECK(gray[i] == Luma(PixelTraits<PIXEL_FORMAT_BGRA32>::Load(&bgra[i])));
+    }
+    CHECK(Luma(0xFFFFFF) == 255 && Luma(0) == 0);
+}
+
+static void TestRefused() {
+    Bytes bgra = Bgra(WIDTH, HEIGHT), out(bgra.size());
+    CHECK(!ConvertFrame(PIXEL_FORMAT_PALETTE8, bgra.data(), WIDTH, PIXEL_FORMAT_BGRA32, out.data(), WIDTH * 4, WIDTH,
+                        HEIGHT, false));
+    CHECK(!ConvertFrame(PIXEL_FORMAT_BGRA32, bgra.data(), WIDTH * 4, PIXEL_FORMAT_PALETTE8, out.data(), WIDTH, WIDTH,
+                        HEIGHT, false));
+    CHECK(!ConvertFrame(0, bgra.data(), WIDTH * 4, PIXEL_FORMAT_BGRA32, out.data(), WIDTH * 4, WIDTH, HEIGHT, false));
+    CHECK(!ConvertFrame(PIXEL_FORMAT_BGRA32, bgra.data(), WIDTH * 4, PIXEL_FORMAT_COUNT, out.data(), WIDTH * 4, WIDTH,
+                        HEIGHT, false));
+}
+
+static void TestScaled() {
+    static_assert(ScaledSize(37, 2) == 10 && ScaledSize(36, 2) == 9 && ScaledSize(5, 0) == 5, "scaled sizes");
+
+    // Blocks average, partial edge blocks over the pixels they have
+    Bytes bgra = Bgra(WIDTH, HEIGHT);
+    int small = ScaledSize(WIDTH, 2), smallHeight = ScaledSize(HEIGHT, 2);
+    Bytes scaled((size_t)small * smallHeight * 4);
+    DownscaleBGRA(bgra.data(), WIDTH * 4, WIDTH, HEIGHT, 2, scaled.data(), (size_t)small * 4);
+    int sum = 0;
+    for (int y = 8; y < HEIGHT; ++y) sum += bgra[((size_t)y * WIDTH + 36) * 4 + 1];
+    CHECK(scaled[((size_t)2 * small + 9) * 4 + 1] == (sum + 1) / 3);
+
+    // A flat area survives the trip exactly
+    Bytes flat((size_t)WIDTH * HEIGHT * 4);
+    for (size_t i = 0; i < flat.size(); i += 4) {
+        flat[i] = 0x12;
+        flat[i + 1] = 0x9A;
+        flat[i + 2] = 0xF0;
+        flat[i + 3] = 0xFF;
+    }
+    DownscaleBGRA(flat.data(), WIDTH * 4, WIDTH, HEIGHT, 2, scaled.data(), (size_t)small * 4);
+    Bytes expanded(flat.size());
+    CHECK(ExpandScaled(PIXEL_FORMAT_BGRA32, scaled.data(), (size_t)small * 4, 2, WIDTH, HEIGHT, expanded.data(),
+                       WIDTH * 4));
+    CHECK(expanded == flat);
+
+    // Each preview pixel covers its whole square, from any format
+    Bytes bgr((size_t)small * 3 * smallHeight);
+    for (size_t i = 0; i < bgr.size(); ++i) bgr[i] = (unsigned char)(i * 11);
+    CHECK(ExpandScaled(PIXEL_FORMAT_BGR24, bgr.data(), (size_t)small * 3, 2, WIDTH, HEIGHT, expanded.data(),
+                       WIDTH * 4));
+    for (int y = 0; y < HEIGHT; ++y) {
+        for (int x = 0; x < WIDTH; ++x) {
+            const unsigned char* source = &bgr[((size_t)(y >> 2) * small + (x >> 2)) * 3];
+            const unsigned char* pixel = &expanded[((size_t)y * WIDTH + x) * 4];
+            CHECK(pixel[0] == source[0] && pixel[1] == source[1] && pixel[2] == source[2] && pixel[3] == 0xFF);
+        }
+    }
+    CHECK(!ExpandScaled(PIXEL_FORMAT_PALETTE8, bgr.data(), (size_t)small, 2, WIDTH, HEIGHT, expanded.data(),
+                        WIDTH * 4));
+}
+
+int main() {
+    TestStrides();
+    TestRoundTrips();
+    TestGray();
+    TestRefused();
+    TestScaled();
+    return CHECK_RESULT();
+}
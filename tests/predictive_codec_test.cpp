@@ -0,0 +1,138 @@
+// ===== tests/predictive_codec_test.cpp =====
+// PredictiveEncoder and PredictiveDecoder: exact round trips of text,
+// flat and noisy areas at awkward sizes and strides, runs longer than one
+// run symbol, the stored fallback and payloads that must be rejected.
+#include <cstdint>
+#include <vector>
+
+#include "glyph_cache.h"
+#include "predictive_codec.h"
+#include "video_region.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+// A capture of width x height with `padding` spare pixels per row
+struct Image {
+    int width, height;
+    size_t stride;
+    Bytes pixels;
+
+    Image(int width, int height, int padding = 0)
+        : width(width), height(height), stride((size_t)(width + padding) * 4), pixels(stride * height, 0x5A) {}
+    TileRect Area() const { return TileRect{0, 0, width, height}; }
+};
+
+// Whether a decoded area matches: BGR equal and alpha opaque
+static bool SameBGR(const Image& expected, const Bytes& decoded, size_t stride) {
+    for (int y = 0; y < expected.height; ++y) {
+        const unsigned char* a = expected.pixels.data() + (size_t)y * expected.stride;
+        const unsigned char* b = decoded.data() + (size_t)y * stride;
+        for (int x = 0; x < expected.width; ++x, a += 4, b += 4) {
+            if (a[0] != b[0] || a[1] != b[1] || a[2] != b[2] || b[3] != 0xFF) return false;
+        }
+    }
+    return true;
+}
+
+// Encode, check the mode, decode into a buffer with its own stride; the
+// payload size, or 0 if the round trip failed
+static size_t RoundTrip(PredictiveEncoder& encoder, PredictiveDecoder& decoder, const Image& image,
+                        int expectedMode = -1) {
+    Bytes payload(PredictiveMaxSize(image.width, image.height));
+    size_t size = encoder.Encode(image.pixels.data(), image.stride, image.width, image.height, payload.data());
+    CHECK(size >= 1 && size <= payload.size());
+    if (expectedMode >= 0) CHECK(payload[0] == expectedMode);
+    size_t stride = (size_t)image.width * 4 + 12;
+    Bytes decoded(stride * image.height, 0);
+    if (!decoder.Decode(payload.data(), size, image.width, image.height, decoded.data(), stride)) return 0;
+    return SameBGR(image, decoded, stride) ? size : 0;
+}
+
+static void TestText() {
+    PredictiveEncoder encoder;
+    PredictiveDecoder decoder;
+    encoder.Reserve(TILE_SIZE, TILE_SIZE);
+    Image image(TILE_SIZE, TILE_SIZE, 7);
+    for (uint32_t frame = 0; frame < 20; ++frame) {
+        FillSyntheticTerminal(image.pixels.data(), image.stride, image.Area(), frame);
+        size_t size = RoundTrip(encoder, decoder, image, PREDICTIVE_CODED);
+        CHECK(size > 0);
+        CHECK(size < (size_t)TILE_SIZE * TILE_SIZE * 3 / 4); // well under BGR24
+    }
+}
+
+// One color costs a few bytes, even when the run outlasts one run symbol
+static void TestFlat() {
+    PredictiveEncoder encoder;
+    PredictiveDecoder decoder;
+    Image tile(TILE_SIZE, TILE_SIZE);
+    size_t size = RoundTrip(encoder, decoder, tile, PREDICTIVE_CODED);
+    CHECK(size > 0 && size < 200);
+
+    Image large(512, 300); // 153600 pixels, more than the 65535 a run symbol covers
+    size = RoundTrip(encoder, decoder, large, PREDICTIVE_CODED);
+    CHECK(size > 0 && size < 200);
+}
+
+// Noise does not compress: it is stored, and still comes back exact
+static void TestNoiseStored() {
+    PredictiveEncoder encoder;
+    PredictiveDecoder decoder;
+    Image image(TILE_SIZE, TILE_SIZE, 3);
+    uint32_t state = 12345;
+    for (unsigned char& byte : image.pixels) {
+        state = state * 1664525u + 1013904223u;
+        byte = (unsigned char)(state >> 24);
+    }
+    CHECK(RoundTrip(encoder, decoder, image, PREDICTIVE_STORED) == PredictiveMaxSize(TILE_SIZE, TILE_SIZE));
+}
+
+// Edge tiles and odd widths, which leave a tail after any vector loop
+static void TestSizes() {
+    PredictiveEncoder encoder;
+    PredictiveDecoder decoder;
+    const int sizes[][2] = {{1, 1}, {1, 17}, {17, 1}, {3, 7}, {15, 64}, {33, 9}, {64, 63}, {100, 37}};
+    for (const auto& size : sizes) {
+        Image image(size[0], size[1], 5);
+        FillSyntheticVideo(image.pixels.data(), image.stride, image.Area(), (uint32_t)size[0]);
+        CHECK(RoundTrip(encoder, decoder, image) > 0);
+        if (size[1] >= 16) {
+            FillSyntheticTerminal(image.pixels.data(), image.stride, image.Area(), (uint32_t)size[1]);
+            CHECK(RoundTrip(encoder, decoder, image) > 0);
+        }
+    }
+}
+
+// Truncated, unknown and shared-without-table payloads are refused
+static void TestMalformed() {
+    PredictiveEncoder encoder;
+    PredictiveDecoder decoder;
+    Image image(TILE_SIZE, TILE_SIZE);
+    FillSyntheticTerminal(image.pixels.data(), image.stride, image.Area(), 3);
+    Bytes payload(PredictiveMaxSize(TILE_SIZE, TILE_SIZE));
+    size_t size = encoder.Encode(image.pixels.data(), image.stride, TILE_SIZE, TILE_SIZE, payload.data());
+    Bytes decoded((size_t)TILE_SIZE * TILE_SIZE * 4);
+    size_t stride = (size_t)TILE_SIZE * 4;
+    CHECK(decoder.Decode(payload.data(), size, TILE_SIZE, TILE_SIZE, decoded.data(), stride));
+    CHECK(!decoder.Decode(payload.data(), size / 2, TILE_SIZE, TILE_SIZE, decoded.data(), stride));
+    CHECK(!decoder.Decode(payload.data(), 0, TILE_SIZE, TILE_SIZE, decoded.data(), stride));
+    CHECK(!decoder.Decode(payload.data(), size, TILE_SIZE, 0, decoded.data(), stride));
+
+    payload[0] = 7;
+    CHECK(!decoder.Decode(payload.data(), size, TILE_SIZE, TILE_SIZE, decoded.data(), stride));
+    payload[0] = PREDICTIVE_SHARED;
+    payload[1] = 5;
+    CHECK(!decoder.Decode(payload.data(), size, TILE_SIZE, TILE_SIZE, decoded.data(), stride));
+    payload[0] = PREDICTIVE_STORED;
+    CHECK(!decoder.Decode(payload.data(), size, TILE_SIZE, TILE_SIZE, decoded.data(), stride));
+}
+
+int main() {
+    TestText();
+    TestFlat();
+    TestNoiseStored();
+    TestSizes();
+    TestMalformed();
+    return CHECK_RESULT();
+}
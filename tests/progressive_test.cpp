@@ -0,0 +1,167 @@
+// ===== tests/progressive_test.cpp =====
+// Progressive refinement: bit plane groups split from BGRA and merged back
+// converge to the exact pixels, TileRefiner hands out settled tiles
+// coarsest and oldest first within its byte budget, and a full screen of
+// text goes exact within a second on a modest link.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "progressive.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+typedef TileRefiner::Clock Clock;
+
+static Bytes Bgra(int width, int height) {
+    Bytes pixels((size_t)width * height * 4);
+    uint32_t state = 12345;
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        state = state * 1103515245u + 12345u;
+        pixels[i] = (i & 3) == 3 ? 0xFF : (unsigned char)(state >> 16);
+    }
+    return pixels;
+}
+
+static int MaxError(const Bytes& a, const Bytes& b) {
+    int error = 0;
+    for (size_t i = 0; i < a.size(); ++i) error = std::max(error, std::abs(a[i] - b[i]));
+    return error;
+}
+
+// Split one pass out of `source` and merge it into `target`
+static void Pass(int format, const Bytes& source, Bytes& target, int width, int height, bool flip) {
+    size_t stride = PlaneRowBytes(format, width);
+    Bytes planes(stride * height, 0);
+    PackPlanes(format, source.data(), (size_t)width * 4, width, height, planes.data(), stride);
+    UnpackPlanes(format, planes.data(), stride, width, height, target.data(), (size_t)width * 4, flip);
+}
+
+static void TestPlanes() {
+    CHECK(PlaneRowBytes(PLANES_HIGH4, 64) == 96 && PlaneRowBytes(PLANES_MID2, 64) == 48);
+    CHECK(PlaneRowBytes(PLANES_HIGH4, 1) == 2 && PlaneRowBytes(PLANES_LOW2, 3) == 3); // partial last byte
+
+    // Odd widths leave a partial byte at the end of each row
+    for (int width : {1, 3, 5, 64}) {
+        const int height = 7;
+        Bytes source = Bgra(width, height);
+        Bytes target(source.size(), 0x5A);
+        Pass(PLANES_HIGH4, source, target, width, height, false);
+        CHECK(MaxError(source, target) <= 8);
+        Pass(PLANES_MID2, source, target, width, height, false);
+        CHECK(MaxError(source, target) <= 2);
+        Pass(PLANES_LOW2, source, target, width, height, false);
+        CHECK(target == source);
+
+        // A new coarse pass replaces what the finer ones left behind
+        Pass(PLANES_HIGH4, source, target, width, height, false);
+        CHECK(target != source && MaxError(source, target) <= 8);
+    }
+
+    // Flipped rows land bottom-up
+    Bytes source = Bgra(9, 4), target(source.size(), 0), flipped(source.size());
+    for (int format : {PLANES_HIGH4, PLANES_MID2, PLANES_LOW2}) Pass(format, source, target, 9, 4, true);
+    for (int y = 0; y < 4; ++y) {
+        std::copy(source.begin() + y * 36, source.begin() + (y + 1) * 36, flipped.begin() + (3 - y) * 36);
+    }
+    CHECK(target == flipped);
+}
+
+static void TestRefinerOrder() {
+    TileRefiner refiner(100);
+    refiner.Reset(200, 100); // 4 x 2 tiles, the right and bottom ones partial
+    CHECK(!refiner.HasPending());
+    Clock::time_point start = Clock::now();
+    refiner.Changed(TileRect{64, 0, 64, 64}, start + std::chrono::milliseconds(20));
+    refiner.Changed(TileRect{192, 64, 8, 36}, start);
+    CHECK(refiner.HasPending());
+
+    std::vector<TileRefiner::Refinement> out;
+    refiner.Next(start + std::chrono::milliseconds(50), 1 << 20, out);
+    CHECK(out.empty()); // not settled yet
+
+    // Oldest first, with the tile's own size
+    refiner.Next(start + std::chrono::milliseconds(200), 1 << 20, out);
+    CHECK(out.size() == 2);
+    CHECK(out[0].rect.x == 192 && out[0].rect.y == 64 && out[0].rect.width == 8 && out[0].rect.height == 36);
+    CHECK(out[0].format == PLANES_MID2 && out[1].format == PLANES_MID2);
+
+    // A tile that changes again goes back to the coarse pass and is
+    // refined before the ones already further along
+    refiner.Changed(TileRect{64, 0, 64, 64}, start + std::chrono::milliseconds(210));
+    refiner.Next(start + std::chrono::milliseconds(400), 1 << 20, out);
+    CHECK(out.size() == 2 && out[0].rect.x == 64 && out[0].format == PLANES_MID2);
+    CHECK(out[1].rect.x == 192 && out[1].format == PLANES_LOW2);
+    refiner.Next(start + std::chrono::milliseconds(400), 1 << 20, out);
+    CHECK(out.size() == 1 && out[0].format == PLANES_LOW2);
+    CHECK(!refiner.HasPending());
+    refiner.Next(start + std::chrono::milliseconds(400), 1 << 20, out);
+    CHECK(out.empty());
+}
+
+static void TestRefinerBudget() {
+    TileRefiner refiner(0);
+    refiner.Reset(640, 64);
+    Clock::time_point start = Clock::now();
+    for (int x = 0; x < 640; x += 64) refiner.Changed(TileRect{x, 0, 64, 64}, start);
+    TileRefiner::Refinement mid = {TileRect{0, 0, 64, 64}, PLANES_MID2, start};
+    size_t tileBytes = TileRefiner::RefinementBytes(mid);
+    CHECK(tileBytes == 48 * 64);
+
+    std::vector<TileRefiner::Refinement> out;
+    refiner.Next(start, tileBytes * 3 + 1, out);
+    CHECK(out.size() == 3);
+    refiner.Next(start, 1, out); // always at least one
+    CHECK(out.size() == 1);
+
+    // Discarded tiles are no longer pending, and empty areas are ignored
+    refiner.Discard(TileRect{0, 0, 0, 64});
+    refiner.Discard(TileRect{0, 0, 640, 64});
+    CHECK(!refiner.HasPending());
+    refiner.Next(start, 1 << 20, out);
+    CHECK(out.empty());
+}
+
+static void TestThroughput() {
+    ThroughputEstimator estimator(1000000);
+    estimator.Record(5000, std::chrono::microseconds(500)); // only reached the socket buffer
+    estimator.Record(0, std::chrono::milliseconds(10));
+    CHECK(estimator.BytesPerSecond() == 1000000);
+    for (int i = 0; i < 50; ++i) estimator.Record(40000, std::chrono::milliseconds(10));
+    CHECK(estimator.BytesPerSecond() > 3900000 && estimator.BytesPerSecond() < 4000001);
+}
+
+// A whole 1920x1080 screen goes static; refinement runs every 50 ms with
+// the budget of an idle 4 MB/s link and tiles settle after 100 ms, as on
+// the host. The whole screen must be exact within a second.
+static void TestConvergence() {
+    const int width = 1920, height = 1080, tickMs = 50;
+    const double bytesPerSecond = 4e6;
+    TileRefiner refiner(100);
+    refiner.Reset(width, height);
+    Clock::time_point start = Clock::now();
+    for (int y = 0; y < height; y += TILE_SIZE) {
+        for (int x = 0; x < width; x += TILE_SIZE) {
+            refiner.Changed(TileRect{x, y, std::min(TILE_SIZE, width - x), std::min(TILE_SIZE, height - y)}, start);
+        }
+    }
+    std::vector<TileRefiner::Refinement> out;
+    int elapsedMs = 0;
+    while (refiner.HasPending() && elapsedMs <= 2000) {
+        elapsedMs += tickMs;
+        refiner.Next(start + std::chrono::milliseconds(elapsedMs), (size_t)(bytesPerSecond * tickMs / 1000), out);
+    }
+    CHECK(!refiner.HasPending());
+    CHECK(elapsedMs <= 1000);
+}
+
+int main() {
+    TestPlanes();
+    TestRefinerOrder();
+    TestRefinerBudget();
+    TestThroughput();
+    TestConvergence();
+    return CHECK_RESULT();
+}
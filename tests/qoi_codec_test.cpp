@@ -0,0 +1,110 @@
+// ===== tests/qoi_codec_test.cpp =====
+// QoiEncode and QoiDecode: exact round trips of keyframe bands, the cost
+// of runs and repeated colors, and payloads that must be refused.
+#include <cstdint>
+#include <vector>
+
+#include "glyph_cache.h"
+#include "qoi_codec.h"
+#include "video_region.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+// Encode an area of `stride`-byte rows and decode it into packed rows; the
+// payload size, or 0 if the round trip was not exact
+static size_t RoundTrip(const Bytes& pixels, size_t stride, int width, int height) {
+    Bytes payload(QoiMaxSize(width, height));
+    size_t size = QoiEncode(pixels.data(), stride, width, height, payload.data());
+    CHECK(size <= payload.size());
+    Bytes decoded((size_t)width * height * 4);
+    if (!QoiDecode(payload.data(), size, width, height, decoded.data(), (size_t)width * 4)) return 0;
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* a = pixels.data() + (size_t)y * stride;
+        const unsigned char* b = decoded.data() + (size_t)y * width * 4;
+        for (int x = 0; x < width; ++x, a += 4, b += 4) {
+            if (a[0] != b[0] || a[1] != b[1] || a[2] != b[2] || b[3] != 0xFF) return 0;
+        }
+    }
+    return size;
+}
+
+// Full-width bands of one tile row, as keyframes are sent
+static void TestBands() {
+    const int width = 1920, height = TILE_SIZE;
+    size_t stride = (size_t)width * 4 + 32;
+    Bytes pixels(stride * height);
+    TileRect area = {0, 0, width, height};
+    for (uint32_t frame = 0; frame < 5; ++frame) {
+        FillSyntheticTerminal(pixels.data(), stride, area, frame);
+        size_t size = RoundTrip(pixels, stride, width, height);
+        CHECK(size > 0 && size < (size_t)width * height / 4);
+        FillSyntheticVideo(pixels.data(), stride, area, frame);
+        CHECK(RoundTrip(pixels, stride, width, height) > 0);
+    }
+}
+
+// One color is a run op per QOI_MAX_RUN pixels, plus the first pixel
+static void TestRuns() {
+    const int width = 1000, height = 3;
+    Bytes pixels((size_t)width * height * 4);
+    for (size_t i = 0; i < pixels.size(); i += 4) {
+        pixels[i] = 0x30;
+        pixels[i + 1] = 0x90;
+        pixels[i + 2] = 0xF0;
+        pixels[i + 3] = 0xFF;
+    }
+    size_t size = RoundTrip(pixels, (size_t)width * 4, width, height);
+    CHECK(size == 4 + (width * height - 1 + QOI_MAX_RUN - 1) / QOI_MAX_RUN);
+
+    Bytes black((size_t)width * 4, 0); // the starting color: runs from the first pixel
+    CHECK(RoundTrip(black, (size_t)width * 4, width, 1) == (width + QOI_MAX_RUN - 1) / QOI_MAX_RUN);
+}
+
+// Colors alternating between a few far apart ones come from the cache
+static void TestCache() {
+    const uint32_t colors[4] = {0xFF102030, 0xFF00FF00, 0xFFC01040, 0xFF0000FF}; // four different cache slots
+    const int width = 400;
+    std::vector<uint32_t> row(width);
+    for (int x = 0; x < width; ++x) row[x] = colors[x % 4];
+    Bytes pixels((const unsigned char*)row.data(), (const unsigned char*)(row.data() + width));
+    size_t size = RoundTrip(pixels, (size_t)width * 4, width, 1);
+    CHECK(size > 0 && size <= 4 * 4 + (width - 4)); // four full colors, then one index byte each
+}
+
+static void TestSizes() {
+    const int sizes[][2] = {{1, 1}, {1, 9}, {9, 1}, {63, 2}, {64, 64}, {127, 5}};
+    for (const auto& size : sizes) {
+        size_t stride = (size_t)size[0] * 4 + 8;
+        Bytes pixels(stride * size[1]);
+        FillSyntheticVideo(pixels.data(), stride, TileRect{0, 0, size[0], size[1]}, (uint32_t)size[1]);
+        CHECK(RoundTrip(pixels, stride, size[0], size[1]) > 0);
+    }
+}
+
+// Truncated payloads, trailing bytes and runs past the area are refused
+static void TestMalformed() {
+    const int width = TILE_SIZE, height = TILE_SIZE;
+    Bytes pixels((size_t)width * height * 4);
+    FillSyntheticTerminal(pixels.data(), (size_t)width * 4, TileRect{0, 0, width, height}, 2);
+    Bytes payload(QoiMaxSize(width, height) + 1);
+    size_t size = QoiEncode(pixels.data(), (size_t)width * 4, width, height, payload.data());
+    Bytes decoded(pixels.size());
+    CHECK(QoiDecode(payload.data(), size, width, height, decoded.data(), (size_t)width * 4));
+    CHECK(!QoiDecode(payload.data(), size - 1, width, height, decoded.data(), (size_t)width * 4));
+    CHECK(!QoiDecode(payload.data(), size / 2, width, height, decoded.data(), (size_t)width * 4));
+    payload[size] = QOI_OP_INDEX;
+    CHECK(!QoiDecode(payload.data(), size + 1, width, height, decoded.data(), (size_t)width * 4));
+
+    unsigned char overlong[] = {QOI_OP_RUN | 9}; // ten pixels into a 2x2 area
+    CHECK(!QoiDecode(overlong, sizeof(overlong), 2, 2, decoded.data(), 8));
+}
+
+int main() {
+    TestBands();
+    TestRuns();
+    TestCache();
+    TestSizes();
+    TestMalformed();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,94 @@
+// ===== tests/send_gate_test.cpp =====
+// SendGate: one holder at a time, an urgent sender goes ahead of bulk
+// pieces that were already waiting, and a cursor update waits for one bulk
+// piece rather than a whole frame. Bounds are loose so loaded machines pass.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "send_gate.h"
+#include "check.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static void TestExclusive() {
+    SendGate gate;
+    std::atomic<int> inside(0);
+    std::atomic<bool> overlapped(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&gate, &inside, &overlapped, t]() {
+            for (int i = 0; i < 2000; ++i) {
+                SendGate::Hold hold(gate, (t + i) % 3 == 0);
+                if (inside.fetch_add(1) != 0) overlapped = true;
+                inside.fetch_sub(1);
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(!overlapped);
+}
+
+// While a bulk piece holds the gate, another bulk piece and then an urgent
+// message queue up; the urgent one is admitted first
+static void TestUrgentFirst() {
+    SendGate gate;
+    std::mutex orderMutex;
+    std::vector<char> order;
+    auto send = [&gate, &orderMutex, &order](bool urgent) {
+        SendGate::Hold hold(gate, urgent);
+        std::lock_guard<std::mutex> lock(orderMutex);
+        order.push_back(urgent ? 'u' : 'b');
+    };
+
+    gate.Lock(false);
+    std::thread bulk(send, false);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    std::thread urgent(send, true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    gate.Unlock();
+    bulk.join();
+    urgent.join();
+    CHECK(order.size() == 2 && order[0] == 'u' && order[1] == 'b');
+}
+
+// A frame of 200 pieces of 1 ms each; cursor updates during it wait for
+// about one piece, not the 200 ms the whole frame takes
+static void TestUrgentWaitsOnePiece() {
+    SendGate gate;
+    std::atomic<bool> sending(true);
+    std::thread frame([&gate, &sending]() {
+        for (int piece = 0; piece < 200; ++piece) {
+            SendGate::Hold hold(gate, false);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        sending = false;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    long long worstMs = 0;
+    int updates = 0;
+    while (sending) {
+        Clock::time_point start = Clock::now();
+        {
+            SendGate::Hold hold(gate, true);
+        }
+        long long waited = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+        worstMs = std::max(worstMs, waited);
+        updates++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    frame.join();
+    CHECK(updates > 5);
+    CHECK(worstMs < 50);
+}
+
+int main() {
+    TestExclusive();
+    TestUrgentFirst();
+    TestUrgentWaitsOnePiece();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,66 @@
+// ===== tests/session_stats_test.cpp =====
+// SessionStats: a line only for what the session used, ratios worked
+// out from the counters, and Reset clearing every counter.
+#include <sstream>
+#include <string>
+
+#include "session_stats.h"
+#include "check.h"
+
+static bool Contains(const std::string& text, const char* part) {
+    return text.find(part) != std::string::npos;
+}
+
+static void TestPrint() {
+    SessionStats stats;
+    std::ostringstream empty;
+    stats.Print(empty);
+    CHECK(empty.str().empty());
+
+    stats.encodeTime[PIXEL_FORMAT_RGB565].RecordMicros(1000);
+    stats.formatBytes[PIXEL_FORMAT_RGB565] += 10 * 1024;
+    stats.keyframes += 2;
+    stats.keyframePixels += 2 * 1000;
+    stats.keyframeBytes += 2000;
+    stats.keyframeBmpBytes += 6000;
+    stats.glyphBytes += 100;
+    stats.glyphRawBytes += 1000;
+    stats.glyphPlacements += 40;
+    stats.glyphDefinitions += 10;
+    std::ostringstream out;
+    stats.Print(out);
+    std::string text = out.str();
+    CHECK(Contains(text, "  RGB565: 1 frames, 10 KB/frame"));
+    CHECK(Contains(text, "Keyframes: 2, 0 KB each, 3:1 against BMP, 4:1 against raw BGRA"));
+    CHECK(Contains(text, "Glyph areas: 0, 0 KB, 10:1 against 24-bit pixels, 75% of glyphs cached"));
+    CHECK(!Contains(text, "Video"));
+    CHECK(!Contains(text, "Exact text tiles"));
+    CHECK(!Contains(text, "Cursor send"));
+
+    std::ostringstream formats;
+    stats.PrintFormats(formats);
+    CHECK(formats.str() == "  RGB565: 1 frames, 10 KB/frame, encode " +
+                               stats.encodeTime[PIXEL_FORMAT_RGB565].Summary() + "\n");
+}
+
+static void TestReset() {
+    SessionStats stats;
+    stats.framesCaptured += 5;
+    stats.videoFrames += 3;
+    stats.videoBytes += 3 * 1024;
+    stats.codecQuantizer.store(12);
+    stats.cursorSendTime.RecordMicros(50);
+    stats.encodeTime[0].RecordMicros(50);
+    stats.Reset();
+    CHECK(stats.framesCaptured.load() == 0 && stats.videoFrames.load() == 0 && stats.codecQuantizer.load() == 0);
+    CHECK(stats.cursorSendTime.Count() == 0 && stats.encodeTime[0].Count() == 0);
+    std::ostringstream out;
+    stats.Print(out);
+    CHECK(out.str().empty());
+}
+
+int main() {
+    TestPrint();
+    TestReset();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,186 @@
+// ===== tests/shared_table_test.cpp =====
+// Shared predictive code tables (MSG_CODE_TABLE): built from collected
+// statistics, packed and unpacked, picked by the encoder when they beat a
+// tile's own codes, and decoded only by a viewer that holds them.
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "glyph_cache.h"
+#include "predictive_codec.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+#define SCREEN_WIDTH 512
+#define SCREEN_HEIGHT 256
+
+struct Terminal {
+    size_t stride;
+    Bytes pixels;
+
+    explicit Terminal(uint32_t frame) : stride((size_t)SCREEN_WIDTH * 4), pixels(stride * SCREEN_HEIGHT) {
+        FillSyntheticTerminal(pixels.data(), stride, TileRect{0, 0, SCREEN_WIDTH, SCREEN_HEIGHT}, frame);
+    }
+    const unsigned char* Tile(int x, int y) const { return pixels.data() + (size_t)y * stride + (size_t)x * 4; }
+};
+
+// Encode every tile of a screen; the total payload size, counting tiles
+// that went out with a shared table
+static size_t EncodeScreen(PredictiveEncoder& encoder, const Terminal& screen, std::vector<Bytes>& payloads,
+                           int& sharedTiles) {
+    size_t total = 0;
+    payloads.clear();
+    sharedTiles = 0;
+    Bytes payload(PredictiveMaxSize(TILE_SIZE, TILE_SIZE));
+    for (int y = 0; y < SCREEN_HEIGHT; y += TILE_SIZE) {
+        for (int x = 0; x < SCREEN_WIDTH; x += TILE_SIZE) {
+            size_t size = encoder.Encode(screen.Tile(x, y), screen.stride, TILE_SIZE, TILE_SIZE, payload.data());
+            if (payload[0] == PREDICTIVE_SHARED) sharedTiles++;
+            payloads.push_back(Bytes(payload.begin(), payload.begin() + size));
+            total += size;
+        }
+    }
+    return total;
+}
+
+static bool DecodeScreen(PredictiveDecoder& decoder, const Terminal& screen, const std::vector<Bytes>& payloads) {
+    Bytes decoded((size_t)TILE_SIZE * TILE_SIZE * 4);
+    size_t i = 0;
+    for (int y = 0; y < SCREEN_HEIGHT; y += TILE_SIZE) {
+        for (int x = 0; x < SCREEN_WIDTH; x += TILE_SIZE, ++i) {
+            const Bytes& payload = payloads[i];
+            if (!decoder.Decode(payload.data(), payload.size(), TILE_SIZE, TILE_SIZE, decoded.data(), TILE_SIZE * 4)) {
+                return false;
+            }
+            for (int row = 0; row < TILE_SIZE; ++row) {
+                const unsigned char* a = screen.Tile(x, y + row);
+                const unsigned char* b = decoded.data() + (size_t)row * TILE_SIZE * 4;
+                for (int column = 0; column < TILE_SIZE; ++column) {
+                    if (memcmp(a + column * 4, b + column * 4, 3) != 0) return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// A table from one screen's statistics, as the host builds its recent table
+static PredictiveTable TrainTable(uint8_t id, uint32_t frame, uint64_t* coldBytes = nullptr) {
+    PredictiveEncoder encoder;
+    std::vector<Bytes> payloads;
+    int sharedTiles;
+    size_t total = EncodeScreen(encoder, Terminal(frame), payloads, sharedTiles);
+    uint64_t counts[3][512] = {};
+    uint64_t cold = 0;
+    encoder.CollectStatistics(counts, cold);
+    CHECK(cold == total); // no shared tables: every tile went out with its own codes
+    if (coldBytes) *coldBytes = cold;
+
+    uint64_t again[3][512] = {};
+    cold = 0;
+    encoder.CollectStatistics(again, cold); // collecting resets
+    CHECK(cold == 0 && again[0][0] == 0 && again[1][0] == 0);
+
+    PredictiveTable table = {};
+    table.id = id;
+    table.Build(counts);
+    return table;
+}
+
+static void TestPackUnpack() {
+    PredictiveTable table = TrainTable(3, 1);
+    unsigned char packed[PREDICTIVE_TABLE_BYTES];
+    table.Pack(packed);
+    PredictiveTable unpacked = {};
+    CHECK(unpacked.Unpack(packed));
+    CHECK(memcmp(unpacked.lengths, table.lengths, sizeof(table.lengths)) == 0);
+    CHECK(memcmp(unpacked.codes, table.codes, sizeof(table.codes)) == 0);
+    for (int c = 0; c < 3; ++c) {
+        for (int i = 0; i < 256; ++i) CHECK(table.lengths[c][i] >= 1 && table.lengths[c][i] <= PREDICTIVE_MAX_CODE);
+    }
+
+    unsigned char missing[PREDICTIVE_TABLE_BYTES];
+    memcpy(missing, packed, sizeof(missing));
+    missing[10] &= 0x0F; // a symbol without a code
+    CHECK(!unpacked.Unpack(missing));
+    memset(missing, 0x11, sizeof(missing)); // every code one bit long
+    CHECK(!unpacked.Unpack(missing));
+}
+
+// Later screens of the same terminal go out smaller with the table, and
+// decode only where the table is held
+static void TestSharedEncoding() {
+    PredictiveTable table = TrainTable(1, 1);
+    const PredictiveTable* tables[] = {&table};
+    unsigned char packed[PREDICTIVE_TABLE_BYTES];
+    table.Pack(packed);
+
+    PredictiveEncoder plain, shared;
+    shared.SetSharedTables(tables, 1);
+    std::vector<Bytes> plainPayloads, sharedPayloads;
+    int sharedTiles = 0;
+    Terminal screen(2);
+    size_t plainSize = EncodeScreen(plain, screen, plainPayloads, sharedTiles);
+    CHECK(sharedTiles == 0);
+    size_t sharedSize = EncodeScreen(shared, screen, sharedPayloads, sharedTiles);
+    CHECK(sharedTiles > 0);
+    CHECK(sharedSize < plainSize);
+
+    uint64_t counts[3][512] = {};
+    uint64_t cold = 0;
+    shared.CollectStatistics(counts, cold);
+    CHECK(cold == plainSize); // what the tiles would have cost on their own codes
+
+    PredictiveDecoder without;
+    CHECK(!DecodeScreen(without, screen, sharedPayloads));
+    PredictiveDecoder with;
+    CHECK(with.SetTable(1, packed));
+    CHECK(DecodeScreen(with, screen, sharedPayloads));
+    CHECK(DecodeScreen(with, screen, plainPayloads));
+
+    CHECK(!with.SetTable(PREDICTIVE_TABLES, packed));
+    CHECK(!with.SetTable(-1, packed));
+    unsigned char invalid[PREDICTIVE_TABLE_BYTES] = {};
+    CHECK(!with.SetTable(1, invalid)); // and the old table 1 is gone
+    CHECK(!DecodeScreen(with, screen, sharedPayloads));
+}
+
+// With two tables the encoder names the one each tile came out smaller with
+static void TestTwoTables() {
+    PredictiveTable trained = TrainTable(0, 1);
+    PredictiveTable noise = {};
+    uint64_t flat[3][512];
+    for (int c = 0; c < 3; ++c) {
+        for (int i = 0; i < 512; ++i) flat[c][i] = 1000;
+    }
+    noise.id = 2;
+    noise.Build(flat);
+    const PredictiveTable* tables[] = {&noise, &trained};
+    PredictiveEncoder encoder;
+    encoder.SetSharedTables(tables, 2);
+
+    std::vector<Bytes> payloads;
+    int sharedTiles = 0;
+    Terminal screen(5);
+    EncodeScreen(encoder, screen, payloads, sharedTiles);
+    CHECK(sharedTiles > 0);
+    for (const Bytes& payload : payloads) {
+        if (payload[0] == PREDICTIVE_SHARED) CHECK(payload[1] == 0);
+    }
+
+    PredictiveDecoder decoder;
+    unsigned char packed[PREDICTIVE_TABLE_BYTES];
+    trained.Pack(packed);
+    CHECK(decoder.SetTable(0, packed));
+    noise.Pack(packed);
+    CHECK(decoder.SetTable(2, packed));
+    CHECK(DecodeScreen(decoder, screen, payloads));
+}
+
+int main() {
+    TestPackUnpack();
+    TestSharedEncoding();
+    TestTwoTables();
+    return CHECK_RESULT();
+}
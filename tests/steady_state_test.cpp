@@ -0,0 +1,173 @@
+// ===== tests/steady_state_test.cpp =====
+// Built with RD_COUNT_ALLOCATIONS: after a warm-up, encoding and decoding
+// frame after frame must not touch the heap. Each codec runs a steady-state
+// loop through SteadyStateCheck, which aborts the program on the first
+// iteration that allocates; the PlaneBatch loops run on a thread pool like
+// the host's. Counts are per thread, so only the calling thread is checked.
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "glyph_cache.h"
+#include "plane_batch.h"
+#include "predictive_codec.h"
+#include "qoi_codec.h"
+#include "video_codec.h"
+#include "video_region.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+#define WIDTH 640
+#define HEIGHT 384
+#define WARMUP_FRAMES 3
+#define STEADY_FRAMES 20
+
+// A capture as plane_batch.h reads it
+struct Screen {
+    size_t stride;
+    Bytes pixels;
+
+    Screen() : stride((size_t)WIDTH * 4 + 32), pixels(stride * HEIGHT) {}
+    const unsigned char* Pixels() const { return pixels.data(); }
+    size_t Stride() const { return stride; }
+    int Width() const { return WIDTH; }
+    int Height() const { return HEIGHT; }
+};
+
+// Terminal text on the left half, moving noise on the right
+static void Paint(Screen& screen, uint32_t frame) {
+    FillSyntheticTerminal(screen.pixels.data(), screen.stride, TileRect{0, 0, WIDTH / 2, HEIGHT}, frame);
+    FillSyntheticVideo(screen.pixels.data(), screen.stride, TileRect{WIDTH / 2, 0, WIDTH / 2, HEIGHT}, frame);
+}
+
+static std::vector<TileRect> Tiles() {
+    std::vector<TileRect> tiles;
+    for (int y = 0; y < HEIGHT; y += TILE_SIZE) {
+        for (int x = 0; x < WIDTH; x += TILE_SIZE) {
+            tiles.push_back(TileRect{x, y, std::min(TILE_SIZE, WIDTH - x), std::min(TILE_SIZE, HEIGHT - y)});
+        }
+    }
+    return tiles;
+}
+
+static void TestPredictive() {
+    Screen screen;
+    std::vector<TileRect> tiles = Tiles();
+    PredictiveEncoder encoder;
+    PredictiveDecoder decoder;
+    encoder.Reserve(TILE_SIZE, TILE_SIZE);
+    Bytes payload(PredictiveMaxSize(TILE_SIZE, TILE_SIZE)), decoded((size_t)TILE_SIZE * TILE_SIZE * 4);
+    SteadyStateCheck check("predictive", WARMUP_FRAMES);
+    for (uint32_t frame = 0; frame < WARMUP_FRAMES + STEADY_FRAMES; ++frame) {
+        Paint(screen, frame);
+        for (const TileRect& tile : tiles) {
+            const unsigned char* pixels = screen.Pixels() + (size_t)tile.y * screen.stride + (size_t)tile.x * 4;
+            size_t size = encoder.Encode(pixels, screen.stride, tile.width, tile.height, payload.data());
+            CHECK(decoder.Decode(payload.data(), size, tile.width, tile.height, decoded.data(), TILE_SIZE * 4));
+        }
+        check.Checkpoint();
+    }
+}
+
+static void TestQoi() {
+    Screen screen;
+    Bytes payload(QoiMaxSize(WIDTH, TILE_SIZE)), decoded((size_t)WIDTH * TILE_SIZE * 4);
+    SteadyStateCheck check("qoi", WARMUP_FRAMES);
+    for (uint32_t frame = 0; frame < WARMUP_FRAMES + STEADY_FRAMES; ++frame) {
+        Paint(screen, frame);
+        for (int y = 0; y < HEIGHT; y += TILE_SIZE) {
+            int rows = std::min(TILE_SIZE, HEIGHT - y);
+            size_t size = QoiEncode(screen.Pixels() + (size_t)y * screen.stride, screen.stride, WIDTH, rows,
+                                    payload.data());
+            CHECK(QoiDecode(payload.data(), size, WIDTH, rows, decoded.data(), WIDTH * 4));
+        }
+        check.Checkpoint();
+    }
+}
+
+static void TestGlyphs() {
+    Screen screen;
+    GlyphEncoder encoder;
+    GlyphDecoder decoder;
+    encoder.Reserve((size_t)WIDTH * HEIGHT);
+    Bytes encoded, drawn((size_t)WIDTH * HEIGHT * 4);
+    GlyphFrame header = {};
+    SteadyStateCheck check("glyphs", WARMUP_FRAMES);
+    for (uint32_t frame = 0; frame < WARMUP_FRAMES + STEADY_FRAMES; ++frame) {
+        FillSyntheticTerminal(screen.pixels.data(), screen.stride, TileRect{0, 0, WIDTH, HEIGHT}, frame);
+        encoded.clear();
+        CHECK(encoder.Encode(screen.Pixels(), screen.stride, WIDTH, HEIGHT, header, encoded));
+        GlyphFrame frameHeader;
+        memcpy(&frameHeader, encoded.data(), sizeof(frameHeader));
+        CHECK(decoder.Decode(frameHeader, encoded.data() + sizeof(frameHeader), frameHeader.dataSize, drawn.data(),
+                             WIDTH * 4));
+        check.Checkpoint();
+    }
+}
+
+static void TestVideo() {
+    Screen screen;
+    WorkStealingPool pool(2);
+    VideoEncoder encoder;
+    VideoDecoder decoder;
+    Bytes encoded;
+    SteadyStateCheck check("video", WARMUP_FRAMES);
+    for (uint32_t frame = 0; frame < WARMUP_FRAMES + STEADY_FRAMES; ++frame) {
+        FillSyntheticVideo(screen.pixels.data(), screen.stride, TileRect{0, 0, WIDTH, HEIGHT}, frame);
+        if (frame == WARMUP_FRAMES + STEADY_FRAMES / 2) encoder.ForceKeyframe();
+        encoder.Encode(screen.Pixels(), screen.stride, WIDTH, HEIGHT, 1, frame % 2 ? &pool : nullptr, encoded);
+        VideoFrame frameHeader;
+        memcpy(&frameHeader, encoded.data(), sizeof(frameHeader));
+        CHECK(decoder.Decode(frameHeader, encoded.data() + sizeof(frameHeader), encoded.size() - sizeof(frameHeader)));
+        check.Checkpoint();
+    }
+}
+
+// Coarse passes, refinements and exact tiles, the way a progressive
+// stream alternates them, with the batches sized up front like the host
+static void TestPlaneBatch() {
+    Screen screen;
+    WorkStealingPool pool(3);
+    std::vector<TileRect> tiles = Tiles();
+    std::vector<PredictiveEncoder> encoders(pool.ThreadCount());
+    for (PredictiveEncoder& encoder : encoders) encoder.Reserve(TILE_SIZE, TILE_SIZE);
+    PlaneBatch planes, exact;
+    planes.Reserve(tiles.size(), (size_t)WIDTH * HEIGHT * 2);
+    exact.Reserve(tiles.size(), tiles.size() * PredictiveMaxSize(TILE_SIZE, TILE_SIZE));
+    std::vector<PlaneJob> jobs;
+    std::vector<TileRect> exactTiles;
+    jobs.reserve(tiles.size());
+    exactTiles.reserve(tiles.size());
+
+    SteadyStateCheck check("plane batch", WARMUP_FRAMES);
+    for (uint32_t frame = 0; frame < WARMUP_FRAMES + STEADY_FRAMES; ++frame) {
+        Paint(screen, frame);
+        jobs.clear();
+        exactTiles.clear();
+        for (size_t i = 0; i < tiles.size(); ++i) {
+            int pass = (int)((i + frame) % 4);
+            if (pass == 3) {
+                exactTiles.push_back(tiles[i]);
+            } else {
+                PlaneJob job = {tiles[i], PLANES_HIGH4 + pass};
+                jobs.push_back(job);
+            }
+        }
+        EncodePlaneBatch(pool, screen, 1, jobs, planes);
+        EncodeExactBatch(pool, screen, 1, frame % 2 ? TILE_QOI : TILE_PREDICTIVE, exactTiles, encoders, exact);
+        CHECK(planes.headers.size() == jobs.size() && exact.headers.size() == exactTiles.size());
+        for (size_t i = 0; i < exact.headers.size(); ++i) CHECK(exact.headers[i].dataSize > 0);
+        check.Checkpoint();
+    }
+}
+
+int main() {
+    TestPredictive();
+    TestQoi();
+    TestGlyphs();
+    TestVideo();
+    TestPlaneBatch();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,135 @@
+// ===== tests/text_input_test.cpp =====
+// The text run decoders: UTF-8 and UTF-16LE payloads, surrogate pairs,
+// and the replacement character for truncated, overlong and unpaired
+// input; and ScratchKeycodes never rebinding a keycode the previous
+// batch pressed.
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "text_input.h"
+#include "check.h"
+
+static std::u16string FromUtf8(const char* text) {
+    return Utf8ToUtf16(reinterpret_cast<const unsigned char*>(text), std::char_traits<char>::length(text));
+}
+
+static void TestUtf8() {
+    CHECK(FromUtf8("abc") == u"abc");
+    CHECK(FromUtf8("\xC3\xA9") == u"é");
+    CHECK(FromUtf8("\xE2\x82\xAC") == u"€");
+    CHECK(FromUtf8("\xF0\x9F\x98\x80") == std::u16string(u"\xD83D\xDE00")); // U+1F600 as a pair
+    CHECK(FromUtf8("\xF4\x8F\xBF\xBF") == std::u16string(u"\xDBFF\xDFFF")); // U+10FFFF
+}
+
+static void TestUtf8Malformed() {
+    // Truncated sequences, at the end and before the next character
+    CHECK(FromUtf8("a\xE2\x82") == u"a�");
+    CHECK(FromUtf8("\xF0\x9F\x98") == u"�");
+    CHECK(FromUtf8("\xC3" "a") == u"�a");
+    CHECK(FromUtf8("\x80z") == u"�z"); // stray continuation byte
+
+    // Overlong forms of NUL, '/', U+07FF and U+FFFF
+    CHECK(FromUtf8("\xC0\x80") != std::u16string(1, u'\0'));
+    CHECK(FromUtf8("\xC0\x80").find(u'\0') == std::u16string::npos);
+    CHECK(FromUtf8("\xC1\xBF")[0] == 0xFFFD);
+    CHECK(FromUtf8("\xE0\x80\xAF").find(u'/') == std::u16string::npos);
+    CHECK(FromUtf8("\xE0\x9F\xBF")[0] == 0xFFFD);
+    CHECK(FromUtf8("\xF0\x8F\xBF\xBF")[0] == 0xFFFD);
+    CHECK(FromUtf8("\xC2\x80") == u"\u0080"); // the shortest forms still decode
+    CHECK(FromUtf8("\xE0\xA0\x80") == u"ࠀ");
+    CHECK(FromUtf8("\xF0\x90\x80\x80") == std::u16string(u"\xD800\xDC00"));
+
+    // Encoded surrogates and code points past U+10FFFF
+    CHECK(FromUtf8("\xED\xA0\x80")[0] == 0xFFFD);
+    CHECK(FromUtf8("\xF4\x90\x80\x80")[0] == 0xFFFD);
+}
+
+static void TestCodePoints() {
+    std::vector<uint32_t> expected = {'a', 0x1F600, 0x20AC};
+    CHECK(Utf16ToCodePoints(std::u16string(u"a\xD83D\xDE00\x20AC")) == expected);
+
+    // Unpaired surrogates: a lone high one, a lone low one, reversed order
+    expected = {0xFFFD, 'b'};
+    CHECK(Utf16ToCodePoints(std::u16string(u"\xD83D" u"b")) == expected);
+    CHECK(Utf16ToCodePoints(std::u16string(u"\xDE00" u"b")) == expected);
+    expected = {0xFFFD, 0xFFFD};
+    CHECK(Utf16ToCodePoints(std::u16string(u"\xDE00\xD83D")) == expected);
+    CHECK(Utf16ToCodePoints(std::u16string(1, 0xD800)) == std::vector<uint32_t>(1, 0xFFFD));
+}
+
+static void TestDecodeTextRun() {
+    const unsigned char utf16[] = {'h', 0, 'i', 0, 0x3D, 0xD8, 0x00, 0xDE};
+    CHECK(DecodeTextRun(TEXT_ENCODING_UTF16, utf16, 4) == std::u16string(u"hi\xD83D\xDE00"));
+    CHECK(TextRunByteSize(TEXT_ENCODING_UTF16, 4) == sizeof(utf16));
+
+    const unsigned char utf8[] = {'h', 0xC3, 0xA9, 0xF0, 0x9F};
+    CHECK(DecodeTextRun(TEXT_ENCODING_UTF8, utf8, 3) == u"hé");
+    CHECK(DecodeTextRun(TEXT_ENCODING_UTF8, utf8, 5) == u"hé�");
+    CHECK(TextRunByteSize(TEXT_ENCODING_UTF8, 5) == sizeof(utf8));
+}
+
+// Type `codePoints` batch by batch, checking that every press hits a
+// keycode bound to its character and no keycode is rebound in the batch
+// after one that pressed it
+static void TypeThrough(ScratchKeycodes& scratch, const std::vector<uint32_t>& codePoints, size_t keycodes) {
+    std::vector<uint32_t> bound(256, 0);
+    std::set<uint8_t> previous;
+    std::vector<ScratchKeycodes::Binding> rebinds;
+    std::vector<uint8_t> presses;
+    size_t pos = 0;
+    while (pos < codePoints.size()) {
+        size_t taken = scratch.Plan(codePoints.data() + pos, codePoints.size() - pos, rebinds, presses);
+        CHECK(taken > 0 && taken == presses.size());
+        for (const ScratchKeycodes::Binding& binding : rebinds) {
+            if (keycodes > 1) CHECK(previous.count(binding.keycode) == 0);
+            bound[binding.keycode] = binding.codePoint;
+        }
+        std::set<uint8_t> pressed(presses.begin(), presses.end());
+        CHECK(pressed.size() <= std::max<size_t>(1, keycodes / 2));
+        for (size_t i = 0; i < taken; ++i) CHECK(bound[presses[i]] == codePoints[pos + i]);
+        previous = pressed;
+        pos += taken;
+    }
+}
+
+static void TestScratchKeycodes() {
+    std::vector<uint32_t> text;
+    for (uint32_t i = 0; i < 500; ++i) text.push_back(0x4E00 + (i * 7919) % 37);
+    for (size_t keycodes : {1, 2, 3, 8, 40}) {
+        std::vector<uint8_t> spare;
+        for (size_t i = 0; i < keycodes; ++i) spare.push_back((uint8_t)(200 + i));
+        ScratchKeycodes scratch(spare);
+        TypeThrough(scratch, text, keycodes);
+    }
+
+    // A repeated character is typed in one batch with no second rebind,
+    // and still bound for the next run
+    ScratchKeycodes scratch(std::vector<uint8_t>{10, 11, 12, 13});
+    std::vector<uint32_t> repeat(20, 'x');
+    std::vector<ScratchKeycodes::Binding> rebinds;
+    std::vector<uint8_t> presses;
+    CHECK(scratch.Plan(repeat.data(), repeat.size(), rebinds, presses) == repeat.size());
+    CHECK(rebinds.size() == 1);
+    CHECK(scratch.Plan(repeat.data(), 1, rebinds, presses) == 1);
+    CHECK(rebinds.empty() && presses[0] == 10);
+
+    // Successive batches rotate through the keycodes
+    std::vector<uint32_t> distinct = {'a', 'b', 'c', 'd', 'e', 'f'};
+    std::set<uint8_t> used;
+    for (size_t pos = 0; pos < distinct.size();) {
+        pos += scratch.Plan(distinct.data() + pos, distinct.size() - pos, rebinds, presses);
+        used.insert(presses.begin(), presses.end());
+    }
+    CHECK(used.size() == 4);
+}
+
+int main() {
+    TestUtf8();
+    TestUtf8Malformed();
+    TestCodePoints();
+    TestDecodeTextRun();
+    TestScratchKeycodes();
+    return CHECK_RESULT();
+}
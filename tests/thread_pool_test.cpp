@@ -0,0 +1,122 @@
+// ===== tests/thread_pool_test.cpp =====
+// WorkStealingPool::ParallelFor: every index runs exactly once, uneven
+// work spreads over the workers, several callers share one pool, and many
+// short loops in a row (the per-frame pattern) finish cleanly, also with
+// more callers than workers and pools coming and going.
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.h"
+#include "check.h"
+
+static void TestEachIndexOnce() {
+    WorkStealingPool pool(4);
+    CHECK(pool.ThreadCount() == 4);
+    const size_t sizes[] = {0, 1, 2, 3, 63, 64, 65, 1000};
+    for (size_t count : sizes) {
+        std::vector<std::atomic<int>> runs(count);
+        for (std::atomic<int>& run : runs) run = 0;
+        pool.ParallelFor(count, [&runs](size_t i) { runs[i]++; });
+        bool once = true;
+        for (const std::atomic<int>& run : runs) once = once && run == 1;
+        CHECK(once);
+    }
+}
+
+// A pool of one thread runs the loop on the caller
+static void TestSingleThread() {
+    WorkStealingPool pool(1);
+    std::thread::id caller = std::this_thread::get_id();
+    bool onCaller = true;
+    size_t next = 0;
+    bool inOrder = true;
+    pool.ParallelFor(100, [&](size_t i) {
+        onCaller = onCaller && std::this_thread::get_id() == caller;
+        inOrder = inOrder && i == next++;
+    });
+    CHECK(onCaller && inOrder && next == 100);
+}
+
+// A few slow tasks among fast ones are spread over several threads
+static void TestUnevenWork() {
+    WorkStealingPool pool(4);
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    auto start = std::chrono::steady_clock::now();
+    pool.ParallelFor(64, [&](size_t i) {
+        if (i % 8 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.insert(std::this_thread::get_id());
+    });
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    CHECK(threads.size() > 1);
+    CHECK(elapsed.count() < 8 * 20); // not one after another
+}
+
+// Streams encode on one pool at once, each frame a short loop
+static void TestConcurrentCallers() {
+    WorkStealingPool pool(4);
+    const int callers = 3, loops = 2000;
+    std::atomic<long long> total(0);
+    std::vector<std::thread> threads;
+    for (int c = 0; c < callers; ++c) {
+        threads.emplace_back([&pool, &total] {
+            for (int loop = 0; loop < loops; ++loop) {
+                std::atomic<int> sum(0);
+                pool.ParallelFor(1 + loop % 7, [&sum](size_t i) { sum += (int)i + 1; });
+                int count = 1 + loop % 7;
+                if (sum != count * (count + 1) / 2) total = -1000000000;
+                total += sum;
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    long long expected = 0;
+    for (int loop = 0; loop < loops; ++loop) expected += (1 + loop % 7) * (2 + loop % 7) / 2;
+    CHECK(total == expected * callers);
+}
+
+// More callers than workers, each running thousands of tiny loops of
+// varying size at once; every index of every loop runs exactly once
+static void TestOverlappingStress() {
+    WorkStealingPool pool(3);
+    const int callers = 8, loops = 3000;
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (int c = 0; c < callers; ++c) {
+        threads.emplace_back([&pool, &failures, c] {
+            std::vector<std::atomic<int>> runs(64);
+            for (int loop = 0; loop < loops; ++loop) {
+                size_t count = (size_t)((loop * 7 + c * 13) % 65);
+                for (size_t i = 0; i < count; ++i) runs[i] = 0;
+                pool.ParallelFor(count, [&runs](size_t i) { runs[i]++; });
+                for (size_t i = 0; i < count; ++i) {
+                    if (runs[i] != 1) failures++;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(failures == 0);
+
+    // Pools started and stopped between loops, as sessions come and go
+    for (int round = 0; round < 50; ++round) {
+        WorkStealingPool shortLived(1 + round % 4);
+        std::atomic<int> sum(0);
+        shortLived.ParallelFor(10, [&sum](size_t i) { sum += (int)i; });
+        CHECK(sum == 45);
+    }
+}
+
+int main() {
+    TestEachIndexOnce();
+    TestSingleThread();
+    TestUnevenWork();
+    TestConcurrentCallers();
+    TestOverlappingStress();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,133 @@
+// ===== tests/tile_priority_test.cpp =====
+// TilePrioritizer: dirty tiles come back as runs around the cursor first,
+// within the byte budget, and everything left over is deferred, ages and
+// goes out after a bounded number of frames.
+#include <chrono>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "tile_priority.h"
+#include "check.h"
+
+typedef TilePrioritizer::Clock Clock;
+
+#define SCREEN_WIDTH 1920
+#define SCREEN_HEIGHT 1080
+#define TILE_BYTES (TILE_SIZE * TILE_SIZE * 3 / 2) // one PLANES_HIGH4 tile
+
+static std::vector<TileRect> AllTiles() {
+    std::vector<TileRect> tiles;
+    for (int y = 0; y < SCREEN_HEIGHT; y += TILE_SIZE) {
+        for (int x = 0; x < SCREEN_WIDTH; x += TILE_SIZE) {
+            tiles.push_back(
+                TileRect{x, y, std::min(TILE_SIZE, SCREEN_WIDTH - x), std::min(TILE_SIZE, SCREEN_HEIGHT - y)});
+        }
+    }
+    return tiles;
+}
+
+static TilePrioritizer::Focus Cursor(int x, int y, double inputActivity = 1.0) {
+    TilePrioritizer::Focus focus = {x, y, inputActivity, false, TileRect{0, 0, 0, 0}};
+    return focus;
+}
+
+static bool Contains(const TileRect& rect, int x, int y) {
+    return x >= rect.x && x < rect.x + rect.width && y >= rect.y && y < rect.y + rect.height;
+}
+
+// Top left corners of the tiles a list of runs covers
+static std::set<std::pair<int, int>> Corners(const std::vector<TileRect>& runs) {
+    std::set<std::pair<int, int>> corners;
+    for (const TileRect& run : runs) {
+        for (int x = run.x; x < run.x + run.width; x += TILE_SIZE) corners.insert(std::make_pair(x, run.y));
+    }
+    return corners;
+}
+
+static void TestOrderFrom() {
+    std::vector<TileRect> tiles = AllTiles();
+    OrderTilesFrom(tiles, 1000, 500);
+    CHECK(Contains(tiles[0], 1000, 500));
+    auto distance = [](const TileRect& tile) {
+        long long dx = 2LL * tile.x + tile.width - 2000, dy = 2LL * tile.y + tile.height - 1000;
+        return dx * dx + dy * dy;
+    };
+    for (size_t i = 1; i < tiles.size(); ++i) CHECK(distance(tiles[i - 1]) <= distance(tiles[i]));
+}
+
+// A full-screen change: the cursor's run goes first, the budget holds,
+// and sent plus deferred is exactly the dirty set
+static void TestBudgetAndCover() {
+    TilePrioritizer prioritizer;
+    prioritizer.Reset(SCREEN_WIDTH, SCREEN_HEIGHT);
+    std::vector<TileRect> dirty = AllTiles(), send, deferred;
+    size_t budget = 40 * TILE_BYTES;
+    prioritizer.Plan(dirty, Cursor(1500, 900), Clock::now(), budget, PLANES_HIGH4, send, deferred);
+
+    CHECK(!send.empty() && Contains(send[0], 1500, 900));
+    size_t bytes = 0;
+    for (const TileRect& run : send) {
+        CHECK(run.width <= PRIORITY_RUN_TILES * TILE_SIZE && run.height <= TILE_SIZE);
+        bytes += PlaneRowBytes(PLANES_HIGH4, run.width) * run.height;
+    }
+    CHECK(bytes <= budget && bytes > budget / 2);
+
+    std::set<std::pair<int, int>> sent = Corners(send), waiting = Corners(deferred);
+    CHECK(sent.size() + waiting.size() == dirty.size());
+    for (const std::pair<int, int>& corner : sent) CHECK(!waiting.count(corner));
+    for (const TileRect& tile : deferred) CHECK(tile.width <= TILE_SIZE);
+
+    // The cursor is near the bottom right: raster order would finish its
+    // area last, priority order first
+    CHECK(prioritizer.PerceivedShare() >= 0 && prioritizer.PerceivedShare() < 0.2);
+    CHECK(prioritizer.RasterShare() > 0.8);
+}
+
+// However little fits per frame, a tile far from a busy cursor gets out
+// once it has waited long enough
+static void TestDeferredAge() {
+    TilePrioritizer prioritizer;
+    prioritizer.Reset(SCREEN_WIDTH, SCREEN_HEIGHT);
+    std::vector<TileRect> send, deferred;
+    TileRect far = {0, 0, TILE_SIZE, TILE_SIZE};
+    Clock::time_point now = Clock::now();
+    int frames = 0;
+    bool sent = false;
+    while (!sent && frames < 100) {
+        // The cursor's neighbourhood changes every frame
+        std::vector<TileRect> dirty = {far};
+        for (int x = 1600; x < 1856; x += TILE_SIZE) dirty.push_back(TileRect{x, 960, TILE_SIZE, TILE_SIZE});
+        prioritizer.Plan(dirty, Cursor(1700, 1000), now, TILE_BYTES, PLANES_HIGH4, send, deferred);
+        CHECK(send.size() == 1);
+        sent = Contains(send[0], 0, 0);
+        now += std::chrono::milliseconds(33);
+        frames++;
+    }
+    CHECK(sent);
+    CHECK(frames < PRIORITY_AGE_SCALE / 33 + 3);
+}
+
+// Without input, a change in the foreground window beats one as far from
+// the cursor outside it
+static void TestForegroundWindow() {
+    TilePrioritizer prioritizer;
+    prioritizer.Reset(SCREEN_WIDTH, SCREEN_HEIGHT);
+    TilePrioritizer::Focus focus = Cursor(960, 512, 0.0);
+    focus.hasWindow = true;
+    focus.window = TileRect{1280, 384, 512, 256};
+    std::vector<TileRect> dirty = {TileRect{384, 448, TILE_SIZE, TILE_SIZE},
+                                   TileRect{1472, 448, TILE_SIZE, TILE_SIZE}};
+    std::vector<TileRect> send, deferred;
+    prioritizer.Plan(dirty, focus, Clock::now(), TILE_BYTES, PLANES_HIGH4, send, deferred);
+    CHECK(send.size() == 1 && send[0].x == 1472);
+    CHECK(deferred.size() == 1 && deferred[0].x == 384);
+}
+
+int main() {
+    TestOrderFrom();
+    TestBudgetAndCover();
+    TestDeferredAge();
+    TestForegroundWindow();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,170 @@
+// ===== tests/uring_transport_test.cpp =====
+// IoUringTransport (when this kernel allows io_uring) and EpollTransport
+// over loopback TCP: messages of every size arrive whole and in order
+// through Receive, ReceiveInPlace and Peek, WaitReadable times out on a
+// quiet link and reports a closed one, and Shutdown wakes a blocked reader.
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "uring_transport.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+enum Kind { URING_ZERO_COPY, URING_COPIED, EPOLL };
+
+static bool ConnectLoopback(int& client, int& server) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    bool ok = listener >= 0 && bind(listener, (sockaddr*)&address, sizeof(address)) == 0 && listen(listener, 1) == 0 &&
+              getsockname(listener, (sockaddr*)&address, &size) == 0;
+    client = ok ? socket(AF_INET, SOCK_STREAM, 0) : -1;
+    ok = ok && client >= 0 && connect(client, (sockaddr*)&address, sizeof(address)) == 0;
+    server = ok ? accept(listener, nullptr, nullptr) : -1;
+    if (listener >= 0) close(listener);
+    return ok && server >= 0;
+}
+
+// Null if io_uring is not available here
+static std::unique_ptr<Transport> Open(Kind kind, int socket, SendStats* stats = nullptr) {
+    if (kind == EPOLL) return std::unique_ptr<Transport>(new EpollTransport(socket, stats));
+    std::unique_ptr<IoRing> sendRing(new IoRing()), receiveRing(new IoRing());
+    if (!sendRing->Create(URING_ENTRIES) || !receiveRing->Create(URING_ENTRIES)) {
+        close(socket);
+        return nullptr;
+    }
+    return std::unique_ptr<Transport>(
+        new IoUringTransport(socket, std::move(sendRing), std::move(receiveRing), stats, kind == URING_ZERO_COPY));
+}
+
+static Bytes Pattern(size_t size, unsigned seed) {
+    Bytes bytes(size);
+    for (size_t i = 0; i < size; ++i) bytes[i] = (unsigned char)((i * 131 + seed * 7) >> 3);
+    return bytes;
+}
+
+// A 4-byte length and a payload, as two slices, for each size; the payload
+// sizes cover gathered sends, zero-copy sends of one piece and messages
+// larger than all registered buffers together
+static void TestMessages(Kind kind) {
+    int client, server;
+    CHECK(ConnectLoopback(client, server));
+    SendStats stats;
+    std::unique_ptr<Transport> sender = Open(kind, client, &stats), receiver = Open(kind, server);
+    if (!sender || !receiver) return;
+
+    const size_t sizes[] = {1, 100, URING_ZERO_COPY_MIN - 4, URING_ZERO_COPY_MIN, 64 * 1024, URING_BUFFER_SIZE + 1,
+                            3 * URING_BUFFER_COUNT * URING_BUFFER_SIZE + 12345, 7};
+    const int rounds = 3;
+    std::thread writer([&sender, &sizes]() {
+        for (int round = 0; round < rounds; ++round) {
+            for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+                uint32_t length = (uint32_t)sizes[i];
+                Bytes payload = Pattern(length, (unsigned)(round * 16 + i));
+                IoSlice slices[2] = {{&length, sizeof(length)}, {payload.data(), payload.size()}};
+                if (!sender->Send(slices, 2)) return;
+            }
+        }
+    });
+
+    int received = 0;
+    for (int round = 0; round < rounds; ++round) {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+            uint8_t first;
+            CHECK(receiver->Peek(first));
+            uint32_t length = 0;
+            CHECK(receiver->Receive(&length, sizeof(length)));
+            CHECK(length == sizes[i]);
+            if (length != sizes[i]) break;
+            Bytes expected = Pattern(length, (unsigned)(round * 16 + i)), payload(length);
+            const void* inPlace = receiver->ReceiveInPlace(length);
+            if (inPlace) {
+                memcpy(payload.data(), inPlace, length);
+            } else {
+                CHECK(receiver->Receive(payload.data(), length));
+            }
+            CHECK(payload == expected);
+            received++;
+        }
+    }
+    writer.join();
+    CHECK(received == rounds * (int)(sizeof(sizes) / sizeof(sizes[0])));
+    CHECK(stats.messages.load() == (uint64_t)received);
+    CHECK(stats.calls.load() >= 1);
+    if (kind == URING_ZERO_COPY) CHECK(std::string(sender->Name()).find("io_uring") == 0);
+}
+
+static void TestWaitReadable(Kind kind) {
+    int client, server;
+    CHECK(ConnectLoopback(client, server));
+    std::unique_ptr<Transport> sender = Open(kind, client), receiver = Open(kind, server);
+    if (!sender || !receiver) return;
+
+    CHECK(receiver->WaitReadable(10) == 0);
+    CHECK(sender->SendBytes("ab", 2));
+    CHECK(receiver->WaitReadable(1000) == 1);
+    char data[2];
+    CHECK(receiver->Receive(data, 2) && data[0] == 'a' && data[1] == 'b');
+    CHECK(receiver->WaitReadable(0) == 0);
+
+    sender.reset();
+    CHECK(receiver->WaitReadable(1000) == -1);
+    uint8_t byte;
+    CHECK(!receiver->Peek(byte));
+}
+
+// Shutdown from another thread wakes a reader blocked in Receive
+static void TestShutdown(Kind kind) {
+    int client, server;
+    CHECK(ConnectLoopback(client, server));
+    std::unique_ptr<Transport> sender = Open(kind, client), receiver = Open(kind, server);
+    if (!sender || !receiver) return;
+
+    bool result = true;
+    std::thread reader([&receiver, &result]() {
+        char data[16];
+        result = receiver->Receive(data, sizeof(data));
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    receiver->Shutdown();
+    reader.join();
+    CHECK(!result);
+}
+
+static void TestLocalPeer(Kind kind) {
+    int client, server;
+    CHECK(ConnectLoopback(client, server));
+    std::unique_ptr<Transport> sender = Open(kind, client), receiver = Open(kind, server);
+    if (!sender || !receiver) return;
+    CHECK(sender->PeerIsLocal() && receiver->PeerIsLocal());
+    CHECK(sender->ChunkSize() == BULK_CHUNK_SIZE);
+}
+
+int main() {
+    const Kind kinds[] = {URING_ZERO_COPY, URING_COPIED, EPOLL};
+    for (Kind kind : kinds) {
+        TestMessages(kind);
+        TestWaitReadable(kind);
+        TestShutdown(kind);
+        TestLocalPeer(kind);
+    }
+
+    // Over loopback zero-copy sends are not asked for
+    int client, server;
+    CHECK(ConnectLoopback(client, server));
+    std::unique_ptr<Transport> opened = OpenLinuxTransport(client);
+    CHECK(opened != nullptr && std::string(opened->Name()).find("zero-copy") == std::string::npos);
+    close(server);
+    return CHECK_RESULT();
+}
@@ -0,0 +1,178 @@
+// ===== tests/video_codec_test.cpp =====
+// VideoEncoder and VideoDecoder: a panning picture decodes close to the
+// source frame after frame without drift, still frames cost next to
+// nothing, motion beats intra coding, slices encoded on a pool match
+// serial ones, and the decoder waits for a keyframe. Also the quantizer
+// adaptation and FullMotionSwitch.
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "video_codec.h"
+#include "check.h"
+
+typedef std::vector<unsigned char> Bytes;
+
+// A smooth picture (chroma edges would be lost to 4:2:0 whatever the
+// codec does) panned `offset` pixels to the left
+static Bytes Picture(int width, int height, int offset) {
+    Bytes pixels((size_t)width * height * 4);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int u = x + offset;
+            unsigned char* out = &pixels[((size_t)y * width + x) * 4];
+            out[0] = (unsigned char)(128 + 90 * std::sin(u / 23.0) * std::cos(y / 31.0));
+            out[1] = (unsigned char)(128 + 100 * std::sin((u + 2 * y) / 41.0));
+            out[2] = (unsigned char)(128 + 80 * std::cos((u - y) / 17.0));
+            out[3] = 0xFF;
+        }
+    }
+    return pixels;
+}
+
+static double Psnr(const Bytes& a, const unsigned char* b, int width, int height) {
+    double squared = 0;
+    for (size_t i = 0; i < (size_t)width * height * 4; ++i) {
+        if (i % 4 == 3) continue;
+        double d = (double)a[i] - b[i];
+        squared += d * d;
+    }
+    double mean = squared / ((double)width * height * 3);
+    return mean > 0 ? 10.0 * std::log10(255.0 * 255.0 / mean) : 99.0;
+}
+
+static bool Decode(VideoDecoder& decoder, const Bytes& encoded) {
+    VideoFrame frame;
+    memcpy(&frame, encoded.data(), sizeof(frame));
+    CHECK(frame.dataSize == encoded.size() - sizeof(frame));
+    return decoder.Decode(frame, encoded.data() + sizeof(frame), encoded.size() - sizeof(frame));
+}
+
+static bool IsKey(const Bytes& encoded) {
+    VideoFrame frame;
+    memcpy(&frame, encoded.data(), sizeof(frame));
+    return (frame.flags & VIDEO_FRAME_KEY) != 0;
+}
+
+// Thirty frames of panning: quality holds, inter frames undercut the keyframe
+static void TestPanning() {
+    const int width = 320, height = 192;
+    VideoEncoder encoder;
+    VideoDecoder decoder;
+    Bytes encoded;
+    size_t keyBytes = 0, interBytes = 0;
+    double worst = 99.0, first = 0, last = 0;
+    for (int frame = 0; frame < 30; ++frame) {
+        Bytes source = Picture(width, height, 3 * frame);
+        encoder.Encode(source.data(), (size_t)width * 4, width, height, 1, nullptr, encoded);
+        CHECK(IsKey(encoded) == (frame == 0));
+        CHECK(Decode(decoder, encoded));
+        CHECK(decoder.Ready() && decoder.Width() == width && decoder.Height() == height);
+        last = Psnr(source, decoder.Pixels(), width, height);
+        if (frame == 0) first = last;
+        worst = std::min(worst, last);
+        if (frame == 0) keyBytes = encoded.size();
+        else interBytes = std::max(interBytes, encoded.size());
+    }
+    CHECK(worst > 30.0);
+    CHECK(last > first - 2.0); // encoder and decoder references stay in step
+    CHECK(interBytes < keyBytes / 2);
+}
+
+// An unchanged frame is all skips
+static void TestStill() {
+    const int width = 256, height = 128;
+    VideoEncoder encoder;
+    VideoDecoder decoder;
+    Bytes source = Picture(width, height, 0), encoded;
+    encoder.Encode(source.data(), (size_t)width * 4, width, height, 1, nullptr, encoded);
+    CHECK(Decode(decoder, encoded));
+    size_t key = encoded.size();
+    encoder.Encode(source.data(), (size_t)width * 4, width, height, 1, nullptr, encoded);
+    CHECK(Decode(decoder, encoded));
+    size_t slices = (height / VIDEO_MB + VIDEO_SLICE_ROWS - 1) / VIDEO_SLICE_ROWS;
+    CHECK(encoded.size() <= sizeof(VideoFrame) + slices * (4 + 4));
+    CHECK(encoded.size() < key / 20);
+
+    encoder.ForceKeyframe();
+    encoder.Encode(source.data(), (size_t)width * 4, width, height, 1, nullptr, encoded);
+    CHECK(IsKey(encoded) && encoder.LastWasKeyframe());
+}
+
+// Sizes off the macroblock grid, coded serially and on a pool
+static void TestPoolAndOddSizes() {
+    const int width = 150, height = 70;
+    WorkStealingPool pool(4);
+    VideoEncoder serial, parallel;
+    VideoDecoder decoder;
+    Bytes a, b;
+    for (int frame = 0; frame < 5; ++frame) {
+        Bytes source = Picture(width, height, 5 * frame);
+        serial.Encode(source.data(), (size_t)width * 4, width, height, 2, nullptr, a);
+        parallel.Encode(source.data(), (size_t)width * 4, width, height, 2, &pool, b);
+        CHECK(a == b);
+        CHECK(Decode(decoder, a));
+        CHECK(Psnr(source, decoder.Pixels(), width, height) > 30.0);
+    }
+}
+
+// Joining a stream mid-way: inter frames are dropped until a keyframe,
+// and a cut payload is refused
+static void TestNeedsKeyframe() {
+    const int width = 128, height = 64;
+    VideoEncoder encoder;
+    Bytes key, inter;
+    Bytes first = Picture(width, height, 0), second = Picture(width, height, 4);
+    encoder.Encode(first.data(), (size_t)width * 4, width, height, 1, nullptr, key);
+    encoder.Encode(second.data(), (size_t)width * 4, width, height, 1, nullptr, inter);
+
+    VideoDecoder late;
+    CHECK(Decode(late, inter));
+    CHECK(!late.Ready());
+    CHECK(Decode(late, key));
+    CHECK(late.Ready());
+
+    VideoDecoder cut;
+    VideoFrame frame;
+    memcpy(&frame, key.data(), sizeof(frame));
+    CHECK(!cut.Decode(frame, key.data() + sizeof(frame), key.size() - sizeof(frame) - 20));
+    CHECK(!cut.Ready());
+}
+
+static void TestAdapt() {
+    VideoEncoder encoder;
+    CHECK(encoder.Quantizer() == VIDEO_INITIAL_QUANTIZER);
+    for (int i = 0; i < 100; ++i) encoder.Adapt(1000, 100);
+    CHECK(encoder.Quantizer() == VIDEO_MAX_QUANTIZER);
+    for (int i = 0; i < 100; ++i) encoder.Adapt(10, 100);
+    CHECK(encoder.Quantizer() == VIDEO_MIN_QUANTIZER);
+    encoder.Adapt(70, 100); // within budget, not far under: unchanged
+    CHECK(encoder.Quantizer() == VIDEO_MIN_QUANTIZER);
+}
+
+static void TestMotionSwitch() {
+    FullMotionSwitch motion;
+    for (int i = 0; i < MOTION_ENTER_FRAMES - 1; ++i) motion.Update(80, 100);
+    CHECK(!motion.Active());
+    motion.Update(40, 100); // one calm frame starts the count again
+    for (int i = 0; i < MOTION_ENTER_FRAMES - 1; ++i) motion.Update(80, 100);
+    CHECK(!motion.Active());
+    motion.Update(80, 100);
+    CHECK(motion.Active());
+
+    for (int i = 0; i < MOTION_LEAVE_FRAMES - 1; ++i) motion.Update(5, 100);
+    CHECK(motion.Active());
+    motion.Update(5, 100);
+    CHECK(!motion.Active());
+}
+
+int main() {
+    TestPanning();
+    TestStill();
+    TestPoolAndOddSizes();
+    TestNeedsKeyframe();
+    TestAdapt();
+    TestMotionSwitch();
+    return CHECK_RESULT();
+}
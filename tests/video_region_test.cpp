@@ -0,0 +1,108 @@
+// ===== tests/video_region_test.cpp =====
+// VideoRegionDetector on synthetic screens: a video playing over
+// terminal text is found and tracked, scrolling text alone never is, and
+// the region is let go once the video stops.
+#include <cstdint>
+#include <vector>
+
+#include "glyph_cache.h"
+#include "video_region.h"
+#include "check.h"
+
+#define SCREEN_WIDTH 1920
+#define SCREEN_HEIGHT 1080
+
+// A capture and the detector fed from it
+struct Screen {
+    size_t stride;
+    std::vector<unsigned char> pixels;
+    VideoRegionDetector detector;
+
+    Screen() : stride((size_t)SCREEN_WIDTH * 4), pixels(stride * SCREEN_HEIGHT) {
+        detector.Reset(SCREEN_WIDTH, SCREEN_HEIGHT);
+    }
+};
+
+static const TileRect kFullScreen = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+
+// The tiles touching `area`: the dirty tiles when only it changed
+static std::vector<TileRect> TilesOf(const TileRect& area) {
+    std::vector<TileRect> tiles;
+    for (int y = area.y / TILE_SIZE * TILE_SIZE; y < area.y + area.height; y += TILE_SIZE) {
+        for (int x = area.x / TILE_SIZE * TILE_SIZE; x < area.x + area.width; x += TILE_SIZE) {
+            tiles.push_back(
+                TileRect{x, y, std::min(TILE_SIZE, SCREEN_WIDTH - x), std::min(TILE_SIZE, SCREEN_HEIGHT - y)});
+        }
+    }
+    return tiles;
+}
+
+static void TestLooksPhotographic() {
+    Screen screen;
+    TileRect tile = {128, 64, TILE_SIZE, TILE_SIZE};
+    FillSyntheticTerminal(screen.pixels.data(), screen.stride, kFullScreen, 0);
+    CHECK(!LooksPhotographic(tile, screen.pixels.data(), screen.stride));
+    FillSyntheticVideo(screen.pixels.data(), screen.stride, tile, 0);
+    CHECK(LooksPhotographic(tile, screen.pixels.data(), screen.stride));
+}
+
+// A video that does not sit on the tile grid, over a static terminal
+static void TestFindsVideo() {
+    Screen screen;
+    const TileRect video = {300, 200, 640, 360};
+    FillSyntheticTerminal(screen.pixels.data(), screen.stride, kFullScreen, 0);
+    std::vector<TileRect> dirty = TilesOf(video);
+    int frame = 0;
+    for (; frame < 40 && !screen.detector.Active(); ++frame) {
+        FillSyntheticVideo(screen.pixels.data(), screen.stride, video, (uint32_t)frame);
+        screen.detector.Update(dirty, screen.pixels.data(), screen.stride);
+    }
+    CHECK(screen.detector.Active());
+    CHECK(frame == VIDEO_HOT_FRAMES + VIDEO_CONFIRM_FRAMES - 1);
+    CHECK(RegionOverlap(screen.detector.Region(), video) > 0.75);
+
+    // Stopped: held through a short pause, then released
+    int quiet = 0;
+    for (; quiet < 60 && screen.detector.Active(); ++quiet) {
+        screen.detector.Update(std::vector<TileRect>(), screen.pixels.data(), screen.stride);
+    }
+    CHECK(!screen.detector.Active());
+    CHECK(quiet >= VIDEO_RELEASE_FRAMES && quiet <= 16 + VIDEO_RELEASE_FRAMES);
+}
+
+// The region follows a video window that is moved
+static void TestFollowsMove() {
+    Screen screen;
+    TileRect video = {256, 128, 512, 384};
+    for (int frame = 0; frame < 20; ++frame) {
+        FillSyntheticVideo(screen.pixels.data(), screen.stride, video, (uint32_t)frame);
+        screen.detector.Update(TilesOf(video), screen.pixels.data(), screen.stride);
+    }
+    CHECK(screen.detector.Active());
+    TileRect moved = {1024, 512, 512, 384};
+    for (int frame = 20; frame < 60; ++frame) {
+        FillSyntheticVideo(screen.pixels.data(), screen.stride, moved, (uint32_t)frame);
+        screen.detector.Update(TilesOf(moved), screen.pixels.data(), screen.stride);
+    }
+    CHECK(screen.detector.Active());
+    CHECK(RegionOverlap(screen.detector.Region(), moved) > 0.9);
+}
+
+// Text scrolling over the whole screen changes every tile but is not video
+static void TestIgnoresText() {
+    Screen screen;
+    std::vector<TileRect> dirty = TilesOf(kFullScreen);
+    for (int frame = 0; frame < 40; ++frame) {
+        FillSyntheticTerminal(screen.pixels.data(), screen.stride, kFullScreen, (uint32_t)frame);
+        screen.detector.Update(dirty, screen.pixels.data(), screen.stride);
+        CHECK(!screen.detector.Active());
+    }
+}
+
+int main() {
+    TestLooksPhotographic();
+    TestFindsVideo();
+    TestFollowsMove();
+    TestIgnoresText();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,309 @@
+// ===== text_input.h =====
+// Unicode text injection: the viewer sends whole runs of typed/pasted text
+// and the host replays them with one batched injection call instead of a
+// key-down/Sleep/key-up round trip per character.
+//
+// On Windows each UTF-16 unit goes through the input queue as an
+// INPUT_EVENT_UNICODE event (Win32InputInjector in input_queue.h, which
+// uses ControlCharToVirtualKey below). SimulateText injects a run directly
+// with X11/XTest on Linux (define RD_HAVE_XTEST and link -lX11 -lXtst).
+#ifndef TEXT_INPUT_H
+#define TEXT_INPUT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+#include "protocol.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(RD_HAVE_XTEST)
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+#endif
+
+// ---- UTF conversion helpers (platform neutral) ----
+
+inline std::u16string Utf8ToUtf16(const unsigned char* data, size_t size) {
+    std::u16string out;
+    out.reserve(size);
+
+    size_t i = 0;
+    while (i < size) {
+        uint32_t cp = data[i];
+        size_t extra = 0;
+        if (cp < 0x80) {
+            extra = 0;
+        } else if ((cp & 0xE0) == 0xC0) {
+            cp &= 0x1F; extra = 1;
+        } else if ((cp & 0xF0) == 0xE0) {
+            cp &= 0x0F; extra = 2;
+        } else if ((cp & 0xF8) == 0xF0) {
+            cp &= 0x07; extra = 3;
+        } else {
+            out.push_back(0xFFFD);
+            i++;
+            continue;
+        }
+
+        if (i + extra >= size) {
+            // Truncated sequence at end of run
+            out.push_back(0xFFFD);
+            break;
+        }
+
+        bool valid = true;
+        for (size_t k = 1; k <= extra; ++k) {
+            unsigned char c = data[i + k];
+            if ((c & 0xC0) != 0x80) {
+                valid = false;
+                break;
+            }
+            cp = (cp << 6) | (c & 0x3F);
+        }
+
+        // Overlong forms are refused, or "C0 80" would smuggle in a NUL and
+        // "E0 80 AF" a '/'
+        static const uint32_t minimum[4] = {0, 0x80, 0x800, 0x10000};
+        if (!valid || cp < minimum[extra] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+            out.push_back(0xFFFD);
+            i++;
+            continue;
+        }
+
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            out.push_back(static_cast<char16_t>(0xD800 + (cp >> 10)));
+            out.push_back(static_cast<char16_t>(0xDC00 + (cp & 0x3FF)));
+        } else {
+            out.push_back(static_cast<char16_t>(cp));
+        }
+        i += extra + 1;
+    }
+    return out;
+}
+
+inline std::vector<uint32_t> Utf16ToCodePoints(const std::u16string& text) {
+    std::vector<uint32_t> out;
+    out.reserve(text.size());
+
+    for (size_t i = 0; i < text.size(); ++i) {
+        uint32_t unit = text[i];
+        if (unit >= 0xD800 && unit <= 0xDBFF && i + 1 < text.size() &&
+            text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF) {
+            out.push_back(0x10000 + ((unit - 0xD800) << 10) + (text[i + 1] - 0xDC00));
+            i++;
+        } else if (unit >= 0xD800 && unit <= 0xDFFF) {
+            out.push_back(0xFFFD); // unpaired surrogate
+        } else {
+            out.push_back(unit);
+        }
+    }
+    return out;
+}
+
+// Decode the payload of a TextInputEvent into UTF-16
+inline std::u16string DecodeTextRun(uint8_t encoding, const unsigned char* data, uint16_t length) {
+    if (encoding == TEXT_ENCODING_UTF8) {
+        return Utf8ToUtf16(data, length);
+    }
+
+    std::u16string out(length, u'\0');
+    for (uint16_t i = 0; i < length; ++i) {
+        out[i] = static_cast<char16_t>(data[i * 2] | (data[i * 2 + 1] << 8));
+    }
+    return out;
+}
+
+// Size in bytes of a text run's payload on the wire
+inline size_t TextRunByteSize(uint8_t encoding, uint16_t length) {
+    return encoding == TEXT_ENCODING_UTF8 ? length : static_cast<size_t>(length) * 2;
+}
+
+// Picks the spare keycode each character of a run is typed with, for
+// backends that must bind a keysym to a keycode before pressing it. A
+// keycode still bound to the character is pressed again as is. Otherwise
+// keycodes are rebound round-robin, and a batch uses at most half of
+// them, so none is rebound in the batch right after the one that pressed
+// it: clients still reading that batch's key events do not see the
+// mapping change under them. (A single spare keycode cannot avoid that.)
+class ScratchKeycodes {
+public:
+    struct Binding {
+        uint8_t keycode;
+        uint32_t codePoint;
+    };
+
+    explicit ScratchKeycodes(const std::vector<uint8_t>& keycodes)
+        : m_keycodes(keycodes), m_bound(keycodes.size(), 0), m_lastBatch(keycodes.size(), 0), m_batch(1),
+          m_next(0) {}
+
+    // Plan the next batch from the start of `codePoints`: the keycodes to
+    // rebind first, then the keycode to press for each character taken.
+    // Returns how many characters the batch takes (at least one).
+    size_t Plan(const uint32_t* codePoints, size_t count, std::vector<Binding>& rebinds,
+                std::vector<uint8_t>& presses) {
+        rebinds.clear();
+        presses.clear();
+        if (m_keycodes.empty()) return 0;
+        m_batch++;
+        size_t limit = std::max<size_t>(1, m_keycodes.size() / 2);
+        size_t used = 0, taken = 0;
+        for (; taken < count; ++taken) {
+            size_t slot = Find(codePoints[taken]);
+            if (slot == m_keycodes.size()) {
+                if (used == limit || !Free(slot, used == 0)) break;
+                m_bound[slot] = codePoints[taken];
+                Binding binding = {m_keycodes[slot], codePoints[taken]};
+                rebinds.push_back(binding);
+            } else if (m_lastBatch[slot] != m_batch && used == limit) {
+                break;
+            }
+            if (m_lastBatch[slot] != m_batch) used++;
+            m_lastBatch[slot] = m_batch;
+            presses.push_back(m_keycodes[slot]);
+        }
+        return taken;
+    }
+
+private:
+    size_t Find(uint32_t codePoint) const {
+        for (size_t slot = 0; slot < m_keycodes.size(); ++slot) {
+            if (m_bound[slot] == codePoint && codePoint != 0) return slot;
+        }
+        return m_keycodes.size();
+    }
+
+    // The next keycode in turn not pressed in this batch or the one
+    // before; `force` allows the one before if there is no other
+    bool Free(size_t& slot, bool force) {
+        for (int pass = 0; pass < (force ? 2 : 1); ++pass) {
+            for (size_t i = 0; i < m_keycodes.size(); ++i) {
+                size_t candidate = (m_next + i) % m_keycodes.size();
+                uint64_t last = m_lastBatch[candidate];
+                if (last != m_batch && (pass == 1 || last + 1 != m_batch)) {
+                    slot = candidate;
+                    m_next = (candidate + 1) % m_keycodes.size();
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    std::vector<uint8_t> m_keycodes;
+    std::vector<uint32_t> m_bound;     // code point each keycode is bound to, 0 for none
+    std::vector<uint64_t> m_lastBatch; // batch that last pressed each keycode
+    uint64_t m_batch;
+    size_t m_next;                     // where the round-robin search starts
+};
+
+// ---- Injection backends ----
+
+#if defined(_WIN32)
+
+// Control characters are replayed as their real keys; apps treat a
+// KEYEVENTF_UNICODE '\r' differently from a VK_RETURN press
+inline WORD ControlCharToVirtualKey(char16_t unit) {
+    switch (unit) {
+        case u'\r':
+        case u'\n': return VK_RETURN;
+        case u'\t': return VK_TAB;
+        case u'\b': return VK_BACK;
+        case 0x1B:  return VK_ESCAPE;
+        default:    return 0;
+    }
+}
+
+#elif defined(RD_HAVE_XTEST)
+
+inline Display* GetTextInputDisplay() {
+    static Display* display = XOpenDisplay(nullptr);
+    return display;
+}
+
+inline KeySym CodePointToKeySym(uint32_t cp) {
+    switch (cp) {
+        case '\r':
+        case '\n': return XK_Return;
+        case '\t': return XK_Tab;
+        case '\b': return XK_BackSpace;
+        case 0x1B: return XK_Escape;
+    }
+    if ((cp >= 0x20 && cp <= 0x7E) || (cp >= 0xA0 && cp <= 0xFF)) {
+        return cp; // Latin-1 keysyms match their code points
+    }
+    return 0x01000000 | cp;
+}
+
+// XTest can only press keycodes, so each character is bound to a spare
+// keycode first. A batch binds its keycodes with one XSync and presses
+// them with another, which keeps throughput at thousands of chars/s;
+// ScratchKeycodes keeps a batch off the keycodes the previous one pressed.
+inline bool SimulateText(const std::u16string& text) {
+    Display* display = GetTextInputDisplay();
+    if (!display) return false;
+    if (text.empty()) return true;
+
+    static std::unique_ptr<ScratchKeycodes> scratch;
+    if (!scratch) {
+        std::vector<uint8_t> spare;
+        int minKeycode = 0, maxKeycode = 0, symsPerKeycode = 0;
+        XDisplayKeycodes(display, &minKeycode, &maxKeycode);
+        KeySym* map = XGetKeyboardMapping(display, minKeycode, maxKeycode - minKeycode + 1, &symsPerKeycode);
+        for (int kc = minKeycode; kc <= maxKeycode && map; ++kc) {
+            bool unused = true;
+            for (int s = 0; s < symsPerKeycode; ++s) {
+                if (map[(kc - minKeycode) * symsPerKeycode + s] != NoSymbol) {
+                    unused = false;
+                    break;
+                }
+            }
+            if (unused) spare.push_back(static_cast<uint8_t>(kc));
+        }
+        if (map) XFree(map);
+        if (spare.empty()) spare.push_back(static_cast<uint8_t>(maxKeycode));
+        scratch.reset(new ScratchKeycodes(spare));
+    }
+
+    std::vector<uint32_t> codePoints = Utf16ToCodePoints(text);
+    std::vector<ScratchKeycodes::Binding> rebinds;
+    std::vector<uint8_t> presses;
+    size_t pos = 0;
+    while (pos < codePoints.size()) {
+        pos += scratch->Plan(codePoints.data() + pos, codePoints.size() - pos, rebinds, presses);
+
+        for (const ScratchKeycodes::Binding& binding : rebinds) {
+            KeySym sym = CodePointToKeySym(binding.codePoint);
+            XChangeKeyboardMapping(display, binding.keycode, 1, &sym, 1);
+        }
+        if (!rebinds.empty()) XSync(display, False);
+
+        for (uint8_t keycode : presses) {
+            XTestFakeKeyEvent(display, keycode, True, CurrentTime);
+            XTestFakeKeyEvent(display, keycode, False, CurrentTime);
+        }
+        XSync(display, False);
+    }
+    // Scratch keycodes stay bound: clearing them right away races clients
+    // that have not yet processed the key events
+    return true;
+}
+
+#else
+
+inline bool SimulateText(const std::u16string&) {
+    return false; // no injection backend on this platform
+}
+
+#endif
+
+#endif // TEXT_INPUT_H
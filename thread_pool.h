@@ -0,0 +1,204 @@
+// ===== thread_pool.h =====
+// Work-stealing pool for per-frame encoding work.
+//
+// ParallelFor splits a loop into one task per index and deals them out
+// round-robin over the workers' deques. A worker takes tasks from the back
+// of its own deque and, once that is empty, steals from the front of the
+// others, so uneven tiles (text next to flat background) even out. The
+// calling thread works on the same tasks until its loop is finished, which
+// makes a pool of N threads use N-1 workers plus the caller. Several
+// streams may run loops on the same pool at once.
+//
+// Once the task rings have grown to the largest loop seen, running a loop
+// does not touch the heap: the loop body is called through a plain
+// function pointer rather than a std::function.
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class WorkStealingPool {
+public:
+    // `threads` counts the caller; 0 means one per hardware thread
+    explicit WorkStealingPool(unsigned threads = 0) : m_stopped(false), m_queued(0), m_nextQueue(0) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        m_threadCount = threads;
+
+        unsigned workers = threads - 1;
+        for (unsigned i = 0; i < std::max(workers, 1u); ++i) {
+            m_queues.emplace_back(new WorkQueue());
+        }
+        for (unsigned i = 0; i < workers; ++i) {
+            m_workers.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_wakeup.notify_all();
+        for (std::thread& worker : m_workers) worker.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    unsigned ThreadCount() const { return m_threadCount; }
+
+    // Run fn(0) .. fn(count - 1) and return when all of them have finished
+    template <typename Fn>
+    void ParallelFor(size_t count, Fn&& fn) {
+        if (count == 0) return;
+        if (m_workers.empty() || count == 1) {
+            for (size_t i = 0; i < count; ++i) fn(i);
+            return;
+        }
+
+        typedef typename std::remove_reference<Fn>::type Function;
+        Batch batch(const_cast<void*>(static_cast<const void*>(&fn)),
+                    [](void* context, size_t index) { (*static_cast<Function*>(context))(index); }, count);
+        size_t queue = m_nextQueue.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < count; ++i, ++queue) {
+            WorkQueue& target = *m_queues[queue % m_queues.size()];
+            std::lock_guard<std::mutex> lock(target.mutex);
+            target.tasks.PushBack(Task{&batch, i});
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queued += count;
+        }
+        m_wakeup.notify_all();
+
+        // Help until nothing is left to take, then wait for stragglers
+        Task task;
+        while (batch.remaining.load(std::memory_order_acquire) > 0 && Steal(queue, task)) {
+            Run(task);
+        }
+        std::unique_lock<std::mutex> lock(batch.mutex);
+        batch.done.wait(lock, [&batch] { return batch.remaining.load(std::memory_order_acquire) == 0; });
+    }
+
+private:
+    struct Batch {
+        Batch(void* function, void (*call)(void*, size_t), size_t count)
+            : context(function), invoke(call), remaining(count) {}
+        void* context;
+        void (*invoke)(void*, size_t);
+        std::atomic<size_t> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    struct Task {
+        Batch* batch;
+        size_t index;
+    };
+
+    // Double-ended ring of tasks; only grows, so a warmed-up pool never allocates
+    class TaskRing {
+    public:
+        TaskRing() : m_tasks(64), m_head(0), m_count(0) {}
+
+        bool Empty() const { return m_count == 0; }
+
+        void PushBack(const Task& task) {
+            if (m_count == m_tasks.size()) {
+                std::vector<Task> grown(m_tasks.size() * 2);
+                for (size_t i = 0; i < m_count; ++i) grown[i] = m_tasks[(m_head + i) & (m_tasks.size() - 1)];
+                m_tasks.swap(grown);
+                m_head = 0;
+            }
+            m_tasks[(m_head + m_count) & (m_tasks.size() - 1)] = task;
+            m_count++;
+        }
+
+        Task PopBack() {
+            m_count--;
+            return m_tasks[(m_head + m_count) & (m_tasks.size() - 1)];
+        }
+
+        Task PopFront() {
+            Task task = m_tasks[m_head];
+            m_head = (m_head + 1) & (m_tasks.size() - 1);
+            m_count--;
+            return task;
+        }
+
+    private:
+        std::vector<Task> m_tasks; // power-of-two size
+        size_t m_head;
+        size_t m_count;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        TaskRing tasks;
+    };
+
+    bool PopOwn(size_t queue, Task& task) {
+        WorkQueue& own = *m_queues[queue];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.tasks.Empty()) return false;
+        task = own.tasks.PopBack();
+        return true;
+    }
+
+    bool Steal(size_t start, Task& task) {
+        for (size_t i = 0; i < m_queues.size(); ++i) {
+            WorkQueue& victim = *m_queues[(start + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.tasks.Empty()) continue;
+            task = victim.tasks.PopFront();
+            return true;
+        }
+        return false;
+    }
+
+    void Run(const Task& task) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queued--;
+        }
+        task.batch->invoke(task.batch->context, task.index);
+        // The caller returns, and the batch goes away, once it sees nothing
+        // remaining under the batch lock. Counting down under that lock
+        // keeps the batch alive until the last task has notified.
+        std::lock_guard<std::mutex> lock(task.batch->mutex);
+        if (task.batch->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) task.batch->done.notify_all();
+    }
+
+    void WorkerLoop(unsigned index) {
+        Task task;
+        while (true) {
+            if (PopOwn(index, task) || Steal(index + 1, task)) {
+                Run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this] { return m_stopped || m_queued > 0; });
+            if (m_stopped) return;
+        }
+    }
+
+    unsigned m_threadCount;
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    bool m_stopped;
+    size_t m_queued;
+    std::atomic<size_t> m_nextQueue;
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,205 @@
+// ===== tile_priority.h =====
+// Order in which changed tiles are sent when a lot changes at once.
+//
+// Dirty tiles are cut into short runs and scored: closeness to the
+// cursor (weighted up while the user is giving input), a bonus inside
+// the foreground window, and the time a tile has already been waiting.
+// Runs go out highest score first until the frame's byte budget is used;
+// the rest are deferred to the next frame, where their age lifts them
+// above fresh changes, so nothing waits for long.
+//
+// For the stats report each plan also records after which share of the
+// changed bytes the area around the cursor was complete, and what that
+// share would have been in raster order.
+#ifndef TILE_PRIORITY_H
+#define TILE_PRIORITY_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "dirty_tiles.h"
+#include "progressive.h"
+
+#define PRIORITY_RUN_TILES 4         // longest run of tiles sent as one message
+#define PRIORITY_PROXIMITY_SCALE 256 // pixels from the cursor at which closeness counts half
+#define PRIORITY_AGE_SCALE 100.0     // ms of waiting worth as much as being under the cursor
+#define PERCEIVED_RADIUS 256         // pixels around the cursor the user is taken to look at
+
+// Sort tiles nearest first to the point (x, y), e.g. the cursor, where
+// the user is most likely looking
+inline void OrderTilesFrom(std::vector<TileRect>& tiles, int x, int y) {
+    auto distance = [x, y](const TileRect& tile) {
+        long long dx = 2LL * tile.x + tile.width - 2LL * x;
+        long long dy = 2LL * tile.y + tile.height - 2LL * y;
+        return dx * dx + dy * dy;
+    };
+    std::sort(tiles.begin(), tiles.end(), [&distance](const TileRect& a, const TileRect& b) {
+        long long da = distance(a), db = distance(b);
+        return da != db ? da < db : (a.y != b.y ? a.y < b.y : a.x < b.x);
+    });
+}
+
+class TilePrioritizer {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Where the user is probably looking
+    struct Focus {
+        int cursorX;           // stream coordinates
+        int cursorY;
+        double inputActivity;  // 1 right after input, 0 once idle
+        bool hasWindow;
+        TileRect window;       // foreground window, stream coordinates
+    };
+
+    TilePrioritizer() : m_width(0), m_height(0), m_columns(0), m_perceivedShare(-1), m_rasterShare(-1) {}
+
+    void Reset(int width, int height) {
+        m_width = width;
+        m_height = height;
+        m_columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+        int rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+        m_waitingSince.assign(static_cast<size_t>(m_columns) * rows, Clock::time_point());
+        m_runs.reserve(m_waitingSince.size());
+    }
+
+    int Width() const { return m_width; }
+    int Height() const { return m_height; }
+
+    // Split `dirty` (raster order) into runs for `format`, most important
+    // first, as many as fit in byteBudget (at least one) into `send`; the
+    // tiles of the other runs go to `deferred`
+    void Plan(const std::vector<TileRect>& dirty, const Focus& focus, Clock::time_point now, size_t byteBudget,
+              int format, std::vector<TileRect>& send, std::vector<TileRect>& deferred) {
+        send.clear();
+        deferred.clear();
+        m_runs.clear();
+        for (const TileRect& tile : dirty) {
+            size_t index = Index(tile);
+            if (index >= m_waitingSince.size()) continue;
+            if (m_waitingSince[index] == Clock::time_point()) m_waitingSince[index] = now;
+            double score = Score(tile, focus, now - m_waitingSince[index]);
+            bool near = Near(tile, focus);
+
+            if (!m_runs.empty()) {
+                Run& last = m_runs.back();
+                if (last.rect.y == tile.y && last.rect.x + last.rect.width == tile.x &&
+                    last.rect.width < PRIORITY_RUN_TILES * TILE_SIZE) {
+                    last.rect.width += tile.width;
+                    last.score = std::max(last.score, score);
+                    last.near = last.near || near;
+                    continue;
+                }
+            }
+            Run run = {tile, score, near, m_runs.size()};
+            m_runs.push_back(run);
+        }
+        MeasureShares(format);
+
+        std::sort(m_runs.begin(), m_runs.end(), [](const Run& a, const Run& b) {
+            return a.score != b.score ? a.score > b.score : a.raster < b.raster;
+        });
+        size_t used = 0;
+        for (const Run& run : m_runs) {
+            size_t bytes = Bytes(run.rect, format);
+            if (!send.empty() && used + bytes > byteBudget) {
+                for (int x = run.rect.x; x < run.rect.x + run.rect.width; x += TILE_SIZE) {
+                    TileRect tile = {x, run.rect.y, std::min(TILE_SIZE, run.rect.x + run.rect.width - x),
+                                     run.rect.height};
+                    deferred.push_back(tile);
+                }
+                continue;
+            }
+            used += bytes;
+            send.push_back(run.rect);
+            for (int x = run.rect.x; x < run.rect.x + run.rect.width; x += TILE_SIZE) {
+                TileRect tile = {x, run.rect.y, TILE_SIZE, TILE_SIZE};
+                m_waitingSince[Index(tile)] = Clock::time_point();
+            }
+        }
+    }
+
+    // Share of the last plan's bytes sent by the time every run near the
+    // cursor was out, in priority and in raster order; -1 if none was near
+    double PerceivedShare() const { return m_perceivedShare; }
+    double RasterShare() const { return m_rasterShare; }
+
+private:
+    struct Run {
+        TileRect rect;
+        double score;
+        bool near;
+        size_t raster; // position in raster order
+    };
+
+    size_t Index(const TileRect& tile) const {
+        return static_cast<size_t>(tile.y / TILE_SIZE) * m_columns + tile.x / TILE_SIZE;
+    }
+
+    static size_t Bytes(const TileRect& rect, int format) {
+        return PlaneRowBytes(format, rect.width) * rect.height;
+    }
+
+    static double Distance(const TileRect& tile, const Focus& focus) {
+        double dx = tile.x + tile.width / 2.0 - focus.cursorX;
+        double dy = tile.y + tile.height / 2.0 - focus.cursorY;
+        return std::sqrt(dx * dx + dy * dy);
+    }
+
+    static bool Near(const TileRect& tile, const Focus& focus) {
+        return Distance(tile, focus) <= PERCEIVED_RADIUS;
+    }
+
+    static double Score(const TileRect& tile, const Focus& focus, Clock::duration waited) {
+        double proximity = 1.0 / (1.0 + Distance(tile, focus) / PRIORITY_PROXIMITY_SCALE);
+        double score = proximity * (0.5 + 0.5 * focus.inputActivity);
+        int centerX = tile.x + tile.width / 2, centerY = tile.y + tile.height / 2;
+        if (focus.hasWindow && centerX >= focus.window.x && centerX < focus.window.x + focus.window.width &&
+            centerY >= focus.window.y && centerY < focus.window.y + focus.window.height) {
+            score += 0.25;
+        }
+        return score + std::chrono::duration<double, std::milli>(waited).count() / PRIORITY_AGE_SCALE;
+    }
+
+    // Called with m_runs still in raster order
+    void MeasureShares(int format) {
+        m_perceivedShare = m_rasterShare = -1;
+        size_t total = 0, nearCount = 0;
+        for (const Run& run : m_runs) {
+            total += Bytes(run.rect, format);
+            if (run.near) nearCount++;
+        }
+        if (!nearCount || !total) return;
+
+        size_t sent = 0, seen = 0;
+        for (const Run& run : m_runs) {
+            sent += Bytes(run.rect, format);
+            if (run.near && ++seen == nearCount) break;
+        }
+        m_rasterShare = static_cast<double>(sent) / total;
+
+        // Priority order sends runs by score; the last near run sets the share
+        double lowestNear = 1e300;
+        for (const Run& run : m_runs) {
+            if (run.near) lowestNear = std::min(lowestNear, run.score);
+        }
+        sent = 0;
+        for (const Run& run : m_runs) {
+            if (run.score >= lowestNear) sent += Bytes(run.rect, format);
+        }
+        m_perceivedShare = static_cast<double>(sent) / total;
+    }
+
+    int m_width;
+    int m_height;
+    int m_columns;
+    std::vector<Clock::time_point> m_waitingSince; // when a dirty tile started waiting, epoch if not dirty
+    std::vector<Run> m_runs;
+    double m_perceivedShare;
+    double m_rasterShare;
+};
+
+#endif // TILE_PRIORITY_H
@@ -0,0 +1,156 @@
+// ===== transport.h =====
+// The byte stream between host and viewer. Both programs speak the
+// protocol through a Transport rather than a raw socket, so the link
+// underneath can change without touching message handling.
+//
+// Send and Maintain are serialised by the caller; Receive, WaitReadable
+// and Peek are only called from one reader thread. Shutdown may be
+// called from any thread and wakes whatever is blocked.
+//
+// The interface is platform neutral; SocketTransport is the Windows one,
+// uring_transport.h has those for Linux.
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <cstdint>
+#include <string>
+
+#include "io_slice.h"
+
+#define BULK_CHUNK_SIZE (64 * 1024) // largest piece of a frame on a socket
+
+class Transport {
+public:
+    virtual ~Transport() {}
+
+    // Write every slice, in order; fails once the peer is gone
+    virtual bool Send(const IoSlice* slices, int count) = 0;
+
+    // Read exactly `size` bytes
+    virtual bool Receive(void* data, size_t size) = 0;
+
+    // The next `size` bytes inside the transport's own buffer, consumed, or
+    // null if it does not hold them contiguously (use Receive then). Valid
+    // until the next receive call.
+    virtual const void* ReceiveInPlace(size_t size) {
+        (void)size;
+        return nullptr;
+    }
+
+    // Wait up to timeoutMs for incoming data.
+    // Returns 1 when data is ready, 0 on timeout, -1 once the link is closed.
+    virtual int WaitReadable(int timeoutMs) = 0;
+
+    // Next incoming byte without consuming it (waits for it)
+    virtual bool Peek(uint8_t& byte) = 0;
+
+    // Called every few seconds while the session runs
+    virtual void Maintain() {}
+
+    virtual void Shutdown() = 0;
+
+    virtual const char* Name() const = 0;
+
+    // Largest piece a bulk message should be cut into so that urgent
+    // messages can go out between pieces; 0 if sends never queue long
+    virtual size_t ChunkSize() const { return 0; }
+
+    // True when the other end runs on this machine
+    virtual bool PeerIsLocal() const { return false; }
+
+    // One line of link statistics for the periodic report, empty if none
+    virtual std::string Status() const { return std::string(); }
+
+    bool SendBytes(const void* data, size_t size) {
+        IoSlice slice = {data, size};
+        return Send(&slice, 1);
+    }
+};
+
+#ifdef _WIN32
+
+#include "socket_io.h"
+
+// Blocking TCP socket. Messages go out as one gather write, Nagle is off
+// and the send buffer follows the bandwidth-delay product.
+class SocketTransport : public Transport {
+public:
+    explicit SocketTransport(SOCKET socket, SendStats* stats = nullptr)
+        : m_socket(socket), m_stats(stats) {
+        SetLowLatency(m_socket);
+        m_sendBuffer.Reset();
+    }
+
+    ~SocketTransport() override { closesocket(m_socket); }
+
+    bool Send(const IoSlice* slices, int count) override {
+        if (!SendSlices(m_socket, slices, count, m_stats)) return false;
+        size_t bytes = 0;
+        for (int i = 0; i < count; ++i) bytes += slices[i].size;
+        m_sendBuffer.Sent(bytes);
+        return true;
+    }
+
+    bool Receive(void* data, size_t size) override {
+        char* ptr = static_cast<char*>(data);
+        size_t totalReceived = 0;
+        while (totalReceived < size) {
+            int received = recv(m_socket, ptr + totalReceived, (int)(size - totalReceived), 0);
+            if (received <= 0) return false;
+            totalReceived += received;
+        }
+        return true;
+    }
+
+    int WaitReadable(int timeoutMs) override {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(m_socket, &readSet);
+        timeval timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+        int result = select(0, &readSet, nullptr, nullptr, &timeout);
+        if (result == SOCKET_ERROR) return -1;
+        if (result == 0) return 0;
+
+        // Readable with nothing to read means the peer closed
+        char next;
+        return recv(m_socket, &next, 1, MSG_PEEK) == 1 ? 1 : -1;
+    }
+
+    bool Peek(uint8_t& byte) override {
+        return recv(m_socket, reinterpret_cast<char*>(&byte), 1, MSG_PEEK) == 1;
+    }
+
+    void Maintain() override { m_sendBuffer.Update(m_socket); }
+
+    void Shutdown() override { shutdown(m_socket, SD_BOTH); }
+
+    const char* Name() const override { return "TCP"; }
+
+    size_t ChunkSize() const override { return BULK_CHUNK_SIZE; }
+
+    // Loopback, or connected to one of our own addresses
+    bool PeerIsLocal() const override {
+        sockaddr_in peer = {}, local = {};
+        int peerSize = sizeof(peer), localSize = sizeof(local);
+        if (getpeername(m_socket, (sockaddr*)&peer, &peerSize) != 0 ||
+            getsockname(m_socket, (sockaddr*)&local, &localSize) != 0 || peer.sin_family != AF_INET) {
+            return false;
+        }
+        return (ntohl(peer.sin_addr.s_addr) >> 24) == 127 || peer.sin_addr.s_addr == local.sin_addr.s_addr;
+    }
+
+    std::string Status() const override {
+        return "SO_SNDBUF " + std::to_string(m_sendBuffer.BufferSize() / 1024) + " KB (RTT " +
+               std::to_string(m_sendBuffer.RttMicros() / 1000) + "ms, peak " +
+               std::to_string((uint64_t)(m_sendBuffer.PeakBytesPerSecond() / 1024)) + " KB/s)";
+    }
+
+private:
+    SOCKET m_socket;
+    SendStats* m_stats;
+    SendBufferTuner m_sendBuffer;
+};
+
+#endif // _WIN32
+
+#endif // TRANSPORT_H
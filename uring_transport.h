@@ -0,0 +1,580 @@
+// ===== uring_transport.h =====
+// Transports for a host running on Linux, over a connected TCP socket.
+//
+// IoUringTransport talks to the kernel through two io_urings, one per
+// direction so the sending thread and the reader thread never share one,
+// set up with raw syscalls against <linux/io_uring.h> (no liburing; the
+// header must be from Linux 6.0 or later). Messages of URING_ZERO_COPY_MIN
+// bytes or more are copied into buffers registered with the send ring and
+// go out as zero-copy sends from there (IORING_OP_SEND_ZC), all pieces of
+// a message linked and submitted with one io_uring_enter. A buffer is
+// taken again once the kernel has said it is done with its pages; those
+// notices are picked up by later calls rather than waited for. Smaller
+// messages, and all of them when the kernel has no zero-copy sends, go out
+// as one IORING_OP_SENDMSG over the slices.
+//
+// EpollTransport is the fallback where io_uring is missing or disabled
+// (seccomp, kernel.io_uring_disabled): a non-blocking socket, a sendmsg per
+// message and epoll_wait while the socket buffer is full.
+// OpenLinuxTransport picks between them.
+//
+// Both read into a buffer of their own that Receive, ReceiveInPlace and
+// Peek are served from. Neither sizes SO_SNDBUF the way SocketTransport
+// does: setting it turns off Linux's own send buffer autotuning.
+#ifndef URING_TRANSPORT_H
+#define URING_TRANSPORT_H
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "transport.h"
+
+#define URING_ENTRIES 16                    // submission queue size of each ring
+#define URING_BUFFER_COUNT 8                // registered send buffers
+#define URING_BUFFER_SIZE (256 * 1024)      // largest piece of a zero-copy send
+#define URING_ZERO_COPY_MIN (16 * 1024)     // smaller messages are not worth pinning pages for
+#define LINUX_RECEIVE_BUFFER (256 * 1024)
+
+// A message over the non-empty slices, with `vectors` (MAX_IO_SLICES long)
+// as its iovecs
+inline msghdr GatherSlices(const IoSlice* slices, int count, iovec* vectors) {
+    msghdr message = {};
+    message.msg_iov = vectors;
+    for (int i = 0; i < count; ++i) {
+        if (slices[i].size) vectors[message.msg_iovlen++] = iovec{const_cast<void*>(slices[i].data), slices[i].size};
+    }
+    return message;
+}
+
+// Skip `sent` bytes of a message's iovecs
+inline void AdvanceMessage(msghdr& message, size_t sent) {
+    while (message.msg_iovlen > 0 && sent >= message.msg_iov->iov_len) {
+        sent -= message.msg_iov->iov_len;
+        message.msg_iov++;
+        message.msg_iovlen--;
+    }
+    if (message.msg_iovlen > 0) {
+        message.msg_iov->iov_base = static_cast<char*>(message.msg_iov->iov_base) + sent;
+        message.msg_iov->iov_len -= sent;
+    }
+}
+
+// Loopback, or connected to one of our own addresses
+inline bool SocketPeerIsLocal(int socket) {
+    sockaddr_in peer = {}, local = {};
+    socklen_t peerSize = sizeof(peer), localSize = sizeof(local);
+    if (getpeername(socket, (sockaddr*)&peer, &peerSize) != 0 ||
+        getsockname(socket, (sockaddr*)&local, &localSize) != 0 || peer.sin_family != AF_INET) {
+        return false;
+    }
+    return (ntohl(peer.sin_addr.s_addr) >> 24) == 127 || peer.sin_addr.s_addr == local.sin_addr.s_addr;
+}
+
+// One io_uring, mapped into this process. Used from one thread at a time.
+class IoRing {
+public:
+    IoRing()
+        : m_fd(-1), m_ring(MAP_FAILED), m_ringSize(0), m_sqes(nullptr), m_sqeSize(0), m_entries(0), m_tail(0),
+          m_submitted(0) {}
+
+    ~IoRing() {
+        if (m_sqes) munmap(m_sqes, m_sqeSize);
+        if (m_ring != MAP_FAILED) munmap(m_ring, m_ringSize);
+        if (m_fd >= 0) close(m_fd);
+    }
+
+    // False if this kernel has no io_uring or does not let us use it
+    bool Create(unsigned entries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (m_fd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP)) return false;
+
+        m_ringSize = std::max<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        m_ring = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if (m_ring == MAP_FAILED) return false;
+        m_sqeSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, m_sqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) return false;
+        m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+        char* ring = static_cast<char*>(m_ring);
+        m_sqHead = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+        m_sqTail = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+        m_sqMask = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+        m_sqArray = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+        m_cqHead = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+        m_cqMask = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+        m_entries = params.sq_entries;
+        m_tail = m_submitted = *m_sqTail;
+        return true;
+    }
+
+    // Whether the kernel knows the operation
+    bool Supports(unsigned op) const {
+        std::vector<unsigned char> storage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+        if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, 256) < 0) return false;
+        return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    bool RegisterBuffers(const iovec* buffers, unsigned count) {
+        return syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+    }
+
+    // A cleared entry at the end of the submission queue, or null if it is
+    // full; Submit hands it to the kernel
+    io_uring_sqe* Queue() {
+        if (m_tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_entries) return nullptr;
+        unsigned index = m_tail & m_sqMask;
+        memset(&m_sqes[index], 0, sizeof(io_uring_sqe));
+        m_sqArray[index] = index;
+        m_tail++;
+        return &m_sqes[index];
+    }
+
+    // Submit what was queued and wait until `waitFor` completions are there
+    bool Submit(unsigned waitFor) {
+        __atomic_store_n(m_sqTail, m_tail, __ATOMIC_RELEASE);
+        for (;;) {
+            long result = syscall(__NR_io_uring_enter, m_fd, m_tail - m_submitted, waitFor,
+                                  waitFor ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (result >= 0) {
+                m_submitted += static_cast<unsigned>(result);
+                if (m_submitted == m_tail) return true;
+            } else if (errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+    // Take the oldest completion, if there is one
+    bool Next(io_uring_cqe& cqe) {
+        unsigned head = *m_cqHead;
+        if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) return false;
+        cqe = m_cqes[head & m_cqMask];
+        __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    int m_fd;
+    void* m_ring;
+    size_t m_ringSize;
+    io_uring_sqe* m_sqes;
+    size_t m_sqeSize;
+    unsigned m_entries;
+    unsigned* m_sqHead;
+    unsigned* m_sqTail;
+    unsigned m_sqMask;
+    unsigned* m_sqArray;
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned m_cqMask;
+    io_uring_cqe* m_cqes;
+    unsigned m_tail;      // entries queued
+    unsigned m_submitted; // of those, taken by the kernel
+};
+
+// What both Linux transports share: the socket, and the receive buffer
+class LinuxTransport : public Transport {
+public:
+    explicit LinuxTransport(int socket) : m_socket(socket), m_buffer(LINUX_RECEIVE_BUFFER), m_start(0), m_end(0) {
+        int one = 1;
+        setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    ~LinuxTransport() override { close(m_socket); }
+
+    bool Receive(void* data, size_t size) override {
+        unsigned char* out = static_cast<unsigned char*>(data);
+        while (size > 0) {
+            if (m_start == m_end && size >= m_buffer.size()) {
+                // Large payloads go straight to the caller
+                ssize_t received = Read(out, size);
+                if (received <= 0) return false;
+                out += received;
+                size -= static_cast<size_t>(received);
+                continue;
+            }
+            if (!Fill(1)) return false;
+            size_t n = std::min(size, m_end - m_start);
+            memcpy(out, &m_buffer[m_start], n);
+            m_start += n;
+            out += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    const void* ReceiveInPlace(size_t size) override {
+        if (size > m_buffer.size() || !Fill(size)) return nullptr;
+        const void* data = &m_buffer[m_start];
+        m_start += size;
+        return data;
+    }
+
+    int WaitReadable(int timeoutMs) override {
+        if (m_start < m_end) return 1;
+        pollfd readable = {m_socket, POLLIN, 0};
+        int ready = poll(&readable, 1, timeoutMs);
+        if (ready < 0) return errno == EINTR ? 0 : -1;
+        if (ready == 0) return 0;
+
+        // Readable with nothing to read means the peer closed
+        return Fill(1) ? 1 : -1;
+    }
+
+    bool Peek(uint8_t& byte) override {
+        if (!Fill(1)) return false;
+        byte = m_buffer[m_start];
+        return true;
+    }
+
+    void Shutdown() override { shutdown(m_socket, SHUT_RDWR); }
+
+    size_t ChunkSize() const override { return BULK_CHUNK_SIZE; }
+
+    bool PeerIsLocal() const override { return SocketPeerIsLocal(m_socket); }
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+
+    // Read up to `size` bytes, waiting for the first: how many, 0 once the
+    // peer has closed, -1 on errors
+    virtual ssize_t Read(void* data, size_t size) = 0;
+
+    int m_socket;
+
+private:
+    // At least `size` bytes in the buffer, in one piece
+    bool Fill(size_t size) {
+        if (m_end - m_start >= size) return true;
+        if (m_start + size > m_buffer.size() || m_start == m_end) {
+            memmove(&m_buffer[0], &m_buffer[m_start], m_end - m_start);
+            m_end -= m_start;
+            m_start = 0;
+        }
+        while (m_end - m_start < size) {
+            ssize_t received = Read(&m_buffer[m_end], m_buffer.size() - m_end);
+            if (received <= 0) return false;
+            m_end += static_cast<size_t>(received);
+        }
+        return true;
+    }
+
+    std::vector<unsigned char> m_buffer;
+    size_t m_start; // next byte to hand out
+    size_t m_end;   // end of the bytes read
+};
+
+class IoUringTransport : public LinuxTransport {
+public:
+    // Zero-copy sends are used if asked for and the kernel has them
+    IoUringTransport(int socket, std::unique_ptr<IoRing> sendRing, std::unique_ptr<IoRing> receiveRing,
+                     SendStats* stats = nullptr, bool zeroCopy = true)
+        : LinuxTransport(socket), m_sendRing(std::move(sendRing)), m_receiveRing(std::move(receiveRing)),
+          m_stats(stats), m_zeroCopy(false), m_nextBuffer(0), m_gatheredDone(false), m_gatheredResult(0),
+          m_zeroCopySends(0), m_gatheredSends(0) {
+        memset(m_notices, 0, sizeof(m_notices));
+        memset(m_results, 0, sizeof(m_results));
+        memset(m_done, 0, sizeof(m_done));
+        if (zeroCopy && m_sendRing->Supports(IORING_OP_SEND_ZC)) {
+            m_buffers.resize(URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+            iovec buffers[URING_BUFFER_COUNT];
+            for (int i = 0; i < URING_BUFFER_COUNT; ++i) buffers[i] = iovec{Buffer(i), URING_BUFFER_SIZE};
+            m_zeroCopy = m_sendRing->RegisterBuffers(buffers, URING_BUFFER_COUNT);
+        }
+    }
+
+    bool Send(const IoSlice* slices, int count) override {
+        if (count > MAX_IO_SLICES) return false;
+        size_t total = 0;
+        for (int i = 0; i < count; ++i) total += slices[i].size;
+        if (m_stats) m_stats->messages++;
+        if (m_zeroCopy && total >= URING_ZERO_COPY_MIN) {
+            m_zeroCopySends++;
+            return SendZeroCopy(slices, count, total);
+        }
+        m_gatheredSends++;
+        return SendGathered(slices, count);
+    }
+
+    const char* Name() const override { return m_zeroCopy ? "io_uring, zero-copy" : "io_uring"; }
+
+    std::string Status() const override {
+        return std::to_string(m_zeroCopySends) + " zero-copy sends, " + std::to_string(m_gatheredSends) + " copied";
+    }
+
+protected:
+    ssize_t Read(void* data, size_t size) override {
+        for (;;) {
+            io_uring_sqe* sqe = m_receiveRing->Queue();
+            if (!sqe) return -1;
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = m_socket;
+            sqe->addr = reinterpret_cast<uintptr_t>(data);
+            sqe->len = static_cast<uint32_t>(std::min<size_t>(size, 1u << 30));
+            if (!m_receiveRing->Submit(1)) return -1;
+            io_uring_cqe cqe;
+            while (!m_receiveRing->Next(cqe)) {
+                if (!m_receiveRing->Submit(1)) return -1;
+            }
+            if (cqe.res != -EINTR) return cqe.res < 0 ? -1 : cqe.res;
+        }
+    }
+
+private:
+    // user_data of a gathered send; zero-copy sends carry their buffer + 1
+    static const uint64_t GATHERED = 0;
+
+    unsigned char* Buffer(int index) { return m_buffers.data() + (size_t)index * URING_BUFFER_SIZE; }
+
+    // Submit what is queued and wait for a completion; counted as one call
+    bool Enter() {
+        Clock::time_point start = Clock::now();
+        bool ok = m_sendRing->Submit(1);
+        if (m_stats) {
+            m_stats->calls++;
+            m_stats->latency.Record(Clock::now() - start);
+        }
+        return ok;
+    }
+
+    // Take in what the send ring has completed: send results, and the
+    // kernel letting go of buffers. A zero-copy send that will not be
+    // followed by a notice says so by leaving IORING_CQE_F_MORE unset.
+    void Collect() {
+        io_uring_cqe cqe;
+        while (m_sendRing->Next(cqe)) {
+            if (cqe.user_data == GATHERED) {
+                m_gatheredResult = cqe.res;
+                m_gatheredDone = true;
+                continue;
+            }
+            int buffer = static_cast<int>(cqe.user_data - 1);
+            if (!(cqe.flags & IORING_CQE_F_NOTIF)) {
+                m_results[buffer] = cqe.res;
+                m_done[buffer] = true;
+            }
+            if ((cqe.flags & IORING_CQE_F_NOTIF) || !(cqe.flags & IORING_CQE_F_MORE)) m_notices[buffer]--;
+        }
+    }
+
+    // One SENDMSG over the slices, again for whatever was not sent
+    bool SendGathered(const IoSlice* slices, int count) {
+        iovec vectors[MAX_IO_SLICES];
+        msghdr message = GatherSlices(slices, count, vectors);
+        while (message.msg_iovlen > 0) {
+            io_uring_sqe* sqe = m_sendRing->Queue();
+            if (!sqe) return false;
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = m_socket;
+            sqe->addr = reinterpret_cast<uintptr_t>(&message);
+            sqe->len = 1;
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+            sqe->user_data = GATHERED;
+            m_gatheredDone = false;
+            if (!Enter()) return false;
+            for (Collect(); !m_gatheredDone; Collect()) {
+                if (!Enter()) return false;
+            }
+            if (m_gatheredResult == -EINTR) continue;
+            if (m_gatheredResult <= 0) return false;
+            AdvanceMessage(message, static_cast<size_t>(m_gatheredResult));
+        }
+        return true;
+    }
+
+    void QueueZeroCopy(io_uring_sqe* sqe, int buffer, size_t offset, size_t size, bool linked) {
+        sqe->opcode = IORING_OP_SEND_ZC;
+        sqe->fd = m_socket;
+        sqe->addr = reinterpret_cast<uintptr_t>(Buffer(buffer) + offset);
+        sqe->len = static_cast<uint32_t>(size);
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+        sqe->buf_index = static_cast<uint16_t>(buffer);
+        sqe->flags = linked ? IOSQE_IO_LINK : 0;
+        sqe->user_data = static_cast<uint64_t>(buffer) + 1;
+        m_notices[buffer]++;
+        m_done[buffer] = false;
+    }
+
+    // Wait until the kernel is done with a buffer's pages
+    bool Reclaim(int buffer) {
+        for (Collect(); m_notices[buffer] > 0; Collect()) {
+            if (!Enter()) return false;
+        }
+        return true;
+    }
+
+    // The message in pieces of up to a buffer, copied into the buffers in
+    // turn and submitted linked, as many at once as there are buffers. A
+    // piece the kernel sent short, or cancelled after an earlier short one,
+    // is sent again on its own.
+    bool SendZeroCopy(const IoSlice* slices, int count, size_t total) {
+        SliceCursor cursor(slices, count);
+        while (total > 0) {
+            int pieces[URING_BUFFER_COUNT];
+            size_t sizes[URING_BUFFER_COUNT];
+            int batch = 0;
+            while (total > 0 && batch < URING_BUFFER_COUNT) {
+                int buffer = m_nextBuffer;
+                m_nextBuffer = (m_nextBuffer + 1) % URING_BUFFER_COUNT;
+                if (!Reclaim(buffer)) return false;
+                IoSlice parts[MAX_IO_SLICES];
+                size_t size = std::min<size_t>(total, URING_BUFFER_SIZE), offset = 0;
+                int used = cursor.Take(size, parts, MAX_IO_SLICES);
+                for (int i = 0; i < used; ++i) {
+                    memcpy(Buffer(buffer) + offset, parts[i].data, parts[i].size);
+                    offset += parts[i].size;
+                }
+                pieces[batch] = buffer;
+                sizes[batch++] = size;
+                total -= size;
+            }
+            for (int i = 0; i < batch; ++i) QueueZeroCopy(m_sendRing->Queue(), pieces[i], 0, sizes[i], i + 1 < batch);
+            if (!Enter()) return false;
+
+            for (int i = 0; i < batch; ++i) {
+                size_t sent = 0;
+                for (;;) {
+                    for (Collect(); !m_done[pieces[i]]; Collect()) {
+                        if (!Enter()) return false;
+                    }
+                    int result = m_results[pieces[i]];
+                    if (result > 0) sent += static_cast<size_t>(result);
+                    else if (result != -ECANCELED && result != -EINTR) return false;
+                    if (sent == sizes[i]) break;
+                    QueueZeroCopy(m_sendRing->Queue(), pieces[i], sent, sizes[i] - sent, false);
+                    if (!Enter()) return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    std::vector<unsigned char> m_buffers; // registered with the send ring
+    std::unique_ptr<IoRing> m_sendRing;
+    std::unique_ptr<IoRing> m_receiveRing;
+    SendStats* m_stats;
+    bool m_zeroCopy;
+
+    int m_nextBuffer;
+    int m_notices[URING_BUFFER_COUNT]; // sends on each buffer the kernel may still read
+    int m_results[URING_BUFFER_COUNT]; // result of the last send from each buffer
+    bool m_done[URING_BUFFER_COUNT];   // and whether it is in
+    bool m_gatheredDone;
+    int m_gatheredResult;
+
+    uint64_t m_zeroCopySends;
+    uint64_t m_gatheredSends;
+};
+
+class EpollTransport : public LinuxTransport {
+public:
+    explicit EpollTransport(int socket, SendStats* stats = nullptr)
+        : LinuxTransport(socket), m_stats(stats), m_sendPoll(epoll_create1(EPOLL_CLOEXEC)),
+          m_receivePoll(epoll_create1(EPOLL_CLOEXEC)) {
+        fcntl(m_socket, F_SETFL, fcntl(m_socket, F_GETFL) | O_NONBLOCK);
+        Watch(m_sendPoll, EPOLLOUT);
+        Watch(m_receivePoll, EPOLLIN | EPOLLRDHUP);
+    }
+
+    ~EpollTransport() override {
+        if (m_sendPoll >= 0) close(m_sendPoll);
+        if (m_receivePoll >= 0) close(m_receivePoll);
+    }
+
+    bool Send(const IoSlice* slices, int count) override {
+        if (count > MAX_IO_SLICES) return false;
+        iovec vectors[MAX_IO_SLICES];
+        msghdr message = GatherSlices(slices, count, vectors);
+        if (m_stats) m_stats->messages++;
+
+        while (message.msg_iovlen > 0) {
+            Clock::time_point start = Clock::now();
+            ssize_t sent = sendmsg(m_socket, &message, MSG_NOSIGNAL);
+            if (m_stats) {
+                m_stats->calls++;
+                m_stats->latency.Record(Clock::now() - start);
+            }
+            if (sent >= 0) {
+                AdvanceMessage(message, static_cast<size_t>(sent));
+            } else if ((errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) || !Wait(m_sendPoll)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const char* Name() const override { return "epoll"; }
+
+protected:
+    ssize_t Read(void* data, size_t size) override {
+        for (;;) {
+            ssize_t received = recv(m_socket, data, size, 0);
+            if (received >= 0) return received;
+            if ((errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) || !Wait(m_receivePoll)) return -1;
+        }
+    }
+
+private:
+    void Watch(int poll, uint32_t events) {
+        epoll_event event = {};
+        event.events = events;
+        if (poll >= 0) epoll_ctl(poll, EPOLL_CTL_ADD, m_socket, &event);
+    }
+
+    // Until the socket is ready for the direction `poll` watches; errors and
+    // hang-ups count as ready so the call that follows reports them
+    bool Wait(int poll) {
+        epoll_event event;
+        for (;;) {
+            int ready = epoll_wait(poll, &event, 1, -1);
+            if (ready > 0) return true;
+            if (ready < 0 && errno != EINTR) return false;
+        }
+    }
+
+    SendStats* m_stats;
+    int m_sendPoll;
+    int m_receivePoll;
+};
+
+// io_uring if the kernel lets us set one up, epoll otherwise. The transport
+// owns the socket from here on. Zero-copy sends only go to other machines:
+// the kernel copies loopback data when it delivers it, which in
+// codec_bench costs more CPU than the copy it saves.
+inline std::unique_ptr<Transport> OpenLinuxTransport(int socket, SendStats* stats = nullptr) {
+    std::unique_ptr<IoRing> sendRing(new IoRing()), receiveRing(new IoRing());
+    if (sendRing->Create(URING_ENTRIES) && receiveRing->Create(URING_ENTRIES)) {
+        return std::unique_ptr<Transport>(new IoUringTransport(socket, std::move(sendRing), std::move(receiveRing),
+                                                               stats, !SocketPeerIsLocal(socket)));
+    }
+    return std::unique_ptr<Transport>(new EpollTransport(socket, stats));
+}
+
+#endif // URING_TRANSPORT_H
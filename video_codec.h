@@ -0,0 +1,814 @@
+// ===== video_codec.h =====
+// Inter-frame codec for streams that are mostly full-screen motion
+// (dashboards, video walls), where tile updates would resend nearly the
+// whole screen every frame. No external libraries.
+//
+// Frames are coded as YUV 4:2:0 in 16x16 macroblocks. A macroblock is
+// skipped (copied from the previous frame), predicted from a full-pixel
+// motion-compensated block of the previous frame, or coded on its own
+// against flat gray. The residual is transformed with an 8x8 integer DCT,
+// quantized with one step for the whole frame and written as run/level
+// pairs in Exp-Golomb codes. Motion is found by a small diamond search
+// from the best of a few predicted vectors (SSE2 SAD where available).
+//
+// A frame is cut into slices of VIDEO_SLICE_ROWS macroblock rows that
+// depend on nothing but the previous frame, so they are encoded in
+// parallel. Keyframes (every macroblock intra) are only sent for the
+// first frame, on a size change and when asked for.
+//
+// Payload of MSG_VIDEO_FRAME after the VideoFrame header: sliceCount
+// little-endian uint32 slice sizes, then the slices. Each slice is a bit
+// stream, most significant bit first, of
+//     repeat: ue skip run, then unless at the end of the slice:
+//         1 bit intra; inter: se mvx - predicted, se mvy - predicted;
+//         6 bits coded-block pattern (4 luma, U, V), then for each coded
+//         block: ue count, count x (ue zero run, se level) in zigzag order
+// The predicted vector is the one of the macroblock to the left in the
+// same slice row, zero at a row start and after skipped or intra blocks.
+#ifndef VIDEO_CODEC_H
+#define VIDEO_CODEC_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "protocol.h"
+#include "thread_pool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VIDEO_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define VIDEO_MB 16                 // macroblock size in luma pixels
+#define VIDEO_SLICE_ROWS 2          // macroblock rows per slice
+#define VIDEO_SEARCH_RANGE 64       // largest motion vector component, pixels
+#define VIDEO_MIN_QUANTIZER 2
+#define VIDEO_MAX_QUANTIZER 80
+#define VIDEO_INITIAL_QUANTIZER 12
+#define VIDEO_MAX_LEVEL 4095        // largest quantized coefficient
+
+// Switching a stream to the codec and back: share of tiles changed per
+// frame that, sustained, means full-screen motion
+#define MOTION_ENTER_SHARE 0.5
+#define MOTION_LEAVE_SHARE 0.1
+#define MOTION_ENTER_FRAMES 30
+#define MOTION_LEAVE_FRAMES 60
+
+namespace video_detail {
+
+const int kDct[8][8] = {
+    {64, 64, 64, 64, 64, 64, 64, 64},     {89, 75, 50, 18, -18, -50, -75, -89},
+    {83, 36, -36, -83, -83, -36, 36, 83}, {75, -18, -89, -50, 50, 89, 18, -75},
+    {64, -64, -64, 64, 64, -64, -64, 64}, {50, -89, 18, 75, -75, -18, 89, -50},
+    {36, -83, 83, -36, -36, 83, -83, 36}, {18, -50, 75, -89, 89, -75, 50, -18},
+};
+
+const uint8_t kZigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+    41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+    30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// The forward transform scales by 16 relative to an orthonormal DCT
+const int kCoefficientScale = 16;
+
+inline uint8_t Clamp255(int value) {
+    return static_cast<uint8_t>(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+// One 8-point transform of in[0], in[step], ... by partial butterflies
+// (the same sums as multiplying by kDct, in fewer multiplications)
+inline void Forward8(const int* in, int step, int* out, int outStep, int shift) {
+    int even[4], odd[4];
+    for (int k = 0; k < 4; ++k) {
+        even[k] = in[k * step] + in[(7 - k) * step];
+        odd[k] = in[k * step] - in[(7 - k) * step];
+    }
+    int evenEven[2] = {even[0] + even[3], even[1] + even[2]};
+    int evenOdd[2] = {even[0] - even[3], even[1] - even[2]};
+    int round = 1 << (shift - 1);
+    out[0] = (64 * evenEven[0] + 64 * evenEven[1] + round) >> shift;
+    out[4 * outStep] = (64 * evenEven[0] - 64 * evenEven[1] + round) >> shift;
+    out[2 * outStep] = (83 * evenOdd[0] + 36 * evenOdd[1] + round) >> shift;
+    out[6 * outStep] = (36 * evenOdd[0] - 83 * evenOdd[1] + round) >> shift;
+    for (int k = 1; k < 8; k += 2) {
+        int sum = kDct[k][0] * odd[0] + kDct[k][1] * odd[1] + kDct[k][2] * odd[2] + kDct[k][3] * odd[3];
+        out[k * outStep] = (sum + round) >> shift;
+    }
+}
+
+inline void Inverse8(const int* in, int step, int* out, int outStep, int shift, bool clip) {
+    int odd[4];
+    for (int k = 0; k < 4; ++k) {
+        odd[k] = kDct[1][k] * in[step] + kDct[3][k] * in[3 * step] + kDct[5][k] * in[5 * step] +
+                 kDct[7][k] * in[7 * step];
+    }
+    int evenOdd[2] = {83 * in[2 * step] + 36 * in[6 * step], 36 * in[2 * step] - 83 * in[6 * step]};
+    int evenEven[2] = {64 * in[0] + 64 * in[4 * step], 64 * in[0] - 64 * in[4 * step]};
+    int even[4] = {evenEven[0] + evenOdd[0], evenEven[1] + evenOdd[1], evenEven[1] - evenOdd[1],
+                   evenEven[0] - evenOdd[0]};
+    int round = 1 << (shift - 1);
+    for (int k = 0; k < 4; ++k) {
+        int low = (even[k] + odd[k] + round) >> shift;
+        int high = (even[3 - k] - odd[3 - k] + round) >> shift;
+        out[k * outStep] = clip ? std::max(-32768, std::min(32767, low)) : low;
+        out[(k + 4) * outStep] = clip ? std::max(-32768, std::min(32767, high)) : high;
+    }
+}
+
+inline void ForwardDct(const int residual[64], int coefficients[64]) {
+    int rows[64];
+    for (int i = 0; i < 8; ++i) Forward8(residual + i * 8, 1, rows + i * 8, 1, 2);
+    for (int k = 0; k < 8; ++k) Forward8(rows + k, 8, coefficients + k, 8, 9);
+}
+
+// Integer only, so encoder and decoder reconstruct the same pixels
+inline void InverseDct(const int coefficients[64], int residual[64]) {
+    int columns[64];
+    for (int k = 0; k < 8; ++k) Inverse8(coefficients + k, 8, columns + k, 8, 7, true);
+    for (int i = 0; i < 8; ++i) Inverse8(columns + i * 8, 1, residual + i * 8, 1, 12, false);
+}
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : m_out(out), m_buffer(0), m_bits(0) { m_out.clear(); }
+
+    void Put(uint32_t value, int count) {
+        m_buffer = (m_buffer << count) | (value & ((1ull << count) - 1));
+        m_bits += count;
+        while (m_bits >= 8) {
+            m_bits -= 8;
+            m_out.push_back(static_cast<uint8_t>(m_buffer >> m_bits));
+        }
+    }
+
+    void PutUe(uint32_t value) {
+        uint32_t coded = value + 1;
+        int length = 0;
+        while ((coded >> length) > 1) length++;
+        Put(0, length);
+        Put(coded, length + 1);
+    }
+
+    void PutSe(int value) { PutUe(value > 0 ? 2 * value - 1 : -2 * value); }
+
+    void Flush() {
+        if (m_bits) Put(0, 8 - m_bits);
+    }
+
+private:
+    std::vector<uint8_t>& m_out;
+    uint64_t m_buffer;
+    int m_bits;
+};
+
+// Reads past the end as zeros and notes it, so corrupt slices fail cleanly
+class BitReader {
+public:
+    BitReader(const uint8_t* data, size_t size) : m_data(data), m_size(size), m_position(0), m_failed(false) {}
+
+    uint32_t Get(int count) {
+        uint32_t value = 0;
+        for (int i = 0; i < count; ++i) {
+            size_t byte = m_position >> 3;
+            uint32_t bit = 0;
+            if (byte < m_size) bit = (m_data[byte] >> (7 - (m_position & 7))) & 1;
+            else m_failed = true;
+            value = (value << 1) | bit;
+            m_position++;
+        }
+        return value;
+    }
+
+    uint32_t GetUe() {
+        int length = 0;
+        while (!Get(1)) {
+            if (++length > 24 || m_failed) {
+                m_failed = true;
+                return 0;
+            }
+        }
+        return ((1u << length) | Get(length)) - 1;
+    }
+
+    int GetSe() {
+        uint32_t value = GetUe();
+        return (value & 1) ? static_cast<int>((value + 1) / 2) : -static_cast<int>(value / 2);
+    }
+
+    bool Failed() const { return m_failed; }
+
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_position;
+    bool m_failed;
+};
+
+// Sum of absolute differences of a 16x16 block
+inline uint32_t Sad16(const uint8_t* a, size_t strideA, const uint8_t* b, size_t strideB) {
+#ifdef VIDEO_SSE2
+    __m128i sum = _mm_setzero_si128();
+    for (int y = 0; y < VIDEO_MB; ++y) {
+        __m128i rowA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + y * strideA));
+        __m128i rowB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + y * strideB));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(rowA, rowB));
+    }
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+#else
+    uint32_t sum = 0;
+    for (int y = 0; y < VIDEO_MB; ++y) {
+        for (int x = 0; x < VIDEO_MB; ++x) sum += std::abs(a[y * strideA + x] - b[y * strideB + x]);
+    }
+    return sum;
+#endif
+}
+
+} // namespace video_detail
+
+// One frame as Y, U and V planes, padded to whole macroblocks
+struct VideoPicture {
+    int width;      // padded luma size
+    int height;
+    std::vector<uint8_t> planes[3];
+
+    VideoPicture() : width(0), height(0) {}
+
+    void Reset(int paddedWidth, int paddedHeight) {
+        width = paddedWidth;
+        height = paddedHeight;
+        planes[0].assign(static_cast<size_t>(width) * height, 0);
+        planes[1].assign(static_cast<size_t>(width / 2) * (height / 2), 128);
+        planes[2].assign(static_cast<size_t>(width / 2) * (height / 2), 128);
+    }
+
+    int Stride(int plane) const { return plane ? width / 2 : width; }
+    uint8_t* At(int plane, int x, int y) { return planes[plane].data() + static_cast<size_t>(y) * Stride(plane) + x; }
+    const uint8_t* At(int plane, int x, int y) const {
+        return planes[plane].data() + static_cast<size_t>(y) * Stride(plane) + x;
+    }
+
+    // Luma rows firstRow .. lastRow - 1 (even) from top-down BGRA rows;
+    // edges are repeated into the padding
+    void FromBGRA(const unsigned char* pixels, size_t stride, int imageWidth, int imageHeight, int firstRow,
+                  int lastRow) {
+        for (int y = firstRow; y < lastRow; y += 2) {
+            const unsigned char* rows[2] = {pixels + static_cast<size_t>(std::min(y, imageHeight - 1)) * stride,
+                                            pixels + static_cast<size_t>(std::min(y + 1, imageHeight - 1)) * stride};
+            uint8_t* luma[2] = {At(0, 0, y), At(0, 0, y + 1)};
+            uint8_t* u = At(1, 0, y / 2);
+            uint8_t* v = At(2, 0, y / 2);
+            for (int x = 0; x < width; x += 2) {
+                int sumB = 0, sumG = 0, sumR = 0;
+                for (int row = 0; row < 2; ++row) {
+                    for (int column = 0; column < 2; ++column) {
+                        const unsigned char* px = rows[row] + static_cast<size_t>(std::min(x + column, imageWidth - 1)) * 4;
+                        luma[row][x + column] = static_cast<uint8_t>((29 * px[0] + 150 * px[1] + 77 * px[2] + 128) >> 8);
+                        sumB += px[0];
+                        sumG += px[1];
+                        sumR += px[2];
+                    }
+                }
+                u[x / 2] = video_detail::Clamp255(((-43 * sumR - 85 * sumG + 128 * sumB + 512) >> 10) + 128);
+                v[x / 2] = video_detail::Clamp255(((128 * sumR - 107 * sumG - 21 * sumB + 512) >> 10) + 128);
+            }
+        }
+    }
+
+    void ToBGRA(unsigned char* pixels, size_t stride, int imageWidth, int imageHeight) const {
+        for (int y = 0; y < imageHeight; ++y) {
+            const uint8_t* luma = At(0, 0, y);
+            const uint8_t* u = At(1, 0, y / 2);
+            const uint8_t* v = At(2, 0, y / 2);
+            unsigned char* out = pixels + static_cast<size_t>(y) * stride;
+            for (int x = 0; x < imageWidth; ++x, out += 4) {
+                int l = luma[x] * 256 + 128, cb = u[x / 2] - 128, cr = v[x / 2] - 128;
+                out[0] = video_detail::Clamp255((l + 454 * cb) >> 8);
+                out[1] = video_detail::Clamp255((l - 88 * cb - 183 * cr) >> 8);
+                out[2] = video_detail::Clamp255((l + 359 * cr) >> 8);
+                out[3] = 0xFF;
+            }
+        }
+    }
+};
+
+// Macroblock layout shared by encoder and decoder
+struct VideoBlock {
+    int plane;
+    int x;  // offset inside the macroblock, in the plane's pixels
+    int y;
+};
+
+const VideoBlock kVideoBlocks[6] = {{0, 0, 0}, {0, 8, 0}, {0, 0, 8}, {0, 8, 8}, {1, 0, 0}, {2, 0, 0}};
+
+struct MotionVector {
+    int x;
+    int y;
+};
+
+class VideoEncoder {
+public:
+    VideoEncoder() : m_imageWidth(0), m_imageHeight(0), m_columns(0), m_rows(0), m_quantizer(VIDEO_INITIAL_QUANTIZER), m_forceKey(true),
+                     m_lastKey(false), m_psnr(0), m_globalVector(),
+                     m_pixels(nullptr), m_pixelStride(0) {}
+
+    void ForceKeyframe() { m_forceKey = true; }
+    int Quantizer() const { return m_quantizer; }
+    bool LastWasKeyframe() const { return m_lastKey; }
+    double LastPsnr() const { return m_psnr; } // luma, dB
+
+    // Coarser when a frame took more than the link moves in one interval,
+    // finer again when it used well under half of that
+    void Adapt(size_t frameBytes, size_t budgetBytes) {
+        if (frameBytes > budgetBytes) m_quantizer = std::min(VIDEO_MAX_QUANTIZER, m_quantizer * 5 / 4 + 1);
+        else if (frameBytes < budgetBytes / 2) m_quantizer = std::max(VIDEO_MIN_QUANTIZER, m_quantizer * 7 / 8);
+    }
+
+    // Encode top-down BGRA rows into `out` (VideoFrame header included);
+    // slices run on `pool` if given
+    void Encode(const unsigned char* pixels, size_t stride, int width, int height, uint8_t streamId,
+                WorkStealingPool* pool, std::vector<unsigned char>& out) {
+        int paddedWidth = (width + VIDEO_MB - 1) / VIDEO_MB * VIDEO_MB;
+        int paddedHeight = (height + VIDEO_MB - 1) / VIDEO_MB * VIDEO_MB;
+        if (width != m_imageWidth || height != m_imageHeight) {
+            m_imageWidth = width;
+            m_imageHeight = height;
+            m_source.Reset(paddedWidth, paddedHeight);
+            m_reference.Reset(paddedWidth, paddedHeight);
+            m_current.Reset(paddedWidth, paddedHeight);
+            m_columns = paddedWidth / VIDEO_MB;
+            m_rows = paddedHeight / VIDEO_MB;
+            m_vectors.assign(static_cast<size_t>(m_columns) * m_rows, MotionVector());
+            m_previousVectors = m_vectors;
+            m_slices.resize((m_rows + VIDEO_SLICE_ROWS - 1) / VIDEO_SLICE_ROWS);
+            m_sliceError.resize(m_slices.size());
+            m_forceKey = true;
+        }
+        m_pixels = pixels;
+        m_pixelStride = stride;
+        bool key = m_forceKey;
+        m_forceKey = false;
+        m_lastKey = key;
+        m_globalVector = DominantVector();
+
+        auto encodeSlice = [this, key](size_t slice) { EncodeSlice(static_cast<int>(slice), key); };
+        if (pool) pool->ParallelFor(m_slices.size(), encodeSlice);
+        else for (size_t slice = 0; slice < m_slices.size(); ++slice) encodeSlice(slice);
+
+        size_t size = sizeof(VideoFrame) + 4 * m_slices.size();
+        uint64_t squaredError = 0;
+        for (size_t i = 0; i < m_slices.size(); ++i) {
+            size += m_slices[i].size();
+            squaredError += m_sliceError[i];
+        }
+        out.resize(size);
+        VideoFrame frame = {};
+        frame.streamId = streamId;
+        frame.flags = key ? VIDEO_FRAME_KEY : 0;
+        frame.quantizer = static_cast<uint8_t>(m_quantizer);
+        frame.width = static_cast<uint16_t>(width);
+        frame.height = static_cast<uint16_t>(height);
+        frame.sliceCount = static_cast<uint16_t>(m_slices.size());
+        frame.dataSize = static_cast<uint32_t>(size - sizeof(VideoFrame));
+        memcpy(out.data(), &frame, sizeof(frame));
+        unsigned char* sizes = out.data() + sizeof(VideoFrame);
+        unsigned char* data = sizes + 4 * m_slices.size();
+        for (size_t i = 0; i < m_slices.size(); ++i) {
+            uint32_t sliceSize = static_cast<uint32_t>(m_slices[i].size());
+            for (int b = 0; b < 4; ++b) sizes[i * 4 + b] = static_cast<unsigned char>(sliceSize >> (8 * b));
+            if (sliceSize) memcpy(data, m_slices[i].data(), sliceSize);
+            data += sliceSize;
+        }
+
+        double meanSquared = static_cast<double>(squaredError) / (static_cast<double>(paddedWidth) * paddedHeight);
+        m_psnr = meanSquared > 0 ? 10.0 * std::log10(255.0 * 255.0 / meanSquared) : 99.0;
+        std::swap(m_reference, m_current);
+        m_previousVectors.swap(m_vectors);
+    }
+
+private:
+    // Most common non-zero vector of the last frame, e.g. a scroll
+    MotionVector DominantVector() const {
+        MotionVector best = {0, 0};
+        int bestCount = 0;
+        for (size_t i = 0; i < m_previousVectors.size(); i += 7) {
+            const MotionVector& candidate = m_previousVectors[i];
+            if (!candidate.x && !candidate.y) continue;
+            int count = 0;
+            for (size_t j = 0; j < m_previousVectors.size(); j += 7) {
+                if (m_previousVectors[j].x == candidate.x && m_previousVectors[j].y == candidate.y) count++;
+            }
+            if (count > bestCount) {
+                bestCount = count;
+                best = candidate;
+            }
+            if (bestCount * 7 * 2 > static_cast<int>(m_previousVectors.size())) break;
+        }
+        return best;
+    }
+
+    bool VectorFits(int mbX, int mbY, const MotionVector& vector) const {
+        int x = mbX * VIDEO_MB + vector.x, y = mbY * VIDEO_MB + vector.y;
+        return std::abs(vector.x) <= VIDEO_SEARCH_RANGE && std::abs(vector.y) <= VIDEO_SEARCH_RANGE && x >= 0 &&
+               y >= 0 && x + VIDEO_MB <= m_source.width && y + VIDEO_MB <= m_source.height;
+    }
+
+    uint32_t MotionSad(int mbX, int mbY, const MotionVector& vector) const {
+        return video_detail::Sad16(m_source.At(0, mbX * VIDEO_MB, mbY * VIDEO_MB), m_source.width,
+                                   m_reference.At(0, mbX * VIDEO_MB + vector.x, mbY * VIDEO_MB + vector.y),
+                                   m_reference.width);
+    }
+
+    // Best of the predicted vectors, refined by a diamond search
+    MotionVector Search(int mbX, int mbY, const MotionVector& left, uint32_t& bestSad) const {
+        MotionVector candidates[4] = {{0, 0}, left, m_previousVectors[static_cast<size_t>(mbY) * m_columns + mbX],
+                                      m_globalVector};
+        MotionVector best = {0, 0};
+        bestSad = MotionSad(mbX, mbY, best);
+        for (const MotionVector& candidate : candidates) {
+            if (!VectorFits(mbX, mbY, candidate)) continue;
+            uint32_t sad = MotionSad(mbX, mbY, candidate);
+            if (sad < bestSad) {
+                bestSad = sad;
+                best = candidate;
+            }
+        }
+        static const MotionVector kDiamond[4] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+        for (int step = 8; step >= 1 && bestSad; step /= 2) {
+            for (bool moved = true; moved && bestSad;) {
+                moved = false;
+                MotionVector center = best;
+                for (const MotionVector& offset : kDiamond) {
+                    MotionVector candidate = {center.x + offset.x * step, center.y + offset.y * step};
+                    if (!VectorFits(mbX, mbY, candidate)) continue;
+                    uint32_t sad = MotionSad(mbX, mbY, candidate);
+                    if (sad < bestSad) {
+                        bestSad = sad;
+                        best = candidate;
+                        moved = true;
+                    }
+                }
+            }
+        }
+        return best;
+    }
+
+    // Distance from the block's own mean: what coding it alone roughly costs
+    uint32_t IntraCost(int mbX, int mbY) const {
+        const uint8_t* block = m_source.At(0, mbX * VIDEO_MB, mbY * VIDEO_MB);
+        uint32_t sum = 0;
+        for (int y = 0; y < VIDEO_MB; ++y) {
+            for (int x = 0; x < VIDEO_MB; ++x) sum += block[y * m_source.width + x];
+        }
+        int mean = static_cast<int>(sum / (VIDEO_MB * VIDEO_MB));
+        uint32_t cost = 0;
+        for (int y = 0; y < VIDEO_MB; ++y) {
+            for (int x = 0; x < VIDEO_MB; ++x) cost += std::abs(block[y * m_source.width + x] - mean);
+        }
+        return cost;
+    }
+
+    // Predict, code and reconstruct one 8x8 block; returns whether any
+    // coefficient survived quantization (the levels go to `levels`)
+    bool CodeBlock(int mbX, int mbY, const VideoBlock& block, bool intra, const MotionVector& vector,
+                   int levels[64], uint64_t& squaredError) {
+        int scale = block.plane ? 8 : VIDEO_MB;
+        int x = mbX * scale + block.x, y = mbY * scale + block.y;
+        int dx = block.plane ? vector.x >> 1 : vector.x, dy = block.plane ? vector.y >> 1 : vector.y;
+        int stride = m_source.Stride(block.plane);
+        const uint8_t* source = m_source.At(block.plane, x, y);
+        const uint8_t* reference = m_reference.At(block.plane, x + dx, y + dy);
+        uint8_t* reconstructed = m_current.At(block.plane, x, y);
+
+        int prediction[64], residual[64], coefficients[64];
+        int absoluteSum = 0;
+        for (int i = 0; i < 64; ++i) {
+            prediction[i] = intra ? 128 : reference[(i / 8) * stride + i % 8];
+            residual[i] = source[(i / 8) * stride + i % 8] - prediction[i];
+            absoluteSum += std::abs(residual[i]);
+        }
+        int step = m_quantizer * video_detail::kCoefficientScale;
+        int deadZone = intra ? step / 2 : step / 3;
+        // No coefficient exceeds 4x the residual's absolute sum (plus rounding):
+        // when that cannot reach a step, the block is all zeros
+        if (4 * absoluteSum + 8 + deadZone < step) {
+            memset(levels, 0, 64 * sizeof(int));
+            for (int i = 0; i < 64; ++i) {
+                reconstructed[(i / 8) * stride + i % 8] = static_cast<uint8_t>(prediction[i]);
+                if (!block.plane) squaredError += static_cast<uint64_t>(residual[i] * residual[i]);
+            }
+            return false;
+        }
+        video_detail::ForwardDct(residual, coefficients);
+        bool coded = false;
+        for (int i = 0; i < 64; ++i) {
+            int magnitude = std::min(VIDEO_MAX_LEVEL, (std::abs(coefficients[i]) + deadZone) / step);
+            levels[i] = coefficients[i] < 0 ? -magnitude : magnitude;
+            coefficients[i] = levels[i] * step;
+            coded = coded || magnitude;
+        }
+        if (coded) video_detail::InverseDct(coefficients, residual);
+        for (int i = 0; i < 64; ++i) {
+            uint8_t value = video_detail::Clamp255(prediction[i] + (coded ? residual[i] : 0));
+            reconstructed[(i / 8) * stride + i % 8] = value;
+            if (!block.plane) {
+                int error = value - source[(i / 8) * stride + i % 8];
+                squaredError += static_cast<uint64_t>(error * error);
+            }
+        }
+        return coded;
+    }
+
+    void SkipBlock(int mbX, int mbY, uint64_t& squaredError) {
+        for (int plane = 0; plane < 3; ++plane) {
+            int size = plane ? 8 : VIDEO_MB;
+            for (int y = 0; y < size; ++y) {
+                const uint8_t* reference = m_reference.At(plane, mbX * size, mbY * size + y);
+                memcpy(m_current.At(plane, mbX * size, mbY * size + y), reference, size);
+                if (plane) continue;
+                const uint8_t* source = m_source.At(0, mbX * size, mbY * size + y);
+                for (int x = 0; x < size; ++x) {
+                    int error = reference[x] - source[x];
+                    squaredError += static_cast<uint64_t>(error * error);
+                }
+            }
+        }
+    }
+
+    static void WriteBlock(video_detail::BitWriter& writer, const int levels[64]) {
+        int count = 0;
+        for (int i = 0; i < 64; ++i) count += levels[i] != 0;
+        writer.PutUe(count);
+        int run = 0;
+        for (int i = 0; i < 64; ++i) {
+            int level = levels[video_detail::kZigzag[i]];
+            if (!level) {
+                run++;
+                continue;
+            }
+            writer.PutUe(run);
+            writer.PutSe(level);
+            run = 0;
+        }
+    }
+
+    void EncodeSlice(int slice, bool key) {
+        int firstRow = slice * VIDEO_SLICE_ROWS, lastRow = std::min(m_rows, firstRow + VIDEO_SLICE_ROWS);
+        m_source.FromBGRA(m_pixels, m_pixelStride, m_imageWidth, m_imageHeight, firstRow * VIDEO_MB,
+                          lastRow * VIDEO_MB);
+
+        video_detail::BitWriter writer(m_slices[slice]);
+        uint64_t squaredError = 0;
+        uint32_t skipRun = 0;
+        int levels[6][64];
+        // Skipping needs the block to match the previous frame about as
+        // well as coding it would
+        uint32_t skipSad = static_cast<uint32_t>(VIDEO_MB * VIDEO_MB) * std::max(1, m_quantizer / 4);
+        for (int mbY = firstRow; mbY < lastRow; ++mbY) {
+            MotionVector left = {0, 0};
+            for (int mbX = 0; mbX < m_columns; ++mbX) {
+                MotionVector& vector = m_vectors[static_cast<size_t>(mbY) * m_columns + mbX];
+                vector.x = vector.y = 0;
+                bool intra = key;
+                if (!key) {
+                    uint32_t sad = MotionSad(mbX, mbY, vector);
+                    if (sad <= skipSad && ChromaMatches(mbX, mbY, skipSad / 4)) {
+                        SkipBlock(mbX, mbY, squaredError);
+                        skipRun++;
+                        left.x = left.y = 0;
+                        continue;
+                    }
+                    vector = Search(mbX, mbY, left, sad);
+                    intra = sad > IntraCost(mbX, mbY) + VIDEO_MB * VIDEO_MB;
+                    if (intra) vector.x = vector.y = 0;
+                }
+
+                int pattern = 0;
+                for (int b = 0; b < 6; ++b) {
+                    if (CodeBlock(mbX, mbY, kVideoBlocks[b], intra, vector, levels[b], squaredError)) {
+                        pattern |= 1 << b;
+                    }
+                }
+                writer.PutUe(skipRun);
+                skipRun = 0;
+                writer.Put(intra ? 1 : 0, 1);
+                if (!intra) {
+                    writer.PutSe(vector.x - left.x);
+                    writer.PutSe(vector.y - left.y);
+                }
+                writer.Put(static_cast<uint32_t>(pattern), 6);
+                for (int b = 0; b < 6; ++b) {
+                    if (pattern & (1 << b)) WriteBlock(writer, levels[b]);
+                }
+                left = vector;
+            }
+        }
+        if (skipRun) writer.PutUe(skipRun);
+        writer.Flush();
+        m_sliceError[slice] = squaredError;
+    }
+
+    bool ChromaMatches(int mbX, int mbY, uint32_t limit) const {
+        for (int plane = 1; plane < 3; ++plane) {
+            uint32_t sad = 0;
+            for (int y = 0; y < 8; ++y) {
+                const uint8_t* source = m_source.At(plane, mbX * 8, mbY * 8 + y);
+                const uint8_t* reference = m_reference.At(plane, mbX * 8, mbY * 8 + y);
+                for (int x = 0; x < 8; ++x) sad += std::abs(source[x] - reference[x]);
+            }
+            if (sad > limit) return false;
+        }
+        return true;
+    }
+
+    int m_imageWidth;
+    int m_imageHeight;
+    int m_columns;
+    int m_rows;
+    int m_quantizer;
+    bool m_forceKey;
+    bool m_lastKey;
+    double m_psnr;
+    MotionVector m_globalVector;
+    const unsigned char* m_pixels;  // frame being encoded
+    size_t m_pixelStride;
+    VideoPicture m_source;          // converted slice by slice
+    VideoPicture m_reference;   // what the viewer shows now
+    VideoPicture m_current;     // being reconstructed
+    std::vector<MotionVector> m_vectors;
+    std::vector<MotionVector> m_previousVectors;
+    std::vector<std::vector<uint8_t>> m_slices;
+    std::vector<uint64_t> m_sliceError;
+};
+
+class VideoDecoder {
+public:
+    VideoDecoder() : m_width(0), m_height(0), m_hasReference(false) {}
+
+    // False if the data is malformed. A frame that needs a reference the
+    // decoder does not have is dropped (Ready() stays false until a keyframe).
+    bool Decode(const VideoFrame& frame, const unsigned char* data, size_t size) {
+        bool key = (frame.flags & VIDEO_FRAME_KEY) != 0;
+        if (!frame.width || !frame.height) return false;
+        int paddedWidth = (frame.width + VIDEO_MB - 1) / VIDEO_MB * VIDEO_MB;
+        int paddedHeight = (frame.height + VIDEO_MB - 1) / VIDEO_MB * VIDEO_MB;
+        if (frame.width != m_width || frame.height != m_height) {
+            m_width = frame.width;
+            m_height = frame.height;
+            m_reference.Reset(paddedWidth, paddedHeight);
+            m_current.Reset(paddedWidth, paddedHeight);
+            m_hasReference = false;
+        }
+        if (!key && !m_hasReference) return true;
+
+        int rows = paddedHeight / VIDEO_MB;
+        int columns = paddedWidth / VIDEO_MB;
+        size_t slices = (rows + VIDEO_SLICE_ROWS - 1) / VIDEO_SLICE_ROWS;
+        if (frame.sliceCount != slices || frame.quantizer < 1 || size < 4 * slices) return false;
+        size_t offset = 4 * slices;
+        for (size_t slice = 0; slice < slices; ++slice) {
+            uint32_t sliceSize = 0;
+            for (int b = 0; b < 4; ++b) sliceSize |= static_cast<uint32_t>(data[slice * 4 + b]) << (8 * b);
+            if (sliceSize > size - offset) return false;
+            if (!DecodeSlice(static_cast<int>(slice), columns, rows, key, frame.quantizer, data + offset, sliceSize)) {
+                m_hasReference = false;
+                return false;
+            }
+            offset += sliceSize;
+        }
+        std::swap(m_reference, m_current);
+        m_hasReference = true;
+        m_pixels.resize(static_cast<size_t>(m_width) * m_height * 4);
+        m_reference.ToBGRA(m_pixels.data(), static_cast<size_t>(m_width) * 4, m_width, m_height);
+        return true;
+    }
+
+    bool Ready() const { return m_hasReference; }
+    int Width() const { return m_width; }
+    int Height() const { return m_height; }
+    const unsigned char* Pixels() const { return m_pixels.data(); } // top-down BGRA, width * 4 per row
+
+private:
+    void Copy(int mbX, int mbY, const MotionVector& vector) {
+        for (int plane = 0; plane < 3; ++plane) {
+            int size = plane ? 8 : VIDEO_MB;
+            int dx = plane ? vector.x >> 1 : vector.x, dy = plane ? vector.y >> 1 : vector.y;
+            for (int y = 0; y < size; ++y) {
+                memcpy(m_current.At(plane, mbX * size, mbY * size + y),
+                       m_reference.At(plane, mbX * size + dx, mbY * size + y + dy), size);
+            }
+        }
+    }
+
+    bool ReadBlock(video_detail::BitReader& reader, int coefficients[64], int step) {
+        memset(coefficients, 0, 64 * sizeof(int));
+        uint32_t count = reader.GetUe();
+        if (count > 64) return false;
+        int position = -1;
+        for (uint32_t i = 0; i < count; ++i) {
+            position += static_cast<int>(reader.GetUe()) + 1;
+            int level = reader.GetSe();
+            if (position >= 64 || std::abs(level) > VIDEO_MAX_LEVEL || reader.Failed()) return false;
+            coefficients[video_detail::kZigzag[position]] = level * step;
+        }
+        return true;
+    }
+
+    bool DecodeSlice(int slice, int columns, int rows, bool key, int quantizer, const uint8_t* data, size_t size) {
+        video_detail::BitReader reader(data, size);
+        int first = slice * VIDEO_SLICE_ROWS * columns;
+        int end = std::min(rows, (slice + 1) * VIDEO_SLICE_ROWS) * columns;
+        int step = quantizer * video_detail::kCoefficientScale;
+        MotionVector left = {0, 0};
+        for (int index = first; index < end;) {
+            uint32_t skip = reader.GetUe();
+            if (reader.Failed() || skip > static_cast<uint32_t>(end - index) || (key && skip)) return false;
+            for (uint32_t i = 0; i < skip; ++i, ++index) {
+                MotionVector zero = {0, 0};
+                Copy(index % columns, index / columns, zero);
+            }
+            if (index == end) break;
+
+            int mbX = index % columns, mbY = index / columns;
+            if (mbX == 0 || skip) left.x = left.y = 0;
+            bool intra = reader.Get(1) != 0;
+            if (key && !intra) return false;
+            MotionVector vector = {0, 0};
+            if (!intra) {
+                vector.x = left.x + reader.GetSe();
+                vector.y = left.y + reader.GetSe();
+                int x = mbX * VIDEO_MB + vector.x, y = mbY * VIDEO_MB + vector.y;
+                if (std::abs(vector.x) > VIDEO_SEARCH_RANGE || std::abs(vector.y) > VIDEO_SEARCH_RANGE || x < 0 ||
+                    y < 0 || x + VIDEO_MB > m_current.width || y + VIDEO_MB > m_current.height) {
+                    return false;
+                }
+                Copy(mbX, mbY, vector);
+            }
+            uint32_t pattern = reader.Get(6);
+            for (int b = 0; b < 6; ++b) {
+                const VideoBlock& block = kVideoBlocks[b];
+                int scale = block.plane ? 8 : VIDEO_MB;
+                int stride = m_current.Stride(block.plane);
+                uint8_t* out = m_current.At(block.plane, mbX * scale + block.x, mbY * scale + block.y);
+                int coefficients[64], residual[64];
+                bool coded = (pattern >> b) & 1;
+                if (coded) {
+                    if (!ReadBlock(reader, coefficients, step)) return false;
+                    video_detail::InverseDct(coefficients, residual);
+                }
+                for (int i = 0; i < 64; ++i) {
+                    uint8_t& pixel = out[(i / 8) * stride + i % 8];
+                    int prediction = intra ? 128 : pixel;
+                    pixel = video_detail::Clamp255(prediction + (coded ? residual[i] : 0));
+                }
+            }
+            left = intra ? MotionVector{0, 0} : vector;
+            index++;
+        }
+        return !reader.Failed();
+    }
+
+    int m_width;
+    int m_height;
+    bool m_hasReference;
+    VideoPicture m_reference;
+    VideoPicture m_current;
+    std::vector<unsigned char> m_pixels;
+};
+
+// Decides when a stream is mostly full-screen motion and should use the
+// codec: most tiles changing for a second, back to tiles once it has
+// mostly stopped for two
+class FullMotionSwitch {
+public:
+    FullMotionSwitch() : m_active(false), m_frames(0) {}
+
+    void Update(size_t changedTiles, size_t tiles) {
+        double share = tiles ? static_cast<double>(changedTiles) / tiles : 0.0;
+        if (!m_active) {
+            m_frames = share >= MOTION_ENTER_SHARE ? m_frames + 1 : 0;
+            if (m_frames >= MOTION_ENTER_FRAMES) {
+                m_active = true;
+                m_frames = 0;
+            }
+        } else {
+            m_frames = share < MOTION_LEAVE_SHARE ? m_frames + 1 : 0;
+            if (m_frames >= MOTION_LEAVE_FRAMES) {
+                m_active = false;
+                m_frames = 0;
+            }
+        }
+    }
+
+    bool Active() const { return m_active; }
+
+private:
+    bool m_active;
+    int m_frames;
+};
+
+#endif // VIDEO_CODEC_H
@@ -0,0 +1,168 @@
+// ===== video_region.h =====
+// Finds a rectangle of sustained, high-entropy change, such as a video
+// or animation playing in one window, so it can be streamed lossy at the
+// capture rate while the rest of the desktop stays on the lossless path.
+//
+// Every tile keeps a 16-frame history of whether it changed with
+// photographic content (many distinct colors in a sparse sample; text
+// and UI edits rarely qualify). Tiles that did so in most recent frames
+// are hot. The bounding box of the hot tiles becomes the region once it
+// is dense enough for a few frames running, and is released after it has
+// been cold for a while.
+//
+// FillSyntheticVideo paints moving noise into a capture so detection can
+// be checked without a real video (see tests/codec_bench.cpp).
+#ifndef VIDEO_REGION_H
+#define VIDEO_REGION_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "dirty_tiles.h"
+
+#define VIDEO_HOT_FRAMES 10      // of the last 16, with photographic change
+#define VIDEO_MIN_TILES 6        // smallest region, in tiles
+#define VIDEO_MIN_DENSITY 0.5    // hot share of the region's tiles
+#define VIDEO_CONFIRM_FRAMES 3   // frames a candidate must persist before it is used
+#define VIDEO_RELEASE_FRAMES 15  // frames without a candidate before the region is dropped
+#define VIDEO_DISTINCT_COLORS 10 // of 16 sampled pixels, for a change to look photographic
+
+// 4x4 sample of a tile of top-down BGRA rows: many distinct colors means
+// image content rather than text or UI
+inline bool LooksPhotographic(const TileRect& tile, const unsigned char* pixels, size_t stride) {
+    uint32_t seen[16];
+    int distinct = 0;
+    for (int sy = 0; sy < 4; ++sy) {
+        const unsigned char* row = pixels + static_cast<size_t>(tile.y + sy * tile.height / 4) * stride;
+        for (int sx = 0; sx < 4; ++sx) {
+            uint32_t pixel;
+            memcpy(&pixel, row + static_cast<size_t>(tile.x + sx * tile.width / 4) * 4, sizeof(pixel));
+            pixel &= 0x00FFFFFF;
+            if (std::find(seen, seen + distinct, pixel) == seen + distinct) seen[distinct++] = pixel;
+        }
+    }
+    return distinct >= VIDEO_DISTINCT_COLORS;
+}
+
+class VideoRegionDetector {
+public:
+    VideoRegionDetector()
+        : m_columns(0), m_rows(0), m_width(0), m_height(0), m_active(false), m_confirm(0), m_quiet(0),
+          m_region(), m_candidate() {}
+
+    void Reset(int width, int height) {
+        m_width = width;
+        m_height = height;
+        m_columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+        m_rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+        m_history.assign(static_cast<size_t>(m_columns) * m_rows, 0);
+        m_active = false;
+        m_confirm = 0;
+        m_quiet = 0;
+    }
+
+    int Width() const { return m_width; }
+    int Height() const { return m_height; }
+
+    // Feed one captured frame and its dirty tiles (top-down BGRA rows)
+    void Update(const std::vector<TileRect>& dirty, const unsigned char* pixels, size_t stride) {
+        for (uint16_t& history : m_history) history = static_cast<uint16_t>(history << 1);
+        for (const TileRect& tile : dirty) {
+            size_t index = static_cast<size_t>(tile.y / TILE_SIZE) * m_columns + tile.x / TILE_SIZE;
+            if (index < m_history.size() && LooksPhotographic(tile, pixels, stride)) m_history[index] |= 1;
+        }
+
+        bool found = FindCandidate();
+        if (m_active) {
+            if (found) {
+                m_region = m_candidate;
+                m_quiet = 0;
+            } else if (++m_quiet >= VIDEO_RELEASE_FRAMES) {
+                m_active = false;
+                m_confirm = 0;
+            }
+            return;
+        }
+        m_confirm = found ? m_confirm + 1 : 0;
+        if (m_confirm >= VIDEO_CONFIRM_FRAMES) {
+            m_active = true;
+            m_quiet = 0;
+            m_region = m_candidate;
+        }
+    }
+
+    bool Active() const { return m_active; }
+    const TileRect& Region() const { return m_region; }
+
+private:
+    static int CountBits(uint16_t value) {
+        int count = 0;
+        for (; value; value &= value - 1) count++;
+        return count;
+    }
+
+    // Bounding box of the hot tiles, if it is big and dense enough
+    bool FindCandidate() {
+        int left = m_columns, top = m_rows, right = -1, bottom = -1, hot = 0;
+        for (int ty = 0; ty < m_rows; ++ty) {
+            for (int tx = 0; tx < m_columns; ++tx) {
+                if (CountBits(m_history[static_cast<size_t>(ty) * m_columns + tx]) < VIDEO_HOT_FRAMES) continue;
+                hot++;
+                left = std::min(left, tx);
+                right = std::max(right, tx);
+                top = std::min(top, ty);
+                bottom = std::max(bottom, ty);
+            }
+        }
+        if (hot < VIDEO_MIN_TILES) return false;
+        int area = (right - left + 1) * (bottom - top + 1);
+        if (hot < VIDEO_MIN_DENSITY * area) return false;
+
+        m_candidate.x = left * TILE_SIZE;
+        m_candidate.y = top * TILE_SIZE;
+        m_candidate.width = std::min((right + 1) * TILE_SIZE, m_width) - m_candidate.x;
+        m_candidate.height = std::min((bottom + 1) * TILE_SIZE, m_height) - m_candidate.y;
+        return true;
+    }
+
+    int m_columns;
+    int m_rows;
+    int m_width;
+    int m_height;
+    bool m_active;
+    int m_confirm;
+    int m_quiet;
+    TileRect m_region;
+    TileRect m_candidate;
+    std::vector<uint16_t> m_history; // bit 0 = this frame
+};
+
+// Overlap of two rectangles as a share of their union (0..1)
+inline double RegionOverlap(const TileRect& a, const TileRect& b) {
+    int width = std::min(a.x + a.width, b.x + b.width) - std::max(a.x, b.x);
+    int height = std::min(a.y + a.height, b.y + b.height) - std::max(a.y, b.y);
+    if (width <= 0 || height <= 0) return 0.0;
+    double overlap = static_cast<double>(width) * height;
+    return overlap / (static_cast<double>(a.width) * a.height + static_cast<double>(b.width) * b.height - overlap);
+}
+
+// Moving color noise over `area` of top-down BGRA rows, different every frame
+inline void FillSyntheticVideo(unsigned char* pixels, size_t stride, const TileRect& area, uint32_t frame) {
+    uint32_t state = frame * 2654435761u + 1;
+    for (int y = 0; y < area.height; ++y) {
+        unsigned char* out = pixels + static_cast<size_t>(area.y + y) * stride + static_cast<size_t>(area.x) * 4;
+        for (int x = 0; x < area.width; ++x, out += 4) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            out[0] = static_cast<unsigned char>((x + frame * 3) ^ (state & 0x3F));
+            out[1] = static_cast<unsigned char>((y + frame * 2) ^ ((state >> 8) & 0x3F));
+            out[2] = static_cast<unsigned char>(((x + y) / 2 + frame) ^ ((state >> 16) & 0x3F));
+            out[3] = 0xFF;
+        }
+    }
+}
+
+#endif // VIDEO_REGION_H
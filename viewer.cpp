@@ -10,6 +10,23 @@
 #include <vector>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <memory>
+
+#include "protocol.h"
+#include "pixel_format.h"
+#include "color_depth.h"
+#include "progressive.h"
+#include "alloc_counter.h"
+#include "local_transport.h"
+#include "datagram.h"
+#include "video_codec.h"
+#include "predictive_codec.h"
+#include "qoi_codec.h"
+#include "glyph_cache.h"
+#include "monitor_layout.h"
 
 #pragma comment(lib, "ws2_32.lib")
 #pragma comment(lib, "user32.lib")
@@ -17,135 +34,752 @@
 
 #define PORT_BASE 9000
 #define WM_UPDATE_SCREEN (WM_USER + 1)
+#define WM_FLUSH_TEXT (WM_USER + 3)
+#define WM_UPDATE_CURSOR (WM_USER + 4)
+#define WM_UPDATE_MONITORS (WM_USER + 5)
+#define WM_REQUEST_UPDATE (WM_USER + 6)  // wParam = stream whose update has arrived
+
+#define MAX_ASSEMBLED_MESSAGE (256 * 1024 * 1024) // largest message accepted in pieces
+#define LOSS_REPORT_INTERVAL 250 // ms between datagram loss reports
+#define DATAGRAM_RCVBUF (4 << 20)
+
+// View menu: "All monitors", then one entry per monitor stream
+#define IDM_VIEW_ALL 2000
+#define IDM_VIEW_MONITOR 2001
+
+// Colors menu: one entry per PIXEL_FORMAT_*
+#define IDM_COLOR_BASE 2100
 
 // Global variables
 HWND g_hMainWnd = NULL;
 HWND g_hCanvas = NULL;
 std::atomic<bool> g_Connected(false);
-std::atomic<SOCKET> g_Socket(INVALID_SOCKET);
-HBITMAP g_hScreenBitmap = NULL;
+std::unique_ptr<Transport> g_Transport;         // owned for the life of the process
+std::atomic<Transport*> g_Connection(nullptr);  // null once disconnected
 uint32_t g_RemoteWidth = 0, g_RemoteHeight = 0;
 std::string g_ServerIP;
 std::string g_Password;
+std::u16string g_PendingText; // typed characters not yet sent (UI thread only)
+bool g_TextKeyDown[256] = {}; // key-downs sent as text instead, so their key-ups are dropped too (UI thread only)
+bool g_TypedSession = false;  // host sends MessageHeader-framed messages
+std::mutex g_SendMutex;       // input (UI thread) and loss reports share the connection
+std::mutex g_MessageMutex;    // messages arrive over TCP and UDP
+std::unordered_map<uint8_t, VideoDecoder> g_VideoDecoders; // per stream (g_MessageMutex held)
+PredictiveDecoder g_PredictiveDecoder;                      // g_MessageMutex held
+std::unordered_map<uint8_t, GlyphDecoder> g_GlyphDecoders; // per stream (g_MessageMutex held)
+std::vector<unsigned char> g_TilePixels;                    // decoded TILE_PREDICTIVE, TILE_QOI or glyph area
+SOCKET g_DatagramSocket = INVALID_SOCKET; // frames over UDP, if the host offered them
+uint32_t g_DatagramToken = 0;
+uint32_t g_DatagramNextId = 0; // frame messages before this one are rebuilt or lost (g_MessageMutex held)
+UpdateEndGate g_UpdateEnds;    // g_MessageMutex held
 
-struct PasswordAuth {
-    char password[32];
+// Remote cursor, drawn locally from the host's cursor channel
+std::mutex g_CursorMutex;
+struct RemoteCursorShape {
+    HCURSOR handle;
+    int hotspotX;
+    int hotspotY;
 };
+std::unordered_map<uint64_t, RemoteCursorShape> g_CursorShapes;
+CursorPosition g_CursorPosition = {};
 
-struct MouseEvent {
-    uint8_t type;
-    int16_t x, y;
+// Remote monitors, one bitmap per stream, placed in virtual desktop coordinates
+std::mutex g_ScreenMutex;
+struct RemoteMonitor {
+    MonitorDescriptor descriptor;
+    HBITMAP bitmap;         // top-down BGRA DIB section, blitted as is
+    unsigned char* bits;
+    int bitmapWidth;
+    int bitmapHeight;
 };
+std::vector<RemoteMonitor> g_Monitors;
+int g_ViewStream = -1; // -1 shows every monitor side by side (UI thread only)
+int g_ColorFormat = PIXEL_FORMAT_BGRA32; // requested color depth (UI thread only)
 
-struct KeyboardEvent {
-    uint8_t type;
-    uint16_t keyCode;
-    uint32_t flags;
-};
+// Event type byte and event struct in one write
+bool SendEvent(Transport* connection, uint8_t eventType, const void* event, size_t size) {
+    IoSlice slices[2] = {{&eventType, sizeof(eventType)}, {event, size}};
+    std::lock_guard<std::mutex> lock(g_SendMutex);
+    return connection->Send(slices, 2);
+}
 
-struct ScreenFrame {
-    uint32_t dataSize;
-    uint32_t width;
-    uint32_t height;
-};
+void SendMouseEvent(uint8_t type, int16_t x = 0, int16_t y = 0) {
+    Transport* connection = g_Connection.load();
+    if (!connection) return;
+    
+    MouseEvent mouseEvent = {type, x, y};
+    SendEvent(connection, EVENT_MOUSE, &mouseEvent, sizeof(mouseEvent));
+}
+
+void SendKeyEvent(uint16_t keyCode, bool keyDown) {
+    Transport* connection = g_Connection.load();
+    if (!connection) return;
+    
+    KeyboardEvent keyEvent = {keyDown ? (uint8_t)1 : (uint8_t)2, keyCode, 0};
+    SendEvent(connection, EVENT_KEYBOARD, &keyEvent, sizeof(keyEvent));
+}
 
-bool SendData(SOCKET socket, const void* data, int size) {
-    if (socket == INVALID_SOCKET) return false;
+void SendTextInput(const std::u16string& text) {
+    Transport* connection = g_Connection.load();
+    if (!connection || text.empty()) return;
     
-    const char* ptr = static_cast<const char*>(data);
-    int totalSent = 0;
+    // Event type, header and UTF-16LE payload go out as one message
+    TextInputEvent textEvent = {TEXT_ENCODING_UTF16, 0, (uint16_t)text.size()};
+    std::vector<unsigned char> message(1 + sizeof(textEvent) + text.size() * 2);
+    message[0] = EVENT_TEXT;
+    memcpy(&message[1], &textEvent, sizeof(textEvent));
     
-    while (totalSent < size) {
-        int sent = send(socket, ptr + totalSent, size - totalSent, 0);
-        if (sent <= 0) return false;
-        totalSent += sent;
+    unsigned char* out = &message[1 + sizeof(textEvent)];
+    for (char16_t unit : text) {
+        *out++ = (unsigned char)(unit & 0xFF);
+        *out++ = (unsigned char)(unit >> 8);
     }
-    return true;
+    
+    std::lock_guard<std::mutex> lock(g_SendMutex);
+    connection->SendBytes(message.data(), message.size());
+}
+
+void FlushPendingText() {
+    if (!g_PendingText.empty()) {
+        SendTextInput(g_PendingText);
+        g_PendingText.clear();
+    }
+}
+
+// Keys that produce a character are sent as text from WM_CHAR instead,
+// unless Ctrl or Alt alone is held (shortcuts must stay key presses)
+bool IsTextKey(WPARAM vk) {
+    if (MapVirtualKeyA((UINT)vk, MAPVK_VK_TO_CHAR) == 0) return false;
+    
+    bool ctrl = (GetKeyState(VK_CONTROL) & 0x8000) != 0;
+    bool alt = (GetKeyState(VK_MENU) & 0x8000) != 0;
+    return ctrl == alt; // neither, or both (AltGr)
+}
+
+// Build a real cursor from BGRA pixels so Windows draws it at mouse rate
+HCURSOR CreateCursorFromShape(const CursorShape& shape, const unsigned char* pixels) {
+    BITMAPINFO bmi = {};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = shape.width;
+    bmi.bmiHeader.biHeight = -(int)shape.height; // top-down
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    
+    void* bits = nullptr;
+    HDC hDC = GetDC(NULL);
+    HBITMAP hColor = CreateDIBSection(hDC, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+    ReleaseDC(NULL, hDC);
+    if (!hColor) return NULL;
+    memcpy(bits, pixels, (size_t)shape.width * shape.height * 4);
+    
+    // Alpha comes from the color bitmap; the mask only needs to exist
+    std::vector<unsigned char> maskBits(((shape.width + 15) / 16) * 2 * shape.height, 0);
+    HBITMAP hMask = CreateBitmap(shape.width, shape.height, 1, 1, maskBits.data());
+    
+    ICONINFO iconInfo = {};
+    iconInfo.fIcon = FALSE;
+    iconInfo.xHotspot = shape.hotspotX;
+    iconInfo.yHotspot = shape.hotspotY;
+    iconInfo.hbmMask = hMask;
+    iconInfo.hbmColor = hColor;
+    HCURSOR hCursor = (HCURSOR)CreateIconIndirect(&iconInfo);
+    
+    DeleteObject(hMask);
+    DeleteObject(hColor);
+    return hCursor;
+}
+
+// Current remote cursor; NULL if hidden or unknown. `known` is false
+// until the host has told us which shape is active.
+HCURSOR GetRemoteCursor(bool* known, POINT* hotspot = nullptr, POINT* position = nullptr) {
+    std::lock_guard<std::mutex> lock(g_CursorMutex);
+    auto it = g_CursorShapes.find(g_CursorPosition.shapeHash);
+    bool found = it != g_CursorShapes.end();
+    if (known) *known = g_TypedSession && (found || !g_CursorPosition.visible);
+    if (hotspot && found) {
+        hotspot->x = it->second.hotspotX;
+        hotspot->y = it->second.hotspotY;
+    }
+    if (position) {
+        position->x = g_CursorPosition.x;
+        position->y = g_CursorPosition.y;
+    }
+    return (g_CursorPosition.visible && found) ? it->second.handle : NULL;
+}
+
+bool IsPointerOverCanvas() {
+    POINT pt;
+    return GetCursorPos(&pt) && WindowFromPoint(pt) == g_hCanvas;
 }
 
-bool ReceiveData(SOCKET socket, void* data, int size) {
-    if (socket == INVALID_SOCKET) return false;
+// Give the monitor a top-down BGRA bitmap of this size (g_ScreenMutex held)
+bool EnsureMonitorBitmap(RemoteMonitor& monitor, int width, int height) {
+    if (monitor.bitmap && monitor.bitmapWidth == width && monitor.bitmapHeight == height) {
+        return true;
+    }
+    if (monitor.bitmap) {
+        DeleteObject(monitor.bitmap);
+        monitor.bitmap = NULL;
+        monitor.bits = nullptr;
+    }
     
-    char* ptr = static_cast<char*>(data);
-    int totalReceived = 0;
+    BITMAPINFO bmi = {};
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = width;
+    bmi.bmiHeader.biHeight = -height; // top-down
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    
+    void* bits = nullptr;
+    HDC hDC = GetDC(NULL);
+    monitor.bitmap = CreateDIBSection(hDC, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+    ReleaseDC(NULL, hDC);
+    if (!monitor.bitmap) return false;
+    
+    monitor.bits = static_cast<unsigned char*>(bits);
+    monitor.bitmapWidth = width;
+    monitor.bitmapHeight = height;
+    return true;
+}
+
+// Write a rectangle of pixels into a monitor's bitmap. BGRA rows are
+// copied as they are; other formats are expanded on the way in.
+bool ApplyFrame(uint8_t streamId, int screenWidth, int screenHeight, int format, bool bottomUp,
+                int x, int y, int width, int height, const unsigned char* pixels, size_t stride,
+                const unsigned char* palette = nullptr, int scale = 0) {
+    bool planes = format >= PLANES_HIGH4 && format <= PLANES_LOW2;
+    if ((!BytesPerPixel(format) && !planes) || x + width > screenWidth || y + height > screenHeight) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_ScreenMutex);
+        RemoteMonitor* monitor = nullptr;
+        for (RemoteMonitor& candidate : g_Monitors) {
+            if (candidate.descriptor.streamId == streamId) monitor = &candidate;
+        }
+        if (!monitor) return true; // stream we were never told about
+        if (!EnsureMonitorBitmap(*monitor, screenWidth, screenHeight)) return true;
+        monitor->descriptor.width = screenWidth;
+        monitor->descriptor.height = screenHeight;
+        
+        GdiFlush();
+        size_t dstStride = RowStride(PIXEL_FORMAT_BGRA32, screenWidth);
+        unsigned char* dst = monitor->bits + (size_t)y * dstStride + (size_t)x * 4;
+        if (planes) {
+            UnpackPlanes(format, pixels, stride, width, height, dst, dstStride, bottomUp);
+        } else if (scale) {
+            ExpandScaled(format, pixels, stride, scale, width, height, dst, dstStride);
+        } else if (format == PIXEL_FORMAT_PALETTE8) {
+            if (!palette) return false;
+            ExpandPalette8(palette, pixels, stride, dst, dstStride, width, height, bottomUp);
+        } else {
+            ConvertFrame(format, pixels, stride, PIXEL_FORMAT_BGRA32, dst, dstStride, width, height, bottomUp);
+        }
+    }
     
-    while (totalReceived < size) {
-        int received = recv(socket, ptr + totalReceived, size - totalReceived, 0);
-        if (received <= 0) return false;
-        totalReceived += received;
+    // Trigger repaint
+    if (g_hMainWnd) {
+        PostMessage(g_hMainWnd, WM_UPDATE_SCREEN, 0, 0);
     }
     return true;
 }
 
-void SendMouseEvent(uint8_t type, int16_t x = 0, int16_t y = 0) {
-    SOCKET sock = g_Socket.load();
-    if (sock == INVALID_SOCKET) return;
+// Full frame as a BMP file (legacy hosts and viewers without raw frames)
+bool HandleFrame(uint8_t streamId, const ScreenFrame& frameHeader, const unsigned char* bmpData) {
+    if (frameHeader.dataSize < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER)) {
+        return false;
+    }
     
-    uint8_t eventType = 1; // Mouse event
-    MouseEvent mouseEvent = {type, x, y};
+    const BITMAPFILEHEADER* fileHeader = reinterpret_cast<const BITMAPFILEHEADER*>(bmpData);
+    const BITMAPINFOHEADER* infoHeader = reinterpret_cast<const BITMAPINFOHEADER*>(bmpData + sizeof(BITMAPFILEHEADER));
+    int width = infoHeader->biWidth;
+    int height = infoHeader->biHeight < 0 ? -infoHeader->biHeight : infoHeader->biHeight;
+    int format = infoHeader->biBitCount == 32 ? PIXEL_FORMAT_BGRA32 :
+                 infoHeader->biBitCount == 24 ? PIXEL_FORMAT_BGR24 : 0;
+    size_t stride = RowStride(format, width, 4);
+    if (!format || width <= 0 || fileHeader->bfOffBits > frameHeader.dataSize ||
+        stride * height > frameHeader.dataSize - fileHeader->bfOffBits) {
+        return false;
+    }
     
-    SendData(sock, &eventType, sizeof(eventType));
-    SendData(sock, &mouseEvent, sizeof(mouseEvent));
+    return ApplyFrame(streamId, width, height, format, infoHeader->biHeight > 0,
+                      0, 0, width, height, bmpData + fileHeader->bfOffBits, stride);
 }
 
-void SendKeyEvent(uint16_t keyCode, bool keyDown) {
-    SOCKET sock = g_Socket.load();
-    if (sock == INVALID_SOCKET) return;
+// Replace the monitor layout, keeping bitmaps of streams that still exist
+void SetMonitors(const std::vector<MonitorDescriptor>& descriptors) {
+    std::lock_guard<std::mutex> lock(g_ScreenMutex);
+    std::vector<RemoteMonitor> monitors;
+    for (const MonitorDescriptor& descriptor : descriptors) {
+        RemoteMonitor monitor = {descriptor, NULL, nullptr, 0, 0};
+        for (RemoteMonitor& previous : g_Monitors) {
+            if (previous.descriptor.streamId == descriptor.streamId) {
+                monitor = previous;
+                monitor.descriptor = descriptor;
+                previous.bitmap = NULL;
+            }
+        }
+        monitors.push_back(monitor);
+    }
+    for (RemoteMonitor& previous : g_Monitors) {
+        if (previous.bitmap) DeleteObject(previous.bitmap);
+    }
+    g_Monitors.swap(monitors);
+}
+
+// Remote area shown on the canvas: one monitor or the bounding box of all
+TileRect GetViewRect() {
+    std::lock_guard<std::mutex> lock(g_ScreenMutex);
+    TileRect view = {0, 0, 0, 0};
+    for (const RemoteMonitor& monitor : g_Monitors) {
+        if (StreamShown(g_ViewStream, monitor.descriptor.streamId)) {
+            view = BoundingArea(view, MonitorArea(monitor.descriptor));
+        }
+    }
+    return view;
+}
+
+// Canvas client coordinates -> host virtual desktop coordinates
+POINT CanvasToRemote(HWND hwnd, LPARAM lParam) {
+    RECT clientRect;
+    GetClientRect(hwnd, &clientRect);
+    int x, y;
+    CanvasToDesktop(GetViewRect(), clientRect.right, clientRect.bottom, LOWORD(lParam), HIWORD(lParam), x, y);
+    POINT pt = {x, y};
+    return pt;
+}
+
+// Ask for the next update of a stream; the host sends nothing until asked
+void SendUpdateRequest(uint8_t streamId, bool incremental) {
+    Transport* connection = g_Connection.load();
+    if (!connection || !g_TypedSession) return;
     
-    uint8_t eventType = 2; // Keyboard event
-    KeyboardEvent keyEvent = {keyDown ? (uint8_t)1 : (uint8_t)2, keyCode, 0};
+    UpdateRequest request = {streamId, incremental ? (uint8_t)1 : (uint8_t)0, 0, 0, 0, 0, 0};
+    SendEvent(connection, EVENT_UPDATE_REQUEST, &request, sizeof(request));
+}
+
+void SendColorFormat() {
+    Transport* connection = g_Connection.load();
+    if (!connection || !g_TypedSession) return;
+    
+    SetFormatEvent request = {(uint8_t)g_ColorFormat, {0, 0, 0}};
+    SendEvent(connection, EVENT_SET_FORMAT, &request, sizeof(request));
+    SendUpdateRequest(UPDATE_ALL_STREAMS, true); // the host resends everything in the new format
+}
+
+void SendSubscription() {
+    Transport* connection = g_Connection.load();
+    if (!connection || !g_TypedSession) return;
     
-    SendData(sock, &eventType, sizeof(eventType));
-    SendData(sock, &keyEvent, sizeof(keyEvent));
+    SubscribeEvent subscribe = {SubscriptionMask(g_ViewStream)};
+    SendEvent(connection, EVENT_SUBSCRIBE, &subscribe, sizeof(subscribe));
+    SendUpdateRequest(UPDATE_ALL_STREAMS, true); // newly shown streams start with a full frame
 }
 
-HBITMAP CreateBitmapFromBMP(const std::vector<unsigned char>& bmpData) {
-    if (bmpData.size() < sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER)) {
-        return NULL;
+// Rebuild the View and Colors menus from the current monitor list (UI thread)
+void UpdateMenus(HWND hwnd) {
+    std::vector<MonitorDescriptor> descriptors;
+    {
+        std::lock_guard<std::mutex> lock(g_ScreenMutex);
+        for (const RemoteMonitor& monitor : g_Monitors) descriptors.push_back(monitor.descriptor);
     }
     
-    const BITMAPFILEHEADER* fileHeader = reinterpret_cast<const BITMAPFILEHEADER*>(bmpData.data());
-    const BITMAPINFOHEADER* infoHeader = reinterpret_cast<const BITMAPINFOHEADER*>(bmpData.data() + sizeof(BITMAPFILEHEADER));
-    const unsigned char* pixelData = bmpData.data() + fileHeader->bfOffBits;
+    HMENU hView = CreatePopupMenu();
+    AppendMenuA(hView, MF_STRING, IDM_VIEW_ALL, "&All monitors");
+    for (const MonitorDescriptor& d : descriptors) {
+        std::string label = "Monitor &" + std::to_string(d.streamId + 1) + " (" +
+                            std::to_string(d.width) + "x" + std::to_string(d.height) +
+                            (d.primary ? ", primary)" : ")");
+        AppendMenuA(hView, MF_STRING, IDM_VIEW_MONITOR + d.streamId, label.c_str());
+    }
+    UINT checked = g_ViewStream < 0 ? IDM_VIEW_ALL : IDM_VIEW_MONITOR + g_ViewStream;
+    CheckMenuRadioItem(hView, IDM_VIEW_ALL, IDM_VIEW_MONITOR + MAX_STREAMS - 1, checked, MF_BYCOMMAND);
     
-    HDC hDC = GetDC(NULL);
-    HBITMAP hBitmap = CreateDIBitmap(hDC, infoHeader, CBM_INIT, pixelData, (BITMAPINFO*)infoHeader, DIB_RGB_COLORS);
-    ReleaseDC(NULL, hDC);
+    // Lower color depths trade fidelity for bandwidth on slow links
+    HMENU hColors = CreatePopupMenu();
+    AppendMenuA(hColors, MF_STRING, IDM_COLOR_BASE + PIXEL_FORMAT_BGRA32, "&Full color (32-bit)");
+    AppendMenuA(hColors, MF_STRING, IDM_COLOR_BASE + PIXEL_FORMAT_BGR24, "&True color (24-bit)");
+    AppendMenuA(hColors, MF_STRING, IDM_COLOR_BASE + PIXEL_FORMAT_RGB565, "&High color (16-bit)");
+    AppendMenuA(hColors, MF_STRING, IDM_COLOR_BASE + PIXEL_FORMAT_PALETTE8, "&256 colors (dithered)");
+    AppendMenuA(hColors, MF_STRING, IDM_COLOR_BASE + PIXEL_FORMAT_GRAY8, "&Grayscale");
+    CheckMenuRadioItem(hColors, IDM_COLOR_BASE + 1, IDM_COLOR_BASE + PIXEL_FORMAT_COUNT - 1,
+                       IDM_COLOR_BASE + g_ColorFormat, MF_BYCOMMAND);
     
-    return hBitmap;
+    HMENU hMenu = CreateMenu();
+    AppendMenuA(hMenu, MF_POPUP, (UINT_PTR)hView, "&View");
+    AppendMenuA(hMenu, MF_POPUP, (UINT_PTR)hColors, "&Colors");
+    HMENU hOldMenu = GetMenu(hwnd);
+    SetMenu(hwnd, hMenu);
+    if (hOldMenu) DestroyMenu(hOldMenu);
+    DrawMenuBar(hwnd);
+}
+
+bool HandleServerMessage(const MessageHeader& header, const unsigned char* payload) {
+    switch (header.type) {
+        case MSG_FRAME: {
+            if (header.length < sizeof(StreamFrame)) return false;
+            StreamFrame streamFrame;
+            memcpy(&streamFrame, payload, sizeof(streamFrame));
+            if (streamFrame.frame.dataSize > header.length - sizeof(StreamFrame)) return false;
+            return HandleFrame(streamFrame.streamId, streamFrame.frame, payload + sizeof(StreamFrame));
+        }
+        
+        case MSG_RAW_FRAME: {
+            if (header.length < sizeof(RawFrame)) return false;
+            RawFrame rawFrame;
+            memcpy(&rawFrame, payload, sizeof(rawFrame));
+            const unsigned char* pixels = payload + sizeof(RawFrame);
+            const unsigned char* palette = nullptr;
+            size_t pixelBytes = rawFrame.dataSize;
+            if (rawFrame.dataSize > header.length - sizeof(RawFrame)) return false;
+            if (rawFrame.format == TILE_PREDICTIVE || rawFrame.format == TILE_QOI) {
+                if (rawFrame.scale || !rawFrame.width || !rawFrame.height) return false;
+                g_TilePixels.resize((size_t)rawFrame.width * rawFrame.height * 4);
+                bool decoded = rawFrame.format == TILE_QOI
+                    ? QoiDecode(pixels, pixelBytes, rawFrame.width, rawFrame.height, g_TilePixels.data(),
+                                (size_t)rawFrame.width * 4)
+                    : g_PredictiveDecoder.Decode(pixels, pixelBytes, rawFrame.width, rawFrame.height,
+                                                 g_TilePixels.data(), (size_t)rawFrame.width * 4);
+                if (!decoded) return false;
+                return ApplyFrame(rawFrame.streamId, rawFrame.screenWidth, rawFrame.screenHeight,
+                                  PIXEL_FORMAT_BGRA32, false, rawFrame.x, rawFrame.y, rawFrame.width,
+                                  rawFrame.height, g_TilePixels.data(), (size_t)rawFrame.width * 4);
+            }
+            if (rawFrame.format == PIXEL_FORMAT_PALETTE8) {
+                if (pixelBytes < PALETTE_SIZE * 4) return false;
+                palette = pixels;
+                pixels += PALETTE_SIZE * 4;
+                pixelBytes -= PALETTE_SIZE * 4;
+            }
+            // Previews carry one pixel per (1 << scale) square of the area
+            if (rawFrame.scale && (rawFrame.scale > 7 || palette || rawFrame.format >= PLANES_HIGH4)) return false;
+            int pixelWidth = ScaledSize(rawFrame.width, rawFrame.scale);
+            int pixelHeight = ScaledSize(rawFrame.height, rawFrame.scale);
+            size_t rowBytes = rawFrame.format >= PLANES_HIGH4 ? PlaneRowBytes(rawFrame.format, pixelWidth)
+                                                              : RowStride(rawFrame.format, pixelWidth);
+            if (rawFrame.stride < rowBytes ||
+                (pixelHeight && pixelBytes < (size_t)rawFrame.stride * (pixelHeight - 1) + rowBytes)) {
+                return false;
+            }
+            return ApplyFrame(rawFrame.streamId, rawFrame.screenWidth, rawFrame.screenHeight, rawFrame.format,
+                              (rawFrame.flags & RAW_FRAME_BOTTOM_UP) != 0, rawFrame.x, rawFrame.y,
+                              rawFrame.width, rawFrame.height, pixels, rawFrame.stride, palette, rawFrame.scale);
+        }
+        
+        case MSG_VIDEO_FRAME: {
+            if (header.length < sizeof(VideoFrame)) return false;
+            VideoFrame frame;
+            memcpy(&frame, payload, sizeof(frame));
+            if (frame.dataSize > header.length - sizeof(VideoFrame)) return false;
+            VideoDecoder& decoder = g_VideoDecoders[frame.streamId];
+            if (!decoder.Decode(frame, payload + sizeof(VideoFrame), frame.dataSize)) return false;
+            if (!decoder.Ready()) return true; // waiting for a keyframe
+            return ApplyFrame(frame.streamId, decoder.Width(), decoder.Height(), PIXEL_FORMAT_BGRA32, false, 0, 0,
+                              decoder.Width(), decoder.Height(), decoder.Pixels(),
+                              RowStride(PIXEL_FORMAT_BGRA32, decoder.Width()));
+        }
+        
+        case MSG_GLYPH_FRAME: {
+            if (header.length < sizeof(GlyphFrame)) return false;
+            GlyphFrame frame;
+            memcpy(&frame, payload, sizeof(frame));
+            if (frame.dataSize > header.length - sizeof(GlyphFrame) || !frame.width || !frame.height) return false;
+            g_TilePixels.resize((size_t)frame.width * frame.height * 4);
+            if (!g_GlyphDecoders[frame.streamId].Decode(frame, payload + sizeof(GlyphFrame), frame.dataSize,
+                                                        g_TilePixels.data(), (size_t)frame.width * 4)) {
+                return false;
+            }
+            return ApplyFrame(frame.streamId, frame.screenWidth, frame.screenHeight, PIXEL_FORMAT_BGRA32, false,
+                              frame.x, frame.y, frame.width, frame.height, g_TilePixels.data(),
+                              (size_t)frame.width * 4);
+        }
+        
+        case MSG_CODE_TABLE: {
+            if (header.length < sizeof(CodeTable)) return false;
+            CodeTable table;
+            memcpy(&table, payload, sizeof(table));
+            if (table.dataSize != PREDICTIVE_TABLE_BYTES || table.dataSize > header.length - sizeof(CodeTable)) {
+                return false;
+            }
+            return g_PredictiveDecoder.SetTable(table.id, payload + sizeof(CodeTable));
+        }
+        
+        case MSG_MONITOR_LIST: {
+            std::vector<MonitorDescriptor> descriptors;
+            if (!ParseMonitorList(payload, header.length, descriptors)) return false;
+            SetMonitors(descriptors);
+            if (g_hMainWnd) {
+                PostMessage(g_hMainWnd, WM_UPDATE_MONITORS, 0, 0);
+            }
+            return true;
+        }
+        
+        case MSG_CURSOR_SHAPE: {
+            if (header.length < sizeof(CursorShape)) return false;
+            CursorShape shape;
+            memcpy(&shape, payload, sizeof(shape));
+            if (shape.width > MAX_CURSOR_SIZE || shape.height > MAX_CURSOR_SIZE ||
+                header.length < sizeof(CursorShape) + (size_t)shape.width * shape.height * 4) {
+                return false;
+            }
+            HCURSOR hCursor = CreateCursorFromShape(shape, payload + sizeof(CursorShape));
+            if (hCursor) {
+                std::lock_guard<std::mutex> lock(g_CursorMutex);
+                auto existing = g_CursorShapes.find(shape.hash);
+                if (existing != g_CursorShapes.end()) DestroyCursor(existing->second.handle);
+                RemoteCursorShape entry = {hCursor, shape.hotspotX, shape.hotspotY};
+                g_CursorShapes[shape.hash] = entry;
+            }
+            return true;
+        }
+        
+        case MSG_UPDATE_END: {
+            if (header.length < sizeof(UpdateEnd)) return false;
+            UpdateEnd end;
+            memcpy(&end, payload, sizeof(end));
+            // Frames sent over UDP may still be arriving: the datagram thread
+            // posts the request once they have
+            bool complete = !(end.flags & UPDATE_END_DATAGRAMS) || g_DatagramSocket == INVALID_SOCKET ||
+                            g_UpdateEnds.Arrived(end.streamId, end.throughId, g_DatagramNextId);
+            // The next request goes out once the UI thread has drawn this update
+            if (complete && g_hMainWnd) {
+                PostMessage(g_hMainWnd, WM_REQUEST_UPDATE, end.streamId, 0);
+            }
+            return true;
+        }
+        
+        case MSG_CURSOR_POSITION: {
+            if (header.length < sizeof(CursorPosition)) return false;
+            {
+                std::lock_guard<std::mutex> lock(g_CursorMutex);
+                memcpy(&g_CursorPosition, payload, sizeof(CursorPosition));
+            }
+            if (g_hMainWnd) {
+                PostMessage(g_hMainWnd, WM_UPDATE_CURSOR, 0, 0);
+            }
+            return true;
+        }
+    }
+    return true; // unknown messages are skipped
+}
+
+// Move host -> viewer traffic onto the shared ring offered by a host on
+// this machine and tell the host whether that worked (connect time only)
+bool AcceptSharedMemory() {
+    MessageHeader header;
+    SharedMemoryOffer offer;
+    if (!g_Transport->Receive(&header, sizeof(header)) || header.length != sizeof(offer) ||
+        !g_Transport->Receive(&offer, sizeof(offer))) {
+        return false;
+    }
+    offer.name[sizeof(offer.name) - 1] = '\0';
+    
+    std::unique_ptr<SharedRing> ring(new SharedRing());
+    SharedMemoryReply reply = {ring->Open(offer.name, offer.size) ? (uint8_t)1 : (uint8_t)0, {0, 0, 0}};
+    if (!SendEvent(g_Transport.get(), EVENT_SHARED_MEMORY, &reply, sizeof(reply))) {
+        return false;
+    }
+    if (reply.accepted) {
+        std::shared_ptr<Transport> link(std::move(g_Transport));
+        g_Transport.reset(new LocalTransport(link, std::move(ring), false));
+    }
+    return true;
+}
+
+// Take frames over UDP from a remote host: open a socket towards the
+// offered port, greet the host through it (which also opens NAT and
+// firewall state) and accept. Any failure declines; frames then stay on TCP.
+bool AcceptDatagrams() {
+    MessageHeader header;
+    DatagramOffer offer;
+    if (!g_Transport->Receive(&header, sizeof(header)) || header.length != sizeof(offer) ||
+        !g_Transport->Receive(&offer, sizeof(offer))) {
+        return false;
+    }
+    
+    DatagramReply reply = {0, {0, 0, 0}};
+    SOCKET udp = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    sockaddr_in hostAddr = {};
+    hostAddr.sin_family = AF_INET;
+    hostAddr.sin_port = htons(offer.port);
+    if (udp != INVALID_SOCKET && inet_pton(AF_INET, g_ServerIP.c_str(), &hostAddr.sin_addr) > 0 &&
+        connect(udp, (sockaddr*)&hostAddr, sizeof(hostAddr)) != SOCKET_ERROR) {
+        int bufferSize = DATAGRAM_RCVBUF;
+        setsockopt(udp, SOL_SOCKET, SO_RCVBUF, (const char*)&bufferSize, sizeof(bufferSize));
+        DatagramHeader hello = {};
+        hello.token = offer.token;
+        for (int i = 0; i < 3; ++i) { // one is enough, the rest are for loss
+            if (send(udp, (const char*)&hello, sizeof(hello), 0) == sizeof(hello)) reply.accepted = 1;
+        }
+    }
+    if (!reply.accepted && udp != INVALID_SOCKET) {
+        closesocket(udp);
+        udp = INVALID_SOCKET;
+    }
+    if (!SendEvent(g_Transport.get(), EVENT_DATAGRAM, &reply, sizeof(reply))) {
+        if (udp != INVALID_SOCKET) closesocket(udp);
+        return false;
+    }
+    g_DatagramSocket = udp;
+    g_DatagramToken = offer.token;
+    return true;
+}
+
+// Rebuilds frame messages from datagrams and hands them over in order;
+// reports what could not be rebuilt so the host resends those areas
+void DatagramReceiveThread() {
+    DatagramReassembler reassembler(g_DatagramToken);
+    std::vector<unsigned char> datagram(sizeof(DatagramHeader) + DATAGRAM_PAYLOAD);
+    std::vector<uint32_t> lost;
+    lost.reserve(MAX_LOSS_REPORT);
+    auto lastReport = std::chrono::steady_clock::now();
+    uint32_t reportedId = 0;
+    
+    while (g_Connected) {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(g_DatagramSocket, &readSet);
+        timeval timeout = {0, 10000};
+        int ready = select(0, &readSet, nullptr, nullptr, &timeout);
+        if (ready == SOCKET_ERROR) break;
+        if (ready > 0) {
+            int received = recv(g_DatagramSocket, (char*)datagram.data(), (int)datagram.size(), 0);
+            if (received > 0) reassembler.Accept(datagram.data(), received);
+        }
+        
+        auto now = std::chrono::steady_clock::now();
+        reassembler.Poll(now, [](const unsigned char* message, size_t size) {
+            MessageHeader header;
+            if (size < sizeof(header)) return;
+            memcpy(&header, message, sizeof(header));
+            if (header.length != size - sizeof(header)) return;
+            std::lock_guard<std::mutex> lock(g_MessageMutex);
+            HandleServerMessage(header, message + sizeof(header));
+        }, [&lost](uint32_t id) {
+            if (lost.size() < MAX_LOSS_REPORT) lost.push_back(id);
+        });
+        {
+            std::lock_guard<std::mutex> lock(g_MessageMutex);
+            g_DatagramNextId = reassembler.NextId();
+            uint32_t complete = g_UpdateEnds.Release(g_DatagramNextId);
+            for (int stream = 0; complete && stream < MAX_STREAMS; ++stream) {
+                if ((complete >> stream & 1) && g_hMainWnd) PostMessage(g_hMainWnd, WM_REQUEST_UPDATE, stream, 0);
+            }
+        }
+        
+        bool due = now - lastReport >= std::chrono::milliseconds(LOSS_REPORT_INTERVAL);
+        if ((due && reassembler.NextId() != reportedId) || lost.size() == MAX_LOSS_REPORT) {
+            Transport* connection = g_Connection.load();
+            if (!connection) break;
+            DatagramLossReport report = {reassembler.NextId(), reassembler.Accounted(), reassembler.Recovered(),
+                                         (uint16_t)lost.size(), 0};
+            uint8_t eventType = EVENT_DATAGRAM_LOSS;
+            IoSlice slices[3] = {{&eventType, sizeof(eventType)}, {&report, sizeof(report)},
+                                 {lost.data(), lost.size() * sizeof(uint32_t)}};
+            {
+                std::lock_guard<std::mutex> lock(g_SendMutex);
+                connection->Send(slices, 3);
+            }
+            lost.clear();
+            reportedId = report.throughId;
+            lastReport = now;
+        }
+    }
+    closesocket(g_DatagramSocket);
 }
 
 void ClientReceiveThread() {
     int frameCount = 0;
+    std::vector<unsigned char> payload; // reused across messages
+    std::vector<unsigned char> assembled; // message arriving in pieces
+    
+    // Frames are received and applied without heap allocation once the
+    // payload buffer has reached its high-water mark
+    SteadyStateCheck allocationCheck("Viewer receive", 10);
     
     while (g_Connected) {
-        ScreenFrame frameHeader;
-        if (!ReceiveData(g_Socket.load(), &frameHeader, sizeof(frameHeader))) {
-            break;
+        allocationCheck.Checkpoint();
+        Transport* connection = g_Connection.load();
+        if (!connection) break;
+        
+        if (!g_TypedSession) {
+            // Legacy host: bare ScreenFrame + BMP data
+            ScreenFrame frameHeader;
+            if (!connection->Receive(&frameHeader, sizeof(frameHeader))) {
+                break;
+            }
+            if (frameHeader.dataSize > payload.capacity()) allocationCheck.Rearm();
+            payload.resize(frameHeader.dataSize);
+            if (!connection->Receive(payload.data(), frameHeader.dataSize)) {
+                break;
+            }
+            HandleFrame(0, frameHeader, payload.data());
+            frameCount++;
+            continue;
         }
         
-        std::vector<unsigned char> imageData(frameHeader.dataSize);
-        if (!ReceiveData(g_Socket.load(), imageData.data(), frameHeader.dataSize)) {
+        MessageHeader header;
+        if (!connection->Receive(&header, sizeof(header))) {
             break;
         }
-        
-        // Create bitmap and update display
-        HBITMAP hNewBitmap = CreateBitmapFromBMP(imageData);
-        if (hNewBitmap) {
-            if (g_hScreenBitmap) {
-                DeleteObject(g_hScreenBitmap);
+        // Pieces of a large message are gathered in their own buffer, since
+        // complete messages (cursor updates) may arrive between them
+        if (header.flags & (MESSAGE_MORE | MESSAGE_CONTINUED)) {
+            size_t offset = (header.flags & MESSAGE_CONTINUED) ? assembled.size() : 0;
+            if (offset + header.length > MAX_ASSEMBLED_MESSAGE) {
+                break;
             }
-            g_hScreenBitmap = hNewBitmap;
-            g_RemoteWidth = frameHeader.width;
-            g_RemoteHeight = frameHeader.height;
-            
-            // Trigger repaint
-            if (g_hMainWnd) {
-                PostMessage(g_hMainWnd, WM_UPDATE_SCREEN, 0, 0);
+            if (offset + header.length > assembled.capacity()) allocationCheck.Rearm();
+            assembled.resize(offset + header.length);
+            if (header.length && !connection->Receive(assembled.data() + offset, header.length)) {
+                break;
+            }
+            if (header.flags & MESSAGE_MORE) {
+                continue;
+            }
+            header.flags = 0;
+            header.length = (uint32_t)assembled.size();
+            {
+                std::lock_guard<std::mutex> lock(g_MessageMutex);
+                if (!HandleServerMessage(header, assembled.data())) {
+                    break;
+                }
             }
+            assembled.clear();
+            if (header.type == MSG_FRAME) {
+                frameCount++;
+            }
+            continue;
         }
         
-        frameCount++;
+        // Monitor lists and new cursor shapes are rare and may allocate
+        if (header.type == MSG_MONITOR_LIST || header.type == MSG_CURSOR_SHAPE) {
+            allocationCheck.Rearm();
+        }
+        // Shared memory hands out payloads where they lie; sockets copy
+        const unsigned char* data = nullptr;
+        if (header.length) {
+            data = static_cast<const unsigned char*>(connection->ReceiveInPlace(header.length));
+        }
+        if (header.length && !data) {
+            if (header.length > payload.capacity()) allocationCheck.Rearm();
+            payload.resize(header.length);
+            if (!connection->Receive(payload.data(), header.length)) {
+                break;
+            }
+            data = payload.data();
+        }
+        {
+            std::lock_guard<std::mutex> lock(g_MessageMutex);
+            if (!HandleServerMessage(header, data)) {
+                break;
+            }
+        }
+        if (header.type == MSG_FRAME) {
+            frameCount++;
+        }
     }
     
     g_Connected = false;
@@ -160,19 +794,39 @@ LRESULT CALLBACK CanvasProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             PAINTSTRUCT ps;
             HDC hdc = BeginPaint(hwnd, &ps);
             
-            if (g_hScreenBitmap && g_Connected) {
-                HDC hMemDC = CreateCompatibleDC(hdc);
-                HGDIOBJ hOldBitmap = SelectObject(hMemDC, g_hScreenBitmap);
-                
+            TileRect view = GetViewRect();
+            
+            if (g_Connected && view.width > 0 && view.height > 0) {
                 RECT clientRect;
                 GetClientRect(hwnd, &clientRect);
+                FillRect(hdc, &clientRect, (HBRUSH)GetStockObject(BLACK_BRUSH));
                 
-                // Scale the remote screen to fit the window
-                StretchBlt(hdc, 0, 0, clientRect.right, clientRect.bottom,
-                          hMemDC, 0, 0, g_RemoteWidth, g_RemoteHeight, SRCCOPY);
-                
-                SelectObject(hMemDC, hOldBitmap);
+                // Scale the viewed area to fit the window, each monitor in its place
+                HDC hMemDC = CreateCompatibleDC(hdc);
+                {
+                    std::lock_guard<std::mutex> lock(g_ScreenMutex);
+                    for (const RemoteMonitor& monitor : g_Monitors) {
+                        const MonitorDescriptor& d = monitor.descriptor;
+                        if (!monitor.bitmap) continue;
+                        if (!StreamShown(g_ViewStream, d.streamId)) continue;
+                        
+                        TileRect place = CanvasPlacement(view, clientRect.right, clientRect.bottom, MonitorArea(d));
+                        HGDIOBJ hOldBitmap = SelectObject(hMemDC, monitor.bitmap);
+                        StretchBlt(hdc, place.x, place.y, place.width, place.height,
+                                  hMemDC, 0, 0, monitor.bitmapWidth, monitor.bitmapHeight, SRCCOPY);
+                        SelectObject(hMemDC, hOldBitmap);
+                    }
+                }
                 DeleteDC(hMemDC);
+                
+                // While the local pointer is elsewhere, show where the remote one is
+                POINT hotspot = {}, position = {};
+                HCURSOR hRemoteCursor = GetRemoteCursor(nullptr, &hotspot, &position);
+                if (hRemoteCursor && !IsPointerOverCanvas()) {
+                    int x, y;
+                    DesktopToCanvas(view, clientRect.right, clientRect.bottom, position.x, position.y, x, y);
+                    DrawIconEx(hdc, x - hotspot.x, y - hotspot.y, hRemoteCursor, 0, 0, 0, NULL, DI_NORMAL);
+                }
             } else {
                 // Draw status message
                 SetTextColor(hdc, RGB(255, 255, 255));
@@ -189,14 +843,22 @@ LRESULT CALLBACK CanvasProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             return 0;
         }
         
+        case WM_SETCURSOR: {
+            // Hovering pointer takes the remote cursor's shape
+            bool known = false;
+            HCURSOR hRemoteCursor = GetRemoteCursor(&known);
+            if (g_Connected && known && LOWORD(lParam) == HTCLIENT) {
+                SetCursor(hRemoteCursor);
+                return TRUE;
+            }
+            break;
+        }
+        
         case WM_LBUTTONDOWN: {
             if (g_Connected) {
                 SetCapture(hwnd);
-                RECT clientRect;
-                GetClientRect(hwnd, &clientRect);
-                int x = (LOWORD(lParam) * g_RemoteWidth) / clientRect.right;
-                int y = (HIWORD(lParam) * g_RemoteHeight) / clientRect.bottom;
-                SendMouseEvent(2, x, y); // Left button down
+                POINT pt = CanvasToRemote(hwnd, lParam);
+                SendMouseEvent(2, (int16_t)pt.x, (int16_t)pt.y); // Left button down
             }
             return 0;
         }
@@ -204,76 +866,76 @@ LRESULT CALLBACK CanvasProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         case WM_LBUTTONUP: {
             if (g_Connected) {
                 ReleaseCapture();
-                RECT clientRect;
-                GetClientRect(hwnd, &clientRect);
-                int x = (LOWORD(lParam) * g_RemoteWidth) / clientRect.right;
-                int y = (HIWORD(lParam) * g_RemoteHeight) / clientRect.bottom;
-                SendMouseEvent(3, x, y); // Left button up
+                POINT pt = CanvasToRemote(hwnd, lParam);
+                SendMouseEvent(3, (int16_t)pt.x, (int16_t)pt.y); // Left button up
             }
             return 0;
         }
         
         case WM_RBUTTONDOWN: {
             if (g_Connected) {
-                RECT clientRect;
-                GetClientRect(hwnd, &clientRect);
-                int x = (LOWORD(lParam) * g_RemoteWidth) / clientRect.right;
-                int y = (HIWORD(lParam) * g_RemoteHeight) / clientRect.bottom;
-                SendMouseEvent(4, x, y); // Right button down
+                POINT pt = CanvasToRemote(hwnd, lParam);
+                SendMouseEvent(4, (int16_t)pt.x, (int16_t)pt.y); // Right button down
             }
             return 0;
         }
         
         case WM_RBUTTONUP: {
             if (g_Connected) {
-                RECT clientRect;
-                GetClientRect(hwnd, &clientRect);
-                int x = (LOWORD(lParam) * g_RemoteWidth) / clientRect.right;
-                int y = (HIWORD(lParam) * g_RemoteHeight) / clientRect.bottom;
-                SendMouseEvent(5, x, y); // Right button up
+                POINT pt = CanvasToRemote(hwnd, lParam);
+                SendMouseEvent(5, (int16_t)pt.x, (int16_t)pt.y); // Right button up
             }
             return 0;
         }
         
         case WM_MOUSEMOVE: {
             if (g_Connected) {
-                RECT clientRect;
-                GetClientRect(hwnd, &clientRect);
-                int x = (LOWORD(lParam) * g_RemoteWidth) / clientRect.right;
-                int y = (HIWORD(lParam) * g_RemoteHeight) / clientRect.bottom;
-                SendMouseEvent(1, x, y); // Mouse move
+                POINT pt = CanvasToRemote(hwnd, lParam);
+                SendMouseEvent(1, (int16_t)pt.x, (int16_t)pt.y); // Mouse move
             }
             return 0;
         }
         
         case WM_KEYDOWN: {
             if (g_Connected) {
-                SendKeyEvent(wParam, true);
+                bool text = IsTextKey(wParam);
+                g_TextKeyDown[wParam & 0xFF] = text;
+                if (!text) SendKeyEvent(wParam, true);
             }
             return 0;
         }
         
         case WM_KEYUP: {
-            if (g_Connected) {
+            bool text = g_TextKeyDown[wParam & 0xFF];
+            g_TextKeyDown[wParam & 0xFF] = false;
+            if (g_Connected && !text) {
                 SendKeyEvent(wParam, false);
             }
             return 0;
         }
         
         case WM_CHAR: {
-            // Handle character input
-            if (g_Connected && wParam >= 32 && wParam <= 126) {
-                // Convert char to virtual key code (simplified)
-                WORD vk = VkKeyScanA((char)wParam) & 0xFF;
-                SendKeyEvent(vk, true);
-                Sleep(10);
-                SendKeyEvent(vk, false);
+            // Queue the UTF-16 unit; everything typed or pasted before the
+            // flush message is processed goes to the host as one text run
+            if (g_Connected && wParam != 0x7F && (wParam >= 32 || wParam == '\r' || wParam == '\t' || wParam == '\b' || wParam == 0x1B)) {
+                if (g_PendingText.empty()) {
+                    PostMessageW(hwnd, WM_FLUSH_TEXT, 0, 0);
+                }
+                g_PendingText.push_back((char16_t)wParam);
+                if (g_PendingText.size() >= MAX_TEXT_RUN) {
+                    FlushPendingText();
+                }
             }
             return 0;
         }
+        
+        case WM_FLUSH_TEXT: {
+            FlushPendingText();
+            return 0;
+        }
     }
     
-    return DefWindowProc(hwnd, uMsg, wParam, lParam);
+    return DefWindowProcW(hwnd, uMsg, wParam, lParam);
 }
 
 LRESULT CALLBACK MainWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
@@ -300,6 +962,60 @@ LRESULT CALLBACK MainWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lPar
             return 0;
         }
         
+        case WM_UPDATE_CURSOR: {
+            bool known = false;
+            HCURSOR hRemoteCursor = GetRemoteCursor(&known);
+            if (IsPointerOverCanvas()) {
+                if (known) SetCursor(hRemoteCursor);
+            } else if (g_hCanvas) {
+                InvalidateRect(g_hCanvas, NULL, FALSE);
+            }
+            return 0;
+        }
+        
+        case WM_UPDATE_MONITORS: {
+            // The host may have fewer monitors than before
+            bool stillExists = false;
+            {
+                std::lock_guard<std::mutex> lock(g_ScreenMutex);
+                for (const RemoteMonitor& monitor : g_Monitors) {
+                    if (monitor.descriptor.streamId == g_ViewStream) stillExists = true;
+                }
+            }
+            if (!stillExists) g_ViewStream = -1;
+            UpdateMenus(hwnd);
+            SendSubscription();
+            if (g_hCanvas) {
+                InvalidateRect(g_hCanvas, NULL, FALSE);
+            }
+            return 0;
+        }
+        
+        case WM_COMMAND: {
+            int id = LOWORD(wParam);
+            if (id >= IDM_VIEW_ALL && id < IDM_VIEW_MONITOR + MAX_STREAMS) {
+                // Only the monitors on screen are captured and streamed
+                g_ViewStream = (id == IDM_VIEW_ALL) ? -1 : id - IDM_VIEW_MONITOR;
+                CheckMenuRadioItem(GetMenu(hwnd), IDM_VIEW_ALL, IDM_VIEW_MONITOR + MAX_STREAMS - 1, id, MF_BYCOMMAND);
+                SendSubscription();
+                if (g_hCanvas) {
+                    InvalidateRect(g_hCanvas, NULL, FALSE);
+                }
+                SetFocus(g_hCanvas);
+                return 0;
+            }
+            if (id > IDM_COLOR_BASE && id < IDM_COLOR_BASE + PIXEL_FORMAT_COUNT) {
+                // Takes effect with the next frame; no reconnect needed
+                g_ColorFormat = id - IDM_COLOR_BASE;
+                CheckMenuRadioItem(GetMenu(hwnd), IDM_COLOR_BASE + 1, IDM_COLOR_BASE + PIXEL_FORMAT_COUNT - 1,
+                                   id, MF_BYCOMMAND);
+                SendColorFormat();
+                SetFocus(g_hCanvas);
+                return 0;
+            }
+            break;
+        }
+        
         case WM_UPDATE_SCREEN: {
             // Update screen display
             if (g_hCanvas) {
@@ -308,6 +1024,15 @@ LRESULT CALLBACK MainWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lPar
             return 0;
         }
         
+        case WM_REQUEST_UPDATE: {
+            // Paint first, so a viewer that draws slowly asks for less
+            if (g_hCanvas) {
+                UpdateWindow(g_hCanvas);
+            }
+            SendUpdateRequest((uint8_t)wParam, true);
+            return 0;
+        }
+        
         case WM_USER + 2: {
             // Disconnect message
             MessageBoxA(hwnd, "Disconnected from remote computer", "Remote Desktop Viewer", MB_OK | MB_ICONINFORMATION);
@@ -316,16 +1041,20 @@ LRESULT CALLBACK MainWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lPar
         
         case WM_CLOSE:
             g_Connected = false;
-            if (g_Socket.load() != INVALID_SOCKET) {
-                closesocket(g_Socket.load());
-                g_Socket.store(INVALID_SOCKET);
+            if (Transport* connection = g_Connection.exchange(nullptr)) {
+                connection->Shutdown();
             }
             DestroyWindow(hwnd);
             return 0;
             
         case WM_DESTROY:
-            if (g_hScreenBitmap) {
-                DeleteObject(g_hScreenBitmap);
+            SetMonitors(std::vector<MonitorDescriptor>());
+            {
+                std::lock_guard<std::mutex> lock(g_CursorMutex);
+                for (auto& entry : g_CursorShapes) {
+                    DestroyCursor(entry.second.handle);
+                }
+                g_CursorShapes.clear();
             }
             PostQuitMessage(0);
             return 0;
@@ -365,31 +1094,79 @@ bool ConnectToRemote() {
         WSACleanup();
         return false;
     }
+    g_Transport.reset(new SocketTransport(clientSocket));
 
     // Send authentication
     PasswordAuth auth = {};
     strncpy_s(auth.password, g_Password.c_str(), sizeof(auth.password) - 1);
+    if (g_Password.size() <= PASSWORD_TYPED_MAX) { // longer ones leave no room: a legacy session
+        uint32_t magic = HANDSHAKE_MAGIC;
+        memcpy(auth.password + sizeof(auth.password) - sizeof(magic), &magic, sizeof(magic));
+    }
     
-    if (!SendData(clientSocket, &auth, sizeof(auth))) {
+    if (!g_Transport->SendBytes(&auth, sizeof(auth))) {
         MessageBoxA(NULL, "Failed to send authentication", "Error", MB_OK | MB_ICONERROR);
-        closesocket(clientSocket);
+        g_Transport.reset();
         WSACleanup();
         return false;
     }
 
     // Receive screen dimensions
     uint32_t screenWidth, screenHeight;
-    if (!ReceiveData(clientSocket, &screenWidth, sizeof(screenWidth)) ||
-        !ReceiveData(clientSocket, &screenHeight, sizeof(screenHeight))) {
+    if (!g_Transport->Receive(&screenWidth, sizeof(screenWidth)) ||
+        !g_Transport->Receive(&screenHeight, sizeof(screenHeight))) {
         MessageBoxA(NULL, "Authentication failed - wrong password", "Error", MB_OK | MB_ICONERROR);
-        closesocket(clientSocket);
+        g_Transport.reset();
         WSACleanup();
         return false;
     }
 
-    g_Socket.store(clientSocket);
+    // Hosts that took us for a typed viewer say so; older ones (or a
+    // password too long to carry the mark) get a legacy session
+    bool typed = (screenWidth & HANDSHAKE_TYPED) != 0;
+    screenWidth &= ~HANDSHAKE_TYPED;
+    
+    // Announce what this viewer understands; the host switches to typed messages
+    ClientCapabilities caps = {PROTOCOL_VERSION,
+                               CAP_CURSOR_CHANNEL | CAP_RAW_BGRA32 | CAP_RAW_BGR24 | CAP_RAW_RGB565 |
+                               CAP_RAW_PALETTE8 | CAP_RAW_GRAY8 | CAP_PROGRESSIVE | CAP_SHARED_MEMORY |
+                               CAP_CHUNKED | CAP_DATAGRAM | CAP_PULL | CAP_PREVIEW | CAP_VIDEO |
+                               CAP_PREDICTIVE | CAP_QOI | CAP_GLYPHS | CAP_CODE_TABLES};
+    if (typed && !SendEvent(g_Transport.get(), EVENT_CAPABILITIES, &caps, sizeof(caps))) {
+        MessageBoxA(NULL, "Failed to send viewer capabilities", "Error", MB_OK | MB_ICONERROR);
+        g_Transport.reset();
+        WSACleanup();
+        return false;
+    }
+    g_TypedSession = typed;
+    
+    // A host on this machine answers with a shared memory offer before
+    // anything else, a remote one with a datagram offer; hosts that offer
+    // neither start with their monitor list
+    uint8_t firstMessage = 0;
+    if (typed && g_Transport->Peek(firstMessage) && firstMessage == MSG_SHARED_MEMORY && !AcceptSharedMemory()) {
+        MessageBoxA(NULL, "Failed to set up shared memory with the host", "Error", MB_OK | MB_ICONERROR);
+        g_Transport.reset();
+        WSACleanup();
+        return false;
+    }
+    if (firstMessage == MSG_DATAGRAM_OFFER && !AcceptDatagrams()) {
+        MessageBoxA(NULL, "Failed to answer the host's datagram offer", "Error", MB_OK | MB_ICONERROR);
+        g_Transport.reset();
+        WSACleanup();
+        return false;
+    }
+
+    g_Connection.store(g_Transport.get());
     g_RemoteWidth = screenWidth;
     g_RemoteHeight = screenHeight;
+    
+    // Until the host sends its monitor list there is only the primary screen
+    MonitorDescriptor primary = {};
+    primary.primary = 1;
+    primary.width = screenWidth;
+    primary.height = screenHeight;
+    SetMonitors(std::vector<MonitorDescriptor>(1, primary));
     g_Connected = true;
     
     return true;
@@ -461,14 +1238,14 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         FreeConsole();
     }
     
-    // Register canvas window class
-    WNDCLASSA canvasWc = {};
+    // Register canvas window class (Unicode so WM_CHAR carries UTF-16)
+    WNDCLASSW canvasWc = {};
     canvasWc.lpfnWndProc = CanvasProc;
     canvasWc.hInstance = hInstance;
-    canvasWc.lpszClassName = "RemoteCanvas";
+    canvasWc.lpszClassName = L"RemoteCanvas";
     canvasWc.hbrBackground = (HBRUSH)GetStockObject(BLACK_BRUSH);
     canvasWc.hCursor = LoadCursor(NULL, IDC_ARROW);
-    RegisterClassA(&canvasWc);
+    RegisterClassW(&canvasWc);
     
     // Register main window class
     WNDCLASSA wc = {};
@@ -499,20 +1276,25 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         // Start receiving thread
         std::thread receiveThread(ClientReceiveThread);
         receiveThread.detach();
+        if (g_DatagramSocket != INVALID_SOCKET) {
+            std::thread datagramThread(DatagramReceiveThread);
+            datagramThread.detach();
+        }
         
         // Message loop
         MSG msg;
-        while (GetMessage(&msg, NULL, 0, 0)) {
+        while (GetMessageW(&msg, NULL, 0, 0)) {
             TranslateMessage(&msg);
-            DispatchMessage(&msg);
+            DispatchMessageW(&msg);
         }
     } else {
         DestroyWindow(g_hMainWnd);
     }
     
-    // Cleanup
-    if (g_Socket.load() != INVALID_SOCKET) {
-        closesocket(g_Socket.load());
+    // Cleanup; the receive thread is detached and may still be inside a
+    // read, so the transport is only shut down here and freed at exit
+    if (Transport* connection = g_Connection.exchange(nullptr)) {
+        connection->Shutdown();
     }
     WSACleanup();
     